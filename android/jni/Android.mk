@@ -200,9 +200,21 @@ MY_FILES += $(ARTOOLKIT_ROOT)/lib/SRC/KPM/FreakMatcher/framework/logger.cpp
 MY_FILES += $(ARTOOLKIT_ROOT)/lib/SRC/KPM/FreakMatcher/framework/timers.cpp
 MY_FILES += $(ARTOOLKIT_ROOT)/lib/SRC/KPM/FreakMatcher/matchers/freak.cpp
 MY_FILES += $(ARTOOLKIT_ROOT)/lib/SRC/KPM/FreakMatcher/matchers/hough_similarity_voting.cpp
+MY_FILES += $(ARTOOLKIT_ROOT)/lib/SRC/KPM/FreakMatcher/math/hamming.cpp
 MY_FILES := $(MY_FILES:$(LOCAL_PATH)/%=%)
 # ARToolKit libs use lots of floating point, so don't compile in thumb mode.
 LOCAL_ARM_MODE := arm
+# Rather than using LOCAL_ARM_NEON := true, just compile the one file in NEON mode.
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+  MY_FILES := $(subst hamming.cpp,hamming.cpp.neon,$(MY_FILES))
+  LOCAL_CFLAGS += -DHAVE_ARM_NEON=1
+endif
+ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+  LOCAL_CFLAGS += -DHAVE_ARM64_NEON=1
+endif
+ifeq ($(TARGET_ARCH_ABI),$(filter $(TARGET_ARCH_ABI),x86 x86_64))
+  LOCAL_CFLAGS += -DHAVE_INTEL_SIMD=1
+endif
 LOCAL_SRC_FILES := $(MY_FILES)
 LOCAL_CFLAGS += $(MY_CFLAGS) -Wno-extern-c-compat -Wno-null-conversion
 LOCAL_C_INCLUDES := $(ARTOOLKIT_ROOT)/include/android $(ARTOOLKIT_ROOT)/include $(ARTOOLKIT_ROOT)/lib/SRC/KPM/FreakMatcher
@@ -219,6 +231,17 @@ MY_FILES := $(wildcard $(ARTOOLKIT_ROOT)/lib/SRC/AR2/*.c)
 MY_FILES := $(MY_FILES:$(LOCAL_PATH)/%=%)
 # ARToolKit libs use lots of floating point, so don't compile in thumb mode.
 LOCAL_ARM_MODE := arm
+# Rather than using LOCAL_ARM_NEON := true, just compile the one file in NEON mode.
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+  MY_FILES := $(subst matching.c,matching.c.neon,$(MY_FILES))
+  LOCAL_CFLAGS += -DHAVE_ARM_NEON=1
+endif
+ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+  LOCAL_CFLAGS += -DHAVE_ARM64_NEON=1
+endif
+ifeq ($(TARGET_ARCH_ABI),$(filter $(TARGET_ARCH_ABI),x86 x86_64))
+  LOCAL_CFLAGS += -DHAVE_INTEL_SIMD=1
+endif
 LOCAL_SRC_FILES := $(MY_FILES)
 LOCAL_CFLAGS += $(MY_CFLAGS)
 LOCAL_C_INCLUDES := $(ARTOOLKIT_ROOT)/include/android $(ARTOOLKIT_ROOT)/include
@@ -326,7 +326,7 @@ static void startCallback(void *userData)
     //kpmSetProcMode( kpmHandle, KpmProcHalfSize );
     
     // AR2 init.
-    if (!(ar2Handle = ar2CreateHandle(gCparamLT, pixFormat, AR2_TRACKING_DEFAULT_THREAD_NUM))) {
+    if (!(ar2Handle = ar2CreateHandle(gCparamLT, AR_PIXEL_FORMAT_MONO, AR2_TRACKING_DEFAULT_THREAD_NUM))) {
         NSLog(@"Error: ar2CreateHandle.\n");
         [self stop];
         return;
@@ -557,7 +557,7 @@ static void startCallback(void *userData)
                 }
             }
             if( detectedPage >= 0 && detectedPage < PAGES_MAX) {
-                if( ar2Tracking(ar2Handle, surfaceSet[detectedPage], buffer->buff, trackingTrans, &err) < 0 ) {
+                if( ar2Tracking(ar2Handle, surfaceSet[detectedPage], buffer->buffLuma, trackingTrans, &err) < 0 ) {
                     detectedPage = -2;
                 } else {
 #ifdef DEBUG
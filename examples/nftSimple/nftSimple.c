@@ -359,7 +359,7 @@ static int initNFT(ARParamLT *cparamLT, AR_PIXEL_FORMAT pixFormat)
     //kpmSetProcMode( kpmHandle, KpmProcHalfSize );
     
     // AR2 init.
-    if( (ar2Handle = ar2CreateHandle(cparamLT, pixFormat, AR2_TRACKING_DEFAULT_THREAD_NUM)) == NULL ) {
+    if( (ar2Handle = ar2CreateHandle(cparamLT, AR_PIXEL_FORMAT_MONO, AR2_TRACKING_DEFAULT_THREAD_NUM)) == NULL ) {
         ARLOGe("Error: ar2CreateHandle.\n");
         kpmDeleteHandle(&kpmHandle);
         return (FALSE);
@@ -576,7 +576,7 @@ static void mainLoop(void)
                 }
             }
             if( detectedPage >= 0 && detectedPage < surfaceSetCount) {
-                if( ar2Tracking(ar2Handle, surfaceSet[detectedPage], image->buff, trackingTrans, &err) < 0 ) {
+                if( ar2Tracking(ar2Handle, surfaceSet[detectedPage], image->buffLuma, trackingTrans, &err) < 0 ) {
                     ARLOGd("Tracking lost.\n");
                     detectedPage = -2;
                 } else {
@@ -95,6 +95,17 @@ extern "C" {
 
 #define AR2_DEFAULT_SEARCH_SIZE	                    25          // Default radius of feature search window.
 
+#define AR2_SEARCH_SIZE_FIXED                       0
+#define AR2_SEARCH_SIZE_ADAPTIVE                    1
+#define AR2_DEFAULT_SEARCH_SIZE_MODE                AR2_SEARCH_SIZE_FIXED
+#define AR2_DEFAULT_SEARCH_SIZE_MIN                 8           // Smallest radius of feature search window in adaptive mode.
+#define AR2_SEARCH_SIZE_ERR_FACTOR                  3.0F        // Adaptive search radius allows this many times the mean recent prediction error.
+
+#define AR2_COARSE_SEARCH_DISABLE                   0
+#define AR2_COARSE_SEARCH_ENABLE                    1
+#define AR2_DEFAULT_COARSE_SEARCH                   AR2_COARSE_SEARCH_DISABLE
+#define AR2_COARSE_SEARCH_MIN_SIZE                  16          // Search windows smaller than this radius are always searched at full resolution.
+
 #define AR2_DEFAULT_SEARCH_FEATURE_NUM	            10          // May not be higher than AR2_SEARCH_FEATURE_MAX.
 
 #define AR2_DEFAULT_TS1                             11          // Template size 1. Multiplied by AR2_TEMP_SCALE to give number of pixels outside centre pixel in negative x/y axis.
@@ -104,17 +115,28 @@ extern "C" {
 
 #define AR2_DEFAULT_TRACKING_THRESH                 2.0F
 
+#define AR2_ROBUST_SCHEDULE_MAX                     8           // Maximum number of robust pose fit levels.
+
+#define AR2_DEFAULT_TEMPLATE_CACHE_POS_TOL          0.25F       // Max. shift (reference image pixels) of template centre before cached template is re-warped. 0 disables the cache.
+#define AR2_DEFAULT_TEMPLATE_CACHE_SHAPE_TOL        0.5F        // Max. shift (reference image pixels) of template corners, relative to centre, before cached template is re-warped.
+
 
 
 /* tracking.c */
 #define    AR2_TRACKING_SURFACE_MAX                 10          // Maximum number of surfaces per surface set (i.e. maximum number of discrete surfaces with fixed relationship to each other able to be combined into a surface set.)
 #define    AR2_TRACKING_CANDIDATE_MAX               200         // Maximum number of candidate feature points.
+#define    AR2_FEATURE_INDEX_GRID_SIZE              16          // Cells along the longer side of the page in the feature point spatial index.
 
 /* tracking2d.c */
 #define AR2_DEFAULT_TRACKING_SD_THRESH              5.0F
 #define AR2_SEARCH_FEATURE_MAX                      40
 
 
+/* featureSet.c */
+#define AR2_FEATURE_SET_VERSION_LEGACY              1           // .fset layout written before 5.3.3: one field at a time.
+#define AR2_FEATURE_SET_VERSION_PACKED              2           // .fset layout with header, scale table and packed coordinate records.
+#define AR2_FEATURE_SET_VERSION_DEFAULT             AR2_FEATURE_SET_VERSION_LEGACY // Readable by every release; packed output is opt-in.
+
 /* genFeatureSet.c */
 #define AR2_DEFAULT_MAX_SIM_THRESH_L0               0.80F
 #define AR2_DEFAULT_MAX_SIM_THRESH_L1               0.85F
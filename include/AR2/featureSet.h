@@ -74,6 +74,25 @@ typedef struct {
     int               num;
 } AR2FeatureSetT;
 
+// Grid over the page (marker coordinates) bucketing the feature points of each scale of an AR2FeatureSetT,
+// so that only features in the part of the page in view need be considered.
+typedef struct {
+    float             minx, miny;       // Marker coordinates of grid origin.
+    float             cellw, cellh;     // Size of one grid cell.
+    int               xnum, ynum;       // Grid dimensions in cells.
+    int               num;              // Number of scales, i.e. featureSet->num.
+    int             **cellStart;        // cellStart[scale][cell]: first entry in featureIdx[scale] for cell. xnum*ynum + 1 entries per scale.
+    int             **featureIdx;       // featureIdx[scale]: feature numbers, grouped by cell and ascending within each cell.
+    ARUint8          *cellVisible;      // Working: cells which may be visible in the current frame.
+    float            *cornerPos;        // Working: screen coordinates of cell corners in the current frame.
+    ARUint8          *cornerFront;      // Working: whether each cell corner is in front of the camera.
+    int              *visible;          // Working: feature numbers returned by ar2GetFeatureIndexVisible().
+} AR2FeatureIndexT;
+
+
+// Set the number of threads ar2GenFeatureMap() shares the rows of the map between, or -1 (the default)
+// for one thread per CPU. Applies to all subsequent calls in the process.
+int ar2SetFeatureMapThreadNum( int threadNum );
 
 AR2FeatureMapT *ar2GenFeatureMap( AR2ImageT *image,
                                   int ts1, int ts2,
@@ -99,8 +118,19 @@ AR2FeatureCoordT *ar2SelectFeature2( AR2ImageT *image, AR2FeatureMapT *featureMa
 
 AR2FeatureSetT *ar2ReadFeatureSet( char *filename, char *ext );
 int             ar2SaveFeatureSet( char *filename, char *ext, AR2FeatureSetT *featureSet );
+// Save in the given .fset layout: AR2_FEATURE_SET_VERSION_LEGACY (readable by ARToolKit versions
+// before 5.3.3) or AR2_FEATURE_SET_VERSION_PACKED. ar2SaveFeatureSet() uses AR2_FEATURE_SET_VERSION_DEFAULT,
+// which is the legacy layout.
+// ar2ReadFeatureSet() reads either.
+int             ar2SaveFeatureSet2( char *filename, char *ext, AR2FeatureSetT *featureSet, int version );
 int             ar2FreeFeatureSet( AR2FeatureSetT **featureSet );
 
+AR2FeatureIndexT *ar2GenFeatureIndex ( AR2FeatureSetT *featureSet );
+int               ar2FreeFeatureIndex( AR2FeatureIndexT **featureIndex );
+int               ar2SetFeatureIndexVisibility( AR2FeatureIndexT *featureIndex, const float trans[3][4],
+                                                float xmin, float ymin, float xmax, float ymax );
+int               ar2GetFeatureIndexVisible   ( AR2FeatureIndexT *featureIndex, int scale, int **visible );
+
 #ifdef __cplusplus
 }
 #endif
@@ -44,16 +44,36 @@
 extern "C" {
 #endif
 
+#define    AR2_IMAGE_TILE_SIZE  128                     // Tiled image sets (.isett) are paged in square tiles of this many pixels a side.
+#define    AR2_DEFAULT_IMAGE_TILE_MEMORY_LIMIT  (16*1024*1024) // Bytes of tiles a tiled image set keeps once they are no longer in use.
+
+typedef struct _AR2ImageTilesT     AR2ImageTilesT;
+typedef struct _AR2ImageTileCacheT AR2ImageTileCacheT;
+
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 #define    AR2_BLUR_IMAGE_MAX  5
+#define    AR2_BLUR_PASSES     3                        // Every blur level above 0 is imgBW filtered this many times with a 3x3 box filter.
+#define    AR2_BLUR_TILE_SIZE  64                       // Blurred images are generated in square tiles of this many pixels a side.
+#define    AR2_DEFAULT_BLUR_MEMORY_LIMIT  (4*1024*1024) // Bytes of blur tiles an image set keeps once they are no longer in use.
+
+typedef struct _AR2BlurCacheT AR2BlurCacheT;
+
+// The blurred image, generated a tile at a time when first used.
+typedef struct {
+    ARUint8     **tile;         /* tileXNum*tileYNum tiles. NULL until generated           */
+    ARUint32     *lastUse;      /* frame in which each tile was last used                  */
+} AR2BlurLevelT;
 #endif
 
 
 typedef struct {
+    ARUint8      *imgBW;        /* NULL in a tiled image set. Use ar2GetImagePixel() if the set may be tiled */
+    AR2ImageTilesT *tiles;      /* tiled image sets only */
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    ARUint8      *imgBWBlur[AR2_BLUR_IMAGE_MAX];
-#else
-    ARUint8      *imgBW;
+    AR2BlurLevelT  blur;        /* all blur levels above 0; level 0 is imgBW itself */
+    int           tileXNum;
+    int           tileYNum;
+    AR2BlurCacheT *blurCache;   /* shared by all scales of the image set */
 #endif
     int           xsize;
     int           ysize;
@@ -63,14 +83,63 @@ typedef struct {
 typedef struct {
     AR2ImageT   **scale;
     int32_t       num;
+    void         *cache;        /* precomputed image set cache the scales' imgBW point into, or NULL */
+    size_t        cacheSize;
+    AR2ImageTileCacheT *tileCache; /* tiled image sets only */
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    AR2BlurCacheT *blurCache;
+#endif
 } AR2ImageSetT;
 
 /*   image.c   */
 AR2ImageSetT   *ar2GenImageSet   ( ARUint8 *image, int xsize, int ysize, int nc, float dpi, float dpi_list[], int dpi_num );
 AR2ImageSetT   *ar2ReadImageSet  ( char *filename );
 int             ar2WriteImageSet ( char *filename, AR2ImageSetT *imageSet );
+// Decode filename.iset and write all its scales, uncompressed, to filename.isetc. ar2ReadImageSet()
+// maps the cache instead of decoding and resampling the .iset, as long as the .iset has not changed
+// since the cache was written. The mapped images are read-only, and identical to the decoded ones.
+int             ar2WriteImageSetCache( char *filename );
+
+// Decode filename.iset and write all its scales to filename.isett in AR2_IMAGE_TILE_SIZE square tiles.
+int             ar2WriteImageSetTiled( char *filename );
+
+// Open filename.isett written by ar2WriteImageSetTiled(). Returns NULL if it is absent or invalid, or, when filename.iset
+// is present, if it was not generated from it. Scales have imgBW NULL; their tiles are read from the file when first used
+// and kept up to a memory limit. Used by ar2ReadSurfaceSet() in preference to ar2ReadImageSet().
+// Tiled image sets are not supported with adaptive templates: when AR2_CAPABLE_ADAPTIVE_TEMPLATE is set, this always
+// returns NULL, and ar2ReadSurfaceSet() reads the .iset instead.
+AR2ImageSetT   *ar2ReadImageSetTiled( char *filename );
+
+// Pixel (x, y) of image, whether held in memory or tiled. Pages the tile in if necessary.
+// Safe to call from several threads at once, but not concurrently with ar2TrimImageSetTiles().
+ARUint8         ar2GetImagePixel ( const AR2ImageT *image, int x, int y );
+
+// Set the number of bytes of tiles kept by ar2TrimImageSetTiles().
+int             ar2SetImageSetTileMemoryLimit( AR2ImageSetT *imageSet, size_t limit );
+
+// Release the least recently used tiles until within the memory limit. Tiles used since the last call are kept.
+// ar2Tracking() calls this once per frame. Returns -1 if imageSet is not tiled.
+int             ar2TrimImageSetTiles( AR2ImageSetT *imageSet );
 int             ar2FreeImageSet  ( AR2ImageSetT **imageSet );
 
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+// Pixel (x, y) of blur level blurLevel of image. Level 0 is the image itself, and every level
+// above it is the same image, blurred with AR2_BLUR_PASSES passes of a 3x3 box filter, as the
+// blurred images used to be precomputed. The tile holding the pixel is generated if necessary.
+// Safe to call from several threads at once, but not concurrently with ar2TrimImageSetBlur().
+ARUint8         ar2GetImageBlurValue( const AR2ImageT *image, int blurLevel, int x, int y );
+
+// Whole of blur level blurLevel of image, in a newly allocated buffer which the caller must free.
+ARUint8        *ar2GenImageBlur  ( const AR2ImageT *image, int blurLevel );
+
+// Set the number of bytes of blur tiles kept by ar2TrimImageSetBlur().
+int             ar2SetImageSetBlurMemoryLimit( AR2ImageSetT *imageSet, size_t limit );
+
+// End a frame: release the least recently used blur tiles until the image set is within its
+// memory limit. Tiles used since the previous call are always kept.
+int             ar2TrimImageSetBlur( AR2ImageSetT *imageSet );
+#endif
+
 #ifdef __cplusplus
 }
 #endif
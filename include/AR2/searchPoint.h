@@ -51,6 +51,8 @@ void ar2GetSearchPoint( const ARParamLT *cparamLT,
                         const float  trans1[3][4], const float  trans2[3][4], const float  trans3[3][4],
                         AR2FeatureCoordT *feature,
                         int search[3][2] );
+int  ar2GetSearchRadius( int search[3][2], float predictErr, int minSize, int maxSize );
+float ar2GetSearchPointError( int search[3][2], int x, int y );
 
 
 #ifdef __cplusplus
@@ -73,6 +73,41 @@ typedef struct {
 #endif
 
 
+// Per-thread working memory for ar2GetBestMatching(). Allocated once per tracking thread and reused for every search.
+typedef struct {
+    ARUint16    *mfImage;           /* visit map, same size as input image. Pixel visited in current search iff == epoch */
+    ARUint16     epoch;             /* stamp of the current search. Map cleared only when this wraps */
+    int          xsize, ysize;      /* size of mfImage       */
+    ARUint32    *subImage1;         /* integral image of pixel values, for optimised matching          */
+    ARUint32    *subImage2;         /* integral image of squared pixel values, for optimised matching  */
+    int          subImageSize;      /* allocated length (in elements) of subImage1 and subImage2       */
+} AR2MatchingWorkT;
+
+
+// A feature's most recently warped template, with the reference image footprint it was warped for.
+typedef struct {
+    ARUint16    *img1;              /* template pixels. NULL until first stored   */
+    int          vlen;
+    int          sum;
+    int          validNum;
+    float        centre[2];         /* reference image coordinates of the centre sample                */
+    float        corner[4][2];      /* reference image coordinates of the corner samples, less centre  */
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    int          blurLevel;
+#endif
+    int          valid;
+} AR2TemplateCacheEntryT;
+
+// Per-surface cache of warped templates, one entry per feature point.
+typedef struct {
+    AR2TemplateCacheEntryT **entry; /* entry[level][num] parallels featureSet->list[level].coord[num] */
+    int                     *entryNum;  /* number of entries at each level */
+    int                      num;   /* number of levels      */
+    int                      xts1, xts2;    /* template size  */
+    int                      yts1, yts2;    /* template size  */
+} AR2TemplateCacheT;
+
+
 typedef struct {
     int     snum;
     int     level;
@@ -95,6 +130,10 @@ int ar2SetTemplateSub ( const ARParamLT *cparamLT, const float  trans[3][4], AR2
 int ar2SetTemplate2Sub( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
                         AR2FeaturePointsT *featurePoints, int num, int blurLevel,
                         AR2Template2T *templ2 );
+int ar2SetTemplateSubCached( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
+                             AR2FeaturePointsT *featurePoints, int num, int blurLevel,
+                             AR2TemplateCacheT *cache, int level, float posTol, float shapeTol,
+                             AR2TemplateT *templ );
 #else
 AR2TemplateT  *ar2GenTemplate ( int ts1, int ts2 );
 int            ar2FreeTemplate( AR2TemplateT  *templ  );
@@ -102,15 +141,30 @@ int            ar2FreeTemplate( AR2TemplateT  *templ  );
 int ar2SetTemplateSub ( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
                         AR2FeaturePointsT *featurePoints, int num,
                         AR2TemplateT *templ );
+int ar2SetTemplateSubCached( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
+                             AR2FeaturePointsT *featurePoints, int num,
+                             AR2TemplateCacheT *cache, int level, float posTol, float shapeTol,
+                             AR2TemplateT *templ );
 #endif
 
+AR2TemplateCacheT *ar2GenTemplateCache ( AR2FeatureSetT *featureSet, int ts1, int ts2 );
+int                ar2FreeTemplateCache( AR2TemplateCacheT **cache );
+
+
+AR2MatchingWorkT *ar2GenMatchingWork ( int xsize, int ysize );
+int               ar2FreeMatchingWork( AR2MatchingWorkT *work );
+ARUint16          ar2MatchingWorkNewEpoch( AR2MatchingWorkT *work );
 
-int ar2GetBestMatching ( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+int ar2GetBestMatching ( ARUint8 *img, AR2MatchingWorkT *work, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
                          AR2TemplateT *mtemp, int rx, int ry,
                          int search[3][2], int *bx, int *by, float *val);
+int ar2GetBestMatchingCoarse( ARUint8 *img, ARUint8 *coarseImg, AR2MatchingWorkT *work, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                              AR2TemplateT *mtemp, int rx, int ry,
+                              int search[3][2], int *bx, int *by, float *val);
+int ar2GetCoarseMatchingImage( ARUint8 *img, int xsize, int ysize, ARUint8 *coarseImg );
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-int ar2GetBestMatching2( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+int ar2GetBestMatching2( ARUint8 *img, AR2MatchingWorkT *work, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
                          AR2Template2T *mtemp, int rx, int ry,
                          int search[3][2], int *bx, int *by, float *val, int *blurLevel);
 #else
@@ -71,6 +71,8 @@ typedef struct {
     float                 trans[3][4];
     float                 itrans[3][4];
     char                 *jpegName;
+    AR2TemplateCacheT    *templCache;   // Warped templates from previous frames. Managed by ar2Tracking().
+    AR2FeatureIndexT     *featureIndex; // Spatial index of featureSet.
 } AR2SurfaceT;
 
 typedef struct {
@@ -80,6 +82,7 @@ typedef struct {
     float                 trans2[3][4];
     float                 trans3[3][4];
     int                   contNum;
+    float                 predictErr;   // Recent mean distance of matched features from their predicted position, or -1 if unknown.
     AR2TemplateCandidateT     prevFeature[AR2_SEARCH_FEATURE_MAX+1];
 } AR2SurfaceSetT;
 
@@ -87,6 +90,7 @@ typedef struct {
     float             sim;
     float             pos2d[2];
     float             pos3d[3];
+    float             predictErr;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     int               blurLevel;
 #endif
@@ -102,7 +106,8 @@ struct _AR2Tracking2DParamT {
     AR2SurfaceSetT          *surfaceSet;
     AR2TemplateCandidateT   *candidate;
     ARUint8                 *dataPtr;    // Input image.
-    ARUint8                 *mfImage;    // (Internally allocated buffer same size as input image).
+    ARUint8                 *coarsePtr;  // Half-resolution input image for coarse-to-fine search, or NULL.
+    AR2MatchingWorkT        *work;       // Internally allocated matching workspace, reused across frames.
     AR2TemplateT            *templ;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     AR2Template2T           *templ2;
@@ -123,11 +128,19 @@ struct _AR2HandleT {
     int               blurLevel;
 #endif
     int               searchSize;
+    int               searchSizeMode;
+    int               searchSizeMin;
+    int               coarseSearch;
+    ARUint8          *coarseImage;      // Internally allocated when coarse-to-fine search is in use.
     int               templateSize1;
     int               templateSize2;
     int               searchFeatureNum;
     float             simThresh;
     float             trackingThresh;
+    float             templateCachePosTol;
+    float             templateCacheShapeTol;
+    float             robustSchedule[AR2_ROBUST_SCHEDULE_MAX];
+    int               robustScheduleNum;
     /*--------------------------------*/
     float                     wtrans1[AR2_TRACKING_SURFACE_MAX][3][4];
     float                     wtrans2[AR2_TRACKING_SURFACE_MAX][3][4];
@@ -236,6 +249,9 @@ int             ar2SetInitTrans          ( AR2SurfaceSetT *surfaceSet, float  tr
         This structure also specifies the size of video frames which will be later supplied to the
         ar2Tracking() function as cparamLT->param.xsize and cparamLT->param.ysize.
     @param pixFormat Pixel format of video frames which will be later supplied to the ar2Tracking() function.
+        Matching is performed on luminance only, so AR_PIXEL_FORMAT_MONO together with the
+        buffLuma plane of an AR2VideoBufferT is the fastest choice; colour formats are converted
+        per-pixel during matching.
     @param threadNum Number of threads to spawn for the NFT texture tracking task.
         Use AR2_TRACKING_DEFAULT_THREAD_NUM to have ARToolKit calculate a sensible default.
     @result Pointer to a newly allocated AR2HandleT structure, which holds the current state of the NFT
@@ -256,6 +272,9 @@ AR2HandleT     *ar2CreateHandle          ( ARParamLT *cparamLT, AR_PIXEL_FORMAT
     @param xsize Width of video frames which will be later supplied to the ar2Tracking() function.
     @param ysize Height of video frames which will be later supplied to the ar2Tracking() function.
     @param pixFormat Pixel format of video frames which will be later supplied to the ar2Tracking() function.
+        Matching is performed on luminance only, so AR_PIXEL_FORMAT_MONO together with the
+        buffLuma plane of an AR2VideoBufferT is the fastest choice; colour formats are converted
+        per-pixel during matching.
     @param threadNum Number of threads to spawn for the NFT texture tracking task.
         Use AR2_TRACKING_DEFAULT_THREAD_NUM to have ARToolKit calculate a sensible default.
     @result Pointer to a newly allocated AR2HandleT structure, which holds the current state of the NFT
@@ -301,6 +320,8 @@ int             ar2GetBlurLevel          ( AR2HandleT *ar2Handle, int *blurLevel
         resolution), at the cost of greater search effort. Search effort increases with
         the square of the search radius.
  
+        When the search size mode is AR2_SEARCH_SIZE_ADAPTIVE, this is the largest radius used.
+ 
         Default value is AR2_DEFAULT_SEARCH_SIZE, as defined in &lt;AR2/config.h&gt;
     @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
     @param searchSize The new search size to use.
@@ -323,6 +344,104 @@ int             ar2SetSearchSize         ( AR2HandleT *ar2Handle, int  searchSiz
  */
 int             ar2GetSearchSize         ( AR2HandleT *ar2Handle, int *searchSize        );
 
+/*!
+    @function
+    @abstract Choose whether the feature point search window size adapts to camera motion.
+    @discussion
+        In AR2_SEARCH_SIZE_FIXED mode, every feature is searched for within the radius set by
+        ar2SetSearchSize.
+ 
+        In AR2_SEARCH_SIZE_ADAPTIVE mode, each feature gets its own radius. The radius is derived from
+        how much the feature's motion is changing over the last three poses, and from the recent
+        error between predicted and matched feature positions. The search window therefore shrinks
+        while the camera is steady and grows when it starts to move. The radius is never smaller
+        than the size set by ar2SetSearchSizeMin nor larger than the size set by ar2SetSearchSize.
+        The full size is always used in the first frames after ar2SetInitTrans().
+ 
+        Default value is AR2_DEFAULT_SEARCH_SIZE_MODE, as defined in &lt;AR2/config.h&gt;
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param searchSizeMode Either AR2_SEARCH_SIZE_FIXED or AR2_SEARCH_SIZE_ADAPTIVE.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2GetSearchSizeMode ar2GetSearchSizeMode
+    @seealso ar2SetSearchSize ar2SetSearchSize
+    @seealso ar2SetSearchSizeMin ar2SetSearchSizeMin
+ */
+int             ar2SetSearchSizeMode     ( AR2HandleT *ar2Handle, int  searchSizeMode    );
+
+/*!
+    @function
+    @abstract Report whether the feature point search window size adapts to camera motion.
+    @discussion
+        See the discussion under ar2SetSearchSizeMode.
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param searchSizeMode Pointer to an int, which on return will be filled with AR2_SEARCH_SIZE_FIXED or AR2_SEARCH_SIZE_ADAPTIVE.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2SetSearchSizeMode ar2SetSearchSizeMode
+ */
+int             ar2GetSearchSizeMode     ( AR2HandleT *ar2Handle, int *searchSizeMode    );
+
+/*!
+    @function
+    @abstract Set the smallest feature point search window size used in adaptive mode.
+    @discussion
+        See the discussion under ar2SetSearchSizeMode.
+ 
+        Default value is AR2_DEFAULT_SEARCH_SIZE_MIN, as defined in &lt;AR2/config.h&gt;
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param searchSizeMin The smallest search radius, in pixels. Must be at least 1.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2GetSearchSizeMin ar2GetSearchSizeMin
+    @seealso ar2SetSearchSizeMode ar2SetSearchSizeMode
+ */
+int             ar2SetSearchSizeMin      ( AR2HandleT *ar2Handle, int  searchSizeMin     );
+
+/*!
+    @function
+    @abstract Get the smallest feature point search window size used in adaptive mode.
+    @discussion
+        See the discussion under ar2SetSearchSizeMode.
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param searchSizeMin Pointer to an int, which on return will be filled with the smallest search radius.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2SetSearchSizeMin ar2SetSearchSizeMin
+ */
+int             ar2GetSearchSizeMin      ( AR2HandleT *ar2Handle, int *searchSizeMin     );
+
+/*!
+    @function
+    @abstract Choose whether feature search is performed coarse-to-fine.
+    @discussion
+        With coarse-to-fine search enabled, each feature is first searched for on a half-resolution
+        copy of the video frame at twice the usual grid spacing, and only the best areas are then
+        searched at full resolution. This allows large search sizes (for tracking under fast motion)
+        at close to the cost of small ones.
+ 
+        The half-resolution frame is generated only for luminance input, i.e. when the AR2HandleT was
+        created with AR_PIXEL_FORMAT_MONO, AR_PIXEL_FORMAT_420v, AR_PIXEL_FORMAT_420f or AR_PIXEL_FORMAT_NV21,
+        and only when the search size is at least AR2_COARSE_SEARCH_MIN_SIZE. Otherwise the search is
+        performed at full resolution as usual.
+ 
+        Default value is AR2_DEFAULT_COARSE_SEARCH, as defined in &lt;AR2/config.h&gt;
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param coarseSearch Either AR2_COARSE_SEARCH_ENABLE or AR2_COARSE_SEARCH_DISABLE.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2GetCoarseSearch ar2GetCoarseSearch
+    @seealso ar2SetSearchSize ar2SetSearchSize
+ */
+int             ar2SetCoarseSearch       ( AR2HandleT *ar2Handle, int  coarseSearch      );
+
+/*!
+    @function
+    @abstract Report whether feature search is performed coarse-to-fine.
+    @discussion
+        See the discussion under ar2SetCoarseSearch.
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param coarseSearch Pointer to an int, which on return will be filled with AR2_COARSE_SEARCH_ENABLE or AR2_COARSE_SEARCH_DISABLE.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2SetCoarseSearch ar2SetCoarseSearch
+ */
+int             ar2GetCoarseSearch       ( AR2HandleT *ar2Handle, int *coarseSearch      );
+
 /*!
     @function
     @abstract 
@@ -438,6 +557,75 @@ int             ar2SetTrackingThresh     ( AR2HandleT *ar2Handle, float   tracki
 */
 int             ar2GetTrackingThresh     ( AR2HandleT *ar2Handle, float  *trackingThresh );
 
+/*!
+    @function
+    @abstract Set the schedule of robust pose fits tried when the plain fit is not good enough.
+    @discussion
+        After the features have been matched, the pose is first fitted to all of them. If the error of
+        that fit exceeds the threshold set with ar2SetTrackingThresh(), robust fits are tried in turn, each
+        assuming a smaller proportion of inliers and each starting from the previous successful fit, until one
+        meets the threshold. Levels assuming more inliers than the residuals of the plain fit support are skipped.
+ 
+        The default schedule is 0.8, 0.6, 0.4, 0.0.
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param inlierProb Array of num inlier probabilities in the range [0.0, 1.0], in non-increasing order.
+    @param num Number of entries in inlierProb, at most AR2_ROBUST_SCHEDULE_MAX. 0 disables robust fitting.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2GetRobustSchedule ar2GetRobustSchedule
+    @seealso ar2SetTrackingThresh ar2SetTrackingThresh
+ */
+int             ar2SetRobustSchedule     ( AR2HandleT *ar2Handle, const float *inlierProb, int num );
+
+/*!
+    @function
+    @abstract Get the schedule of robust pose fits tried when the plain fit is not good enough.
+    @discussion
+        See the discussion under ar2SetRobustSchedule.
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param inlierProb Array of AR2_ROBUST_SCHEDULE_MAX floats, which on return will hold the inlier probabilities.
+    @param num Pointer to an int, which on return will be filled with the number of entries in inlierProb.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2SetRobustSchedule ar2SetRobustSchedule
+ */
+int             ar2GetRobustSchedule     ( AR2HandleT *ar2Handle, float inlierProb[AR2_ROBUST_SCHEDULE_MAX], int *num );
+
+/*!
+    @function
+    @abstract Set tolerances for reuse of feature templates warped in previous frames.
+    @discussion
+        Each frame, the template for every feature searched for is warped from the reference image
+        according to the current pose. While tracking is stable the warp changes little between frames,
+        so the most recently warped template of each feature is kept, along with the reference image
+        coordinates of its centre and corner samples. The kept template is reused while the centre
+        moves by no more than posTol pixels, and the corners (relative to the centre, i.e. change in scale,
+        rotation and perspective) by no more than shapeTol pixels. Distances are in pixels of the reference
+        image at the feature's scale.
+ 
+        Larger values save more time but allow more error in the matched feature positions.
+        Pass 0 for posTol to disable the cache.
+ 
+        Default values are AR2_DEFAULT_TEMPLATE_CACHE_POS_TOL and AR2_DEFAULT_TEMPLATE_CACHE_SHAPE_TOL, as defined in &lt;AR2/config.h&gt;
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param posTol Tolerance on movement of the template centre.
+    @param shapeTol Tolerance on movement of the template corners relative to the centre.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2GetTemplateCacheTolerance ar2GetTemplateCacheTolerance
+ */
+int             ar2SetTemplateCacheTolerance( AR2HandleT *ar2Handle, float  posTol, float  shapeTol );
+
+/*!
+    @function
+    @abstract Get tolerances for reuse of feature templates warped in previous frames.
+    @discussion
+        See the discussion under ar2SetTemplateCacheTolerance.
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param posTol Pointer to a float, which on return will be filled with the centre tolerance.
+    @param shapeTol Pointer to a float, which on return will be filled with the corner tolerance.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2SetTemplateCacheTolerance ar2SetTemplateCacheTolerance
+ */
+int             ar2GetTemplateCacheTolerance( AR2HandleT *ar2Handle, float *posTol, float *shapeTol );
+
 /*!
     @function
     @abstract Choose whether full 6 degree-of-freedom tracking is performed, or homography extraction only.
@@ -56,6 +56,7 @@
 #  include <AR2/tracking.h>
 #  include <KPM/kpm.h>
 #  include <ARWrapper/ARMarkerNFT.h>
+class ARMarkerNFT;
 #endif
 
 
@@ -73,7 +74,7 @@
 #  define pthread_mutex_unlock(pm)      LeaveCriticalSection(pm)
 #  define pthread_mutex_destroy(pm)     DeleteCriticalSection(pm)
 #endif
-#define PAGES_MAX 64
+#define PAGES_MAX 64 // Maximum number of NFT pages when all pages are kept resident.
 
 /**
  * Wrapper for ARToolKit functionality. This class handles ARToolKit initialisation, updates,
@@ -143,7 +144,19 @@ private:
     THREAD_HANDLE_T     *trackingThreadHandle;
     AR2HandleT          *m_ar2Handle;
     KpmHandle           *m_kpmHandle;
-    AR2SurfaceSetT      *surfaceSet[PAGES_MAX]; // Weak-reference. Strong reference is now in ARMarkerNFT class.
+    std::vector<ARMarkerNFT *> m_nftPages; // Indexed by page number. Weak-reference. Strong reference is in ARMarkerNFT class.
+    // On-demand loading of AR2 data.
+    size_t               m_nftPageMemoryBudget;      ///< Bytes of AR2 data kept resident, or 0 to keep all pages resident.
+    std::vector<int>     m_nftPageLastTracked;       ///< Frame number at which each page was last recognised or tracked.
+    int                  m_nftFrame;
+    typedef struct {
+        char            *datasetPathname;
+        AR2SurfaceSetT  *surfaceSet;
+    } NFTPageLoad;
+    THREAD_HANDLE_T     *m_nftPageLoaderThread;
+    NFTPageLoad          m_nftPageLoad;
+    int                  m_nftPageLoading;           ///< Page being loaded by m_nftPageLoaderThread, or -1.
+    float                m_nftPageLoadTrans[3][4];   ///< KPM pose of the page being loaded.
 #endif
     
     int m_error;
@@ -184,6 +197,10 @@ private:
     bool unloadNFTData(void);
     bool loadNFTData(void);
     bool initNFT(void);
+    static void *nftPageLoader(THREAD_HANDLE_T *threadHandle);
+    void requestNFTPage(int pageNo, float trans[3][4]);
+    void updateNFTPageLoading(void);
+    void evictNFTPages(void);
 #endif
 
 public:
@@ -477,6 +494,20 @@ public:
     void setNFTMultiMode(bool on);
     
     bool getNFTMultiMode() const;
+    
+    /**
+     * Sets the amount of AR2 (tracking) data kept resident for NFT markers.
+     * With a budget of 0 (the default), every NFT marker's data is read when the marker is
+     * added and stays resident. With a non-zero budget, NFT markers added afterwards
+     * keep only their KPM (recognition) data resident; a page's tracking data is read on a
+     * background thread when the page is first recognised, and the pages least recently
+     * tracked are released when the total exceeds the budget. This also removes the limit
+     * of PAGES_MAX NFT pages.
+     * @param megabytes Budget in megabytes, or 0 to keep all pages resident.
+     */
+    void setNFTPageMemoryBudget(int megabytes);
+    
+    int getNFTPageMemoryBudget() const;
 
 	/**
 	 * Populates the provided color buffer with the current contents of the debug image.
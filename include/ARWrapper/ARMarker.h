@@ -86,7 +86,8 @@ public:
 	
     // Factory methods.
     static std::vector<ARMarker *> newFromConfigDataFile(const char *markersConfigDataFilePath, ARPattHandle *arPattHandle, int *patternDetectionMode_out);
-    static ARMarker* newWithConfig(const char* cfg, ARPattHandle *arPattHandle);
+    // If nftLoadOnDemand is true, NFT markers defer reading their AR2 data until the page is recognised.
+    static ARMarker* newWithConfig(const char* cfg, ARPattHandle *arPattHandle, bool nftLoadOnDemand = false);
     
 	
     // Inputs from subclasses.
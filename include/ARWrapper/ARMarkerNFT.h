@@ -52,6 +52,7 @@ class ARMarkerNFT : public ARMarker {
 private:
     bool m_loaded;
     float m_nftScale;
+    size_t m_surfaceSetMemorySize;
 
 protected:
     bool unload();
@@ -65,7 +66,30 @@ public:
 	ARMarkerNFT();
 	~ARMarkerNFT();
 
-	bool load(const char* dataSetPathname_in);
+	/**
+	 * Loads the NFT dataset.
+	 * @param dataSetPathname_in Pathname of the dataset, without extension.
+	 * @param loadOnDemand If true, only check that the dataset is present and defer
+	 *     reading of the AR2 surface set (.iset and .fset) until the page is recognised
+	 *     (see attachSurfaceSet()). Pattern geometry is unavailable until then.
+	 */
+	bool load(const char* dataSetPathname_in, bool loadOnDemand = false);
+
+	/**
+	 * Takes ownership of a surface set read for this marker's dataset, replacing any
+	 * surface set already held, and updates the pattern geometry from it.
+	 */
+	bool attachSurfaceSet(AR2SurfaceSetT *surfaceSet_in);
+
+	/**
+	 * Frees the surface set, if held. The marker stays loaded and can be re-attached.
+	 */
+	void releaseSurfaceSet();
+
+	/**
+	 * Approximate heap footprint of the held surface set, in bytes, or 0 if none is held.
+	 */
+	size_t getSurfaceSetMemorySize() const;
 
 	bool updateWithNFTResults(int detectedPage, float trackingTrans[3][4], ARdouble transL2R[3][4] = NULL);
 
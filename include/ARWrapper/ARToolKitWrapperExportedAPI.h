@@ -371,6 +371,16 @@ extern "C" {
     EXPORT_API void arwSetNFTMultiMode(bool on);
     
     EXPORT_API bool arwGetNFTMultiMode();
+    
+    /**
+     * Sets the amount of NFT tracking data kept resident. With a non-zero budget, NFT markers
+     * added afterwards read their tracking data only when first recognised, and the least recently
+     * tracked pages are released when over budget.
+     * @param megabytes Budget in megabytes, or 0 (the default) to keep all NFT pages resident.
+     */
+    EXPORT_API void arwSetNFTPageMemoryBudget(int megabytes);
+    
+    EXPORT_API int arwGetNFTPageMemoryBudget();
 
     // ----------------------------------------------------------------------------------------------------
 #pragma mark  Marker management
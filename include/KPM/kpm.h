@@ -220,6 +220,45 @@ int         kpmSetDetectedFeatureMax( KpmHandle *kpmHandle, int  detectedMaxFeat
 int         kpmGetDetectedFeatureMax( KpmHandle *kpmHandle, int *detectedMaxFeature );
 int         kpmSetSurfThreadNum( KpmHandle *kpmHandle, int surfThreadNum );
 
+/*!
+    @function
+    @abstract Set the number of threads used to verify reference images during matching.
+    @discussion
+        kpmMatching compares the input image against every reference image (each page, at
+        each scale) loaded into the handle. These comparisons are independent, and are
+        shared out over this many threads. The best match is chosen in the same order
+        regardless of the number of threads, so the result does not change.
+        The Gaussian image pyramid of the input image is also built, and its feature
+        points detected and described, with this many threads, each working on a band
+        of rows or a batch of feature points.
+    @param kpmHandle Handle to the current KPM tracker instance, as generated by kpmCreateHandle or kpmCreateHandleHomography.
+    @param matchingThreadNum Number of threads to use, or -1 to use one thread per CPU.
+        1 (the default) disables threading.
+    @result 0 if successful, or value &lt;0 in case of error.
+ */
+int         kpmSetMatchingThreadNum( KpmHandle *kpmHandle, int  matchingThreadNum );
+int         kpmGetMatchingThreadNum( KpmHandle *kpmHandle, int *matchingThreadNum );
+
+/*!
+    @function
+    @abstract Limit the number of reference images fully verified during matching.
+    @discussion
+        By default, kpmMatching verifies the input image against every reference image
+        (each page, at each scale), so matching time grows with the number of pages.
+        With a shortlist size set, and more reference images than this loaded, the
+        features of all reference images are held in a single index. Each input feature
+        votes for the reference image holding its nearest neighbour, and only the
+        reference images with the most votes are verified. This makes matching against
+        a large number of pages much faster, at some risk of missing a page which is
+        visible but only weakly matched.
+    @param kpmHandle Handle to the current KPM tracker instance, as generated by kpmCreateHandle or kpmCreateHandleHomography.
+    @param shortlistSize Maximum number of reference images to verify per call to
+        kpmMatching, or 0 (the default) to verify all reference images.
+    @result 0 if successful, or value &lt;0 in case of error.
+ */
+int         kpmSetMatchingShortlistSize( KpmHandle *kpmHandle, int  shortlistSize );
+int         kpmGetMatchingShortlistSize( KpmHandle *kpmHandle, int *shortlistSize );
+
 /*!
     @function
     @abstract Load a reference data set into the key point matcher for tracking.
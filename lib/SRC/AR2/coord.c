@@ -190,7 +190,7 @@ int ar2GetImageValue( const ARParamLT *cparamLT, const float  trans[3][4], const
     if( ix < 0 || ix >= image->xsize
      || iy < 0 || iy >= image->ysize ) return -1;
 
-    *pBW = image->imgBWBlur[blurLevel][iy*image->xsize+ix];
+    *pBW = ar2GetImageBlurValue( image, blurLevel, ix, iy );
 
     return 0;
 }
@@ -201,6 +201,7 @@ int ar2GetImageValue2( const ARParamLT *cparamLT, const float  trans[3][4], cons
     float   mx, my;
     float   iix, iiy;
     int     ix, iy;
+    int     level;
 
     if( ar2ScreenCoord2MarkerCoord( cparamLT, trans, sx, sy, &mx, &my ) < 0 ) return -1;
     ar2MarkerCoord2ImageCoord( image->xsize, image->ysize, image->dpi, mx, my, &iix, &iiy );
@@ -210,11 +211,12 @@ int ar2GetImageValue2( const ARParamLT *cparamLT, const float  trans[3][4], cons
     if( ix < 0 || ix >= image->xsize
      || iy < 0 || iy >= image->ysize ) return -1;
 
-    if( blurLevel < 1 ) blurLevel = 1;
-    if( blurLevel >= AR2_BLUR_IMAGE_MAX-1 ) blurLevel = AR2_BLUR_IMAGE_MAX-2;
-    *pBW1 = image->imgBWBlur[blurLevel-1][iy*image->xsize+ix];
-    *pBW2 = image->imgBWBlur[blurLevel  ][iy*image->xsize+ix];
-    *pBW3 = image->imgBWBlur[blurLevel+1][iy*image->xsize+ix];
+    level = blurLevel;
+    if( level < 1 ) level = 1;
+    if( level >= AR2_BLUR_IMAGE_MAX-1 ) level = AR2_BLUR_IMAGE_MAX-2;
+    *pBW1 = ar2GetImageBlurValue( image, level-1, ix, iy );
+    *pBW2 = ar2GetImageBlurValue( image, level,   ix, iy );
+    *pBW3 = ar2GetImageBlurValue( image, level+1, ix, iy );
 
     return 0;
 }
@@ -233,7 +235,7 @@ int ar2GetImageValue( const ARParamLT *cparamLT, const float trans[3][4], const
     iy = (int)(image->ysize - my * image->dpi / 25.4F + 0.5F);
     if( iy < 0 || iy >= image->ysize ) return -1;
 
-    *pBW = image->imgBW[iy*image->xsize+ix];
+    *pBW = ar2GetImagePixel( image, ix, iy );
 
     return 0;
 }
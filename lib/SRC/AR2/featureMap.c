@@ -39,8 +39,31 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <float.h>
 #include <AR2/config.h>
 #include <AR2/featureSet.h>
+#include <thread_sub.h>
+#if defined(HAVE_INTEL_SIMD)
+#  include <emmintrin.h> // SSE2.
+#  define AR2_FMAP_SSE2 1
+#endif
+
+// Number of horizontally adjacent search positions whose similarity is computed together.
+#define AR2_FMAP_SIM_LANES  8
+
+typedef struct {
+    ARUint8    *imageBW;
+    float      *imageF;            // imageBW as float, for the vectorised similarity.
+    float      *fimage;            // Output feature map.
+    float      *fimage2;           // Gradient magnitude.
+    int         xsize, ysize;
+    int         ts1, ts2;
+    int         search_size1, search_size2;
+    float       max_sim_thresh, sd_thresh;
+    int         gradThresh;
+    int         row0, rowStep;     // This worker fills rows 1+row0, 1+row0+rowStep, ...
+} AR2GenFeatureMapArgT;
 
 static int make_template( ARUint8 *imageBW, int xsize, int ysize,
                           int cx, int cy, int ts1, int ts2, float  sd_thresh,
@@ -50,6 +73,24 @@ static int get_similarity( ARUint8 *imageBW, int xsize, int ysize,
                            float  *template, float  vlen, int ts1, int ts2,
                            int cx, int cy, float  *sim);
 
+static void get_similarity_lanes( ARUint8 *imageBW, float *imageF, int xsize, int ysize,
+                                  float *template, float vlen, int ts1, int ts2,
+                                  int cx, int cy, float sim[AR2_FMAP_SIM_LANES], int valid[AR2_FMAP_SIM_LANES] );
+
+static void gen_feature_map_rows( AR2GenFeatureMapArgT *arg );
+static void *gen_feature_map_worker( THREAD_HANDLE_T *threadHandle );
+
+static void row_min_update( float *map, int xsize, int j, float *rowMin, int *rowMinX );
+static int  row_min_find( float *rowMin, int *rowMinX, int ysize, float thresh, int *cx, int *cy, float *min );
+
+static int  ar2FeatureMapThreadNum = -1;
+
+int ar2SetFeatureMapThreadNum( int threadNum )
+{
+    ar2FeatureMapThreadNum = threadNum;
+    return 0;
+}
+
 int ar2FreeFeatureMap( AR2FeatureMapT *featureMap )
 {
     free( featureMap->map );
@@ -122,31 +163,32 @@ AR2FeatureMapT *ar2GenFeatureMap( AR2ImageT *image,
                                   float  max_sim_thresh, float  sd_thresh )
 {
     AR2FeatureMapT  *featureMap;
-    float           *fimage, *fp;
+    float           *fimage;
     float           *fimage2, *fp2;
-    float           *template;
+    float           *imageF;
+    ARUint8         *imageBW;
     ARUint8         *p;
     float           dx, dy;
     int             xsize, ysize;
     int             hist[1000], sum;
     int             i, j, k;
-    float           vlen;
-    float           max, sim;
-    int             ii, jj;
+    AR2GenFeatureMapArgT *arg;
+    THREAD_HANDLE_T **threadHandle;
+    int             threadNum;
 
     xsize = image->xsize;
     ysize = image->ysize;
     arMalloc(fimage,   float,  xsize*ysize);
     arMalloc(fimage2,  float,  xsize*ysize);
-    arMalloc(template, float , (ts1+ts2+1)*(ts1+ts2+1));
-
-
-    fp2 = fimage2;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    p = image->imgBWBlur[1];
+    imageBW = ar2GenImageBlur( image, 1 );
 #else
-    p = image->imgBW;
+    imageBW = image->imgBW;
 #endif
+
+
+    fp2 = fimage2;
+    p = imageBW;
     for( i = 0; i < xsize; i++ ) {*(fp2++) = -1.0f; p++;}
     for( j = 1; j < ysize-1; j++ ) {
         *(fp2++) = -1.0f; p++;
@@ -193,70 +235,58 @@ AR2FeatureMapT *ar2GenFeatureMap( AR2ImageT *image,
     ARLOGi(" Filtered features = %7d[pixel]\n", j);
 
 
-    fp = fimage;
-    fp2 = fimage2;
     for( i = 0; i < xsize; i++ ) {
-        *(fp++) = 1.0f;
-        fp2++;
+        fimage[i] = 1.0f;
+        fimage[(ysize-1)*xsize+i] = 1.0f;
     }
-    for( j = 1; j < ysize-1; j++ ) {
-        ARLOGi("\r%4d/%4d.", j+1, ysize); fflush(stdout);
-        *(fp++) = 1.0f;
-        fp2++;
-        for( i = 1; i < xsize-1; i++ ) {
-            if( *fp2 <= *(fp2-1) || *fp2 <= *(fp2+1) || *fp2 <= *(fp2-xsize) || *fp2 <= *(fp2+xsize) ) {
-                *(fp++) = 1.0f;
-                fp2++;
-                continue;
-            }
-            if( (int)(*fp2 * 1000) < k ) {
-                *(fp++) = 1.0f;
-                fp2++;
-                continue;
-            }
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-            if( make_template(image->imgBWBlur[1], xsize, ysize, i, j, ts1, ts2, sd_thresh, template, &vlen) < 0 ) {
-#else
-            if( make_template(image->imgBW, xsize, ysize, i, j, ts1, ts2, sd_thresh, template, &vlen) < 0 ) {
-#endif
-                *(fp++) = 1.0f;
-                fp2++;
-                continue;
-            }
-
-            max = -1.0f;
-            for( jj = -search_size1; jj <= search_size1; jj++ ) {
-                for( ii = -search_size1; ii <= search_size1; ii++ ) {
-
-                    if( ii*ii + jj*jj <= search_size2*search_size2 ) continue;
-                    //if( jj >= -search_size2 && jj <= search_size2 && ii >= -search_size2 && ii <= search_size2 ) continue;
-
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                    if( get_similarity(image->imgBWBlur[1], xsize, ysize, template, vlen, ts1, ts2, i+ii, j+jj, &sim) < 0 ) continue;
-#else
-                    if( get_similarity(image->imgBW, xsize, ysize, template, vlen, ts1, ts2, i+ii, j+jj, &sim) < 0 ) continue;
-#endif
-
-                    if( sim > max ) {
-                        max = sim;
-                        if( max > max_sim_thresh ) break;
-                    }
-                }
-                if( max > max_sim_thresh ) break;
-            }
-            *(fp++) = (float)max;
-            fp2++;
+    arMalloc(imageF, float, xsize*ysize);
+    for( i = 0; i < xsize*ysize; i++ ) imageF[i] = (float)imageBW[i];
+
+    // Rows are independent, so share them out across one worker per CPU (or as set by ar2SetFeatureMapThreadNum()).
+    // Interleaving the rows balances the load, since feature candidates cluster in textured parts of the image.
+    threadNum = (ar2FeatureMapThreadNum > 0 ? ar2FeatureMapThreadNum : threadGetCPU());
+    if( threadNum > ysize - 2 ) threadNum = ysize - 2;
+    if( threadNum < 1 ) threadNum = 1;
+    arMalloc(arg, AR2GenFeatureMapArgT, threadNum);
+    for( i = 0; i < threadNum; i++ ) {
+        arg[i].imageBW        = imageBW;
+        arg[i].imageF         = imageF;
+        arg[i].fimage         = fimage;
+        arg[i].fimage2        = fimage2;
+        arg[i].xsize          = xsize;
+        arg[i].ysize          = ysize;
+        arg[i].ts1            = ts1;
+        arg[i].ts2            = ts2;
+        arg[i].search_size1   = search_size1;
+        arg[i].search_size2   = search_size2;
+        arg[i].max_sim_thresh = max_sim_thresh;
+        arg[i].sd_thresh      = sd_thresh;
+        arg[i].gradThresh     = k;
+        arg[i].row0           = i;
+        arg[i].rowStep        = threadNum;
+    }
+    if( threadNum == 1 ) {
+        gen_feature_map_rows( &arg[0] );
+    } else {
+        arMalloc(threadHandle, THREAD_HANDLE_T *, threadNum);
+        for( i = 0; i < threadNum; i++ ) {
+            threadHandle[i] = threadInit(i, &arg[i], gen_feature_map_worker);
+            threadStartSignal( threadHandle[i] );
         }
-        *(fp++) = 1.0f;
-        fp2++;
+        for( i = 0; i < threadNum; i++ ) {
+            threadEndWait( threadHandle[i] );
+            threadWaitQuit( threadHandle[i] );
+            threadFree( &threadHandle[i] );
+        }
+        free( threadHandle );
     }
-  	for (i = 0; i < xsize; i++) {
-  		*(fp++) = 1.0f;
-  		fp2++;
-  	}
+    free( arg );
+    free( imageF );
     ARLOGi("\n");
     free(fimage2);
-    free(template);
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    free( imageBW );
+#endif
 
     arMalloc( featureMap, AR2FeatureMapT, 1 );
     featureMap->map = fimage;
@@ -272,9 +302,12 @@ AR2FeatureCoordT *ar2SelectFeature( AR2ImageT *image, AR2FeatureMapT *featureMap
                                     float  max_sim_thresh, float  min_sim_thresh, float  sd_thresh, int *num )
 {
     AR2FeatureCoordT   *coord;
+    ARUint8            *imageBW;
     float              *template, vlen;
     float              *fimage2, *fp1, *fp2;
     float              min_sim;
+    float             *rowMin;
+    int               *rowMinX;
     float              sim, min, max;
     float              dpi;
     int                xsize, ysize;
@@ -289,6 +322,11 @@ AR2FeatureCoordT *ar2SelectFeature( AR2ImageT *image, AR2FeatureMapT *featureMap
     dpi = image->dpi;
     arMalloc(template, float , (ts1+ts2+1)*(ts1+ts2+1));
     arMalloc(fimage2, float, xsize*ysize);
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    imageBW = ar2GenImageBlur( image, 1 );
+#else
+    imageBW = image->imgBW;
+#endif
     fp1 = featureMap->map;
     fp2 = fimage2;
     for( i = 0; i < xsize*ysize; i++ ) {
@@ -301,33 +339,23 @@ AR2FeatureCoordT *ar2SelectFeature( AR2ImageT *image, AR2FeatureMapT *featureMap
     arMalloc( coord, AR2FeatureCoordT, max_feature_num );
     *num = 0;
 
+    // Keep the minimum of each row, so each search for the next best candidate only rescans the rows changed.
+    arMalloc( rowMin, float, ysize );
+    arMalloc( rowMinX, int, ysize );
+    for( j = 0; j < ysize; j++ ) row_min_update( fimage2, xsize, j, rowMin, rowMinX );
+
     while( *num < max_feature_num ) {
 
-        min_sim = max_sim_thresh;
-        fp2 = fimage2;
-        cx = cy = -1;
-        for( j = 0; j < ysize; j++ ) {
-            for( i = 0; i < xsize; i++ ) {
-                if( *fp2 < min_sim ) {
-                    min_sim = *fp2;
-                    cx = i;
-                    cy = j;
-                }
-                fp2++;
-            }
-        }
-        if( cx == -1 ) break;
+        if( row_min_find( rowMin, rowMinX, ysize, max_sim_thresh, &cx, &cy, &min_sim ) < 0 ) break;
 
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-        if( make_template( image->imgBWBlur[1], xsize, ysize, cx, cy, ts1, ts2, 0.0, template, &vlen ) < 0 ) {
-#else
-        if( make_template( image->imgBW, xsize, ysize, cx, cy, ts1, ts2, 0.0, template, &vlen ) < 0 ) {
-#endif
+        if( make_template( imageBW, xsize, ysize, cx, cy, ts1, ts2, 0.0, template, &vlen ) < 0 ) {
             fimage2[cy*xsize+cx] = 1.0f;
+            row_min_update( fimage2, xsize, cy, rowMin, rowMinX );
             continue;
         }
         if( vlen/(ts1+ts2+1) < sd_thresh ) {
             fimage2[cy*xsize+cx] = 1.0f;
+            row_min_update( fimage2, xsize, cy, rowMin, rowMinX );
             continue;
         }
 
@@ -338,11 +366,7 @@ AR2FeatureCoordT *ar2SelectFeature( AR2ImageT *image, AR2FeatureMapT *featureMap
                 if( i*i + j*j > search_size2*search_size2 ) continue;
                 if( i == 0 && j == 0 ) continue;
 
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                if( get_similarity(image->imgBWBlur[1], xsize, ysize, template, vlen, ts1, ts2, cx+i, cy+j, &sim) < 0 ) continue;
-#else
-                if( get_similarity(image->imgBW, xsize, ysize, template, vlen, ts1, ts2, cx+i, cy+j, &sim) < 0 ) continue;
-#endif
+                if( get_similarity(imageBW, xsize, ysize, template, vlen, ts1, ts2, cx+i, cy+j, &sim) < 0 ) continue;
 
                 if( sim < min ) {
                     min = sim;
@@ -358,6 +382,7 @@ AR2FeatureCoordT *ar2SelectFeature( AR2ImageT *image, AR2FeatureMapT *featureMap
 
         if( (min < min_sim_thresh && min < min_sim) || max > 0.99f ) {
             fimage2[cy*xsize+cx] = 1.0f;
+            row_min_update( fimage2, xsize, cy, rowMin, rowMinX );
             continue;
         }
 
@@ -375,11 +400,17 @@ AR2FeatureCoordT *ar2SelectFeature( AR2ImageT *image, AR2FeatureMapT *featureMap
 
                 fimage2[(cy+j)*xsize+(cx+i)] = 1.0f;
             }
+            if( cy+j >= 0 && cy+j < ysize ) row_min_update( fimage2, xsize, cy+j, rowMin, rowMinX );
         }
     }
 
     free( template );
     free( fimage2 );
+    free( rowMin );
+    free( rowMinX );
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    free( imageBW );
+#endif
 
     return coord;
 }
@@ -390,8 +421,11 @@ AR2FeatureCoordT *ar2SelectFeature2( AR2ImageT *image, AR2FeatureMapT *featureMa
                                      float  max_sim_thresh, float  min_sim_thresh, float  sd_thresh, int *num )
 {
     AR2FeatureCoordT   *coord;
+    ARUint8            *imageBW;
     float              *template, vlen;
     float              min_sim;
+    float             *rowMin;
+    int               *rowMinX;
     float              sim, min, max;
     float              *fimage2, *fp1, *fp2;
     float              dpi;
@@ -411,6 +445,11 @@ AR2FeatureCoordT *ar2SelectFeature2( AR2ImageT *image, AR2FeatureMapT *featureMa
     dpi = image->dpi;
     arMalloc(template, float , (ts1+ts2+1)*(ts1+ts2+1));
     arMalloc(fimage2, float, xsize*ysize);
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    imageBW = ar2GenImageBlur( image, 1 );
+#else
+    imageBW = image->imgBW;
+#endif
     fp1 = featureMap->map;
     fp2 = fimage2;
     for( i = 0; i < xsize*ysize; i++ ) {
@@ -426,33 +465,23 @@ AR2FeatureCoordT *ar2SelectFeature2( AR2ImageT *image, AR2FeatureMapT *featureMa
     arMalloc( coord, AR2FeatureCoordT, max_feature_num );
     *num = 0;
 
+    // Keep the minimum of each row, so each search for the next best candidate only rescans the rows changed.
+    arMalloc( rowMin, float, ysize );
+    arMalloc( rowMinX, int, ysize );
+    for( j = 0; j < ysize; j++ ) row_min_update( fimage2, xsize, j, rowMin, rowMinX );
+
     while( *num < max_feature_num ) {
 
-        min_sim = max_sim_thresh;
-        fp2 = fimage2;
-        cx = cy = -1;
-        for( j = 0; j < ysize; j++ ) {
-            for( i = 0; i < xsize; i++ ) {
-                if( *fp2 < min_sim ) {
-                    min_sim = *fp2;
-                    cx = i;
-                    cy = j;
-                }
-                fp2++;
-            }
-        }
-        if( cx == -1 ) break;
+        if( row_min_find( rowMin, rowMinX, ysize, max_sim_thresh, &cx, &cy, &min_sim ) < 0 ) break;
 
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-        if( make_template( image->imgBWBlur[1], xsize, ysize, cx, cy, ts1, ts2, 0.0, template, &vlen ) < 0 ) {
-#else
-        if( make_template( image->imgBW, xsize, ysize, cx, cy, ts1, ts2, 0.0, template, &vlen ) < 0 ) {
-#endif
+        if( make_template( imageBW, xsize, ysize, cx, cy, ts1, ts2, 0.0, template, &vlen ) < 0 ) {
             fimage2[cy*xsize+cx] = 1.0f;
+            row_min_update( fimage2, xsize, cy, rowMin, rowMinX );
             continue;
         }
         if( vlen/(ts1+ts2+1) < sd_thresh ) {
             fimage2[cy*xsize+cx] = 1.0f;
+            row_min_update( fimage2, xsize, cy, rowMin, rowMinX );
             continue;
         }
 
@@ -463,11 +492,7 @@ AR2FeatureCoordT *ar2SelectFeature2( AR2ImageT *image, AR2FeatureMapT *featureMa
                 if( i*i + j*j > search_size2*search_size2 ) continue;
                 if( i == 0 && j == 0 ) continue;
 
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                if( get_similarity(image->imgBWBlur[1], xsize, ysize, template, vlen, ts1, ts2, cx+i, cy+j, &sim) < 0 ) continue;
-#else
-                if( get_similarity(image->imgBW, xsize, ysize, template, vlen, ts1, ts2, cx+i, cy+j, &sim) < 0 ) continue;
-#endif
+                if( get_similarity(imageBW, xsize, ysize, template, vlen, ts1, ts2, cx+i, cy+j, &sim) < 0 ) continue;
 
                 if( sim < min ) {
                     min = sim;
@@ -483,6 +508,7 @@ AR2FeatureCoordT *ar2SelectFeature2( AR2ImageT *image, AR2FeatureMapT *featureMa
 
         if( (min < min_sim_thresh && min < min_sim) || max > 0.99f ) {
             fimage2[cy*xsize+cx] = 1.0f;
+            row_min_update( fimage2, xsize, cy, rowMin, rowMinX );
             continue;
         }
 
@@ -500,6 +526,7 @@ AR2FeatureCoordT *ar2SelectFeature2( AR2ImageT *image, AR2FeatureMapT *featureMa
 
                 fimage2[(cy+j)*xsize+(cx+i)] = 1.0f;
             }
+            if( cy+j >= 0 && cy+j < ysize ) row_min_update( fimage2, xsize, cy+j, rowMin, rowMinX );
         }
     }
 
@@ -524,6 +551,11 @@ AR2FeatureCoordT *ar2SelectFeature2( AR2ImageT *image, AR2FeatureMapT *featureMa
 
     free( template );
     free( fimage2 );
+    free( rowMin );
+    free( rowMinX );
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    free( imageBW );
+#endif
 
     return coord;
 }
@@ -531,6 +563,7 @@ AR2FeatureCoordT *ar2SelectFeature2( AR2ImageT *image, AR2FeatureMapT *featureMa
 
 int ar2PrintFeatureInfo( AR2ImageT *image, AR2FeatureMapT *featureMap, int ts1, int ts2, int search_size2, int cx, int cy )
 {
+    ARUint8     *imageBW;
     float       *template, vlen;
     float       max, min, sim;
     int         xsize, ysize;
@@ -553,11 +586,15 @@ int ar2PrintFeatureInfo( AR2ImageT *image, AR2FeatureMapT *featureMap, int ts1,
     }
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    if( make_template( image->imgBWBlur[1], xsize, ysize, cx, cy, ts1, ts2, 0.0, template, &vlen ) < 0 ) {
+    imageBW = ar2GenImageBlur( image, 1 );
 #else
-    if( make_template( image->imgBW, xsize, ysize, cx, cy, ts1, ts2, 0.0, template, &vlen ) < 0 ) {
+    imageBW = image->imgBW;
 #endif
+    if( make_template( imageBW, xsize, ysize, cx, cy, ts1, ts2, 0.0, template, &vlen ) < 0 ) {
         free( template );
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+        free( imageBW );
+#endif
         return -1;
     }
 
@@ -566,11 +603,7 @@ int ar2PrintFeatureInfo( AR2ImageT *image, AR2FeatureMapT *featureMap, int ts1,
 ARLOG("\n");
     for( j = -search_size2; j <= search_size2; j++ ) {
         for( i = -search_size2; i <= search_size2; i++ ) {
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-            if( get_similarity(image->imgBWBlur[1], xsize, ysize, template, vlen, ts1, ts2, cx+i, cy+j, &sim) < 0 ) continue;
-#else
-            if( get_similarity(image->imgBW, xsize, ysize, template, vlen, ts1, ts2, cx+i, cy+j, &sim) < 0 ) continue;
-#endif
+            if( get_similarity(imageBW, xsize, ysize, template, vlen, ts1, ts2, cx+i, cy+j, &sim) < 0 ) continue;
 
             if( (i*i + j*j <= search_size2*search_size2) 
              && (i != 0 || j != 0) ) {
@@ -585,10 +618,118 @@ ARLOG("\n");
 
     ARLOG("%3d, %3d: max_sim = %f, (max,min) = %f, %f, sd = %f\n", cx, cy, featureMap->map[cy*xsize+cx], max, min, vlen/(ts1+ts2+1));
     free( template );
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    free( imageBW );
+#endif
     return 0;
 }
 
 
+static void gen_feature_map_rows( AR2GenFeatureMapArgT *arg )
+{
+    ARUint8    *imageBW = arg->imageBW;
+    int         xsize = arg->xsize;
+    int         ysize = arg->ysize;
+    int         ts1 = arg->ts1;
+    int         ts2 = arg->ts2;
+    int         search_size1 = arg->search_size1;
+    int         search_size2 = arg->search_size2;
+    float       max_sim_thresh = arg->max_sim_thresh;
+    float      *fp, *fp2;
+    float      *template;
+    float       vlen;
+    float       max, sim[AR2_FMAP_SIM_LANES];
+    int         valid[AR2_FMAP_SIM_LANES];
+    int         i, j, ii, jj, l;
+
+    arMalloc(template, float, (ts1+ts2+1)*(ts1+ts2+1));
+
+    for( j = 1 + arg->row0; j < ysize-1; j += arg->rowStep ) {
+        if( arg->row0 == 0 ) {
+            ARLOGi("\r%4d/%4d.", j+1, ysize); fflush(stdout);
+        }
+        fp  = &(arg->fimage[j*xsize]);
+        fp2 = &(arg->fimage2[j*xsize]);
+        fp[0] = 1.0f;
+        fp[xsize-1] = 1.0f;
+        for( i = 1; i < xsize-1; i++ ) {
+            fp[i] = 1.0f;
+            if( fp2[i] <= fp2[i-1] || fp2[i] <= fp2[i+1] || fp2[i] <= fp2[i-xsize] || fp2[i] <= fp2[i+xsize] ) continue;
+            if( (int)(fp2[i] * 1000) < arg->gradThresh ) continue;
+            if( make_template(imageBW, xsize, ysize, i, j, ts1, ts2, arg->sd_thresh, template, &vlen) < 0 ) continue;
+
+            // Visit search positions in the same order as a one-at-a-time search, so the early
+            // exit (and therefore the result) is unchanged.
+            max = -1.0f;
+            for( jj = -search_size1; jj <= search_size1; jj++ ) {
+                for( ii = -search_size1; ii <= search_size1; ii += AR2_FMAP_SIM_LANES ) {
+                    get_similarity_lanes(imageBW, arg->imageF, xsize, ysize, template, vlen, ts1, ts2, i+ii, j+jj, sim, valid);
+                    for( l = 0; l < AR2_FMAP_SIM_LANES && ii+l <= search_size1; l++ ) {
+                        if( (ii+l)*(ii+l) + jj*jj <= search_size2*search_size2 ) continue;
+                        if( !valid[l] ) continue;
+                        if( sim[l] > max ) {
+                            max = sim[l];
+                            if( max > max_sim_thresh ) break;
+                        }
+                    }
+                    if( max > max_sim_thresh ) break;
+                }
+                if( max > max_sim_thresh ) break;
+            }
+            fp[i] = max;
+        }
+    }
+
+    free(template);
+}
+
+static void *gen_feature_map_worker( THREAD_HANDLE_T *threadHandle )
+{
+    AR2GenFeatureMapArgT *arg = (AR2GenFeatureMapArgT *)threadGetArg(threadHandle);
+
+    while( threadStartWait(threadHandle) == 0 ) {
+        gen_feature_map_rows( arg );
+        threadEndSignal(threadHandle);
+    }
+    return NULL;
+}
+
+// Minimum of row j of map (first occurrence), or FLT_MAX and -1 if no value is less than FLT_MAX.
+static void row_min_update( float *map, int xsize, int j, float *rowMin, int *rowMinX )
+{
+    float  *fp = &map[j*xsize];
+    float   min = FLT_MAX;
+    int     minX = -1;
+    int     i;
+
+    for( i = 0; i < xsize; i++ ) {
+        if( fp[i] < min ) {
+            min = fp[i];
+            minX = i;
+        }
+    }
+    rowMin[j] = min;
+    rowMinX[j] = minX;
+}
+
+// Equivalent to a raster scan of the whole map for the first value less than all before it and
+// less than thresh, but only visits the per-row minima.
+static int row_min_find( float *rowMin, int *rowMinX, int ysize, float thresh, int *cx, int *cy, float *min )
+{
+    int     j;
+
+    *min = thresh;
+    *cx = *cy = -1;
+    for( j = 0; j < ysize; j++ ) {
+        if( rowMin[j] < *min ) {
+            *min = rowMin[j];
+            *cx = rowMinX[j];
+            *cy = j;
+        }
+    }
+    return (*cx == -1 ? -1 : 0);
+}
+
 static int make_template( ARUint8 *imageBW, int xsize, int ysize,
                           int cx, int cy, int ts1, int ts2, float  sd_thresh,
                           float *template, float *vlen )
@@ -688,3 +829,74 @@ static int get_similarity( ARUint8 *imageBW, int xsize, int ysize,
 
     return 0;
 }
+
+// Similarity at (cx+l, cy) for each lane l, as computed by get_similarity(). Each lane accumulates
+// in the same order as get_similarity(), so the results are bit-identical to it.
+static void get_similarity_lanes( ARUint8 *imageBW, float *imageF, int xsize, int ysize,
+                                  float *template, float vlen, int ts1, int ts2,
+                                  int cx, int cy, float sim[AR2_FMAP_SIM_LANES], int valid[AR2_FMAP_SIM_LANES] )
+{
+    float     sx[AR2_FMAP_SIM_LANES], sxx[AR2_FMAP_SIM_LANES], sxy[AR2_FMAP_SIM_LANES];
+    float    *ip, *tp;
+    float     vlen2;
+    int       i, j, l;
+
+    if( cy - ts1 < 0 || cy + ts2 >= ysize || cx - ts1 < 0 || cx + AR2_FMAP_SIM_LANES - 1 + ts2 >= xsize ) {
+        for( l = 0; l < AR2_FMAP_SIM_LANES; l++ ) {
+            valid[l] = (get_similarity(imageBW, xsize, ysize, template, vlen, ts1, ts2, cx+l, cy, &sim[l]) == 0);
+        }
+        return;
+    }
+
+    tp = template;
+#if AR2_FMAP_SSE2
+    {
+        __m128    sx0 = _mm_setzero_ps(), sxx0 = _mm_setzero_ps(), sxy0 = _mm_setzero_ps();
+        __m128    sx1 = _mm_setzero_ps(), sxx1 = _mm_setzero_ps(), sxy1 = _mm_setzero_ps();
+        __m128    t, p0, p1;
+        for( j = -ts1; j <= ts2; j++ ) {
+            ip = &imageF[(cy+j)*xsize+(cx-ts1)];
+            for( i = -ts1; i <= ts2 ; i++ ) {
+                t  = _mm_load1_ps(tp++);
+                p0 = _mm_loadu_ps(ip);
+                p1 = _mm_loadu_ps(ip + 4);
+                sx0  = _mm_add_ps(sx0,  p0);
+                sx1  = _mm_add_ps(sx1,  p1);
+                sxx0 = _mm_add_ps(sxx0, _mm_mul_ps(p0, p0));
+                sxx1 = _mm_add_ps(sxx1, _mm_mul_ps(p1, p1));
+                sxy0 = _mm_add_ps(sxy0, _mm_mul_ps(p0, t));
+                sxy1 = _mm_add_ps(sxy1, _mm_mul_ps(p1, t));
+                ip++;
+            }
+        }
+        _mm_storeu_ps(&sx[0], sx0);   _mm_storeu_ps(&sx[4], sx1);
+        _mm_storeu_ps(&sxx[0], sxx0); _mm_storeu_ps(&sxx[4], sxx1);
+        _mm_storeu_ps(&sxy[0], sxy0); _mm_storeu_ps(&sxy[4], sxy1);
+    }
+#else
+    for( l = 0; l < AR2_FMAP_SIM_LANES; l++ ) sx[l] = sxx[l] = sxy[l] = 0.0f;
+    for( j = -ts1; j <= ts2; j++ ) {
+        ip = &imageF[(cy+j)*xsize+(cx-ts1)];
+        for( i = -ts1; i <= ts2 ; i++ ) {
+            for( l = 0; l < AR2_FMAP_SIM_LANES; l++ ) {
+                sx[l] += ip[l];
+                sxx[l] += ip[l] * ip[l];
+                sxy[l] += ip[l] * *tp;
+            }
+            ip++;
+            tp++;
+        }
+    }
+#endif
+
+    for( l = 0; l < AR2_FMAP_SIM_LANES; l++ ) {
+        vlen2 = sxx[l] - sx[l]*sx[l]/((ts1+ts2+1)*(ts1+ts2+1));
+        if( vlen2 == 0.0f ) {
+            valid[l] = 0;
+            continue;
+        }
+        vlen2 = sqrtf(vlen2);
+        sim[l] = sxy[l] / (vlen * vlen2);
+        valid[l] = 1;
+    }
+}
@@ -38,13 +38,41 @@
 #include <AR/ar.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
 #include <AR2/featureSet.h>
 
+// Packed (AR2_FEATURE_SET_VERSION_PACKED) .fset layout: header, scale table, then the coordinates of
+// every scale as AR2FeatureCoordT records, so a whole file can be read at once.
+// The legacy layout is num, then for each scale: scale, maxdpi, mindpi, num, and num records.
+// All values in host byte order.
+#define AR2_FEATURE_SET_MAGIC  "AR2F"
+
+typedef struct {
+    char        magic[4];
+    uint32_t    version;
+    int32_t     num;
+    uint32_t    reserved;
+} AR2FeatureSetHeaderT;
+
+typedef struct {
+    int32_t     scale;
+    float       maxdpi;
+    float       mindpi;
+    int32_t     num;
+    uint64_t    offset;     /* of the first coordinate record, from the start of the file */
+} AR2FeatureSetScaleT;
+
+static AR2FeatureSetT *ar2ParseFeatureSetPacked( const ARUint8 *data, size_t size );
+static AR2FeatureSetT *ar2ParseFeatureSetLegacy( const ARUint8 *data, size_t size );
+
 AR2FeatureSetT *ar2ReadFeatureSet( char *filename, char *ext )
 {
-    AR2FeatureSetT *featureSet = NULL;
-    FILE           *fp = NULL;
-    int            i, j, l3;
+    AR2FeatureSetT *featureSet;
+    FILE           *fp;
+    ARUint8        *data;
+    long            size;
 
     char buf[512];
     sprintf(buf, "%s.%s", filename, ext);
@@ -53,60 +81,103 @@ AR2FeatureSetT *ar2ReadFeatureSet( char *filename, char *ext )
         return NULL;
     }
 
-    arMalloc( featureSet, AR2FeatureSetT, 1 );
-
-    //COVHI10403
-    if( fread(&(featureSet->num), sizeof(featureSet->num), 1, fp) != 1 ) {
+    // Read the whole file at once, then parse it in memory.
+    if( fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < (long)sizeof(int) ) {
+        ARLOGe("Read error!!\n");
+        fclose(fp);
+        return NULL;
+    }
+    rewind(fp);
+    arMalloc( data, ARUint8, size );
+    if( fread(data, 1, size, fp) != (size_t)size ) {
         ARLOGe("Read error!!\n");
-        goto bail0;
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+
+    if( (size_t)size >= sizeof(AR2FeatureSetHeaderT) && memcmp(data, AR2_FEATURE_SET_MAGIC, 4) == 0 ) {
+        featureSet = ar2ParseFeatureSetPacked( data, (size_t)size );
+    } else {
+        featureSet = ar2ParseFeatureSetLegacy( data, (size_t)size );
     }
+    free(data);
+    if( featureSet == NULL ) ARLOGe("Read error!!\n");
+
+    return featureSet;
+}
 
-    arMalloc( featureSet->list, AR2FeaturePointsT, featureSet->num );
+static AR2FeatureSetT *ar2ParseFeatureSetPacked( const ARUint8 *data, size_t size )
+{
+    AR2FeatureSetT             *featureSet;
+    const AR2FeatureSetHeaderT *header;
+    const AR2FeatureSetScaleT  *table;
+    int                         i, l3;
+
+    header = (const AR2FeatureSetHeaderT *)data;
+    if( header->version != AR2_FEATURE_SET_VERSION_PACKED ) {
+        ARLOGe("Unsupported feature set version %u.\n", header->version);
+        return NULL;
+    }
+    if( header->num < 0 || sizeof(AR2FeatureSetHeaderT) + sizeof(AR2FeatureSetScaleT) * (uint64_t)header->num > size ) return NULL;
+    table = (const AR2FeatureSetScaleT *)(data + sizeof(AR2FeatureSetHeaderT));
+    for( i = 0; i < header->num; i++ ) {
+        if( table[i].num < 0 || table[i].offset + sizeof(AR2FeatureCoordT) * (uint64_t)table[i].num > size ) return NULL;
+    }
+
+    arMalloc( featureSet, AR2FeatureSetT, 1 );
+    featureSet->num = header->num;
+    arMalloc( featureSet->list, AR2FeaturePointsT, (featureSet->num > 0 ? featureSet->num : 1) );
     for( i = 0; i < featureSet->num; i++ ) {
-        if( fread(&(featureSet->list[i].scale), sizeof(featureSet->list[i].scale), 1, fp) != 1 ) {
-            ARLOGe("Read error!!\n");
-            goto bail1;
-        }
-        if( fread(&(featureSet->list[i].maxdpi), sizeof(featureSet->list[i].maxdpi), 1, fp) != 1 ) {
-            ARLOGe("Read error!!\n");
-            goto bail1;
-        }
-        if( fread(&(featureSet->list[i].mindpi), sizeof(featureSet->list[i].mindpi), 1, fp) != 1 ) {
-            ARLOGe("Read error!!\n");
-            goto bail1;
-        }
-        if( fread(&(featureSet->list[i].num), sizeof(featureSet->list[i].num), 1, fp) != 1 ) {
-            ARLOGe("Read error!!\n");
-            goto bail1;
+        featureSet->list[i].scale  = table[i].scale;
+        featureSet->list[i].maxdpi = table[i].maxdpi;
+        featureSet->list[i].mindpi = table[i].mindpi;
+        featureSet->list[i].num    = table[i].num;
+        featureSet->list[i].coord  = (AR2FeatureCoordT *)malloc( sizeof(AR2FeatureCoordT) * (table[i].num > 0 ? table[i].num : 1) );
+        if( featureSet->list[i].coord == NULL ) {
+            for( l3 = 0; l3 < i; l3++ ) free( featureSet->list[l3].coord );
+            free( featureSet->list );
+            free( featureSet );
+            return NULL;
         }
+        memcpy( featureSet->list[i].coord, data + table[i].offset, sizeof(AR2FeatureCoordT) * table[i].num );
+    }
 
-        arMalloc( featureSet->list[i].coord, AR2FeatureCoordT, featureSet->list[i].num );
-        for( j = 0; j < featureSet->list[i].num; j++ ) {
-            if( fread(&(featureSet->list[i].coord[j].x), sizeof(featureSet->list[i].coord[j].x), 1, fp) != 1 ) {
-                ARLOGe("Read error!!\n");
-                goto bail1;
-            }
-            if( fread(&(featureSet->list[i].coord[j].y), sizeof(featureSet->list[i].coord[j].y), 1, fp) != 1 ) {
-                ARLOGe("Read error!!\n");
-                goto bail1;
-            }
-            if( fread(&(featureSet->list[i].coord[j].mx), sizeof(featureSet->list[i].coord[j].mx), 1, fp) != 1 ) {
-                ARLOGe("Read error!!\n");
-                goto bail1;
-            }
-            if( fread(&(featureSet->list[i].coord[j].my), sizeof(featureSet->list[i].coord[j].my), 1, fp) != 1 ) {
-                ARLOGe("Read error!!\n");
-                goto bail1;
-            }
-            if( fread(&(featureSet->list[i].coord[j].maxSim), sizeof(featureSet->list[i].coord[j].maxSim), 1, fp) != 1 ) {
-                ARLOGe("Read error!!\n");
-                goto bail1;
-            }
-        }
+    return featureSet;
+}
+
+static AR2FeatureSetT *ar2ParseFeatureSetLegacy( const ARUint8 *data, size_t size )
+{
+    AR2FeatureSetT *featureSet;
+    const ARUint8  *p, *end;
+    int             i, l3;
+
+    p = data;
+    end = data + size;
+    arMalloc( featureSet, AR2FeatureSetT, 1 );
+
+    memcpy( &(featureSet->num), p, sizeof(featureSet->num) ); p += sizeof(featureSet->num);
+    if( featureSet->num < 0 ) goto bail0;
+
+    arMalloc( featureSet->list, AR2FeaturePointsT, (featureSet->num > 0 ? featureSet->num : 1) );
+    for( i = 0; i < featureSet->num; i++ ) {
+        if( end - p < (ptrdiff_t)(sizeof(int)*2 + sizeof(float)*2) ) goto bail1;
+        memcpy( &(featureSet->list[i].scale),  p, sizeof(featureSet->list[i].scale) );  p += sizeof(featureSet->list[i].scale);
+        memcpy( &(featureSet->list[i].maxdpi), p, sizeof(featureSet->list[i].maxdpi) ); p += sizeof(featureSet->list[i].maxdpi);
+        memcpy( &(featureSet->list[i].mindpi), p, sizeof(featureSet->list[i].mindpi) ); p += sizeof(featureSet->list[i].mindpi);
+        memcpy( &(featureSet->list[i].num),    p, sizeof(featureSet->list[i].num) );    p += sizeof(featureSet->list[i].num);
+        if( featureSet->list[i].num < 0
+         || (uint64_t)(end - p) < sizeof(AR2FeatureCoordT) * (uint64_t)featureSet->list[i].num ) goto bail1;
+
+        // Coordinates are stored as packed x, y, mx, my, maxSim records, i.e. exactly AR2FeatureCoordT.
+        arMalloc( featureSet->list[i].coord, AR2FeatureCoordT, (featureSet->list[i].num > 0 ? featureSet->list[i].num : 1) );
+        memcpy( featureSet->list[i].coord, p, sizeof(AR2FeatureCoordT) * featureSet->list[i].num );
+        p += sizeof(AR2FeatureCoordT) * featureSet->list[i].num;
     }
 
-    goto done;
-    
+    return featureSet;
+
 bail1:
     for(l3=0;l3<i;l3++) {
         free( featureSet->list[l3].coord );
@@ -114,17 +185,26 @@ bail1:
     free( featureSet->list );
 bail0:
     free( featureSet );
-    featureSet = NULL;
-
-done:
-    fclose(fp);
-    return featureSet;
+    return NULL;
 }
 
 int ar2SaveFeatureSet( char *filename, char *ext, AR2FeatureSetT *featureSet )
 {
-    FILE    *fp;
-    int     i, j;
+    return ar2SaveFeatureSet2( filename, ext, featureSet, AR2_FEATURE_SET_VERSION_DEFAULT );
+}
+
+int ar2SaveFeatureSet2( char *filename, char *ext, AR2FeatureSetT *featureSet, int version )
+{
+    FILE                 *fp;
+    AR2FeatureSetHeaderT  header;
+    AR2FeatureSetScaleT  *table;
+    uint64_t              offset;
+    int                   i;
+
+    if( version != AR2_FEATURE_SET_VERSION_LEGACY && version != AR2_FEATURE_SET_VERSION_PACKED ) {
+        ARLOGe("Unsupported feature set version %d.\n", version);
+        return -1;
+    }
 
     char buf[512];
     sprintf(buf, "%s.%s", filename, ext);
@@ -133,21 +213,41 @@ int ar2SaveFeatureSet( char *filename, char *ext, AR2FeatureSetT *featureSet )
         return -1;
     }
 
-    if( fwrite(&(featureSet->num), sizeof(featureSet->num), 1, fp) != 1 ) goto bailBadWrite;
+    if( version == AR2_FEATURE_SET_VERSION_LEGACY ) {
+        if( fwrite(&(featureSet->num), sizeof(featureSet->num), 1, fp) != 1 ) goto bailBadWrite;
+        for( i = 0; i < featureSet->num; i++ ) {
+            if( fwrite(&(featureSet->list[i].scale), sizeof(featureSet->list[i].scale), 1, fp) != 1 ) goto bailBadWrite;
+            if( fwrite(&(featureSet->list[i].maxdpi), sizeof(featureSet->list[i].maxdpi), 1, fp) != 1 ) goto bailBadWrite;
+            if( fwrite(&(featureSet->list[i].mindpi), sizeof(featureSet->list[i].mindpi), 1, fp) != 1 ) goto bailBadWrite;
+            if( fwrite(&(featureSet->list[i].num), sizeof(featureSet->list[i].num), 1, fp) != 1 ) goto bailBadWrite;
+            if( fwrite(featureSet->list[i].coord, sizeof(AR2FeatureCoordT), featureSet->list[i].num, fp) != (size_t)featureSet->list[i].num ) goto bailBadWrite;
+        }
+        fclose(fp);
+        return 0;
+    }
 
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, AR2_FEATURE_SET_MAGIC, 4 );
+    header.version = AR2_FEATURE_SET_VERSION_PACKED;
+    header.num     = featureSet->num;
+    arMallocClear( table, AR2FeatureSetScaleT, (featureSet->num > 0 ? featureSet->num : 1) );
+    offset = sizeof(header) + sizeof(AR2FeatureSetScaleT) * featureSet->num;
     for( i = 0; i < featureSet->num; i++ ) {
-        if( fwrite(&(featureSet->list[i].scale), sizeof(featureSet->list[i].scale), 1, fp) != 1 ) goto bailBadWrite;
-        if( fwrite(&(featureSet->list[i].maxdpi), sizeof(featureSet->list[i].maxdpi), 1, fp) != 1 ) goto bailBadWrite;
-        if( fwrite(&(featureSet->list[i].mindpi), sizeof(featureSet->list[i].mindpi), 1, fp) != 1 ) goto bailBadWrite;
-        if( fwrite(&(featureSet->list[i].num), sizeof(featureSet->list[i].num), 1, fp) != 1 ) goto bailBadWrite;
-
-        for( j = 0; j < featureSet->list[i].num; j++ ) {
-            if( fwrite(&(featureSet->list[i].coord[j].x), sizeof(featureSet->list[i].coord[j].x), 1, fp) != 1 ) goto bailBadWrite;
-            if( fwrite(&(featureSet->list[i].coord[j].y), sizeof(featureSet->list[i].coord[j].y), 1, fp) != 1 ) goto bailBadWrite;
-            if( fwrite(&(featureSet->list[i].coord[j].mx), sizeof(featureSet->list[i].coord[j].mx), 1, fp) != 1 ) goto bailBadWrite;
-            if( fwrite(&(featureSet->list[i].coord[j].my), sizeof(featureSet->list[i].coord[j].my), 1, fp) != 1 ) goto bailBadWrite;
-            if( fwrite(&(featureSet->list[i].coord[j].maxSim), sizeof(featureSet->list[i].coord[j].maxSim), 1, fp) != 1 ) goto bailBadWrite;
-        }
+        table[i].scale  = featureSet->list[i].scale;
+        table[i].maxdpi = featureSet->list[i].maxdpi;
+        table[i].mindpi = featureSet->list[i].mindpi;
+        table[i].num    = featureSet->list[i].num;
+        table[i].offset = offset;
+        offset += sizeof(AR2FeatureCoordT) * (uint64_t)featureSet->list[i].num;
+    }
+    if( fwrite(&header, sizeof(header), 1, fp) != 1
+     || fwrite(table, sizeof(AR2FeatureSetScaleT), featureSet->num, fp) != (size_t)featureSet->num ) {
+        free(table);
+        goto bailBadWrite;
+    }
+    free(table);
+    for( i = 0; i < featureSet->num; i++ ) {
+        if( fwrite(featureSet->list[i].coord, sizeof(AR2FeatureCoordT), featureSet->list[i].num, fp) != (size_t)featureSet->list[i].num ) goto bailBadWrite;
     }
 
     fclose(fp);
@@ -174,3 +274,201 @@ int ar2FreeFeatureSet( AR2FeatureSetT **featureSet )
 
     return 0;
 }
+
+AR2FeatureIndexT *ar2GenFeatureIndex( AR2FeatureSetT *featureSet )
+{
+    AR2FeatureIndexT *featureIndex;
+    float             maxx, maxy;
+    int               cellNum, featureMax;
+    int               cx, cy;
+    int               i, j, k;
+
+    if( featureSet == NULL ) return NULL;
+
+    // Page extent, taken from the features themselves.
+    featureIndex = NULL;
+    maxx = maxy = 0.0f;
+    featureMax = 0;
+    for( i = 0; i < featureSet->num; i++ ) {
+        if( featureSet->list[i].num > featureMax ) featureMax = featureSet->list[i].num;
+        for( j = 0; j < featureSet->list[i].num; j++ ) {
+            if( featureIndex == NULL ) {
+                arMallocClear( featureIndex, AR2FeatureIndexT, 1 );
+                featureIndex->minx = maxx = featureSet->list[i].coord[j].mx;
+                featureIndex->miny = maxy = featureSet->list[i].coord[j].my;
+                continue;
+            }
+            if( featureSet->list[i].coord[j].mx < featureIndex->minx ) featureIndex->minx = featureSet->list[i].coord[j].mx;
+            if( featureSet->list[i].coord[j].mx > maxx )               maxx               = featureSet->list[i].coord[j].mx;
+            if( featureSet->list[i].coord[j].my < featureIndex->miny ) featureIndex->miny = featureSet->list[i].coord[j].my;
+            if( featureSet->list[i].coord[j].my > maxy )               maxy               = featureSet->list[i].coord[j].my;
+        }
+    }
+    if( featureIndex == NULL ) return NULL;
+
+    // Square-ish cells, AR2_FEATURE_INDEX_GRID_SIZE along the longer side.
+    if( maxx - featureIndex->minx >= maxy - featureIndex->miny ) {
+        featureIndex->xnum = AR2_FEATURE_INDEX_GRID_SIZE;
+        featureIndex->ynum = (int)ceilf( AR2_FEATURE_INDEX_GRID_SIZE * (maxy - featureIndex->miny) / (maxx - featureIndex->minx + 1e-6f) );
+    }
+    else {
+        featureIndex->ynum = AR2_FEATURE_INDEX_GRID_SIZE;
+        featureIndex->xnum = (int)ceilf( AR2_FEATURE_INDEX_GRID_SIZE * (maxx - featureIndex->minx) / (maxy - featureIndex->miny + 1e-6f) );
+    }
+    if( featureIndex->xnum < 1 ) featureIndex->xnum = 1;
+    if( featureIndex->ynum < 1 ) featureIndex->ynum = 1;
+    // Cells are slightly oversized so that the features on the far edges fall inside the grid.
+    featureIndex->cellw = (maxx - featureIndex->minx) / featureIndex->xnum + 1e-3f;
+    featureIndex->cellh = (maxy - featureIndex->miny) / featureIndex->ynum + 1e-3f;
+    cellNum = featureIndex->xnum * featureIndex->ynum;
+
+    featureIndex->num = featureSet->num;
+    arMalloc( featureIndex->cellStart,  int *, featureSet->num );
+    arMalloc( featureIndex->featureIdx, int *, featureSet->num );
+    for( i = 0; i < featureSet->num; i++ ) {
+        // Counting sort of the features of this scale by cell. Scanning features in order keeps each cell's list ascending.
+        arMallocClear( featureIndex->cellStart[i], int, cellNum + 1 );
+        arMalloc( featureIndex->featureIdx[i], int, (featureSet->list[i].num > 0 ? featureSet->list[i].num : 1) );
+        for( j = 0; j < featureSet->list[i].num; j++ ) {
+            cx = (int)((featureSet->list[i].coord[j].mx - featureIndex->minx) / featureIndex->cellw);
+            cy = (int)((featureSet->list[i].coord[j].my - featureIndex->miny) / featureIndex->cellh);
+            if( cx >= featureIndex->xnum ) cx = featureIndex->xnum - 1;
+            if( cy >= featureIndex->ynum ) cy = featureIndex->ynum - 1;
+            featureIndex->cellStart[i][cy*featureIndex->xnum + cx + 1]++;
+        }
+        for( k = 0; k < cellNum; k++ ) featureIndex->cellStart[i][k+1] += featureIndex->cellStart[i][k];
+        for( j = 0; j < featureSet->list[i].num; j++ ) {
+            cx = (int)((featureSet->list[i].coord[j].mx - featureIndex->minx) / featureIndex->cellw);
+            cy = (int)((featureSet->list[i].coord[j].my - featureIndex->miny) / featureIndex->cellh);
+            if( cx >= featureIndex->xnum ) cx = featureIndex->xnum - 1;
+            if( cy >= featureIndex->ynum ) cy = featureIndex->ynum - 1;
+            featureIndex->featureIdx[i][ featureIndex->cellStart[i][cy*featureIndex->xnum + cx]++ ] = j;
+        }
+        // Placement advanced each start to the next cell's; shift back.
+        for( k = cellNum; k > 0; k-- ) featureIndex->cellStart[i][k] = featureIndex->cellStart[i][k-1];
+        featureIndex->cellStart[i][0] = 0;
+    }
+
+    arMalloc( featureIndex->cellVisible, ARUint8, cellNum );
+    memset( featureIndex->cellVisible, 1, cellNum );
+    arMalloc( featureIndex->cornerPos,   float,   (featureIndex->xnum + 1)*(featureIndex->ynum + 1)*2 );
+    arMalloc( featureIndex->cornerFront, ARUint8, (featureIndex->xnum + 1)*(featureIndex->ynum + 1) );
+    arMalloc( featureIndex->visible,     int,     (featureMax > 0 ? featureMax : 1) );
+
+    return featureIndex;
+}
+
+int ar2FreeFeatureIndex( AR2FeatureIndexT **featureIndex )
+{
+    int     i;
+
+    if( featureIndex == NULL || *featureIndex == NULL ) return -1;
+
+    for( i = 0; i < (*featureIndex)->num; i++ ) {
+        free( (*featureIndex)->cellStart[i] );
+        free( (*featureIndex)->featureIdx[i] );
+    }
+    free( (*featureIndex)->cellStart );
+    free( (*featureIndex)->featureIdx );
+    free( (*featureIndex)->cellVisible );
+    free( (*featureIndex)->cornerPos );
+    free( (*featureIndex)->cornerFront );
+    free( (*featureIndex)->visible );
+    free( *featureIndex );
+    *featureIndex = NULL;
+
+    return 0;
+}
+
+// Mark the grid cells which may project into the screen rectangle [xmin, xmax] x [ymin, ymax] under trans,
+// which maps marker coordinates (mx, my, 0, 1) to homogeneous screen coordinates.
+// Cells wholly in front of the camera are culled by the bounding box of their projected corners.
+// Cells crossing the camera plane are kept, and left to the per-feature tests.
+int ar2SetFeatureIndexVisibility( AR2FeatureIndexT *featureIndex, const float trans[3][4],
+                                  float xmin, float ymin, float xmax, float ymax )
+{
+    float    mx, my, hx, hy, h;
+    float    bx0, by0, bx1, by1;
+    float   *p;
+    int      c[4];
+    int      xnum1;
+    int      i, j, k;
+
+    if( featureIndex == NULL ) return -1;
+
+    xnum1 = featureIndex->xnum + 1;
+    for( j = 0; j <= featureIndex->ynum; j++ ) {
+        my = featureIndex->miny + j*featureIndex->cellh;
+        for( i = 0; i <= featureIndex->xnum; i++ ) {
+            mx = featureIndex->minx + i*featureIndex->cellw;
+            hx = trans[0][0]*mx + trans[0][1]*my + trans[0][3];
+            hy = trans[1][0]*mx + trans[1][1]*my + trans[1][3];
+            h  = trans[2][0]*mx + trans[2][1]*my + trans[2][3];
+            p = &featureIndex->cornerPos[(j*xnum1 + i)*2];
+            if( h > 0.0f ) {
+                featureIndex->cornerFront[j*xnum1 + i] = 1;
+                p[0] = hx / h;
+                p[1] = hy / h;
+            }
+            else {
+                featureIndex->cornerFront[j*xnum1 + i] = 0;
+            }
+        }
+    }
+
+    for( j = 0; j < featureIndex->ynum; j++ ) {
+        for( i = 0; i < featureIndex->xnum; i++ ) {
+            c[0] = j*xnum1 + i;
+            c[1] = c[0] + 1;
+            c[2] = c[0] + xnum1;
+            c[3] = c[2] + 1;
+            if( !featureIndex->cornerFront[c[0]] || !featureIndex->cornerFront[c[1]]
+             || !featureIndex->cornerFront[c[2]] || !featureIndex->cornerFront[c[3]] ) {
+                featureIndex->cellVisible[j*featureIndex->xnum + i] = 1;
+                continue;
+            }
+            bx0 = bx1 = featureIndex->cornerPos[c[0]*2];
+            by0 = by1 = featureIndex->cornerPos[c[0]*2 + 1];
+            for( k = 1; k < 4; k++ ) {
+                p = &featureIndex->cornerPos[c[k]*2];
+                if( p[0] < bx0 ) bx0 = p[0];
+                if( p[0] > bx1 ) bx1 = p[0];
+                if( p[1] < by0 ) by0 = p[1];
+                if( p[1] > by1 ) by1 = p[1];
+            }
+            featureIndex->cellVisible[j*featureIndex->xnum + i] = (bx1 >= xmin && bx0 <= xmax && by1 >= ymin && by0 <= ymax);
+        }
+    }
+
+    return 0;
+}
+
+static int compareInt( const void *a, const void *b )
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+// Get the numbers of the features at one scale lying in cells marked by ar2SetFeatureIndexVisibility(),
+// in ascending order, i.e. the order in which they appear in featureSet->list[scale].coord[].
+int ar2GetFeatureIndexVisible( AR2FeatureIndexT *featureIndex, int scale, int **visible )
+{
+    int     *start, *idx;
+    int      cellNum, cellsVisible;
+    int      n, i, k;
+
+    if( featureIndex == NULL || scale < 0 || scale >= featureIndex->num ) return -1;
+
+    start = featureIndex->cellStart[scale];
+    idx = featureIndex->featureIdx[scale];
+    cellNum = featureIndex->xnum * featureIndex->ynum;
+    n = cellsVisible = 0;
+    for( i = 0; i < cellNum; i++ ) {
+        if( !featureIndex->cellVisible[i] ) continue;
+        if( start[i+1] > start[i] ) cellsVisible++;
+        for( k = start[i]; k < start[i+1]; k++ ) featureIndex->visible[n++] = idx[k];
+    }
+    if( cellsVisible > 1 ) qsort( featureIndex->visible, n, sizeof(int), compareInt );
+
+    *visible = featureIndex->visible;
+    return n;
+}
@@ -51,6 +51,7 @@ AR2HandleT *ar2CreateHandle( ARParamLT *cparamLT, AR_PIXEL_FORMAT pixFormat, int
     AR2HandleT   *ar2Handle;
 
     ar2Handle = ar2CreateHandleSub( pixFormat, cparamLT->param.xsize, cparamLT->param.ysize, threadNum );
+    if( ar2Handle == NULL ) return NULL;
 
     ar2Handle->trackingMode      = AR2_TRACKING_6DOF;
     ar2Handle->cparamLT          = cparamLT;
@@ -65,6 +66,7 @@ AR2HandleT *ar2CreateHandleHomography( int xsize, int ysize, AR_PIXEL_FORMAT pix
     AR2HandleT   *ar2Handle;
 
     ar2Handle = ar2CreateHandleSub( pixFormat, xsize, ysize, threadNum );
+    if( ar2Handle == NULL ) return NULL;
 
     ar2Handle->trackingMode      = AR2_TRACKING_HOMOGRAPHY;
     ar2Handle->cparamLT          = NULL;
@@ -73,6 +75,9 @@ AR2HandleT *ar2CreateHandleHomography( int xsize, int ysize, AR_PIXEL_FORMAT pix
     return ar2Handle;
 }
 
+// Inlier probabilities for the robust pose fits. This is the retry sequence ar2Tracking() has always used.
+static const float ar2DefaultRobustSchedule[] = {0.8F, 0.6F, 0.4F, 0.0F};
+
 static AR2HandleT *ar2CreateHandleSub( int pixFormat, int xsize, int ysize, int threadNum )
 {
     AR2HandleT   *ar2Handle;
@@ -87,6 +92,10 @@ static AR2HandleT *ar2CreateHandleSub( int pixFormat, int xsize, int ysize, int
     ar2Handle->blurLevel         = AR2_DEFAULT_BLUR_LEVEL;
 #endif
     ar2Handle->searchSize        = AR2_DEFAULT_SEARCH_SIZE;
+    ar2Handle->searchSizeMode    = AR2_DEFAULT_SEARCH_SIZE_MODE;
+    ar2Handle->searchSizeMin     = AR2_DEFAULT_SEARCH_SIZE_MIN;
+    ar2Handle->coarseSearch      = AR2_DEFAULT_COARSE_SEARCH;
+    ar2Handle->coarseImage       = NULL;
     ar2Handle->templateSize1     = AR2_DEFAULT_TS1;
     ar2Handle->templateSize2     = AR2_DEFAULT_TS2;
     ar2Handle->searchFeatureNum  = AR2_DEFAULT_SEARCH_FEATURE_NUM;
@@ -95,6 +104,9 @@ static AR2HandleT *ar2CreateHandleSub( int pixFormat, int xsize, int ysize, int
     }
     ar2Handle->simThresh         = AR2_DEFAULT_SIM_THRESH;
     ar2Handle->trackingThresh    = AR2_DEFAULT_TRACKING_THRESH;
+    ar2Handle->templateCachePosTol   = AR2_DEFAULT_TEMPLATE_CACHE_POS_TOL;
+    ar2Handle->templateCacheShapeTol = AR2_DEFAULT_TEMPLATE_CACHE_SHAPE_TOL;
+    ar2SetRobustSchedule( ar2Handle, ar2DefaultRobustSchedule, sizeof(ar2DefaultRobustSchedule)/sizeof(ar2DefaultRobustSchedule[0]) );
 
 
 
@@ -110,11 +122,19 @@ static AR2HandleT *ar2CreateHandleSub( int pixFormat, int xsize, int ysize, int
     ar2Handle->threadNum = threadNum;
     ARLOGi("Tracking thread = %d\n", threadNum);
     for( i = 0; i < ar2Handle->threadNum; i++ ) {
-        arMalloc( ar2Handle->arg[i].mfImage, ARUint8, xsize*ysize );
+        ar2Handle->arg[i].work = ar2GenMatchingWork( xsize, ysize );
+        if( ar2Handle->arg[i].work == NULL ) {
+            ARLOGe("Error: unable to allocate matching workspace.\n");
+            while( --i >= 0 ) ar2FreeMatchingWork( ar2Handle->arg[i].work );
+            free( ar2Handle );
+            return NULL;
+        }
         ar2Handle->arg[i].templ = NULL;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
         ar2Handle->arg[i].templ2 = NULL;
 #endif
+    }
+    for( i = 0; i < ar2Handle->threadNum; i++ ) {
         ar2Handle->threadHandle[i] = threadInit(i, &(ar2Handle->arg[i]), ar2Tracking2d);
     }
 
@@ -130,14 +150,15 @@ int ar2DeleteHandle( AR2HandleT **ar2Handle )
     for( i = 0; i < (*ar2Handle)->threadNum; i++ ) {
         threadWaitQuit( (*ar2Handle)->threadHandle[i] );
         threadFree( &((*ar2Handle)->threadHandle[i]) );
-        if( (*ar2Handle)->arg[i].mfImage   != NULL )  free( (*ar2Handle)->arg[i].mfImage );
+        if( (*ar2Handle)->arg[i].work   != NULL ) ar2FreeMatchingWork( (*ar2Handle)->arg[i].work );
         if( (*ar2Handle)->arg[i].templ  != NULL ) ar2FreeTemplate( (*ar2Handle)->arg[i].templ );
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-        if( (*ar2Handle)->arg[i].templ2 != NULL ) ar2FreeTemplate ( (*ar2Handle)->arg[i].templ2 );
+        if( (*ar2Handle)->arg[i].templ2 != NULL ) ar2FreeTemplate2( (*ar2Handle)->arg[i].templ2 );
 #endif
     }
 
     if( (*ar2Handle)->icpHandle != NULL ) icpDeleteHandle( &((*ar2Handle)->icpHandle) );
+    free( (*ar2Handle)->coarseImage );
     //if( (*ar2Handle)->cparamLT  != NULL ) arParamLTFree( (*ar2Handle)->cparamLT );
     free( *ar2Handle );
     *ar2Handle = NULL;
@@ -218,6 +239,47 @@ int ar2GetTrackingThresh( AR2HandleT *ar2Handle, float  *trackingThresh )
     return 0;
 }
 
+int ar2SetRobustSchedule( AR2HandleT *ar2Handle, const float *inlierProb, int num )
+{
+    int     i;
+
+    if( ar2Handle == NULL ) return -1;
+    if( num < 0 || num > AR2_ROBUST_SCHEDULE_MAX || (num > 0 && inlierProb == NULL) ) return -1;
+    for( i = 0; i < num; i++ ) {
+        if( inlierProb[i] < 0.0F || inlierProb[i] > 1.0F ) return -1;
+        if( i > 0 && inlierProb[i] > inlierProb[i-1] ) return -1;
+    }
+    for( i = 0; i < num; i++ ) ar2Handle->robustSchedule[i] = inlierProb[i];
+    ar2Handle->robustScheduleNum = num;
+    return 0;
+}
+
+int ar2GetRobustSchedule( AR2HandleT *ar2Handle, float inlierProb[AR2_ROBUST_SCHEDULE_MAX], int *num )
+{
+    int     i;
+
+    if( ar2Handle == NULL || inlierProb == NULL || num == NULL ) return -1;
+    for( i = 0; i < ar2Handle->robustScheduleNum; i++ ) inlierProb[i] = ar2Handle->robustSchedule[i];
+    *num = ar2Handle->robustScheduleNum;
+    return 0;
+}
+
+int ar2SetTemplateCacheTolerance( AR2HandleT *ar2Handle, float  posTol, float  shapeTol )
+{
+    if( ar2Handle == NULL ) return -1;
+    ar2Handle->templateCachePosTol   = posTol;
+    ar2Handle->templateCacheShapeTol = shapeTol;
+    return 0;
+}
+
+int ar2GetTemplateCacheTolerance( AR2HandleT *ar2Handle, float *posTol, float *shapeTol )
+{
+    if( ar2Handle == NULL ) return -1;
+    *posTol   = ar2Handle->templateCachePosTol;
+    *shapeTol = ar2Handle->templateCacheShapeTol;
+    return 0;
+}
+
 int ar2SetSearchSize( AR2HandleT *ar2Handle, int searchSize )
 {
     if( ar2Handle == NULL ) return -1;
@@ -232,6 +294,51 @@ int ar2GetSearchSize( AR2HandleT *ar2Handle, int *searchSize )
     return 0;
 }
 
+int ar2SetSearchSizeMode( AR2HandleT *ar2Handle, int searchSizeMode )
+{
+    if( ar2Handle == NULL ) return -1;
+    if( searchSizeMode != AR2_SEARCH_SIZE_FIXED && searchSizeMode != AR2_SEARCH_SIZE_ADAPTIVE ) return -1;
+    ar2Handle->searchSizeMode = searchSizeMode;
+    return 0;
+}
+
+int ar2GetSearchSizeMode( AR2HandleT *ar2Handle, int *searchSizeMode )
+{
+    if( ar2Handle == NULL ) return -1;
+    *searchSizeMode = ar2Handle->searchSizeMode;
+    return 0;
+}
+
+int ar2SetSearchSizeMin( AR2HandleT *ar2Handle, int searchSizeMin )
+{
+    if( ar2Handle == NULL ) return -1;
+    if( searchSizeMin < 1 ) return -1;
+    ar2Handle->searchSizeMin = searchSizeMin;
+    return 0;
+}
+
+int ar2GetSearchSizeMin( AR2HandleT *ar2Handle, int *searchSizeMin )
+{
+    if( ar2Handle == NULL ) return -1;
+    *searchSizeMin = ar2Handle->searchSizeMin;
+    return 0;
+}
+
+int ar2SetCoarseSearch( AR2HandleT *ar2Handle, int coarseSearch )
+{
+    if( ar2Handle == NULL ) return -1;
+    if( coarseSearch != AR2_COARSE_SEARCH_DISABLE && coarseSearch != AR2_COARSE_SEARCH_ENABLE ) return -1;
+    ar2Handle->coarseSearch = coarseSearch;
+    return 0;
+}
+
+int ar2GetCoarseSearch( AR2HandleT *ar2Handle, int *coarseSearch )
+{
+    if( ar2Handle == NULL ) return -1;
+    *coarseSearch = ar2Handle->coarseSearch;
+    return 0;
+}
+
 int ar2SetSearchFeatureNum( AR2HandleT *ar2Handle, int searchFeatureNum )
 {
     if( ar2Handle == NULL ) return -1;
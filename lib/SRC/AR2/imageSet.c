@@ -45,13 +45,131 @@
 #endif
 #include <AR2/imageFormat.h>
 #include <AR2/imageSet.h>
+#if !defined(_WIN32)
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  define AR2_IMAGE_SET_CACHE_MMAP 1
+#else
+#  define AR2_IMAGE_SET_CACHE_MMAP 0 // Cache is read into memory instead.
+#endif
+#if !defined(_WINRT)
+#  include <pthread.h>
+#else
+#  include <windows.h>
+#  define pthread_mutex_t               CRITICAL_SECTION
+#  define pthread_mutex_init(pm, a)     InitializeCriticalSectionEx(pm, 4000, CRITICAL_SECTION_NO_DEBUG_INFO)
+#  define pthread_mutex_lock(pm)        EnterCriticalSection(pm)
+#  define pthread_mutex_unlock(pm)      LeaveCriticalSection(pm)
+#  define pthread_mutex_destroy(pm)     DeleteCriticalSection(pm)
+#endif
+// Tiled image sets may be larger than 2GB.
+#ifdef _WIN32
+#  define ar2Fseek _fseeki64
+#  define ar2Ftell _ftelli64
+#else
+#  define ar2Fseek fseeko
+#  define ar2Ftell ftello
+#endif
+
+// Tile pointers are checked without the lock. A tile is published with release semantics once
+// its pixels are written, and read with acquire semantics, so a reader that sees the pointer
+// also sees the pixels, on weakly ordered CPUs too. Without atomics, every read takes the lock.
+// Readers stamp the frame a tile was last used in concurrently, all with the same value.
+#if defined(__GNUC__) || defined(__clang__)
+#  define ar2TileGet(pp)        __atomic_load_n( (pp), __ATOMIC_ACQUIRE )
+#  define ar2TileSet(pp, t)     __atomic_store_n( (pp), (t), __ATOMIC_RELEASE )
+#  define ar2TileTouch(p, c)    __atomic_store_n( (p), (c), __ATOMIC_RELAXED )
+#elif defined(_MSC_VER)
+#  include <windows.h>
+#  define ar2TileGet(pp)        ((ARUint8 *)InterlockedCompareExchangePointer( (PVOID volatile *)(pp), NULL, NULL ))
+#  define ar2TileSet(pp, t)     InterlockedExchangePointer( (PVOID volatile *)(pp), (t) )
+#  define ar2TileTouch(p, c)    (*(volatile ARUint32 *)(p) = (c))
+#else
+#  define ar2TileGet(pp)        ((ARUint8 *)NULL)
+#  define ar2TileSet(pp, t)     (*(pp) = (t))
+#  define ar2TileTouch(p, c)    (*(volatile ARUint32 *)(p) = (c))
+#endif
+
+// Image set cache (.isetc) file layout: header, scale table, then the imgBW of each scale
+// starting at a multiple of AR2_IMAGE_SET_CACHE_ALIGN bytes. All values in host byte order.
+// Tiled image sets (.isett) have the same layout, but each scale is stored as tileSize x tileSize
+// tiles, row by row, with the tiles on the right and bottom edges padded to full size.
+#define AR2_IMAGE_SET_CACHE_MAGIC    "AR2ISC"
+#define AR2_IMAGE_SET_TILED_MAGIC    "AR2IST"
+#define AR2_IMAGE_SET_CACHE_VERSION  1
+#define AR2_IMAGE_SET_CACHE_ALIGN    64
+
+typedef struct {
+    char              magic[8];
+    uint32_t          version;
+    int32_t           num;
+    uint64_t          isetSize;     /* size of the .iset the cache was generated from */
+    uint64_t          isetHash;     /* FNV-1a hash of the .iset                       */
+    uint64_t          fileSize;     /* size of the whole cache file                   */
+} AR2ImageSetCacheHeaderT;
+
+typedef struct {
+    int32_t           xsize;
+    int32_t           ysize;
+    float             dpi;
+    uint32_t          tileSize;     /* 0 in a .isetc                       */
+    uint64_t          offset;       /* of imgBW from the start of the file */
+} AR2ImageSetCacheScaleT;
+
+struct _AR2ImageTileCacheT {
+    pthread_mutex_t   mutex;        /* held while paging in a tile                    */
+    FILE             *fp;           /* the open .isett                                */
+    size_t            size;         /* bytes of tiles currently allocated             */
+    size_t            limit;        /* bytes of tiles kept by ar2TrimImageSetTiles()  */
+    ARUint32          clock;        /* current frame                                  */
+};
+
+struct _AR2ImageTilesT {
+    ARUint8         **tile;         /* xnum*ynum tiles. NULL until paged in           */
+    ARUint32         *lastUse;      /* frame in which each tile was last used         */
+    int               xnum;
+    int               ynum;
+    uint64_t          offset;       /* of tile 0 in the .isett                        */
+    AR2ImageTileCacheT *cache;      /* shared by all scales of the image set          */
+};
+
+// A cached tile, for choosing which to evict.
+typedef struct {
+    int               scale;
+    int               level;
+    int               tile;
+    ARUint32          age;
+} AR2TileRefT;
+
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+struct _AR2BlurCacheT {
+    pthread_mutex_t   mutex;        /* held while generating a tile             */
+    size_t            size;         /* bytes of tiles currently allocated       */
+    size_t            limit;        /* bytes of tiles kept by ar2TrimImageSetBlur() */
+    ARUint32          clock;        /* current frame                            */
+};
+#endif
 
 static AR2ImageT *ar2GenImageLayer1 ( ARUint8 *image, int xsize, int ysize, int nc, float srcdpi, float dstdpi );
 static AR2ImageT *ar2GenImageLayer2 ( AR2ImageT *src, float dstdpi );
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-static void       defocus_image     ( ARUint8 *img, int xsize, int ysize, int n );
+static void       ar2ImageSetInitBlur( AR2ImageSetT *imageSet );
+static void       ar2ImageFreeBlur   ( AR2ImageT *image );
+static void       ar2BlurRegion      ( const ARUint8 *img, int xsize, int ysize, int x0, int y0, int x1, int y1, int n,
+                                       ARUint8 *dst, int dstPitch );
 #endif
 static AR2ImageSetT *ar2ReadImageSetOld( FILE *fp );
+static AR2ImageSetT *ar2ReadImageSetSub( const char *filename, int useCache );
+static int           ar2ImageSetHashFile( FILE *fp, uint64_t *size, uint64_t *hash );
+static int           ar2ImageSetFileMatches( FILE *fp, uint64_t size, uint64_t hash );
+static AR2ImageSetT *ar2ReadImageSetCache( const char *filename, FILE *fpIset );
+static void          ar2ImageSetCacheRelease( void *cache, size_t cacheSize );
+static int           ar2WriteImageSetPrecomputed( const char *filename, const char *ext, AR2ImageSetT *imageSet, int tileSize );
+static ARUint8      *ar2LoadImageTile( AR2ImageTilesT *tiles, int t );
+static int           ar2TileRefCompare( const void *a, const void *b );
 
 AR2ImageSetT *ar2GenImageSet( ARUint8 *image, int xsize, int ysize, int nc, float dpi, float dpi_list[], int dpi_num )
 {
@@ -67,27 +185,35 @@ AR2ImageSetT *ar2GenImageSet( ARUint8 *image, int xsize, int ysize, int nc, floa
 
     arMalloc( imageSet, AR2ImageSetT, 1 );
     imageSet->num = dpi_num;
+    imageSet->cache = NULL;
+    imageSet->cacheSize = 0;
+    imageSet->tileCache = NULL;
     arMalloc( imageSet->scale,  AR2ImageT*,  imageSet->num );
 
     imageSet->scale[0] = ar2GenImageLayer1( image, xsize, ysize, nc, dpi, dpi_list[0] );
     for( i = 1; i < dpi_num; i++ ) {
         imageSet->scale[i] = ar2GenImageLayer2( imageSet->scale[0], dpi_list[i] );
     }
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    ar2ImageSetInitBlur( imageSet );
+#endif
 
     return imageSet;
 }
 
 AR2ImageSetT *ar2ReadImageSet( char *filename )
+{
+    return ar2ReadImageSetSub( filename, 1 );
+}
+
+// Read filename.iset, using filename.isetc instead of decoding it if useCache is set and the cache matches.
+static AR2ImageSetT *ar2ReadImageSetSub( const char *filename, int useCache )
 {
     FILE          *fp;
     AR2JpegImageT *jpgImage;
     AR2ImageSetT  *imageSet;
     float          dpi;
     int            i, k1;
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    int            j, k2;
-    ARUint        *p1, *p2;
-#endif
     size_t         len;
     const char     ext[] = ".iset";
     char          *buf;
@@ -102,7 +228,19 @@ AR2ImageSetT *ar2ReadImageSet( char *filename )
         return (NULL);
     }
 
+    // Use the precomputed scales if a cache generated from this exact .iset is present.
+    if( useCache ) {
+        imageSet = ar2ReadImageSetCache( filename, fp );
+        if( imageSet != NULL ) {
+            fclose(fp);
+            return imageSet;
+        }
+    }
+
     arMalloc( imageSet, AR2ImageSetT, 1 );
+    imageSet->cache = NULL;
+    imageSet->cacheSize = 0;
+    imageSet->tileCache = NULL;
 
     if( fread(&(imageSet->num), sizeof(imageSet->num), 1, fp) != 1 || imageSet->num <= 0) {
         ARLOGe("Error reading imageSet.\n");
@@ -111,7 +249,7 @@ AR2ImageSetT *ar2ReadImageSet( char *filename )
     ARLOGi("Imageset contains %d images.\n", imageSet->num);
     arMalloc( imageSet->scale, AR2ImageT*, imageSet->num );
 
-    arMalloc( imageSet->scale[0], AR2ImageT, 1 );
+    arMallocClear( imageSet->scale[0], AR2ImageT, 1 );
     jpgImage = ar2ReadJpegImage2(fp); // Caller must free result.
     if( jpgImage == NULL || jpgImage->nc != 1 ) {
         ARLOGw("Falling back to reading '%s%s' in ARToolKit v4.x format.\n", filename, ext);
@@ -130,19 +268,7 @@ AR2ImageSetT *ar2ReadImageSet( char *filename )
     imageSet->scale[0]->xsize = jpgImage->xsize;
     imageSet->scale[0]->ysize = jpgImage->ysize;
     imageSet->scale[0]->dpi   = jpgImage->dpi; // The dpi value is not read correctly by jpeglib embedded in OpenCV 2.2.x.
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    imageSet->scale[0]->imgBWBlur[0] = jpgImage->image;
-    // Create the blurred images.
-    for( j = 1; j < AR2_BLUR_IMAGE_MAX; j++ ) {
-        arMalloc( imageSet->scale[0]->imgBWBlur[j], ARUint8, imageSet->scale[0]->xsize * imageSet->scale[0]->ysize);
-        p1 = dst->imgBWBlur[0];
-        p2 = dst->imgBWBlur[i];
-        for( k1 = 0; k1 < imageSet->scale[0]->xsize * imageSet->scale[0]->ysize; k1++ ) *(p2++) = *(p1++);
-        defocus_image( imageSet->scale[0]->imgBWBlur[j], imageSet->scale[0]->xsize, imageSet->scale[0]->ysize, 3 );
-    }
-#else
     imageSet->scale[0]->imgBW = jpgImage->image;
-#endif
     free(jpgImage);
 
     // Minify for the other scales.
@@ -152,11 +278,7 @@ AR2ImageSetT *ar2ReadImageSet( char *filename )
         
         if( fread(&dpi, sizeof(dpi), 1, fp) != 1 ) {
             for( k1 = 0; k1 < i; k1++ ) {
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                for( k2 = 0; k2 < AR2_BLUR_IMAGE_MAX; k2++ ) free(imageSet->scale[k1]->imgBWBlur[k2]);
-#else
                 free(imageSet->scale[k1]->imgBW);
-#endif
                 free(imageSet->scale[k1]);
             }
             goto bail1;
@@ -165,11 +287,7 @@ AR2ImageSetT *ar2ReadImageSet( char *filename )
         imageSet->scale[i] = ar2GenImageLayer2( imageSet->scale[0], dpi );
         if( imageSet->scale[i] == NULL ) {
             for( k1 = 0; k1 < i; k1++ ) {
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                for( k2 = 0; k2 < AR2_BLUR_IMAGE_MAX; k2++ ) free(imageSet->scale[k1]->imgBWBlur[k2]);
-#else
                 free(imageSet->scale[k1]->imgBW);
-#endif
                 free(imageSet->scale[k1]);
             }
             goto bail1;
@@ -177,6 +295,9 @@ AR2ImageSetT *ar2ReadImageSet( char *filename )
     }
 
     fclose(fp);
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    ar2ImageSetInitBlur( imageSet );
+#endif
 
     return imageSet;
     
@@ -214,11 +335,7 @@ int ar2WriteImageSet( char *filename, AR2ImageSetT *imageSet )
     jpegImage.ysize = imageSet->scale[0]->ysize;
     jpegImage.dpi   = imageSet->scale[0]->dpi;
     jpegImage.nc    = 1;
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    jpegImage.image = imageSet->scale[0]->imgBWBlur[0];
-#else
     jpegImage.image = imageSet->scale[0]->imgBW;
-#endif
 
     if( ar2WriteJpegImage2(fp, &jpegImage, AR2_DEFAULT_JPEG_IMAGE_QUALITY) < 0 ) goto bailBadWrite;
 
@@ -235,23 +352,176 @@ bailBadWrite:
     return (-1);
 }
 
+int ar2WriteImageSetCache( char *filename )
+{
+    AR2ImageSetT *imageSet;
+    int           ret;
+
+    // Written from what ar2ReadImageSet() decodes from the .iset, not from the image the .iset was
+    // generated from, so that tracking is the same whether or not the cache is present.
+    if( (imageSet = ar2ReadImageSetSub( filename, 0 )) == NULL ) return (-1);
+    ret = ar2WriteImageSetPrecomputed( filename, ".isetc", imageSet, 0 );
+    ar2FreeImageSet( &imageSet );
+    return (ret);
+}
+
+int ar2WriteImageSetTiled( char *filename )
+{
+    AR2ImageSetT *imageSet;
+    int           ret;
+
+    // As for the .isetc, tiles are cut from the decoded .iset, since ar2ReadSurfaceSet() uses them in its place.
+    if( (imageSet = ar2ReadImageSetSub( filename, 0 )) == NULL ) return (-1);
+    ret = ar2WriteImageSetPrecomputed( filename, ".isett", imageSet, AR2_IMAGE_TILE_SIZE );
+    ar2FreeImageSet( &imageSet );
+    return (ret);
+}
+
+// Write filename.ext: every scale of imageSet as a raster (tileSize 0) or as tiles.
+static int ar2WriteImageSetPrecomputed( const char *filename, const char *ext, AR2ImageSetT *imageSet, int tileSize )
+{
+    FILE                    *fp;
+    AR2ImageSetCacheHeaderT  header;
+    AR2ImageSetCacheScaleT  *scale;
+    static const ARUint8     pad[AR2_IMAGE_SET_CACHE_ALIGN] = {0};
+    ARUint8                 *tile = NULL;
+    AR2ImageT               *image;
+    uint64_t                 offset;
+    int                      tx, ty, x1, y1, j;
+    int                      i;
+    size_t                   len;
+    char                    *buf;
+
+    if( imageSet == NULL || imageSet->num <= 0 ) return (-1);
+    for( i = 0; i < imageSet->num; i++ ) {
+        if( imageSet->scale[i]->imgBW == NULL ) return (-1); // Must be fully in memory.
+    }
+
+    len = strlen(filename) + strlen(".iset") + strlen(ext) + 1; // +1 for nul terminator.
+    arMalloc(buf, char, len);
+
+    // The file is only valid for the .iset it was generated from.
+    sprintf(buf, "%s.iset", filename);
+    if( (fp=fopen(buf, "rb")) == NULL ) {
+        ARLOGe("Error: unable to open file '%s' for reading.\n", buf);
+        free(buf);
+        return (-1);
+    }
+    memset( &header, 0, sizeof(header) );
+    if( ar2ImageSetHashFile(fp, &header.isetSize, &header.isetHash) < 0 ) {
+        ARLOGe("Error reading '%s'.\n", buf);
+        fclose(fp);
+        free(buf);
+        return (-1);
+    }
+    fclose(fp);
+
+    strncpy( header.magic, (tileSize > 0 ? AR2_IMAGE_SET_TILED_MAGIC : AR2_IMAGE_SET_CACHE_MAGIC), sizeof(header.magic) );
+    header.version = AR2_IMAGE_SET_CACHE_VERSION;
+    header.num     = imageSet->num;
+
+    arMallocClear( scale, AR2ImageSetCacheScaleT, imageSet->num );
+    offset = sizeof(header) + sizeof(AR2ImageSetCacheScaleT) * imageSet->num;
+    for( i = 0; i < imageSet->num; i++ ) {
+        offset = (offset + AR2_IMAGE_SET_CACHE_ALIGN - 1) / AR2_IMAGE_SET_CACHE_ALIGN * AR2_IMAGE_SET_CACHE_ALIGN;
+        scale[i].xsize    = imageSet->scale[i]->xsize;
+        scale[i].ysize    = imageSet->scale[i]->ysize;
+        scale[i].dpi      = imageSet->scale[i]->dpi;
+        scale[i].tileSize = tileSize;
+        scale[i].offset   = offset;
+        if( tileSize > 0 ) {
+            offset += (uint64_t)((scale[i].xsize + tileSize - 1) / tileSize) * ((scale[i].ysize + tileSize - 1) / tileSize) * tileSize * tileSize;
+        } else {
+            offset += (uint64_t)scale[i].xsize * scale[i].ysize;
+        }
+    }
+    header.fileSize = offset;
+
+    sprintf(buf, "%s%s", filename, ext);
+    if( (fp=fopen(buf, "wb")) == NULL ) {
+        ARLOGe("Error: unable to open file '%s' for writing.\n", buf);
+        free(scale);
+        free(buf);
+        return (-1);
+    }
+    free(buf);
+    if( tileSize > 0 ) arMalloc( tile, ARUint8, tileSize*tileSize );
+
+    if( fwrite(&header, sizeof(header), 1, fp) != 1 ) goto bailBadWrite;
+    if( fwrite(scale, sizeof(AR2ImageSetCacheScaleT), imageSet->num, fp) != (size_t)imageSet->num ) goto bailBadWrite;
+    offset = sizeof(header) + sizeof(AR2ImageSetCacheScaleT) * imageSet->num;
+    for( i = 0; i < imageSet->num; i++ ) {
+        if( scale[i].offset > offset ) {
+            if( fwrite(pad, 1, (size_t)(scale[i].offset - offset), fp) != (size_t)(scale[i].offset - offset) ) goto bailBadWrite;
+        }
+        image = imageSet->scale[i];
+        if( tileSize == 0 ) {
+            len = (size_t)image->xsize * image->ysize;
+            if( fwrite(image->imgBW, sizeof(ARUint8), len, fp) != len ) goto bailBadWrite;
+            offset = scale[i].offset + len;
+            continue;
+        }
+        for( ty = 0; ty < image->ysize; ty += tileSize ) {
+            y1 = (ty + tileSize > image->ysize) ? image->ysize : ty + tileSize;
+            for( tx = 0; tx < image->xsize; tx += tileSize ) {
+                x1 = (tx + tileSize > image->xsize) ? image->xsize : tx + tileSize;
+                if( x1 - tx < tileSize || y1 - ty < tileSize ) memset( tile, 0, tileSize*tileSize );
+                for( j = ty; j < y1; j++ ) {
+                    memcpy( &tile[(j - ty)*tileSize], &image->imgBW[j*image->xsize + tx], x1 - tx );
+                }
+                if( fwrite(tile, sizeof(ARUint8), tileSize*tileSize, fp) != (size_t)(tileSize*tileSize) ) goto bailBadWrite;
+            }
+        }
+        offset = scale[i].offset + (uint64_t)((image->xsize + tileSize - 1) / tileSize) * ((image->ysize + tileSize - 1) / tileSize) * tileSize * tileSize;
+    }
+
+    free(tile);
+    free(scale);
+    fclose(fp);
+    return 0;
+
+bailBadWrite:
+    ARLOGe("Error saving image set: error writing data.\n");
+    free(tile);
+    free(scale);
+    fclose(fp);
+    return (-1);
+}
+
 int ar2FreeImageSet( AR2ImageSetT **imageSet )
 {
-    int    i;
+    AR2ImageTilesT *tiles;
+    int    i, t;
 
     if(  imageSet == NULL ) return -1;
     if( *imageSet == NULL ) return -1;
 
     for( i = 0; i < (*imageSet)->num; i++ ) {
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-        for( int j = 0; j < AR2_BLUR_IMAGE_MAX; j++ ) {
-            free( (*imageSet)->scale[i]->imgBWBlur[j] );
-        }
-#else
-        free( (*imageSet)->scale[i]->imgBW  );
+        ar2ImageFreeBlur( (*imageSet)->scale[i] );
 #endif
+        if( (*imageSet)->scale[i]->tiles != NULL ) {
+            tiles = (*imageSet)->scale[i]->tiles;
+            for( t = 0; t < tiles->xnum*tiles->ynum; t++ ) free( tiles->tile[t] );
+            free( tiles->tile );
+            free( tiles->lastUse );
+            free( tiles );
+        }
+        if( (*imageSet)->cache == NULL ) free( (*imageSet)->scale[i]->imgBW );
         free( (*imageSet)->scale[i] );
     }
+    if( (*imageSet)->cache != NULL ) ar2ImageSetCacheRelease( (*imageSet)->cache, (*imageSet)->cacheSize );
+    if( (*imageSet)->tileCache != NULL ) {
+        fclose( (*imageSet)->tileCache->fp );
+        pthread_mutex_destroy( &((*imageSet)->tileCache->mutex) );
+        free( (*imageSet)->tileCache );
+    }
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    if( (*imageSet)->blurCache != NULL ) {
+        pthread_mutex_destroy( &((*imageSet)->blurCache->mutex) );
+        free( (*imageSet)->blurCache );
+    }
+#endif
     free( (*imageSet)->scale );
     free( *imageSet );
     *imageSet = NULL;
@@ -271,19 +541,12 @@ static AR2ImageT *ar2GenImageLayer1( ARUint8 *image, int xsize, int ysize, int n
     wx = (int)lroundf(xsize * dstdpi / srcdpi);
     wy = (int)lroundf(ysize * dstdpi / srcdpi);
 
-    arMalloc( dst, AR2ImageT, 1 );
+    arMallocClear( dst, AR2ImageT, 1 );
     dst->xsize = wx;
     dst->ysize = wy;
     dst->dpi   = dstdpi;
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    for( int i = 0; i < AR2_BLUR_IMAGE_MAX; i++ ) {
-        arMalloc( dst->imgWBlur[i], ARUint8, wx*wy );
-    }
-    p2 = dst->imgBWBlur[0];
-#else
     arMalloc( dst->imgBW, ARUint8, wx*wy );
     p2 = dst->imgBW;
-#endif
 
     // Scale down, nearest neighbour.
     for( jj = 0; jj < wy; jj++ ) {
@@ -320,16 +583,7 @@ static AR2ImageT *ar2GenImageLayer1( ARUint8 *image, int xsize, int ysize, int n
         }
     }
 
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    for( int i = 1; i < AR2_BLUR_IMAGE_MAX; i++ ) {
-        p1 = dst->imgBWBlue[0];
-        p2 = dst->imgBWBlue[i];
-        for( int j = 0; j < wx*wy; j++ ) *(p2++) = *(p1++);
-        defocus_image( dst->imgBWBlur[i], wx, wy, 2 );
-    }
-#else
     //defocus_image( dst->imgBW, wx, wy, 3 );
-#endif
 
     return dst;
 }
@@ -346,19 +600,12 @@ static AR2ImageT *ar2GenImageLayer2( AR2ImageT *src, float dpi )
     wx = (int)lroundf(src->xsize * dpi / src->dpi);
     wy = (int)lroundf(src->ysize * dpi / src->dpi);
 
-    arMalloc( dst, AR2ImageT, 1 );
+    arMallocClear( dst, AR2ImageT, 1 );
     dst->xsize = wx;
     dst->ysize = wy;
     dst->dpi   = dpi;
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    for( int i = 0; i < AR2_BLUR_IMAGE_MAX; i++ ) {
-        arMalloc( dst->imgBWBlur[i], ARUint8, wx*wy );
-    }
-    p2 = dst->imgBWBlue[0];
-#else
     arMalloc( dst->imgBW, ARUint8, wx*wy );
     p2 = dst->imgBW;
-#endif
 
     for( jj = 0; jj < wy; jj++ ) {
         sy = (int)lroundf( jj    * src->dpi / dpi);
@@ -371,11 +618,7 @@ static AR2ImageT *ar2GenImageLayer2( AR2ImageT *src, float dpi )
 
             co = value = 0;
             for( jjj = sy; jjj <= ey; jjj++ ) {
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                p1 = &(src->imgBWBlur[0][jjj*src->xsize+sx]);
-#else
                 p1 = &(src->imgBW[jjj*src->xsize+sx]);
-#endif
                 for( iii = sx; iii <= ex; iii++ ) {
                     value += *(p1++);
                     co++;
@@ -385,66 +628,190 @@ static AR2ImageT *ar2GenImageLayer2( AR2ImageT *src, float dpi )
         }
     }
 
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    defocus_image( dst->imageBWBlur[0], wx, wy, 3 );
-    for( int i = 1; i < AR2_BLUR_IMAGE_MAX; i++ ) {
-        p1 = dst->imgBWBlue[0];
-        p2 = dst->imgBWBlue[i];
-        for( int j = 0; j < wx*wy; j++ ) *(p2++) = *(p1++);
-        defocus_image( dst->imgBWBlur[i], wx, wy, 2 );
-    }
-#else
     //defocus_image( dst->imgBW, wx, wy, 3 );
-#endif
 
     return dst;
 }
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-static void defocus_image( ARUint8 *img, int xsize, int ysize, int n )
+static void ar2ImageSetInitBlur( AR2ImageSetT *imageSet )
 {
-    ARUint8        *wimg;
-    int             isize;
-    ARUint8         *p1, *p2;
-    int             i, j, k, w;
+    AR2ImageT   *image;
+    int          i;
 
-    isize = xsize * ysize;
-    arMalloc( wimg, ARUint8, xsize*ysize );
+    arMalloc( imageSet->blurCache, AR2BlurCacheT, 1 );
+    pthread_mutex_init( &(imageSet->blurCache->mutex), NULL );
+    imageSet->blurCache->size  = 0;
+    imageSet->blurCache->limit = AR2_DEFAULT_BLUR_MEMORY_LIMIT;
+    imageSet->blurCache->clock = 1;
+
+    for( i = 0; i < imageSet->num; i++ ) {
+        image = imageSet->scale[i];
+        image->tileXNum  = (image->xsize + AR2_BLUR_TILE_SIZE - 1) / AR2_BLUR_TILE_SIZE;
+        image->tileYNum  = (image->ysize + AR2_BLUR_TILE_SIZE - 1) / AR2_BLUR_TILE_SIZE;
+        image->blurCache = imageSet->blurCache;
+        arMallocClear( image->blur.tile,    ARUint8 *, image->tileXNum*image->tileYNum );
+        arMallocClear( image->blur.lastUse, ARUint32,  image->tileXNum*image->tileYNum );
+    }
+}
+
+static void ar2ImageFreeBlur( AR2ImageT *image )
+{
+    int     i;
+
+    if( image->blur.tile == NULL ) return;
+    for( i = 0; i < image->tileXNum*image->tileYNum; i++ ) free( image->blur.tile[i] );
+    free( image->blur.tile );
+    free( image->blur.lastUse );
+    image->blur.tile    = NULL;
+    image->blur.lastUse = NULL;
+}
+
+// n passes of a 3x3 box filter, with pixels on the image border left unfiltered: the filter the blurred images used to be precomputed with.
+// Writes pixels [x0,x1) x [y0,y1) of the result to dst, reading only the region of img within n pixels of them.
+static void ar2BlurRegion( const ARUint8 *img, int xsize, int ysize, int x0, int y0, int x1, int y1, int n,
+                           ARUint8 *dst, int dstPitch )
+{
+    ARUint8     *buf1, *buf2, *w;
+    ARUint8     *p1, *p2;
+    int          ex0, ey0, ex1, ey1, bw, bh;
+    int          i, j, k;
+
+    ex0 = (x0 - n < 0)     ? 0     : x0 - n;
+    ey0 = (y0 - n < 0)     ? 0     : y0 - n;
+    ex1 = (x1 + n > xsize) ? xsize : x1 + n;
+    ey1 = (y1 + n > ysize) ? ysize : y1 + n;
+    bw = ex1 - ex0;
+    bh = ey1 - ey0;
+
+    arMalloc( buf1, ARUint8, bw*bh );
+    arMalloc( buf2, ARUint8, bw*bh );
+    for( j = 0; j < bh; j++ ) memcpy( &buf1[j*bw], &img[(ey0 + j)*xsize + ex0], bw );
 
     for( k = 0; k < n; k++ ) {
-        if( k%2 == 0 ) {
-            p1 = img;
-            p2 = wimg;
-        }
-        else {
-            p1 = wimg;
-            p2 = img;
-        }
-        for( j = 0; j < ysize; j++ ) {
-            for( i = 0; i < xsize; i++ ) {
-                if( i == 0 || j == 0 || i == xsize-1 || j == ysize-1 ) {
-                    *(p2++) = *(p1++);
+        for( j = 0; j < bh; j++ ) {
+            p1 = &buf1[j*bw];
+            p2 = &buf2[j*bw];
+            for( i = 0; i < bw; i++, p1++, p2++ ) {
+                // Pixels on the edge of the region are only correct where it is the image border,
+                // and errors spread inwards one pixel per pass, never reaching [x0,x1) x [y0,y1).
+                if( i == 0 || j == 0 || i == bw-1 || j == bh-1 ) {
+                    *p2 = *p1;
                     continue;
                 }
-
-                w = *(p1-xsize-1) + *(p1-xsize) + *(p1-xsize+1)
-                 +  *(p1-1)       + *(p1)       + *(p1+1)
-                 +  *(p1+xsize-1) + *(p1+xsize) + *(p1+xsize+1);
-                *(p2++) = w / 9;
-                p1++;
+                *p2 = (ARUint8)(( *(p1-bw-1) + *(p1-bw) + *(p1-bw+1)
+                                + *(p1-1)    + *(p1)    + *(p1+1)
+                                + *(p1+bw-1) + *(p1+bw) + *(p1+bw+1) ) / 9);
             }
         }
+        w = buf1; buf1 = buf2; buf2 = w;
     }
 
-    if( n%2 == 1 ) {
-        p1 = wimg;
-        p2 = img;
-        for( i = 0; i < xsize*ysize; i++ ) *(p2++) = *(p1++);
+    for( j = y0; j < y1; j++ ) memcpy( &dst[(j - y0)*dstPitch], &buf1[(j - ey0)*bw + (x0 - ex0)], x1 - x0 );
+
+    free( buf1 );
+    free( buf2 );
+}
+
+static ARUint8 *ar2GenImageBlurTile( AR2ImageT *image, int t )
+{
+    ARUint8         *tile;
+    int              x0, y0, x1, y1;
+
+    pthread_mutex_lock( &(image->blurCache->mutex) );
+    tile = image->blur.tile[t];
+    if( tile == NULL ) {
+        x0 = (t % image->tileXNum) * AR2_BLUR_TILE_SIZE;
+        y0 = (t / image->tileXNum) * AR2_BLUR_TILE_SIZE;
+        x1 = (x0 + AR2_BLUR_TILE_SIZE > image->xsize) ? image->xsize : x0 + AR2_BLUR_TILE_SIZE;
+        y1 = (y0 + AR2_BLUR_TILE_SIZE > image->ysize) ? image->ysize : y0 + AR2_BLUR_TILE_SIZE;
+        arMalloc( tile, ARUint8, AR2_BLUR_TILE_SIZE*AR2_BLUR_TILE_SIZE );
+        ar2BlurRegion( image->imgBW, image->xsize, image->ysize, x0, y0, x1, y1, AR2_BLUR_PASSES, tile, AR2_BLUR_TILE_SIZE );
+        image->blurCache->size += AR2_BLUR_TILE_SIZE*AR2_BLUR_TILE_SIZE;
+        ar2TileSet( &(image->blur.tile[t]), tile );
+    }
+    pthread_mutex_unlock( &(image->blurCache->mutex) );
+
+    return tile;
+}
+
+ARUint8 ar2GetImageBlurValue( const AR2ImageT *image, int blurLevel, int x, int y )
+{
+    ARUint8     *tile;
+    int          t;
+
+    if( blurLevel <= 0 ) return image->imgBW[y*image->xsize + x];
+
+    t = (y / AR2_BLUR_TILE_SIZE) * image->tileXNum + x / AR2_BLUR_TILE_SIZE;
+    if( (tile = ar2TileGet( &(image->blur.tile[t]) )) == NULL ) {
+        tile = ar2GenImageBlurTile( (AR2ImageT *)image, t );
+    }
+    ar2TileTouch( &(image->blur.lastUse[t]), image->blurCache->clock );
+
+    return tile[(y % AR2_BLUR_TILE_SIZE)*AR2_BLUR_TILE_SIZE + x % AR2_BLUR_TILE_SIZE];
+}
+
+ARUint8 *ar2GenImageBlur( const AR2ImageT *image, int blurLevel )
+{
+    ARUint8     *dst;
+
+    if( image == NULL ) return NULL;
+
+    arMalloc( dst, ARUint8, image->xsize*image->ysize );
+    if( blurLevel <= 0 ) memcpy( dst, image->imgBW, image->xsize*image->ysize );
+    else ar2BlurRegion( image->imgBW, image->xsize, image->ysize, 0, 0, image->xsize, image->ysize, AR2_BLUR_PASSES, dst, image->xsize );
+
+    return dst;
+}
+
+int ar2SetImageSetBlurMemoryLimit( AR2ImageSetT *imageSet, size_t limit )
+{
+    if( imageSet == NULL || imageSet->blurCache == NULL ) return -1;
+    imageSet->blurCache->limit = limit;
+    return 0;
+}
+
+int ar2TrimImageSetBlur( AR2ImageSetT *imageSet )
+{
+    AR2BlurCacheT     *cache;
+    AR2TileRefT       *ref;
+    AR2ImageT         *image;
+    ARUint32           clock;
+    int                refNum;
+    int                i, t;
+
+    if( imageSet == NULL || imageSet->blurCache == NULL ) return -1;
+    cache = imageSet->blurCache;
+    clock = cache->clock++;
+    if( cache->size <= cache->limit ) return 0;
+
+    refNum = (int)(cache->size / (AR2_BLUR_TILE_SIZE*AR2_BLUR_TILE_SIZE));
+    arMalloc( ref, AR2TileRefT, refNum );
+    refNum = 0;
+    for( i = 0; i < imageSet->num; i++ ) {
+        image = imageSet->scale[i];
+        for( t = 0; t < image->tileXNum*image->tileYNum; t++ ) {
+            if( image->blur.tile[t] == NULL ) continue;
+            ref[refNum].scale = i;
+            ref[refNum].level = 1;
+            ref[refNum].tile  = t;
+            ref[refNum].age   = clock - image->blur.lastUse[t];
+            refNum++;
+        }
     }
 
-    free(wimg);
+    // Oldest first.
+    qsort( ref, refNum, sizeof(AR2TileRefT), ar2TileRefCompare );
+    for( i = 0; i < refNum && cache->size > cache->limit; i++ ) {
+        if( ref[i].age == 0 ) break;
+        image = imageSet->scale[ref[i].scale];
+        free( image->blur.tile[ref[i].tile] );
+        image->blur.tile[ref[i].tile] = NULL;
+        cache->size -= AR2_BLUR_TILE_SIZE*AR2_BLUR_TILE_SIZE;
+    }
+    free( ref );
 
-    return;
+    return 0;
 }
 #endif
 
@@ -452,11 +819,11 @@ static AR2ImageSetT *ar2ReadImageSetOld( FILE *fp )
 {
     AR2ImageSetT  *imageSet;
     int            i, k;
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    int            j, l;
-#endif
 
     arMalloc( imageSet, AR2ImageSetT, 1 );
+    imageSet->cache = NULL;
+    imageSet->cacheSize = 0;
+    imageSet->tileCache = NULL;
     
     if( fread(&(imageSet->num), sizeof(imageSet->num), 1, fp) != 1 || imageSet->num <= 0) {
         ARLOGe("Error reading imageSet.\n");
@@ -465,64 +832,34 @@ static AR2ImageSetT *ar2ReadImageSetOld( FILE *fp )
 
     arMalloc( imageSet->scale, AR2ImageT*, imageSet->num );
     for( i = 0; i < imageSet->num; i++ ) {
-        arMalloc( imageSet->scale[i], AR2ImageT, 1 );
+        arMallocClear( imageSet->scale[i], AR2ImageT, 1 );
     }
     
     for( i = 0; i < imageSet->num; i++ ) {
         if( fread(&(imageSet->scale[i]->xsize), sizeof(imageSet->scale[i]->xsize), 1, fp) != 1 ) {
             for( k = 0; k < i; k++ ) {
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                for( l = 0; l < AR2_BLUR_IMAGE_MAX; l++) free(imageSet->scale[k]->imgBWBlur[l]);
-#else
                 free(imageSet->scale[k]->imgBW);
-#endif
             }
             for( k = 0; k < imageSet->num; k++ ) free(imageSet->scale[k]);
             goto bail1;
         }
         if( fread(&(imageSet->scale[i]->ysize), sizeof(imageSet->scale[i]->ysize), 1, fp) != 1 ) {
             for( k = 0; k < i; k++ ) {
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                for( l = 0; l < AR2_BLUR_IMAGE_MAX; l++) free(imageSet->scale[k]->imgBWBlur[l]);
-#else
                 free(imageSet->scale[k]->imgBW);
-#endif
             }
             for( k = 0; k < imageSet->num; k++ ) free(imageSet->scale[k]);
             goto bail1;
         }
         if( fread(&(imageSet->scale[i]->dpi), sizeof(imageSet->scale[i]->dpi), 1, fp) != 1 ) {
             for( k = 0; k < i; k++ ) {
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                for( l = 0; l < AR2_BLUR_IMAGE_MAX; l++) free(imageSet->scale[k]->imgBWBlur[l]);
-#else
                 free(imageSet->scale[k]->imgBW);
-#endif
             }
             for( k = 0; k < imageSet->num; k++ ) free(imageSet->scale[k]);
             goto bail1;
         }
         
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-        for( j = 0; j < AR2_BLUR_IMAGE_MAX; j++ ) {
-            arMalloc( imageSet->scale[i]->imgBWBlur[j], ARUint8, imageSet->scale[i]->xsize * imageSet->scale[i]->ysize);
-        }
-#else
         arMalloc( imageSet->scale[i]->imgBW,  ARUint8, imageSet->scale[i]->xsize * imageSet->scale[i]->ysize);
-#endif
         
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-        for( j = 0; j < AR2_BLUR_IMAGE_MAX; j++ ) {
-            if( fread(imageSet->scale[i]->imgBWBlur[j], sizeof(ARUint8), imageSet->scale[i]->xsize * imageSet->scale[i]->ysize, fp)
-               != imageSet->scale[i]->xsize * imageSet->scale[i]->ysize ) {
-                for( k = 0; k <= i; k++ ) {
-                    for( l = 0; l < AR2_BLUR_IMAGE_MAX; l++) free(imageSet->scale[k]->imgBWBlur[l]);
-                }
-                for( k = 0; k < imageSet->num; k++ ) free(imageSet->scale[k]);
-                goto bail1;
-            }
-        }
-#else
         if( fread(imageSet->scale[i]->imgBW, sizeof(ARUint8), imageSet->scale[i]->xsize * imageSet->scale[i]->ysize, fp)
            != imageSet->scale[i]->xsize * imageSet->scale[i]->ysize ) {
             for( k = 0; k <= i; k++ ) {
@@ -531,10 +868,22 @@ static AR2ImageSetT *ar2ReadImageSetOld( FILE *fp )
             for( k = 0; k < imageSet->num; k++ ) free(imageSet->scale[k]);
             goto bail1;
         }
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+        // Files written with blur levels store them after the unblurred image. They are regenerated on demand instead.
+        if( fseek(fp, (long)(AR2_BLUR_IMAGE_MAX - 1) * imageSet->scale[i]->xsize * imageSet->scale[i]->ysize, SEEK_CUR) != 0 ) {
+            for( k = 0; k <= i; k++ ) {
+                free(imageSet->scale[k]->imgBW);
+            }
+            for( k = 0; k < imageSet->num; k++ ) free(imageSet->scale[k]);
+            goto bail1;
+        }
 #endif
     }
     
     fclose(fp);
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    ar2ImageSetInitBlur( imageSet );
+#endif
     return imageSet;
     
 bail1:
@@ -545,3 +894,364 @@ bail:
     return NULL;
 }
 
+// 64-bit FNV-1a hash and size of the whole of fp. Leaves fp rewound.
+static int ar2ImageSetHashFile( FILE *fp, uint64_t *size, uint64_t *hash )
+{
+    unsigned char  buf[16384];
+    size_t         n, i;
+    uint64_t       h = 14695981039346656037ULL;
+    uint64_t       total = 0;
+
+    rewind(fp);
+    while( (n = fread(buf, 1, sizeof(buf), fp)) > 0 ) {
+        for( i = 0; i < n; i++ ) {
+            h ^= buf[i];
+            h *= 1099511628211ULL;
+        }
+        total += n;
+    }
+    if( ferror(fp) ) {
+        clearerr(fp);
+        rewind(fp);
+        return -1;
+    }
+    rewind(fp);
+
+    *size = total;
+    *hash = h;
+    return 0;
+}
+
+// Returns 1 if fp has the given size and 64-bit FNV-1a hash, 0 otherwise. The size is checked first,
+// so fp is only read and hashed when it might match. Leaves fp rewound.
+static int ar2ImageSetFileMatches( FILE *fp, uint64_t size, uint64_t hash )
+{
+    int64_t   fileSize;
+    uint64_t  fileHash;
+
+    if( ar2Fseek(fp, 0, SEEK_END) != 0 || (fileSize = (int64_t)ar2Ftell(fp)) < 0 ) {
+        rewind(fp);
+        return 0;
+    }
+    rewind(fp);
+    if( (uint64_t)fileSize != size ) return 0;
+    if( ar2ImageSetHashFile(fp, &size, &fileHash) < 0 ) return 0;
+    return (fileHash == hash);
+}
+
+// Map filename.isetc if it exists and was generated from the .iset open as fpIset. Leaves fpIset rewound.
+static AR2ImageSetT *ar2ReadImageSetCache( const char *filename, FILE *fpIset )
+{
+    AR2ImageSetT                   *imageSet;
+    const AR2ImageSetCacheHeaderT  *header;
+    const AR2ImageSetCacheScaleT   *scale;
+    ARUint8                        *cache;
+    size_t                          cacheSize;
+    int                             i;
+    size_t                          len;
+    const char                      ext[] = ".isetc";
+    char                           *buf;
+#if AR2_IMAGE_SET_CACHE_MMAP
+    int                             fd;
+    struct stat                     st;
+#else
+    FILE                           *fp;
+    long                            fsize;
+#endif
+
+    len = strlen(filename) + strlen(ext) + 1; // +1 for nul terminator.
+    arMalloc(buf, char, len);
+    sprintf(buf, "%s%s", filename, ext);
+
+#if AR2_IMAGE_SET_CACHE_MMAP
+    // Mapped read-only and shared, so processes tracking the same pages share physical memory.
+    fd = open(buf, O_RDONLY);
+    free(buf);
+    if( fd < 0 ) return NULL; // No cache; not an error.
+    if( fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(AR2ImageSetCacheHeaderT) ) {
+        close(fd);
+        return NULL;
+    }
+    cacheSize = (size_t)st.st_size;
+    cache = (ARUint8 *)mmap(NULL, cacheSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if( cache == (ARUint8 *)MAP_FAILED ) {
+        ARLOGw("Unable to map image set cache '%s%s'.\n", filename, ext);
+        return NULL;
+    }
+#else
+    fp = fopen(buf, "rb");
+    free(buf);
+    if( !fp ) return NULL; // No cache; not an error.
+    if( fseek(fp, 0, SEEK_END) != 0 || (fsize = ftell(fp)) < (long)sizeof(AR2ImageSetCacheHeaderT) ) {
+        fclose(fp);
+        return NULL;
+    }
+    rewind(fp);
+    cacheSize = (size_t)fsize;
+    arMalloc( cache, ARUint8, cacheSize );
+    if( fread(cache, 1, cacheSize, fp) != cacheSize ) {
+        fclose(fp);
+        free(cache);
+        return NULL;
+    }
+    fclose(fp);
+#endif
+
+    header = (const AR2ImageSetCacheHeaderT *)cache;
+    if( strncmp(header->magic, AR2_IMAGE_SET_CACHE_MAGIC, sizeof(header->magic)) != 0
+     || header->version != AR2_IMAGE_SET_CACHE_VERSION
+     || header->fileSize != cacheSize
+     || header->num <= 0
+     || sizeof(AR2ImageSetCacheHeaderT) + sizeof(AR2ImageSetCacheScaleT) * (uint64_t)header->num > cacheSize ) {
+        ARLOGw("Ignoring invalid image set cache '%s%s'.\n", filename, ext);
+        ar2ImageSetCacheRelease( cache, cacheSize );
+        return NULL;
+    }
+    if( !ar2ImageSetFileMatches(fpIset, header->isetSize, header->isetHash) ) {
+        ARLOGw("Ignoring out-of-date image set cache '%s%s'.\n", filename, ext);
+        ar2ImageSetCacheRelease( cache, cacheSize );
+        return NULL;
+    }
+    scale = (const AR2ImageSetCacheScaleT *)(cache + sizeof(AR2ImageSetCacheHeaderT));
+    for( i = 0; i < header->num; i++ ) {
+        if( scale[i].xsize <= 0 || scale[i].ysize <= 0
+         || scale[i].offset % AR2_IMAGE_SET_CACHE_ALIGN != 0
+         || scale[i].offset + (uint64_t)scale[i].xsize * scale[i].ysize > cacheSize ) {
+            ARLOGw("Ignoring invalid image set cache '%s%s'.\n", filename, ext);
+            ar2ImageSetCacheRelease( cache, cacheSize );
+            return NULL;
+        }
+    }
+
+    arMalloc( imageSet, AR2ImageSetT, 1 );
+    imageSet->num       = header->num;
+    imageSet->cache     = cache;
+    imageSet->cacheSize = cacheSize;
+    imageSet->tileCache = NULL;
+    ARLOGi("Imageset contains %d images (precomputed).\n", imageSet->num);
+    arMalloc( imageSet->scale, AR2ImageT*, imageSet->num );
+    for( i = 0; i < imageSet->num; i++ ) {
+        arMallocClear( imageSet->scale[i], AR2ImageT, 1 );
+        imageSet->scale[i]->xsize = scale[i].xsize;
+        imageSet->scale[i]->ysize = scale[i].ysize;
+        imageSet->scale[i]->dpi   = scale[i].dpi;
+        imageSet->scale[i]->imgBW = cache + scale[i].offset; // Read-only.
+    }
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    ar2ImageSetInitBlur( imageSet );
+#endif
+
+    return imageSet;
+}
+
+static void ar2ImageSetCacheRelease( void *cache, size_t cacheSize )
+{
+#if AR2_IMAGE_SET_CACHE_MMAP
+    munmap( cache, cacheSize );
+#else
+    (void)cacheSize;
+    free( cache );
+#endif
+}
+
+AR2ImageSetT *ar2ReadImageSetTiled( char *filename )
+{
+    AR2ImageSetT            *imageSet;
+    AR2ImageSetCacheHeaderT  header;
+    AR2ImageSetCacheScaleT  *scale;
+    AR2ImageTilesT          *tiles;
+    FILE                    *fp, *fpIset;
+    int64_t                  fileSize;
+    int                      i;
+    size_t                   len;
+    const char               ext[] = ".isett";
+    char                    *buf;
+
+    len = strlen(filename) + strlen(ext) + 1; // +1 for nul terminator.
+    arMalloc(buf, char, len);
+    sprintf(buf, "%s%s", filename, ext);
+    fp = fopen(buf, "rb");
+    free(buf);
+    if( !fp ) return NULL; // No tiled image set; not an error.
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    ARLOGw("Tiled image sets are not supported with adaptive templates. Ignoring '%s%s'.\n", filename, ext);
+    fclose(fp);
+    return NULL;
+#endif
+
+    if( ar2Fseek(fp, 0, SEEK_END) != 0 || (fileSize = (int64_t)ar2Ftell(fp)) < (int64_t)sizeof(header) ) goto bailInvalid;
+    rewind(fp);
+    if( fread(&header, sizeof(header), 1, fp) != 1
+     || strncmp(header.magic, AR2_IMAGE_SET_TILED_MAGIC, sizeof(header.magic)) != 0
+     || header.version != AR2_IMAGE_SET_CACHE_VERSION
+     || header.fileSize != (uint64_t)fileSize
+     || header.num <= 0
+     || sizeof(header) + sizeof(AR2ImageSetCacheScaleT) * (uint64_t)header.num > (uint64_t)fileSize ) goto bailInvalid;
+
+    // If the .iset is present, the tiles must have been generated from it. Tiles may also be deployed without it.
+    len = strlen(filename) + strlen(".iset") + 1;
+    arMalloc(buf, char, len);
+    sprintf(buf, "%s.iset", filename);
+    fpIset = fopen(buf, "rb");
+    free(buf);
+    if( fpIset ) {
+        i = ar2ImageSetFileMatches(fpIset, header.isetSize, header.isetHash);
+        fclose(fpIset);
+        if( !i ) {
+            ARLOGw("Ignoring out-of-date tiled image set '%s%s'.\n", filename, ext);
+            fclose(fp);
+            return NULL;
+        }
+    }
+
+    arMalloc( scale, AR2ImageSetCacheScaleT, header.num );
+    if( fread(scale, sizeof(AR2ImageSetCacheScaleT), header.num, fp) != (size_t)header.num ) {
+        free(scale);
+        goto bailInvalid;
+    }
+    for( i = 0; i < header.num; i++ ) {
+        if( scale[i].xsize <= 0 || scale[i].ysize <= 0
+         || scale[i].tileSize != AR2_IMAGE_TILE_SIZE
+         || scale[i].offset + (uint64_t)((scale[i].xsize + AR2_IMAGE_TILE_SIZE - 1) / AR2_IMAGE_TILE_SIZE)
+                            * ((scale[i].ysize + AR2_IMAGE_TILE_SIZE - 1) / AR2_IMAGE_TILE_SIZE)
+                            * AR2_IMAGE_TILE_SIZE * AR2_IMAGE_TILE_SIZE > (uint64_t)fileSize ) {
+            free(scale);
+            goto bailInvalid;
+        }
+    }
+
+    arMalloc( imageSet, AR2ImageSetT, 1 );
+    imageSet->num       = header.num;
+    imageSet->cache     = NULL;
+    imageSet->cacheSize = 0;
+    arMalloc( imageSet->tileCache, AR2ImageTileCacheT, 1 );
+    pthread_mutex_init( &(imageSet->tileCache->mutex), NULL );
+    imageSet->tileCache->fp    = fp;
+    imageSet->tileCache->size  = 0;
+    imageSet->tileCache->limit = AR2_DEFAULT_IMAGE_TILE_MEMORY_LIMIT;
+    imageSet->tileCache->clock = 1;
+    ARLOGi("Imageset contains %d images (tiled).\n", imageSet->num);
+    arMalloc( imageSet->scale, AR2ImageT*, imageSet->num );
+    for( i = 0; i < imageSet->num; i++ ) {
+        arMallocClear( imageSet->scale[i], AR2ImageT, 1 );
+        imageSet->scale[i]->xsize = scale[i].xsize;
+        imageSet->scale[i]->ysize = scale[i].ysize;
+        imageSet->scale[i]->dpi   = scale[i].dpi;
+        imageSet->scale[i]->imgBW = NULL;
+        arMalloc( tiles, AR2ImageTilesT, 1 );
+        tiles->xnum   = (scale[i].xsize + AR2_IMAGE_TILE_SIZE - 1) / AR2_IMAGE_TILE_SIZE;
+        tiles->ynum   = (scale[i].ysize + AR2_IMAGE_TILE_SIZE - 1) / AR2_IMAGE_TILE_SIZE;
+        tiles->offset = scale[i].offset;
+        tiles->cache  = imageSet->tileCache;
+        arMallocClear( tiles->tile,    ARUint8 *, tiles->xnum*tiles->ynum );
+        arMallocClear( tiles->lastUse, ARUint32,  tiles->xnum*tiles->ynum );
+        imageSet->scale[i]->tiles = tiles;
+    }
+    free(scale);
+
+    return imageSet;
+
+bailInvalid:
+    ARLOGw("Ignoring invalid tiled image set '%s%s'.\n", filename, ext);
+    fclose(fp);
+    return NULL;
+}
+
+static ARUint8 *ar2LoadImageTile( AR2ImageTilesT *tiles, int t )
+{
+    AR2ImageTileCacheT *cache = tiles->cache;
+    ARUint8            *tile;
+
+    pthread_mutex_lock( &(cache->mutex) );
+    tile = tiles->tile[t];
+    if( tile == NULL ) {
+        arMalloc( tile, ARUint8, AR2_IMAGE_TILE_SIZE*AR2_IMAGE_TILE_SIZE );
+        if( ar2Fseek(cache->fp, tiles->offset + (uint64_t)t*AR2_IMAGE_TILE_SIZE*AR2_IMAGE_TILE_SIZE, SEEK_SET) != 0
+         || fread(tile, 1, AR2_IMAGE_TILE_SIZE*AR2_IMAGE_TILE_SIZE, cache->fp) != AR2_IMAGE_TILE_SIZE*AR2_IMAGE_TILE_SIZE ) {
+            ARLOGe("Error reading image tile.\n");
+            memset( tile, 0, AR2_IMAGE_TILE_SIZE*AR2_IMAGE_TILE_SIZE );
+        }
+        cache->size += AR2_IMAGE_TILE_SIZE*AR2_IMAGE_TILE_SIZE;
+        ar2TileSet( &(tiles->tile[t]), tile );
+    }
+    pthread_mutex_unlock( &(cache->mutex) );
+
+    return tile;
+}
+
+ARUint8 ar2GetImagePixel( const AR2ImageT *image, int x, int y )
+{
+    AR2ImageTilesT  *tiles;
+    ARUint8         *tile;
+    int              t;
+
+    if( image->imgBW != NULL ) return image->imgBW[y*image->xsize + x];
+
+    tiles = image->tiles;
+    t = (y / AR2_IMAGE_TILE_SIZE) * tiles->xnum + x / AR2_IMAGE_TILE_SIZE;
+    if( (tile = ar2TileGet( &(tiles->tile[t]) )) == NULL ) tile = ar2LoadImageTile( tiles, t );
+    ar2TileTouch( &(tiles->lastUse[t]), tiles->cache->clock );
+
+    return tile[(y % AR2_IMAGE_TILE_SIZE)*AR2_IMAGE_TILE_SIZE + x % AR2_IMAGE_TILE_SIZE];
+}
+
+int ar2SetImageSetTileMemoryLimit( AR2ImageSetT *imageSet, size_t limit )
+{
+    if( imageSet == NULL || imageSet->tileCache == NULL ) return -1;
+    imageSet->tileCache->limit = limit;
+    return 0;
+}
+
+int ar2TrimImageSetTiles( AR2ImageSetT *imageSet )
+{
+    AR2ImageTileCacheT *cache;
+    AR2ImageTilesT     *tiles;
+    AR2TileRefT        *ref;
+    ARUint32            clock;
+    int                 refNum;
+    int                 i, t;
+
+    if( imageSet == NULL || imageSet->tileCache == NULL ) return -1;
+    cache = imageSet->tileCache;
+    clock = cache->clock++;
+    if( cache->size <= cache->limit ) return 0;
+
+    refNum = (int)(cache->size / (AR2_IMAGE_TILE_SIZE*AR2_IMAGE_TILE_SIZE));
+    arMalloc( ref, AR2TileRefT, refNum );
+    refNum = 0;
+    for( i = 0; i < imageSet->num; i++ ) {
+        tiles = imageSet->scale[i]->tiles;
+        for( t = 0; t < tiles->xnum*tiles->ynum; t++ ) {
+            if( tiles->tile[t] == NULL ) continue;
+            ref[refNum].scale = i;
+            ref[refNum].level = 0;
+            ref[refNum].tile  = t;
+            ref[refNum].age   = clock - tiles->lastUse[t];
+            refNum++;
+        }
+    }
+
+    // Oldest first.
+    qsort( ref, refNum, sizeof(AR2TileRefT), ar2TileRefCompare );
+    for( i = 0; i < refNum && cache->size > cache->limit; i++ ) {
+        if( ref[i].age == 0 ) break;
+        tiles = imageSet->scale[ref[i].scale]->tiles;
+        free( tiles->tile[ref[i].tile] );
+        tiles->tile[ref[i].tile] = NULL;
+        cache->size -= AR2_IMAGE_TILE_SIZE*AR2_IMAGE_TILE_SIZE;
+    }
+    free( ref );
+
+    return 0;
+}
+
+static int ar2TileRefCompare( const void *a, const void *b )
+{
+    ARUint32    ageA = ((const AR2TileRefT *)a)->age;
+    ARUint32    ageB = ((const AR2TileRefT *)b)->age;
+
+    if( ageA > ageB ) return -1;
+    if( ageA < ageB ) return  1;
+    return 0;
+}
@@ -38,11 +38,38 @@
 #include <AR/ar.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#ifdef ANDROID
+#  include <malloc.h>
+#endif
 #include <AR2/tracking.h>
 #include <AR2/config.h>
 #include <AR2/template.h>
 
+#if AR2_TEMP_SCALE == 2
+#  if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+#    include <arm_neon.h>
+#    define AR2_MATCH_NEON 1
+#    if defined(ANDROID) && defined(HAVE_ARM_NEON)
+#      include "cpu-features.h"
+#    endif
+#  elif defined(HAVE_INTEL_SIMD)
+#    include <emmintrin.h> // SSE2.
+#    define AR2_MATCH_SSE2 1
+#    if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#      include <immintrin.h>
+#      define AR2_MATCH_AVX2 1
+#      define AR2_TARGET_AVX2 __attribute__((target("avx2")))
+#    elif defined(_MSC_VER) && _MSC_VER >= 1800
+#      include <immintrin.h>
+#      include <intrin.h>
+#      define AR2_MATCH_AVX2 1
+#      define AR2_TARGET_AVX2
+#    endif
+#  endif
+#endif
+
 #define  USE_SEARCH1    1
 #define  USE_SEARCH2    1
 #define  USE_SEARCH3    1
@@ -60,136 +87,548 @@ static int ar2GetBestMatchingSubFineOpt( ARUint8 *img, int xsize, int ysize, int
                                          ARUint32 *subImage1, ARUint32 *subImage2, int sx2, int sy2, int *val);
 #endif
 
-/*!
-    @function
-    @abstract Get best match for a candidate feature template.
-    @discussion 
-    @param img Incoming image to match against.
-    @param mfImage Buffer same size as img, to provide working memory for status of matched features.
-    @param xsize Horizontal size of img and mfImage.
-    @param ysize Vertical size of img and mfImage.
-    @param pixFormat Pixel format of img.
-    @param mtemp Template undergoing matching.
-    @param rx search radius in x dimension.
-    @param ry search radius in y dimension.
-    @param search screen coordinates (second dimension is x and y) for up to three previous positions of this feature.
-    @param bx On return, x position of best candidate.
-    @param by On return, y position of best candidate.
-    @param val On return, the quality of the match of the best candidate.
-    @result -1 in case of error or no match, or 0 otherwise.
- */
- 
-int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
-                        AR2TemplateT *mtemp, int rx, int ry,
-                         int search[3][2], int *bx, int *by, float *val)
-{
-    int              search_flag[] = {USE_SEARCH1, USE_SEARCH2, USE_SEARCH3};
-    int              px, py, sx, sy, ex, ey;
-    int              yts1, yts2;
-    int              keep_num;
-    int              cx[KEEP_NUM], cy[KEEP_NUM];
-    int              cval[KEEP_NUM];
-    int              wval, wval2;
-    int              i, j, l;
-    int              ii;
-    int              ret;
-    ARUint8         *pmf;
-#if 0
-#else
-    ARUint32   *subImage1, *p11, *p12, w1;
-    ARUint32   *subImage2, *p21, *p22, w2;
-    ARUint32    subImage11[AR2_TEMP_SCALE];
-    ARUint32    subImage21[AR2_TEMP_SCALE];
-    ARUint8    *p3, *p4;
-#endif
+//
+// Correlation kernels.
+//
+// The 'sums' kernel accumulates, over every non-null template pixel, the sum of the sampled image
+// pixels (sum1), the sum of their squares (sum2) and their cross-product with the template (sum3).
+// Image pixels are sampled every AR2_TEMP_SCALE pixels in x and y, starting at img.
+// The 'dot' kernel accumulates only the cross-product, and requires that the template has no null pixels.
+// The SIMD versions replace the null-pixel test with a mask, so the inner loops are branch free.
+// The best available version is chosen once at run time.
+//
 
-    // First pass: initialise.
-    yts1 = mtemp->yts1;
-    yts2 = mtemp->yts2;
-    for( ii = 0; ii < 3; ii++ ) {
-        if( search_flag[ii] == 0 ) continue;
-        if( search[ii][0] < 0 ) break;
+typedef void (*AR2MatchSumsFunc)( const ARUint8 *img, int xsize, const ARUint16 *templ, int txsize, int tysize,
+                                  int *sum1, int *sum2, int *sum3 );
+typedef void (*AR2MatchDotFunc) ( const ARUint8 *img, int xsize, const ARUint16 *templ, int txsize, int tysize,
+                                  int *sum3 );
+
+typedef struct {
+    AR2MatchSumsFunc  sums;
+    AR2MatchDotFunc   dot;
+    const char       *name;
+} AR2MatchKernelsT;
 
-        // "Snap" position to centre of grid square.
-        px = (search[ii][0]/(SKIP_INTERVAL + 1))*(SKIP_INTERVAL + 1) + (SKIP_INTERVAL + 1)/2;
-        py = (search[ii][1]/(SKIP_INTERVAL + 1))*(SKIP_INTERVAL + 1) + (SKIP_INTERVAL + 1)/2;
-
-        sx = px - rx; // Start position in x.
-        if( sx < 0 ) sx = 0;
-        ex = px + rx; // End position in x.
-        if( ex >= xsize ) ex = xsize - 1;
-
-        sy = py - ry; // Start position in y.
-        if( sy < 0 ) sy = 0;
-        ey = py + ry; // End position in y.
-        if( ey >= ysize ) ey = ysize - 1;
-
-        // Initialise mfImage by writing 0s into the potential search space.
-        for( j = sy; j <= ey; j++ ) {
-            pmf = &mfImage[j*xsize + sx];
-            for( i = sx; i <= ex; i++ ) {
-                *(pmf++) = 0;
+static void ar2MatchSumsC( const ARUint8 *img, int xsize, const ARUint16 *templ, int txsize, int tysize,
+                           int *sum1, int *sum2, int *sum3 )
+{
+    const ARUint8   *p2;
+    int              s1, s2, s3;
+    int              i, j;
+
+    s1 = s2 = s3 = 0;
+    for( j = 0; j < tysize; j++ ) {
+        p2 = img;
+        for( i = 0; i < txsize; i++ ) {
+            if( *templ != AR2_TEMPLATE_NULL_PIXEL ) {
+                s1 += (*p2);
+                s2 += (*p2) * (*p2);
+                s3 += (*p2) * (*templ);
             }
+            p2 += AR2_TEMP_SCALE;
+            templ++;
         }
+        img += AR2_TEMP_SCALE*xsize;
     }
+    *sum1 = s1;
+    *sum2 = s2;
+    *sum3 = s3;
+}
 
-    // Second pass: get candidates.
-    keep_num = 0;
-    ret = 1;
-    for( ii = 0; ii < 3; ii++ ) {      
-        if( search_flag[ii] == 0 ) continue;
-        if( search[ii][0] < 0 ) {
-            if( ret ) return -1; // If we haven't got at least one starting point for a search, bail out.
-            else    break;
+static void ar2MatchDotC( const ARUint8 *img, int xsize, const ARUint16 *templ, int txsize, int tysize,
+                          int *sum3 )
+{
+    const ARUint8   *p2;
+    int              s3;
+    int              i, j;
+
+    s3 = 0;
+    for( j = 0; j < tysize; j++ ) {
+        p2 = img;
+        for( i = 0; i < txsize; i++ ) {
+            s3 += (*p2) * *(templ++);
+            p2 += AR2_TEMP_SCALE;
         }
+        img += AR2_TEMP_SCALE*xsize;
+    }
+    *sum3 = s3;
+}
 
-        px = (search[ii][0]/(SKIP_INTERVAL + 1))*(SKIP_INTERVAL + 1) + (SKIP_INTERVAL + 1)/2;
-        py = (search[ii][1]/(SKIP_INTERVAL + 1))*(SKIP_INTERVAL + 1) + (SKIP_INTERVAL + 1)/2;
+//
+// The vector kernels process each template row in blocks of 8 (or 16) pixels, with each block
+// reading 2 image bytes per template pixel. The final block of a row is the 8 pixels ending at
+// the end of the row: its image load starts one byte early and is shifted down so that nothing
+// past the last sampled pixel is read, and lanes already accumulated by the previous block are
+// masked off. Rows shorter than 9 pixels are handled by the scalar code.
+//
 
-        for( j = py - ry; j <= py + ry; j += SKIP_INTERVAL + 1 ) {
-            if( j - yts1*AR2_TEMP_SCALE <  0     ) continue;
-            if( j + yts2*AR2_TEMP_SCALE >= ysize ) break;
-            for( i = px - rx; i <= px + rx; i += SKIP_INTERVAL + 1 ) {
-                if( i - mtemp->xts1*AR2_TEMP_SCALE <  0     ) continue;
-                if( i + mtemp->xts2*AR2_TEMP_SCALE >= xsize ) break;
-                if( mfImage[j*xsize + i] ) continue; // Skip pixels already matched.
-                mfImage[j*xsize + i] = 1; // Mark this pixel as matched.
-                if( ar2GetBestMatchingSubFine(img, xsize, ysize, pixFormat, mtemp, i, j, &wval) < 0 ) {
-                    continue;
-                }
-                ret = 0;
-                updateCandidate(i, j, wval, &keep_num, cx, cy, cval);
-            }
+#if AR2_MATCH_SSE2
+static inline int ar2HSumSSE2( __m128i v )
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+static inline void ar2MatchSumsSSE2Block( __m128i pix, __m128i tv, __m128i inv, __m128i *acc1, __m128i *acc2, __m128i *acc3 )
+{
+    pix   = _mm_andnot_si128(inv, pix);
+    tv    = _mm_andnot_si128(inv, tv);
+    *acc1 = _mm_add_epi32(*acc1, _mm_madd_epi16(pix, _mm_set1_epi16(1)));
+    *acc2 = _mm_add_epi32(*acc2, _mm_madd_epi16(pix, pix));
+    *acc3 = _mm_add_epi32(*acc3, _mm_madd_epi16(pix, tv));
+}
+
+// Image pixels and already-accumulated lane mask for the final block of a row.
+static inline __m128i ar2MatchLastPixSSE2( const ARUint8 *img, int txsize )
+{
+    return _mm_and_si128(_mm_srli_si128(_mm_loadu_si128((const __m128i *)(img + (txsize - 8)*AR2_TEMP_SCALE - 1)), 1),
+                         _mm_set1_epi16(0x00FF));
+}
+
+static inline __m128i ar2MatchLastMaskSSE2( int i, int txsize )
+{
+    return _mm_cmplt_epi16(_mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7), _mm_set1_epi16((short)(i - (txsize - 8))));
+}
+
+static void ar2MatchSumsSSE2( const ARUint8 *img, int xsize, const ARUint16 *templ, int txsize, int tysize,
+                              int *sum1, int *sum2, int *sum3 )
+{
+    const __m128i    lo8     = _mm_set1_epi16(0x00FF);
+    const __m128i    nullPix = _mm_set1_epi16(AR2_TEMPLATE_NULL_PIXEL);
+    __m128i          acc1, acc2, acc3, tv;
+    int              i, j;
+
+    if( txsize < 9 ) {
+        ar2MatchSumsC( img, xsize, templ, txsize, tysize, sum1, sum2, sum3 );
+        return;
+    }
+    acc1 = acc2 = acc3 = _mm_setzero_si128();
+    for( j = 0; j < tysize; j++ ) {
+        for( i = 0; i + 8 < txsize; i += 8 ) {
+            tv = _mm_loadu_si128((const __m128i *)(templ + i));
+            ar2MatchSumsSSE2Block( _mm_and_si128(_mm_loadu_si128((const __m128i *)(img + i*AR2_TEMP_SCALE)), lo8),
+                                   tv, _mm_cmpeq_epi16(tv, nullPix), &acc1, &acc2, &acc3 );
         }
+        tv = _mm_loadu_si128((const __m128i *)(templ + txsize - 8));
+        ar2MatchSumsSSE2Block( ar2MatchLastPixSSE2(img, txsize), tv,
+                               _mm_or_si128(_mm_cmpeq_epi16(tv, nullPix), ar2MatchLastMaskSSE2(i, txsize)),
+                               &acc1, &acc2, &acc3 );
+        templ += txsize;
+        img   += AR2_TEMP_SCALE*xsize;
     }
+    *sum1 = ar2HSumSSE2(acc1);
+    *sum2 = ar2HSumSSE2(acc2);
+    *sum3 = ar2HSumSSE2(acc3);
+}
 
-    // Third pass. Determine best candidate.
-    wval2 = 0;
-    ret = -1;
-#if 0
-    for(l = 0; l < keep_num; l++) {
-        for( j = cy[l] - SKIP_INTERVAL; j <= cy[l] + SKIP_INTERVAL; j++ ) {
+static void ar2MatchDotSSE2( const ARUint8 *img, int xsize, const ARUint16 *templ, int txsize, int tysize,
+                             int *sum3 )
+{
+    const __m128i    lo8 = _mm_set1_epi16(0x00FF);
+    __m128i          acc3, tv;
+    int              i, j;
+
+    if( txsize < 9 ) {
+        ar2MatchDotC( img, xsize, templ, txsize, tysize, sum3 );
+        return;
+    }
+    acc3 = _mm_setzero_si128();
+    for( j = 0; j < tysize; j++ ) {
+        for( i = 0; i + 8 < txsize; i += 8 ) {
+            acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_and_si128(_mm_loadu_si128((const __m128i *)(img + i*AR2_TEMP_SCALE)), lo8),
+                                                      _mm_loadu_si128((const __m128i *)(templ + i))));
+        }
+        tv   = _mm_andnot_si128(ar2MatchLastMaskSSE2(i, txsize), _mm_loadu_si128((const __m128i *)(templ + txsize - 8)));
+        acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(ar2MatchLastPixSSE2(img, txsize), tv));
+        templ += txsize;
+        img   += AR2_TEMP_SCALE*xsize;
+    }
+    *sum3 = ar2HSumSSE2(acc3);
+}
+#endif // AR2_MATCH_SSE2
+
+#if AR2_MATCH_AVX2
+AR2_TARGET_AVX2 static int ar2HSumAVX2( __m256i v )
+{
+    return ar2HSumSSE2(_mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+
+// Blocks of 16 template pixels, then at most one SSE2 block of 8, then the final block.
+AR2_TARGET_AVX2 static void ar2MatchSumsAVX2( const ARUint8 *img, int xsize, const ARUint16 *templ, int txsize, int tysize,
+                                              int *sum1, int *sum2, int *sum3 )
+{
+    const __m256i    lo8     = _mm256_set1_epi16(0x00FF);
+    const __m256i    nullPix = _mm256_set1_epi16(AR2_TEMPLATE_NULL_PIXEL);
+    const __m256i    one     = _mm256_set1_epi16(1);
+    __m256i          acc1, acc2, acc3, pix, tv, inv;
+    __m128i          acc81, acc82, acc83, tv8;
+    int              i, j;
+
+    if( txsize < 9 ) {
+        ar2MatchSumsC( img, xsize, templ, txsize, tysize, sum1, sum2, sum3 );
+        return;
+    }
+    acc1 = acc2 = acc3 = _mm256_setzero_si256();
+    acc81 = acc82 = acc83 = _mm_setzero_si128();
+    for( j = 0; j < tysize; j++ ) {
+        for( i = 0; i + 16 < txsize; i += 16 ) {
+            pix  = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(img + i*AR2_TEMP_SCALE)), lo8);
+            tv   = _mm256_loadu_si256((const __m256i *)(templ + i));
+            inv  = _mm256_cmpeq_epi16(tv, nullPix);
+            pix  = _mm256_andnot_si256(inv, pix);
+            tv   = _mm256_andnot_si256(inv, tv);
+            acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(pix, one));
+            acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(pix, pix));
+            acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(pix, tv));
+        }
+        if( i + 8 < txsize ) {
+            tv8 = _mm_loadu_si128((const __m128i *)(templ + i));
+            ar2MatchSumsSSE2Block( _mm_and_si128(_mm_loadu_si128((const __m128i *)(img + i*AR2_TEMP_SCALE)), _mm256_castsi256_si128(lo8)),
+                                   tv8, _mm_cmpeq_epi16(tv8, _mm256_castsi256_si128(nullPix)), &acc81, &acc82, &acc83 );
+            i += 8;
+        }
+        tv8 = _mm_loadu_si128((const __m128i *)(templ + txsize - 8));
+        ar2MatchSumsSSE2Block( ar2MatchLastPixSSE2(img, txsize), tv8,
+                               _mm_or_si128(_mm_cmpeq_epi16(tv8, _mm256_castsi256_si128(nullPix)), ar2MatchLastMaskSSE2(i, txsize)),
+                               &acc81, &acc82, &acc83 );
+        templ += txsize;
+        img   += AR2_TEMP_SCALE*xsize;
+    }
+    *sum1 = ar2HSumAVX2(acc1) + ar2HSumSSE2(acc81);
+    *sum2 = ar2HSumAVX2(acc2) + ar2HSumSSE2(acc82);
+    *sum3 = ar2HSumAVX2(acc3) + ar2HSumSSE2(acc83);
+}
+
+AR2_TARGET_AVX2 static void ar2MatchDotAVX2( const ARUint8 *img, int xsize, const ARUint16 *templ, int txsize, int tysize,
+                                             int *sum3 )
+{
+    const __m256i    lo8 = _mm256_set1_epi16(0x00FF);
+    __m256i          acc3;
+    __m128i          acc83, tv8;
+    int              i, j;
+
+    if( txsize < 9 ) {
+        ar2MatchDotC( img, xsize, templ, txsize, tysize, sum3 );
+        return;
+    }
+    acc3  = _mm256_setzero_si256();
+    acc83 = _mm_setzero_si128();
+    for( j = 0; j < tysize; j++ ) {
+        for( i = 0; i + 16 < txsize; i += 16 ) {
+            acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_and_si256(_mm256_loadu_si256((const __m256i *)(img + i*AR2_TEMP_SCALE)), lo8),
+                                                            _mm256_loadu_si256((const __m256i *)(templ + i))));
+        }
+        if( i + 8 < txsize ) {
+            acc83 = _mm_add_epi32(acc83, _mm_madd_epi16(_mm_and_si128(_mm_loadu_si128((const __m128i *)(img + i*AR2_TEMP_SCALE)), _mm256_castsi256_si128(lo8)),
+                                                        _mm_loadu_si128((const __m128i *)(templ + i))));
+            i += 8;
+        }
+        tv8   = _mm_andnot_si128(ar2MatchLastMaskSSE2(i, txsize), _mm_loadu_si128((const __m128i *)(templ + txsize - 8)));
+        acc83 = _mm_add_epi32(acc83, _mm_madd_epi16(ar2MatchLastPixSSE2(img, txsize), tv8));
+        templ += txsize;
+        img   += AR2_TEMP_SCALE*xsize;
+    }
+    *sum3 = ar2HSumAVX2(acc3) + ar2HSumSSE2(acc83);
+}
+
+static int ar2CPUHasAVX2( void )
+{
+#  if defined(_MSC_VER) && !defined(__clang__)
+    int     info[4];
+
+    __cpuid(info, 0);
+    if( info[0] < 7 ) return 0;
+    __cpuid(info, 1);
+    if( (info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 ) return 0; // OSXSAVE and AVX.
+    if( (_xgetbv(0) & 0x6) != 0x6 ) return 0; // OS saves XMM and YMM state.
+    __cpuidex(info, 7, 0);
+    return( (info[1] & (1 << 5)) != 0 );
+#  else
+    __builtin_cpu_init();
+    return( __builtin_cpu_supports("avx2") != 0 );
+#  endif
+}
+#endif // AR2_MATCH_AVX2
+
+#if AR2_MATCH_NEON
+static inline int ar2HSumNEON( uint32x4_t v )
+{
+    uint32x2_t w = vadd_u32(vget_low_u32(v), vget_high_u32(v));
+    w = vpadd_u32(w, w);
+    return (int)vget_lane_u32(w, 0);
+}
+
+static inline void ar2MatchSumsNEONBlock( uint16x8_t pix, uint16x8_t tv, uint16x8_t inv, uint32x4_t *acc1, uint32x4_t *acc2, uint32x4_t *acc3 )
+{
+    pix   = vbicq_u16(pix, inv);
+    tv    = vbicq_u16(tv, inv);
+    *acc1 = vpadalq_u16(*acc1, pix);
+    *acc2 = vmlal_u16(*acc2, vget_low_u16(pix),  vget_low_u16(pix));
+    *acc2 = vmlal_u16(*acc2, vget_high_u16(pix), vget_high_u16(pix));
+    *acc3 = vmlal_u16(*acc3, vget_low_u16(pix),  vget_low_u16(tv));
+    *acc3 = vmlal_u16(*acc3, vget_high_u16(pix), vget_high_u16(tv));
+}
+
+// vld2_u8 de-interleaves 16 image bytes, giving the 8 pixels at AR2_TEMP_SCALE spacing in val[0].
+// For the final block, the high byte of each 16-bit lane of a load starting one byte early is used instead.
+static inline uint16x8_t ar2MatchLastPixNEON( const ARUint8 *img, int txsize )
+{
+    return vshrq_n_u16(vreinterpretq_u16_u8(vld1q_u8(img + (txsize - 8)*AR2_TEMP_SCALE - 1)), 8);
+}
+
+static inline uint16x8_t ar2MatchLastMaskNEON( int i, int txsize )
+{
+    static const ARUint16 lane[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    return vcltq_u16(vld1q_u16(lane), vdupq_n_u16((ARUint16)(i - (txsize - 8))));
+}
+
+static void ar2MatchSumsNEON( const ARUint8 *img, int xsize, const ARUint16 *templ, int txsize, int tysize,
+                              int *sum1, int *sum2, int *sum3 )
+{
+    const uint16x8_t nullPix = vdupq_n_u16(AR2_TEMPLATE_NULL_PIXEL);
+    uint32x4_t       acc1, acc2, acc3;
+    uint16x8_t       tv;
+    int              i, j;
+
+    if( txsize < 9 ) {
+        ar2MatchSumsC( img, xsize, templ, txsize, tysize, sum1, sum2, sum3 );
+        return;
+    }
+    acc1 = acc2 = acc3 = vdupq_n_u32(0);
+    for( j = 0; j < tysize; j++ ) {
+        for( i = 0; i + 8 < txsize; i += 8 ) {
+            tv = vld1q_u16(templ + i);
+            ar2MatchSumsNEONBlock( vmovl_u8(vld2_u8(img + i*AR2_TEMP_SCALE).val[0]), tv, vceqq_u16(tv, nullPix), &acc1, &acc2, &acc3 );
+        }
+        tv = vld1q_u16(templ + txsize - 8);
+        ar2MatchSumsNEONBlock( ar2MatchLastPixNEON(img, txsize), tv,
+                               vorrq_u16(vceqq_u16(tv, nullPix), ar2MatchLastMaskNEON(i, txsize)), &acc1, &acc2, &acc3 );
+        templ += txsize;
+        img   += AR2_TEMP_SCALE*xsize;
+    }
+    *sum1 = ar2HSumNEON(acc1);
+    *sum2 = ar2HSumNEON(acc2);
+    *sum3 = ar2HSumNEON(acc3);
+}
+
+static void ar2MatchDotNEON( const ARUint8 *img, int xsize, const ARUint16 *templ, int txsize, int tysize,
+                             int *sum3 )
+{
+    uint32x4_t       acc3;
+    uint16x8_t       pix, tv;
+    int              i, j;
+
+    if( txsize < 9 ) {
+        ar2MatchDotC( img, xsize, templ, txsize, tysize, sum3 );
+        return;
+    }
+    acc3 = vdupq_n_u32(0);
+    for( j = 0; j < tysize; j++ ) {
+        for( i = 0; i + 8 < txsize; i += 8 ) {
+            pix  = vmovl_u8(vld2_u8(img + i*AR2_TEMP_SCALE).val[0]);
+            tv   = vld1q_u16(templ + i);
+            acc3 = vmlal_u16(acc3, vget_low_u16(pix),  vget_low_u16(tv));
+            acc3 = vmlal_u16(acc3, vget_high_u16(pix), vget_high_u16(tv));
+        }
+        pix  = ar2MatchLastPixNEON(img, txsize);
+        tv   = vbicq_u16(vld1q_u16(templ + txsize - 8), ar2MatchLastMaskNEON(i, txsize));
+        acc3 = vmlal_u16(acc3, vget_low_u16(pix),  vget_low_u16(tv));
+        acc3 = vmlal_u16(acc3, vget_high_u16(pix), vget_high_u16(tv));
+        templ += txsize;
+        img   += AR2_TEMP_SCALE*xsize;
+    }
+    *sum3 = ar2HSumNEON(acc3);
+}
+#endif // AR2_MATCH_NEON
+
+static const AR2MatchKernelsT ar2MatchKernelsC    = { ar2MatchSumsC,    ar2MatchDotC,    "C"     };
+#if AR2_MATCH_SSE2
+static const AR2MatchKernelsT ar2MatchKernelsSSE2 = { ar2MatchSumsSSE2, ar2MatchDotSSE2, "SSE2"  };
+#endif
+#if AR2_MATCH_AVX2
+static const AR2MatchKernelsT ar2MatchKernelsAVX2 = { ar2MatchSumsAVX2, ar2MatchDotAVX2, "AVX2"  };
+#endif
+#if AR2_MATCH_NEON
+static const AR2MatchKernelsT ar2MatchKernelsNEON = { ar2MatchSumsNEON, ar2MatchDotNEON, "NEON"  };
+#endif
+
+static const AR2MatchKernelsT *ar2MatchKernels = NULL;
+
+// Selection is idempotent, so concurrent first calls from several tracking threads are harmless.
+static const AR2MatchKernelsT *ar2GetMatchKernels( void )
+{
+    const AR2MatchKernelsT *kernels = ar2MatchKernels;
+
+    if( kernels != NULL ) return kernels;
+
+    kernels = &ar2MatchKernelsC;
+#if AR2_MATCH_NEON
+#  if defined(ANDROID) && defined(HAVE_ARM_NEON)
+    // Not all Android devices with ARMv7 CPUs are guaranteed to have NEON, so check.
+    if( (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON) != 0 )
+#  endif
+    kernels = &ar2MatchKernelsNEON;
+#elif AR2_MATCH_SSE2
+    // SSE2 is part of the minimum supported Intel CPU.
+    kernels = &ar2MatchKernelsSSE2;
+#  if AR2_MATCH_AVX2
+    if( ar2CPUHasAVX2() ) kernels = &ar2MatchKernelsAVX2;
+#  endif
+#endif
+    ARLOGd("AR2 template matching will use %s kernels.\n", kernels->name);
+    ar2MatchKernels = kernels;
+
+    return kernels;
+}
+
+// Workspace buffers are aligned to a cache line so that the per-thread workspaces never share a line.
+#define AR2_MATCHING_WORK_ALIGN     64
+
+static void *ar2AlignedAlloc( size_t size )
+{
+    void *p;
+#if defined(_WIN32)
+    p = _aligned_malloc(size, AR2_MATCHING_WORK_ALIGN);
+#elif defined(ANDROID)
+    p = memalign(AR2_MATCHING_WORK_ALIGN, size);
+#else
+    if( posix_memalign(&p, AR2_MATCHING_WORK_ALIGN, size) != 0 ) p = NULL;
+#endif
+    return p;
+}
+
+static void ar2AlignedFree( void *p )
+{
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+AR2MatchingWorkT *ar2GenMatchingWork( int xsize, int ysize )
+{
+    AR2MatchingWorkT *work;
+    
+    if( xsize <= 0 || ysize <= 0 ) return NULL;
+    
+    arMallocClear( work, AR2MatchingWorkT, 1 );
+    work->xsize = xsize;
+    work->ysize = ysize;
+    work->mfImage = (ARUint16 *)ar2AlignedAlloc( xsize*ysize*sizeof(ARUint16) );
+    if( work->mfImage == NULL ) {
+        ARLOGe("Out of memory!!\n");
+        free( work );
+        return NULL;
+    }
+    memset( work->mfImage, 0, xsize*ysize*sizeof(ARUint16) );
+    work->epoch = 0;
+    // subImage1 and subImage2 are sized on first use, as they depend on the template size.
+    
+    return work;
+}
+
+int ar2FreeMatchingWork( AR2MatchingWorkT *work )
+{
+    if( work == NULL ) return -1;
+    
+    ar2AlignedFree( work->mfImage );
+    ar2AlignedFree( work->subImage1 );
+    ar2AlignedFree( work->subImage2 );
+    free( work );
+    
+    return 0;
+}
+
+// Make sure the integral image buffers can hold size elements. Grows only; template size rarely changes.
+static int ar2MatchingWorkReserve( AR2MatchingWorkT *work, int size )
+{
+    if( size <= work->subImageSize ) return 0;
+    
+    ar2AlignedFree( work->subImage1 );
+    ar2AlignedFree( work->subImage2 );
+    work->subImage1 = (ARUint32 *)ar2AlignedAlloc( size*sizeof(ARUint32) );
+    work->subImage2 = (ARUint32 *)ar2AlignedAlloc( size*sizeof(ARUint32) );
+    if( work->subImage1 == NULL || work->subImage2 == NULL ) {
+        ARLOGe("Out of memory!!\n");
+        ar2AlignedFree( work->subImage1 );
+        ar2AlignedFree( work->subImage2 );
+        work->subImage1 = work->subImage2 = NULL;
+        work->subImageSize = 0;
+        return -1;
+    }
+    work->subImageSize = size;
+    
+    return 0;
+}
+
+// Start a new search. Pixels stamped with an older epoch count as unvisited, so the visit map
+// never needs clearing, except once every 65535 searches when the stamp wraps.
+ARUint16 ar2MatchingWorkNewEpoch( AR2MatchingWorkT *work )
+{
+    if( ++work->epoch == 0 ) {
+        memset( work->mfImage, 0, work->xsize*work->ysize*sizeof(ARUint16) );
+        work->epoch = 1;
+    }
+    return work->epoch;
+}
+
+// Match mtemp at every step'th pixel within (rx, ry) of each search point, skipping pixels already
+// visited in this epoch, and keep the KEEP_NUM best matches. Search points are processed in order up
+// to the first unset one.
+static void ar2GetMatchingCandidates( ARUint8 *img, AR2MatchingWorkT *work, ARUint16 epoch, int xsize, int ysize,
+                                      AR_PIXEL_FORMAT pixFormat, AR2TemplateT *mtemp, int rx, int ry, int step,
+                                      int searchNum, int search[][2],
+                                      int *keep_num, int cx[KEEP_NUM], int cy[KEEP_NUM], int cval[KEEP_NUM] )
+{
+    ARUint16        *mfImage = work->mfImage;
+    int              px, py;
+    int              wval;
+    int              i, j, ii;
+
+    for( ii = 0; ii < searchNum; ii++ ) {
+        if( search[ii][0] < 0 ) break;
+
+        px = (search[ii][0]/step)*step + step/2;
+        py = (search[ii][1]/step)*step + step/2;
+
+        for( j = py - ry; j <= py + ry; j += step ) {
             if( j - mtemp->yts1*AR2_TEMP_SCALE <  0     ) continue;
             if( j + mtemp->yts2*AR2_TEMP_SCALE >= ysize ) break;
-            for( i = cx[l] - SKIP_INTERVAL; i <= cx[l] + SKIP_INTERVAL; i++ ) {
+            for( i = px - rx; i <= px + rx; i += step ) {
                 if( i - mtemp->xts1*AR2_TEMP_SCALE <  0     ) continue;
                 if( i + mtemp->xts2*AR2_TEMP_SCALE >= xsize ) break;
+                if( mfImage[j*xsize + i] == epoch ) continue; // Skip pixels already matched.
+                mfImage[j*xsize + i] = epoch; // Mark this pixel as matched.
                 if( ar2GetBestMatchingSubFine(img, xsize, ysize, pixFormat, mtemp, i, j, &wval) < 0 ) {
                     continue;
                 }
-                if( wval > wval2 ) {
-                    *bx    =  i;
-                    *by    =  j;
-                     wval2 =  wval;
-                    *val   = (float)wval / 10000.0f;
-                    ret = 0;
-                }
+                updateCandidate(i, j, wval, keep_num, cx, cy, cval);
             }
         }
     }
-#else
-    arMalloc( subImage1, ARUint32, ( (mtemp->xsize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2)) * ((mtemp->ysize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2) ) );
-    arMalloc( subImage2, ARUint32, ( (mtemp->xsize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2)) * ((mtemp->ysize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2) ) );
+}
+
+// Match mtemp at every pixel within SKIP_INTERVAL of each candidate, and return the best.
+static int ar2GetBestMatchingRefine( ARUint8 *img, AR2MatchingWorkT *work, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                                     AR2TemplateT *mtemp, int keep_num, int cx[KEEP_NUM], int cy[KEEP_NUM],
+                                     int *bx, int *by, float *val )
+{
+    int              wval, wval2;
+    int              i, j, l;
+    int              ret;
+    ARUint32   *subImage1, *p11, *p12, w1;
+    ARUint32   *subImage2, *p21, *p22, w2;
+    ARUint32    subImage11[AR2_TEMP_SCALE];
+    ARUint32    subImage21[AR2_TEMP_SCALE];
+    ARUint8    *p3, *p4;
+
+    wval2 = 0;
+    ret = -1;
+    if( ar2MatchingWorkReserve( work, ( (mtemp->xsize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2)) * ((mtemp->ysize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2) ) ) < 0 ) return -1;
+    subImage1 = work->subImage1;
+    subImage2 = work->subImage2;
 
     for(l = 0; l < keep_num; l++) {
         if( mtemp->validNum != mtemp->xsize*mtemp->ysize
@@ -266,13 +705,163 @@ int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR
             }
         }
     }
-    free(subImage1);
-    free(subImage2);
-#endif
 
     return ret;
 }
 
+/*!
+    @function
+    @abstract Get best match for a candidate feature template.
+    @discussion 
+    @param img Incoming image to match against.
+    @param work Per-thread workspace, as returned by ar2GenMatchingWork() for an image of size xsize x ysize.
+    @param xsize Horizontal size of img.
+    @param ysize Vertical size of img.
+    @param pixFormat Pixel format of img.
+    @param mtemp Template undergoing matching.
+    @param rx search radius in x dimension.
+    @param ry search radius in y dimension.
+    @param search screen coordinates (second dimension is x and y) for up to three previous positions of this feature.
+    @param bx On return, x position of best candidate.
+    @param by On return, y position of best candidate.
+    @param val On return, the quality of the match of the best candidate.
+    @result -1 in case of error or no match, or 0 otherwise.
+ */
+ 
+int ar2GetBestMatching( ARUint8 *img, AR2MatchingWorkT *work, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                        AR2TemplateT *mtemp, int rx, int ry,
+                         int search[3][2], int *bx, int *by, float *val)
+{
+    int              search_flag[] = {USE_SEARCH1, USE_SEARCH2, USE_SEARCH3};
+    int              searchPoints[3][2];
+    int              searchNum;
+    int              keep_num;
+    int              cx[KEEP_NUM], cy[KEEP_NUM];
+    int              cval[KEEP_NUM];
+    int              ii;
+
+    if( work == NULL || work->xsize != xsize || work->ysize != ysize ) return -1;
+
+    searchNum = 0;
+    for( ii = 0; ii < 3; ii++ ) {
+        if( search_flag[ii] == 0 ) continue;
+        searchPoints[searchNum][0] = search[ii][0];
+        searchPoints[searchNum][1] = search[ii][1];
+        searchNum++;
+    }
+
+    // First pass: get candidates on a sparse grid. Visit status is epoch-stamped, so no clearing of mfImage is needed.
+    keep_num = 0;
+    ar2GetMatchingCandidates( img, work, ar2MatchingWorkNewEpoch( work ), xsize, ysize, pixFormat, mtemp, rx, ry, SKIP_INTERVAL + 1,
+                              searchNum, searchPoints, &keep_num, cx, cy, cval );
+    if( keep_num == 0 ) return -1;
+
+    // Second pass. Determine best candidate.
+    return ar2GetBestMatchingRefine( img, work, xsize, ysize, pixFormat, mtemp, keep_num, cx, cy, bx, by, val );
+}
+
+/*!
+    @function
+    @abstract Get best match for a candidate feature template, searching coarse-to-fine.
+    @discussion
+        Gives the same kind of result as ar2GetBestMatching(), but first searches coarseImg at twice the
+        grid spacing, then searches img at the normal grid spacing around the best coarse matches only,
+        and finally refines on img as usual. The cost of the search therefore grows far more slowly
+        with rx and ry. If coarseImg is NULL, this is equivalent to ar2GetBestMatching().
+    @param img Incoming image to match against.
+    @param coarseImg Half-resolution version of img, as generated by ar2GetCoarseMatchingImage().
+    @param work Per-thread workspace, as returned by ar2GenMatchingWork() for an image of size xsize x ysize.
+    @param xsize Horizontal size of img.
+    @param ysize Vertical size of img.
+    @param pixFormat Pixel format of img.
+    @param mtemp Template undergoing matching.
+    @param rx search radius in x dimension.
+    @param ry search radius in y dimension.
+    @param search screen coordinates (second dimension is x and y) for up to three previous positions of this feature.
+    @param bx On return, x position of best candidate.
+    @param by On return, y position of best candidate.
+    @param val On return, the quality of the match of the best candidate.
+    @result -1 in case of error or no match, or 0 otherwise.
+ */
+
+int ar2GetBestMatchingCoarse( ARUint8 *img, ARUint8 *coarseImg, AR2MatchingWorkT *work, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                              AR2TemplateT *mtemp, int rx, int ry,
+                              int search[3][2], int *bx, int *by, float *val)
+{
+    int              search_flag[] = {USE_SEARCH1, USE_SEARCH2, USE_SEARCH3};
+    int              searchPoints[3][2];
+    int              searchNum;
+    int              keep_num;
+    int              cx[KEEP_NUM], cy[KEEP_NUM];
+    int              cval[KEEP_NUM];
+    int              ii;
+
+    if( work == NULL || work->xsize != xsize || work->ysize != ysize ) return -1;
+    if( coarseImg == NULL ) return ar2GetBestMatching( img, work, xsize, ysize, pixFormat, mtemp, rx, ry, search, bx, by, val );
+
+    searchNum = 0;
+    for( ii = 0; ii < 3; ii++ ) {
+        if( search_flag[ii] == 0 ) continue;
+        searchPoints[searchNum][0] = search[ii][0];
+        searchPoints[searchNum][1] = search[ii][1];
+        searchNum++;
+    }
+
+    // First pass: coarse grid over the whole search window.
+    keep_num = 0;
+    ar2GetMatchingCandidates( coarseImg, work, ar2MatchingWorkNewEpoch( work ), xsize, ysize, AR_PIXEL_FORMAT_MONO, mtemp, rx, ry, (SKIP_INTERVAL + 1)*2,
+                              searchNum, searchPoints, &keep_num, cx, cy, cval );
+    if( keep_num == 0 ) return -1;
+
+    // Second pass: normal grid, in one coarse cell around each coarse candidate.
+    for( ii = 0; ii < keep_num; ii++ ) {
+        searchPoints[ii][0] = cx[ii];
+        searchPoints[ii][1] = cy[ii];
+    }
+    searchNum = keep_num;
+    keep_num = 0;
+    ar2GetMatchingCandidates( img, work, ar2MatchingWorkNewEpoch( work ), xsize, ysize, pixFormat, mtemp, SKIP_INTERVAL + 1, SKIP_INTERVAL + 1, SKIP_INTERVAL + 1,
+                              searchNum, searchPoints, &keep_num, cx, cy, cval );
+    if( keep_num == 0 ) return -1;
+
+    // Third pass. Determine best candidate at full resolution.
+    return ar2GetBestMatchingRefine( img, work, xsize, ysize, pixFormat, mtemp, keep_num, cx, cy, bx, by, val );
+}
+
+/*!
+    @function
+    @abstract Generate the half-resolution image used by ar2GetBestMatchingCoarse().
+    @discussion
+        Each pixel of coarseImg is the mean of the 2x2 block of img whose top-left pixel is at the same
+        position. Templates sample the image every AR2_TEMP_SCALE pixels, so sampling coarseImg in the same
+        way matches against a half-resolution image at any sub-pixel phase, without changing coordinates.
+    @param img Luminance image.
+    @param xsize Horizontal size of img.
+    @param ysize Vertical size of img.
+    @param coarseImg Buffer of xsize*ysize bytes, which on return holds the filtered image.
+    @result -1 in case of error, or 0 otherwise.
+ */
+
+int ar2GetCoarseMatchingImage( ARUint8 *img, int xsize, int ysize, ARUint8 *coarseImg )
+{
+    ARUint8    *p1, *p2, *p3;
+    int         i, j;
+
+    if( img == NULL || coarseImg == NULL || xsize < 2 || ysize < 2 ) return -1;
+
+    for( j = 0; j < ysize; j++ ) {
+        p1 = &img[j*xsize];
+        p2 = (j < ysize - 1) ? p1 + xsize : p1;
+        p3 = &coarseImg[j*xsize];
+        for( i = 0; i < xsize - 1; i++ ) {
+            p3[i] = (ARUint8)((p1[i] + p1[i+1] + p2[i] + p2[i+1] + 2) >> 2);
+        }
+        p3[i] = (ARUint8)((p1[i] + p2[i] + 1) >> 1);
+    }
+
+    return 0;
+}
+
 static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
                                       AR2TemplateT *mtemp, int sx, int sy, int *val)
 {
@@ -286,40 +875,8 @@ static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIX
     p1 = mtemp->img1;
     sum1 = sum2 = sum3 = 0;
     if( pixFormat == AR_PIXEL_FORMAT_MONO || pixFormat == AR_PIXEL_FORMAT_420v || pixFormat == AR_PIXEL_FORMAT_420f || pixFormat == AR_PIXEL_FORMAT_NV21 ) {
-#if 0
-        for( j = -(mtemp->yts1); j <= mtemp->yts2; j++ ) {
-            p2 = &img[((sy + j*AR2_TEMP_SCALE)*xsize + sx - mtemp->xts1*AR2_TEMP_SCALE)];
-            for( i = -(mtemp->xts1); i <= mtemp->xts2; i++ ) {
-                if( *p1 != AR2_TEMPLATE_NULL_PIXEL ) {
-                    sum1 += (*p2);
-                    sum2 += (*p2) * (*p2);
-                    sum3 += (*p2) * (*p1);
-                }
-                p2 += AR2_TEMP_SCALE;
-                p1++;
-            }
-        }
-#else
-        int        ssx, eex, ssy, eey;
-        ARUint8   *p3;
-        ssx = -(mtemp->xts1);
-        eex =   mtemp->xts2;
-        ssy = -(mtemp->yts1);
-        eey =   mtemp->yts2;
-        p2 = p3 = &img[((sy + ssy*AR2_TEMP_SCALE)*xsize + sx + ssx*AR2_TEMP_SCALE)];
-        for( j = ssy; j <= eey; j++ ) {
-            for( i = ssx; i <= eex; i++ ) {
-                if( *p1 != AR2_TEMPLATE_NULL_PIXEL ) {
-                    sum1 += (*p2);
-                    sum2 += (*p2) * (*p2);
-                    sum3 += (*p2) * (*p1);
-                }
-                p2 += AR2_TEMP_SCALE;
-                p1++;
-            }
-            p2 = p3 += AR2_TEMP_SCALE*xsize; // i.e. p3 += AR2_TEMP_SCALE*xsize; p2 = p3;
-        }
-#endif
+        ar2GetMatchKernels()->sums( &img[((sy - mtemp->yts1*AR2_TEMP_SCALE)*xsize + sx - mtemp->xts1*AR2_TEMP_SCALE)], xsize,
+                                    mtemp->img1, mtemp->xsize, mtemp->ysize, &sum1, &sum2, &sum3 );
     }
     else if( pixFormat == AR_PIXEL_FORMAT_RGB || pixFormat == AR_PIXEL_FORMAT_BGR) {
         for( j = -(mtemp->yts1); j <= mtemp->yts2; j++ ) {
@@ -409,23 +966,11 @@ static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIX
 static int ar2GetBestMatchingSubFineOpt( ARUint8 *img, int xsize, int ysize, int sx1, int sy1, AR2TemplateT *mtemp,
                                          ARUint32 *subImage1, ARUint32 *subImage2, int sx2, int sy2, int *val)
 {
-    ARUint16            *p1;
-    ARUint8             *p2, *p3;
     int                  sum1, sum2, sum3;
     int                  vlen;
     int                  subImageXsize, px1, px2, py1, py2;
-    int                  i, j;
     
-    p1 = mtemp->img1;
-    sum3 = 0;
-    p2 = p3 = &img[sy1*xsize + sx1];
-    for( j = 0; j < mtemp->ysize; j++ ) {
-        for( i = 0; i < mtemp->xsize; i++ ) {
-            sum3 += (*p2) * *(p1++);
-            p2 += AR2_TEMP_SCALE;
-        }
-        p2 = p3 += AR2_TEMP_SCALE*xsize;
-    }
+    ar2GetMatchKernels()->dot( &img[sy1*xsize + sx1], xsize, mtemp->img1, mtemp->xsize, mtemp->ysize, &sum3 );
 
     subImageXsize = (mtemp->xsize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2);
     px1 =  sx2 + (mtemp->xsize - 1)*AR2_TEMP_SCALE;
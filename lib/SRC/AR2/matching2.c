@@ -38,6 +38,7 @@
 #include <AR/ar.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <AR2/tracking.h>
 #include <AR2/config.h>
@@ -62,12 +63,12 @@ static void updateCandidate            ( int x, int y, int wval,
 
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-int ar2GetBestMatching2( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+int ar2GetBestMatching2( ARUint8 *img, AR2MatchingWorkT *work, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
                          AR2Template2T *mtemp, int rx, int ry,
                          int search[3][2], int *bx, int *by, float *val, int *blurLevel)
 {
     int              search_flag[] = {USE_SEARCH1, USE_SEARCH2, USE_SEARCH3};
-    int              px, py, sx, sy, ex, ey;
+    int              px, py;
     int              yts1, yts2;
     int              keep_num;
     int              cx[KEEP_NUM], cy[KEEP_NUM];
@@ -77,37 +78,19 @@ int ar2GetBestMatching2( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, A
     int              i, j, l;
     int              ii;
     int              ret;
-    ARUint8         *pmf;
+    ARUint16        *mfImage;
+    ARUint16         epoch;
+
+    if( work == NULL || work->xsize != xsize || work->ysize != ysize ) return -1;
 
     keep_num = 0;
 
     yts1 = mtemp->yts1;
     yts2 = mtemp->yts2;
 
-    for( ii = 0; ii < 3; ii++ ) {
-        if( search_flag[ii] == 0 ) continue;
-        if( search[ii][0] < 0 ) break;
-
-        px = (search[ii][0]/(SKIP_INTERVAL+1))*(SKIP_INTERVAL+1) + (SKIP_INTERVAL+1)/2;
-        py = (search[ii][1]/(SKIP_INTERVAL+1))*(SKIP_INTERVAL+1) + (SKIP_INTERVAL+1)/2;
-
-        sx = px - rx;
-        if( sx < 0 ) sx = 0;
-        ex = px + rx;
-        if( ex >= xsize ) ex = xsize-1;
-
-        sy = py - ry;
-        if( sy < 0 ) sy = 0;
-        ey = py + ry;
-        if( ey >= ysize ) ey = ysize-1;
-
-        for( j = sy; j <= ey; j++ ) {
-            pmf = &mfImage[j*xsize+sx];
-            for( i = sx; i <= ex; i++ ) {
-                *(pmf++) = 0;
-            }
-        }
-    }
+    // Visit status is epoch-stamped; see ar2GetBestMatching().
+    mfImage = work->mfImage;
+    epoch = ar2MatchingWorkNewEpoch( work );
 
     ret = 1;
     for( ii = 0; ii < 3; ii++ ) {      
@@ -126,8 +109,8 @@ int ar2GetBestMatching2( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, A
             for( i = px - rx; i <= px + rx; i += SKIP_INTERVAL+1 ) {
                 if( i - mtemp->xts1*AR2_TEMP_SCALE <  0     ) continue;
                 if( i + mtemp->xts2*AR2_TEMP_SCALE >= xsize ) break;
-                if( mfImage[j*xsize+i] ) continue;
-                mfImage[j*xsize+i] = 1;
+                if( mfImage[j*xsize+i] == epoch ) continue;
+                mfImage[j*xsize+i] = epoch;
                 if( ar2GetBestMatchingSubFine(img,xsize,ysize,pixFormat,mtemp,i,j,&wval) < 0 ) {
                     continue;
                 }
@@ -178,10 +161,10 @@ static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIX
     ARUint8             *p2;
     int                  sum1, sum2, sum3;
     int                  w, vlen;
-    int                  i, j;
+    int                  i, j, k;
 
     p1 = mtemp->img1[1];
-    sum1 = sum2 = sum3 = 0;
+    k = sum1 = sum2 = sum3 = 0;
     if( pixFormat == AR_PIXEL_FORMAT_MONO || pixFormat == AR_PIXEL_FORMAT_420v || pixFormat == AR_PIXEL_FORMAT_420f || pixFormat == AR_PIXEL_FORMAT_NV21 ) {
         for( j = -(mtemp->yts1); j <= mtemp->yts2; j++ ) {
             p2 = &img[((sy+j*AR2_TEMP_SCALE)*xsize + sx - mtemp->xts1*AR2_TEMP_SCALE)];
@@ -190,6 +173,7 @@ static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIX
                     sum1 += (*p2);
                     sum2 += (*p2) * (*p2);
                     sum3 += (*p2) * (*p1);
+                    k++;
                 }
                 p2+=AR2_TEMP_SCALE;
                 p1++;
@@ -206,6 +190,7 @@ static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIX
                     sum1 += w;
                     sum2 += w*w;
                     sum3 += w * (*p1);
+                    k++;
                 }
                 p2+=3*AR2_TEMP_SCALE;
                 p1++;
@@ -222,12 +207,14 @@ static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIX
                     sum1 += w;
                     sum2 += w*w;
                     sum3 += w * (*p1);
+                    k++;
                 }
                 p2+=4*AR2_TEMP_SCALE;
                 p1++;
             }
         }
         if( k == 0 ) return -1;
+    }
     else if( pixFormat == AR_PIXEL_FORMAT_ARGB || pixFormat == AR_PIXEL_FORMAT_ABGR ) {
         for( j = -(mtemp->yts1); j <= mtemp->yts2; j++ ) {
             p2 = &img[((sy+j*AR2_TEMP_SCALE)*xsize + sx - mtemp->xts1*AR2_TEMP_SCALE)*4];
@@ -237,6 +224,7 @@ static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIX
                     sum1 += w;
                     sum2 += w*w;
                     sum3 += w * (*p1);
+                    k++;
                 }
                 p2+=4*AR2_TEMP_SCALE;
                 p1++;
@@ -253,6 +241,7 @@ static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIX
                     sum1 += w;
                     sum2 += w*w;
                     sum3 += w * (*p1);
+                    k++;
                 }
                 p2+=2*AR2_TEMP_SCALE;
                 p1++;
@@ -269,6 +258,7 @@ static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIX
                     sum1 += w;
                     sum2 += w*w;
                     sum3 += w * (*p1);
+                    k++;
                 }
                 p2+=2*AR2_TEMP_SCALE;
                 p1++;
@@ -277,8 +267,8 @@ static int ar2GetBestMatchingSubFine( ARUint8 *img, int xsize, int ysize, AR_PIX
         if( k == 0 ) return -1;
     }
 
-    sum3 -= sum1 * mtemp->sum / mtemp->validNum;
-    vlen = sum2 - sum1*sum1/mtemp->validNum;
+    sum3 -= sum1 * mtemp->sum[1] / k;
+    vlen = sum2 - sum1*sum1/k;
     if( vlen == 0 ) *val = 0;
     else            *val = sum3 * 100 / mtemp->vlen[1] * 100 / (int)sqrtf((float)vlen);
 
@@ -360,6 +350,7 @@ static int ar2GetBestMatchingSubFine2( ARUint8 *img, int xsize, int ysize, AR_PI
             }
         }
         if( k == 0 ) return -1;
+    }
     else if( pixFormat == AR_PIXEL_FORMAT_ARGB || pixFormat == AR_PIXEL_FORMAT_ABGR ) {
         for( j = -(mtemp->yts1); j <= mtemp->yts2; j++ ) {
             p2 = &img[((sy+j*AR2_TEMP_SCALE)*xsize + sx - mtemp->xts1*AR2_TEMP_SCALE)*4];
@@ -89,3 +89,47 @@ nosearch3:
     search[2][1] = -1;
     return;
 }
+
+// Radius of the search window to use around each of the points returned by ar2GetSearchPoint().
+// The disagreement between the constant velocity and constant acceleration predictions measures how
+// much the motion is changing at this feature; predictErr is the recent mean distance of matches from
+// their nearest prediction (negative if not yet known).
+int ar2GetSearchRadius( int search[3][2], float predictErr, int minSize, int maxSize )
+{
+    float    d, r;
+
+    if( predictErr < 0.0F || search[0][0] < 0 || search[1][0] < 0 ) return maxSize;
+    if( minSize > maxSize ) minSize = maxSize;
+
+    if( search[2][0] >= 0 ) {
+        d = (float)sqrt( (double)((search[1][0] - search[2][0])*(search[1][0] - search[2][0])
+                                + (search[1][1] - search[2][1])*(search[1][1] - search[2][1])) );
+    }
+    else {
+        d = 0.5F * (float)sqrt( (double)((search[0][0] - search[1][0])*(search[0][0] - search[1][0])
+                                       + (search[0][1] - search[1][1])*(search[0][1] - search[1][1])) );
+    }
+    r = d + AR2_SEARCH_SIZE_ERR_FACTOR * predictErr;
+
+    if( r >= (float)maxSize ) return maxSize;
+    if( r <= (float)minSize ) return minSize;
+    return (int)ceilf( r );
+}
+
+// Distance (the larger of x and y, matching the square search window) from (x, y) to the nearest search point.
+float ar2GetSearchPointError( int search[3][2], int x, int y )
+{
+    int      dx, dy, d, dmin;
+    int      i;
+
+    dmin = -1;
+    for( i = 0; i < 3; i++ ) {
+        if( search[i][0] < 0 ) break;
+        dx = abs( x - search[i][0] );
+        dy = abs( y - search[i][1] );
+        d = (dx > dy) ? dx : dy;
+        if( dmin < 0 || d < dmin ) dmin = d;
+    }
+
+    return (float)dmin;
+}
@@ -90,22 +90,28 @@ AR2SurfaceSetT *ar2ReadSurfaceSet( const char *filename, const char *ext, ARPatt
         }
         surfaceSet->num     = i;
         surfaceSet->contNum = 0;
+        surfaceSet->predictErr = -1.0F;
     }
     else {
         surfaceSet->num     = 1;
         surfaceSet->contNum = 0;
+        surfaceSet->predictErr = -1.0F;
     }
     arMalloc(surfaceSet->surface, AR2SurfaceT, surfaceSet->num);
 
     for( i = 0; i < surfaceSet->num; i++ ) {
         ARLOGi("\n### Surface No.%d ###\n", i+1);
+        surfaceSet->surface[i].templCache = NULL;
+        surfaceSet->surface[i].featureIndex = NULL;
         if( readMode ) {
             if( get_buff(buf, 256, fp) == NULL ) break;
             if( sscanf(buf, "%s", name) != 1 ) break;
             ar2UtilRemoveExt( name );
         }
         ARLOGi("  Read ImageSet.\n");
-        surfaceSet->surface[i].imageSet = ar2ReadImageSet( name );
+        // A tiled image set, if present, is paged in as tracking needs it rather than loaded whole.
+        surfaceSet->surface[i].imageSet = ar2ReadImageSetTiled( name );
+        if( surfaceSet->surface[i].imageSet == NULL ) surfaceSet->surface[i].imageSet = ar2ReadImageSet( name );
         if( surfaceSet->surface[i].imageSet == NULL ) {
             ARLOGe("Error opening file '%s.iset'.\n", name);
             free(surfaceSet->surface);
@@ -125,6 +131,7 @@ AR2SurfaceSetT *ar2ReadSurfaceSet( const char *filename, const char *ext, ARPatt
 			if (fp) fclose(fp); //COVHI10426
             return (NULL);
         }
+        surfaceSet->surface[i].featureIndex = ar2GenFeatureIndex( surfaceSet->surface[i].featureSet );
         ARLOGi("    end.\n");
 
         if (pattHandle) {
@@ -221,6 +228,8 @@ int ar2FreeSurfaceSet( AR2SurfaceSetT **surfaceSet )
             ar2FreeMarkerSet( &((*surfaceSet)->surface[i].markerSet) );
         }
         free( (*surfaceSet)->surface[i].jpegName );
+        if( (*surfaceSet)->surface[i].templCache != NULL ) ar2FreeTemplateCache( &((*surfaceSet)->surface[i].templCache) );
+        if( (*surfaceSet)->surface[i].featureIndex != NULL ) ar2FreeFeatureIndex( &((*surfaceSet)->surface[i].featureIndex) );
     }
     free( (*surfaceSet)->surface );
     free( *surfaceSet );
@@ -236,6 +245,7 @@ int ar2SetInitTrans( AR2SurfaceSetT *surfaceSet, float  trans[3][4] )
 
     if( surfaceSet == NULL ) return -1;
     surfaceSet->contNum = 1;
+    surfaceSet->predictErr = -1.0F;
     for( j = 0; j < 3; j++ ) {
         for( i = 0; i < 4; i++ ) surfaceSet->trans1[j][i] = trans[j][i];
     }
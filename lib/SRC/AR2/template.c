@@ -38,6 +38,7 @@
 #include <AR/ar.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <AR2/config.h>
 #include <AR2/coord.h>
@@ -106,27 +107,212 @@ int ar2FreeTemplate2( AR2Template2T *templ2 )
 }
 #endif
 
+// Number of template samples warped together. Keeps the working arrays on the stack whatever the template size.
+#define AR2_TEMPLATE_WARP_CHUNK     16
+
+// Get g, mapping homogeneous ideal screen coordinates to reference image pixel coordinates.
+// This is the inverse of the marker-to-screen homography in wtrans, followed by the marker mm to image pixel scaling.
+static int ar2GetTemplateWarp( const float wtrans[3][4], const AR2ImageT *image, float g[3][3] )
+{
+    double   h[3][3], ih[3][3];
+    double   det, k;
+    int      i;
+
+    for( i = 0; i < 3; i++ ) {
+        h[i][0] = wtrans[i][0];
+        h[i][1] = wtrans[i][1];
+        h[i][2] = wtrans[i][3];
+    }
+    ih[0][0] = h[1][1]*h[2][2] - h[1][2]*h[2][1];
+    ih[0][1] = h[0][2]*h[2][1] - h[0][1]*h[2][2];
+    ih[0][2] = h[0][1]*h[1][2] - h[0][2]*h[1][1];
+    ih[1][0] = h[1][2]*h[2][0] - h[1][0]*h[2][2];
+    ih[1][1] = h[0][0]*h[2][2] - h[0][2]*h[2][0];
+    ih[1][2] = h[0][2]*h[1][0] - h[0][0]*h[1][2];
+    ih[2][0] = h[1][0]*h[2][1] - h[1][1]*h[2][0];
+    ih[2][1] = h[0][1]*h[2][0] - h[0][0]*h[2][1];
+    ih[2][2] = h[0][0]*h[1][1] - h[0][1]*h[1][0];
+    det = h[0][0]*ih[0][0] + h[0][1]*ih[1][0] + h[0][2]*ih[2][0];
+    if( det == 0.0 ) return -1;
+
+    k = image->dpi / 25.4;
+    for( i = 0; i < 3; i++ ) {
+        g[0][i] = (float)( k*ih[0][i]/det );
+        g[1][i] = (float)( (image->ysize*ih[2][i] - k*ih[1][i])/det );
+        g[2][i] = (float)( ih[2][i]/det );
+    }
+
+    return 0;
+}
+
+// Reference image coordinates of the template sample at observed screen position (ix2, iy2).
+static int ar2GetTemplateWarpPoint( const ARParamLT *cparamLT, const float g[3][3], int ix2, int iy2, float *u, float *v )
+{
+    float    sx, sy, w;
+
+    if( cparamLT != NULL ) {
+        if( arParamObserv2IdealLTf( &cparamLT->paramLTf, (float)ix2, (float)iy2, &sx, &sy) < 0 ) return -1;
+    }
+    else {
+        sx = (float)ix2;
+        sy = (float)iy2;
+    }
+    w = g[2][0]*sx + g[2][1]*sy + g[2][2];
+    if( w == 0.0F ) return -1;
+    *u = (g[0][0]*sx + g[0][1]*sy + g[0][2]) / w;
+    *v = (g[1][0]*sx + g[1][1]*sy + g[1][2]) / w;
+
+    return 0;
+}
+
+// Fill templ by warping the reference image around observed screen position (ix, iy).
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+static int ar2WarpTemplate( const ARParamLT *cparamLT, const float g[3][3], const AR2ImageT *image, int blurLevel,
+                            int ix, int iy, AR2TemplateT *templ )
+#else
+static int ar2WarpTemplate( const ARParamLT *cparamLT, const float g[3][3], const AR2ImageT *image,
+                            int ix, int iy, AR2TemplateT *templ )
+#endif
+{
+    float    xs[AR2_TEMPLATE_WARP_CHUNK], ys[AR2_TEMPLATE_WARP_CHUNK];
+    float    us[AR2_TEMPLATE_WARP_CHUNK], vs[AR2_TEMPLATE_WARP_CHUNK], ws[AR2_TEMPLATE_WARP_CHUNK];
+    int      ok[AR2_TEMPLATE_WARP_CHUNK];
+    ARUint8 *src;
+    ARUint16 *img1;
+    int      sum, sum2;
+    int      vlen;
+    int      pixel;
+    int      iu, iv;
+    int      ix2, iy2;
+    int      i, i0, j, k, n;
+
+    src = image->imgBW;
+    img1 = templ->img1;
+    sum = sum2 = 0;
+    k = 0;
+    iy2 = iy - (templ->yts1)*AR2_TEMP_SCALE;
+    for( j = -(templ->yts1); j <= templ->yts2; j++, iy2+=AR2_TEMP_SCALE ) {
+        for( i0 = -(templ->xts1); i0 <= templ->xts2; i0 += n ) {
+            n = templ->xts2 - i0 + 1;
+            if( n > AR2_TEMPLATE_WARP_CHUNK ) n = AR2_TEMPLATE_WARP_CHUNK;
+
+            // Undistort. A table lookup per sample.
+            ix2 = ix + i0*AR2_TEMP_SCALE;
+            for( i = 0; i < n; i++, ix2+=AR2_TEMP_SCALE ) {
+                if( cparamLT != NULL ) {
+                    ok[i] = (arParamObserv2IdealLTf( &cparamLT->paramLTf, (float)ix2, (float)iy2, &xs[i], &ys[i]) >= 0);
+                }
+                else {
+                    xs[i] = (float)ix2;
+                    ys[i] = (float)iy2;
+                    ok[i] = 1;
+                }
+            }
+
+            // Apply the homography. Straight-line arithmetic over the chunk, so the compiler can vectorise it.
+            for( i = 0; i < n; i++ ) {
+                ws[i] = g[2][0]*xs[i] + g[2][1]*ys[i] + g[2][2];
+                us[i] = g[0][0]*xs[i] + g[0][1]*ys[i] + g[0][2];
+                vs[i] = g[1][0]*xs[i] + g[1][1]*ys[i] + g[1][2];
+            }
+
+            // Sample.
+            for( i = 0; i < n; i++ ) {
+                if( !ok[i] || ws[i] == 0.0F ) {
+                    *(img1++) = AR2_TEMPLATE_NULL_PIXEL;
+                    continue;
+                }
+                iu = (int)(us[i]/ws[i] + 0.5F);
+                iv = (int)(vs[i]/ws[i] + 0.5F);
+                if( iu < 0 || iu >= image->xsize || iv < 0 || iv >= image->ysize ) {
+                    *(img1++) = AR2_TEMPLATE_NULL_PIXEL;
+                    continue;
+                }
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+                pixel = (blurLevel == 0) ? src[iv*image->xsize + iu] : ar2GetImageBlurValue( image, blurLevel, iu, iv );
+#else
+                pixel = (src != NULL) ? src[iv*image->xsize + iu] : ar2GetImagePixel( image, iu, iv ); // NULL if tiled.
+#endif
+                *(img1++) = (ARUint16)pixel;
+                sum  += pixel;
+                sum2 += pixel*pixel;
+                k++;
+            }
+        }
+    }
+    if( k == 0 ) return -1;
+
+    vlen = sum2 - sum*sum/k;
+    templ->vlen = (int)sqrtf((float)vlen);
+    templ->sum = sum;
+    templ->validNum = k;
+
+    return 0;
+}
+
+// Reference image footprint of the template centred on (ix, iy): the centre sample, and the four corner samples relative to it.
+static int ar2GetTemplateFootprint( const ARParamLT *cparamLT, const float g[3][3], int ix, int iy, AR2TemplateT *templ,
+                                    float centre[2], float corner[4][2] )
+{
+    int      cx[2], cy[2];
+    int      i;
+
+    if( ar2GetTemplateWarpPoint( cparamLT, g, ix, iy, &centre[0], &centre[1] ) < 0 ) return -1;
+    cx[0] = ix - templ->xts1*AR2_TEMP_SCALE;
+    cx[1] = ix + templ->xts2*AR2_TEMP_SCALE;
+    cy[0] = iy - templ->yts1*AR2_TEMP_SCALE;
+    cy[1] = iy + templ->yts2*AR2_TEMP_SCALE;
+    for( i = 0; i < 4; i++ ) {
+        if( ar2GetTemplateWarpPoint( cparamLT, g, cx[i&1], cy[i>>1], &corner[i][0], &corner[i][1] ) < 0 ) return -1;
+        corner[i][0] -= centre[0];
+        corner[i][1] -= centre[1];
+    }
+
+    return 0;
+}
+
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 int ar2SetTemplateSub( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
                        AR2FeaturePointsT *featurePoints, int num, int blurLevel,
                        AR2TemplateT *templ )
+{
+    return ar2SetTemplateSubCached( cparamLT, trans, imageSet, featurePoints, num, blurLevel, NULL, 0, 0.0F, 0.0F, templ );
+}
 #else
 int ar2SetTemplateSub( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
                        AR2FeaturePointsT *featurePoints, int num,
                        AR2TemplateT *templ )
+{
+    return ar2SetTemplateSubCached( cparamLT, trans, imageSet, featurePoints, num, NULL, 0, 0.0F, 0.0F, templ );
+}
+#endif
+
+// As ar2SetTemplateSub(), but reuses the template stored in cache->entry[level][num] while the reference image
+// footprint of the template stays within posTol (centre) and shapeTol (corners, relative to centre) pixels of the
+// footprint it was warped for. Otherwise the template is warped afresh and stored. Pass cache NULL or posTol 0 to skip the cache.
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+int ar2SetTemplateSubCached( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
+                             AR2FeaturePointsT *featurePoints, int num, int blurLevel,
+                             AR2TemplateCacheT *cache, int level, float posTol, float shapeTol,
+                             AR2TemplateT *templ )
+#else
+int ar2SetTemplateSubCached( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
+                             AR2FeaturePointsT *featurePoints, int num,
+                             AR2TemplateCacheT *cache, int level, float posTol, float shapeTol,
+                             AR2TemplateT *templ )
 #endif
 {
+    AR2TemplateCacheEntryT *entry;
+    const AR2ImageT *image;
     float    mx, my;
     float    sx, sy;
     float    wtrans[3][4];
-    ARUint16 *img1;
-    int      sum, sum2;
-    int      vlen;
-    ARUint8  pixel;
+    float    g[3][3];
+    float    centre[2], corner[4][2];
+    float    dx, dy;
     int      ix, iy;
-    int      ix2, iy2;
-    int      ret;
-    int      i, j, k;
+    int      size;
+    int      i;
 
     if( cparamLT != NULL ) {
 #ifdef ARDOUBLE_IS_FLOAT
@@ -139,79 +325,121 @@ int ar2SetTemplateSub( const ARParamLT *cparamLT, const float  trans[3][4], AR2I
         my = featurePoints->coord[num].my;
         if( ar2MarkerCoord2ScreenCoord( NULL, (const float (*)[4])wtrans, mx, my, &mx, &my ) < 0 ) return -1;
         if( arParamIdeal2ObservLTf( &cparamLT->paramLTf, mx, my, &sx, &sy ) < 0 ) return -1;
-        ix = (int)(sx + 0.5F);
-        iy = (int)(sy + 0.5F);
+    }
+    else {
+        for( i = 0; i < 3; i++ ) {
+            wtrans[i][0] = trans[i][0]; wtrans[i][1] = trans[i][1]; wtrans[i][2] = trans[i][2]; wtrans[i][3] = trans[i][3];
+        }
+        mx = featurePoints->coord[num].mx;
+        my = featurePoints->coord[num].my;
+        if( ar2MarkerCoord2ScreenCoord( NULL, trans, mx, my, &sx, &sy ) < 0 ) return -1;
+    }
+    ix = (int)(sx + 0.5F);
+    iy = (int)(sy + 0.5F);
 
-        img1 = templ->img1;
-        sum = sum2 = 0;
-        k = 0;
-        iy2 = iy - (templ->yts1)*AR2_TEMP_SCALE;
-        for( j = -(templ->yts1); j <= templ->yts2; j++, iy2+=AR2_TEMP_SCALE ) {
-            ix2 = ix - (templ->xts1)*AR2_TEMP_SCALE;
-            for( i = -(templ->xts1); i <= templ->xts2; i++, ix2+=AR2_TEMP_SCALE ) {
+    image = imageSet->scale[featurePoints->scale];
+    if( ar2GetTemplateWarp( (const float (*)[4])wtrans, image, g ) < 0 ) return -1;
 
-                if( arParamObserv2IdealLTf( &cparamLT->paramLTf, (float)ix2, (float)iy2, &sx, &sy) < 0 ) {
-                    *(img1++) = AR2_TEMPLATE_NULL_PIXEL;
-                    continue;
-                }
+    entry = NULL;
+    if( cache != NULL && posTol > 0.0F
+     && cache->xts1 == templ->xts1 && cache->xts2 == templ->xts2 && cache->yts1 == templ->yts1 && cache->yts2 == templ->yts2
+     && level >= 0 && level < cache->num && num < cache->entryNum[level]
+     && ar2GetTemplateFootprint( cparamLT, (const float (*)[3])g, ix, iy, templ, centre, corner ) == 0 ) {
+        entry = &(cache->entry[level][num]);
+    }
+    size = templ->xsize*templ->ysize;
 
-                ret = ar2GetImageValue( NULL, (const float (*)[4])wtrans, imageSet->scale[featurePoints->scale],
+    if( entry != NULL && entry->valid
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                                       sx, sy, blurLevel, &pixel );
-#else
-                                        sx, sy, &pixel );
+     && entry->blurLevel == blurLevel
 #endif
-                if( ret < 0 ) {
-                    *(img1++) = AR2_TEMPLATE_NULL_PIXEL;
-                }
-                else {
-                    *(img1++) = pixel;
-                    sum  += pixel;
-                    sum2 += pixel*pixel;
-                    k++;
-                }
+      ) {
+        dx = centre[0] - entry->centre[0];
+        dy = centre[1] - entry->centre[1];
+        if( dx*dx + dy*dy <= posTol*posTol ) {
+            for( i = 0; i < 4; i++ ) {
+                dx = corner[i][0] - entry->corner[i][0];
+                dy = corner[i][1] - entry->corner[i][1];
+                if( dx*dx + dy*dy > shapeTol*shapeTol ) break;
+            }
+            if( i == 4 ) {
+                memcpy( templ->img1, entry->img1, size*sizeof(ARUint16) );
+                templ->vlen     = entry->vlen;
+                templ->sum      = entry->sum;
+                templ->validNum = entry->validNum;
+                return 0;
             }
         }
     }
-    else {
-        mx = featurePoints->coord[num].mx;
-        my = featurePoints->coord[num].my;
-        if( ar2MarkerCoord2ScreenCoord( NULL, trans, mx, my, &sx, &sy ) < 0 ) return -1;
-        ix = (int)(sx + 0.5F);
-        iy = (int)(sy + 0.5F);
-        
-        img1 = templ->img1;
-        sum = sum2 = 0;
-        k = 0;
-        iy2 = iy - (templ->yts1)*AR2_TEMP_SCALE;
-        for( j = -(templ->yts1); j <= templ->yts2; j++, iy2+=AR2_TEMP_SCALE ) {
-            ix2 = ix - (templ->xts1)*AR2_TEMP_SCALE;
-            for( i = -(templ->xts1); i <= templ->xts2; i++, ix2+=AR2_TEMP_SCALE ) {
-                
-                ret = ar2GetImageValue( NULL, trans, imageSet->scale[featurePoints->scale],
+
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                                       (float)ix2, (float)iy2, blurLevel, &pixel );
+    if( ar2WarpTemplate( cparamLT, (const float (*)[3])g, image, blurLevel, ix, iy, templ ) < 0 ) {
 #else
-                                       (float)ix2, (float)iy2, &pixel );
+    if( ar2WarpTemplate( cparamLT, (const float (*)[3])g, image, ix, iy, templ ) < 0 ) {
 #endif
-                if( ret < 0 ) {
-                    *(img1++) = AR2_TEMPLATE_NULL_PIXEL;
-                }
-                else {
-                    *(img1++) = pixel;
-                    sum  += pixel;
-                    sum2 += pixel*pixel;
-                    k++;
-                }
+        if( entry != NULL ) entry->valid = 0;
+        return -1;
+    }
+
+    if( entry != NULL ) {
+        if( entry->img1 == NULL ) entry->img1 = (ARUint16 *)malloc( size*sizeof(ARUint16) );
+        if( entry->img1 != NULL ) {
+            memcpy( entry->img1, templ->img1, size*sizeof(ARUint16) );
+            entry->vlen     = templ->vlen;
+            entry->sum      = templ->sum;
+            entry->validNum = templ->validNum;
+            entry->centre[0] = centre[0];
+            entry->centre[1] = centre[1];
+            for( i = 0; i < 4; i++ ) {
+                entry->corner[i][0] = corner[i][0];
+                entry->corner[i][1] = corner[i][1];
             }
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+            entry->blurLevel = blurLevel;
+#endif
+            entry->valid = 1;
         }
     }
-    if( k == 0 ) return -1;
 
-    vlen = sum2 - sum*sum/k;
-    templ->vlen = (int)sqrtf((float)vlen);
-    templ->sum = sum;
-    templ->validNum = k;
+    return 0;
+}
+
+AR2TemplateCacheT *ar2GenTemplateCache( AR2FeatureSetT *featureSet, int ts1, int ts2 )
+{
+    AR2TemplateCacheT *cache;
+    int                i;
+
+    if( featureSet == NULL ) return NULL;
+
+    arMalloc( cache, AR2TemplateCacheT, 1 );
+    cache->num = featureSet->num;
+    cache->xts1 = cache->yts1 = ts1;
+    cache->xts2 = cache->yts2 = ts2;
+    arMalloc( cache->entry, AR2TemplateCacheEntryT *, cache->num );
+    arMalloc( cache->entryNum, int, cache->num );
+    for( i = 0; i < cache->num; i++ ) {
+        // Entries start zeroed, i.e. invalid and with no template storage.
+        cache->entryNum[i] = featureSet->list[i].num;
+        arMallocClear( cache->entry[i], AR2TemplateCacheEntryT, (cache->entryNum[i] > 0 ? cache->entryNum[i] : 1) );
+    }
+
+    return cache;
+}
+
+int ar2FreeTemplateCache( AR2TemplateCacheT **cache )
+{
+    int     i, j;
+
+    if( cache == NULL || *cache == NULL ) return -1;
+
+    for( i = 0; i < (*cache)->num; i++ ) {
+        for( j = 0; j < (*cache)->entryNum[i]; j++ ) free( (*cache)->entry[i][j].img1 );
+        free( (*cache)->entry[i] );
+    }
+    free( (*cache)->entry );
+    free( (*cache)->entryNum );
+    free( *cache );
+    *cache = NULL;
 
     return 0;
 }
@@ -235,7 +463,11 @@ int ar2SetTemplate2Sub( const ARParamLT *cparamLT, const float  trans[3][4], AR2
     int      i, j, k;
 
     if( cparamLT != NULL ) {
+#ifdef ARDOUBLE_IS_FLOAT
         arUtilMatMul( cparamLT->param.mat, trans, wtrans );
+#else
+        arUtilMatMuldff( cparamLT->param.mat, trans, wtrans );
+#endif
 
         mx = featurePoints->coord[num].mx;
         my = featurePoints->coord[num].my;
@@ -333,8 +565,8 @@ int ar2SetTemplate2Sub( const ARParamLT *cparamLT, const float  trans[3][4], AR2
     templ2->vlen[1] = (int)sqrtf((float)vlen2); 
     templ2->vlen[2] = (int)sqrtf((float)vlen3);
     templ2->sum[0] = sum11;
-    templ2->sum[0] = sum21;
-    templ2->sum[0] = sum31;
+    templ2->sum[1] = sum21;
+    templ2->sum[2] = sum31;
     templ2->validNum = k;
 
     return 0;
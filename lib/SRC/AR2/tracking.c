@@ -62,15 +62,19 @@ static int    extractVisibleFeaturesHomography( int xsize, int ysize, float  tra
                                           AR2TemplateCandidateT candidate[],
                                           AR2TemplateCandidateT candidate2[] );
 static int    getDeltaS( float  H[8], float  dU[], float  J_U_H[][8], int n );
+static float  ar2GetTransMatAdaptive    ( AR2HandleT *ar2Handle, float  initConv[3][4], int num, float  conv[3][4] );
+static int    ar2GetRobustStartLevel    ( AR2HandleT *ar2Handle, float  conv[3][4], int num );
 
 
 int ar2Tracking( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, ARUint8 *dataPtr, float  trans[3][4], float  *err )
 {
     AR2TemplateCandidateT  *candidatePtr;
     AR2TemplateCandidateT  *cp[AR2_THREAD_MAX];
+    ARUint8                *coarsePtr;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     float                   aveBlur;
 #endif
+    float                   avePredictErr;
     int                     num, num2;
     int                     i, j, k;
 
@@ -87,6 +91,29 @@ int ar2Tracking( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, ARUint8 *dat
         arUtilMatMulf( (const float (*)[4])surfaceSet->trans1, (const float (*)[4])surfaceSet->surface[i].trans, ar2Handle->wtrans1[i] );
         if( surfaceSet->contNum > 1 ) arUtilMatMulf( (const float (*)[4])surfaceSet->trans2, (const float (*)[4])surfaceSet->surface[i].trans, ar2Handle->wtrans2[i] );
         if( surfaceSet->contNum > 2 ) arUtilMatMulf( (const float (*)[4])surfaceSet->trans3, (const float (*)[4])surfaceSet->surface[i].trans, ar2Handle->wtrans3[i] );
+
+        // Template cache entries are owned by the surface; each feature is searched by at most one thread per frame.
+        if( surfaceSet->surface[i].templCache != NULL
+         && (surfaceSet->surface[i].templCache->xts1 != ar2Handle->templateSize1 || surfaceSet->surface[i].templCache->xts2 != ar2Handle->templateSize2) ) {
+            ar2FreeTemplateCache( &(surfaceSet->surface[i].templCache) );
+        }
+        if( surfaceSet->surface[i].templCache == NULL && ar2Handle->templateCachePosTol > 0.0F ) {
+            surfaceSet->surface[i].templCache = ar2GenTemplateCache( surfaceSet->surface[i].featureSet, ar2Handle->templateSize1, ar2Handle->templateSize2 );
+        }
+    }
+
+    // Half-resolution frame for coarse-to-fine search, shared read-only by all tracking threads.
+    coarsePtr = NULL;
+    if( ar2Handle->coarseSearch == AR2_COARSE_SEARCH_ENABLE && ar2Handle->searchSize >= AR2_COARSE_SEARCH_MIN_SIZE
+     && (ar2Handle->pixFormat == AR_PIXEL_FORMAT_MONO || ar2Handle->pixFormat == AR_PIXEL_FORMAT_420v
+      || ar2Handle->pixFormat == AR_PIXEL_FORMAT_420f || ar2Handle->pixFormat == AR_PIXEL_FORMAT_NV21) ) {
+        if( ar2Handle->coarseImage == NULL ) {
+            ar2Handle->coarseImage = (ARUint8 *)malloc( ar2Handle->xsize * ar2Handle->ysize );
+        }
+        if( ar2Handle->coarseImage != NULL
+         && ar2GetCoarseMatchingImage( dataPtr, ar2Handle->xsize, ar2Handle->ysize, ar2Handle->coarseImage ) == 0 ) {
+            coarsePtr = ar2Handle->coarseImage;
+        }
     }
 
     if( ar2Handle->trackingMode == AR2_TRACKING_6DOF ) {
@@ -100,6 +127,7 @@ int ar2Tracking( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, ARUint8 *dat
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     aveBlur = 0.0F;
 #endif
+    avePredictErr = 0.0F;
     i = 0; // Counts up to searchFeatureNum.
     num = 0;
     while( i < ar2Handle->searchFeatureNum ) {
@@ -124,6 +152,7 @@ int ar2Tracking( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, ARUint8 *dat
             ar2Handle->arg[j].surfaceSet = surfaceSet;
             ar2Handle->arg[j].candidate  = &(candidatePtr[k]);
             ar2Handle->arg[j].dataPtr    = dataPtr;
+            ar2Handle->arg[j].coarsePtr  = coarsePtr;
 
             threadStartSignal( ar2Handle->threadHandle[j] );
             num2++;
@@ -167,81 +196,35 @@ int ar2Tracking( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, ARUint8 *dat
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
                 aveBlur += ar2Handle->arg[j].result.blurLevel;
 #endif
+                avePredictErr += ar2Handle->arg[j].result.predictErr;
                 num++;
             }
         }
     }
+    // Tracking threads are idle, so image and blur tiles not used recently can be released.
+    for( i = 0; i < surfaceSet->num; i++ ) {
+        ar2TrimImageSetTiles( surfaceSet->surface[i].imageSet );
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+        ar2TrimImageSetBlur( surfaceSet->surface[i].imageSet );
+#endif
+    }
     for( i = 0; i < num; i++ ) {
         surfaceSet->prevFeature[i] = ar2Handle->usedFeature[i];
     }
     surfaceSet->prevFeature[num].flag = -1;
 //ARLOG("------\nNum = %d\n", num);
 
-    if( ar2Handle->trackingMode == AR2_TRACKING_6DOF ) {
-        if( num < 3 ) {
-            surfaceSet->contNum = 0;
-            return -3;
-        }
-        *err = ar2GetTransMat( ar2Handle->icpHandle, surfaceSet->trans1, ar2Handle->pos2d, ar2Handle->pos3d, num, trans, 0 );
-//ARLOG("outlier  0%%: err = %f, num = %d\n", *err, num);
-        if( *err > ar2Handle->trackingThresh ) {
-            icpSetInlierProbability( ar2Handle->icpHandle, 0.8F );
-            *err = ar2GetTransMat( ar2Handle->icpHandle, trans, ar2Handle->pos2d, ar2Handle->pos3d, num, trans, 1 );
-//ARLOG("outlier 20%%: err = %f, num = %d\n", *err, num);
-            if( *err > ar2Handle->trackingThresh ) {
-                icpSetInlierProbability( ar2Handle->icpHandle, 0.6F );
-                *err = ar2GetTransMat( ar2Handle->icpHandle, trans, ar2Handle->pos2d, ar2Handle->pos3d, num, trans, 1 );
-//ARLOG("outlier 60%%: err = %f, num = %d\n", *err, num);
-                if( *err > ar2Handle->trackingThresh ) {
-                    icpSetInlierProbability( ar2Handle->icpHandle, 0.4F );
-                    *err = ar2GetTransMat( ar2Handle->icpHandle, trans, ar2Handle->pos2d, ar2Handle->pos3d, num, trans, 1 );
-//ARLOG("outlier 60%%: err = %f, num = %d\n", *err, num);
-                    if( *err > ar2Handle->trackingThresh ) {
-                        icpSetInlierProbability( ar2Handle->icpHandle, 0.0F );
-                        *err = ar2GetTransMat( ar2Handle->icpHandle, trans, ar2Handle->pos2d, ar2Handle->pos3d, num, trans, 1 );
-//ARLOG("outlier Max: err = %f, num = %d\n", *err, num);
-                        if( *err > ar2Handle->trackingThresh ) {
-                            surfaceSet->contNum = 0;
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                            if( ar2Handle->blurMethod == AR2_ADAPTIVE_BLUR ) ar2Handle->blurLevel = AR2_DEFAULT_BLUR_LEVEL; // Reset the blurLevel.
-#endif
-                            return -4;
-                        }
-                    }
-                }
-            }
-        }
+    if( num < 3 ) {
+        surfaceSet->contNum = 0;
+        return -3;
     }
-    else {
-        if( num < 3 ) {
-            surfaceSet->contNum = 0;
-            return -3;
-        }
-        *err = ar2GetTransMatHomography( surfaceSet->trans1, ar2Handle->pos2d, ar2Handle->pos3d, num, trans, 0, 1.0F );
-//ARLOG("outlier  0%%: err = %f, num = %d\n", *err, num);
-        if( *err > ar2Handle->trackingThresh ) {
-            *err = ar2GetTransMatHomography( trans, ar2Handle->pos2d, ar2Handle->pos3d, num, trans, 1, 0.8F );
-//ARLOG("outlier 20%%: err = %f, num = %d\n", *err, num);
-            if( *err > ar2Handle->trackingThresh ) {
-                *err = ar2GetTransMatHomography( trans, ar2Handle->pos2d, ar2Handle->pos3d, num, trans, 1, 0.6F );
-//ARLOG("outlier 40%%: err = %f, num = %d\n", *err, num);
-                if( *err > ar2Handle->trackingThresh ) {
-                    *err = ar2GetTransMatHomography( trans, ar2Handle->pos2d, ar2Handle->pos3d, num, trans, 1, 0.4F );
-//ARLOG("outlier 60%%: err = %f, num = %d\n", *err, num);
-                    if( *err > ar2Handle->trackingThresh ) {
-                        *err = ar2GetTransMatHomography( trans, ar2Handle->pos2d, ar2Handle->pos3d, num, trans, 1, 0.0F );
-//ARLOG("outlier Max: err = %f, num = %d\n", *err, num);
-                        if( *err > ar2Handle->trackingThresh ) {
-                            surfaceSet->contNum = 0;
+    *err = ar2GetTransMatAdaptive( ar2Handle, surfaceSet->trans1, num, trans );
+    if( *err > ar2Handle->trackingThresh ) {
+        surfaceSet->contNum = 0;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                            if( ar2Handle->blurMethod == AR2_ADAPTIVE_BLUR ) ar2Handle->blurLevel = AR2_DEFAULT_BLUR_LEVEL; // Reset the blurLevel.
+        if( ar2Handle->blurMethod == AR2_ADAPTIVE_BLUR ) ar2Handle->blurLevel = AR2_DEFAULT_BLUR_LEVEL; // Reset the blurLevel.
 #endif
-                            return -4;
-                        }
-                    }
-                }
-            }
-        }
+        return -4;
     }
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
@@ -253,6 +236,11 @@ int ar2Tracking( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, ARUint8 *dat
     }
 #endif
 
+    // Smoothed prediction error, from which adaptive search windows are sized.
+    avePredictErr /= num;
+    if( surfaceSet->predictErr < 0.0F ) surfaceSet->predictErr = avePredictErr;
+    else                                surfaceSet->predictErr = 0.5F*(surfaceSet->predictErr + avePredictErr);
+
     surfaceSet->contNum++;
     for( j = 0; j < 3; j++ ) {
         for( i = 0; i < 4; i++ ) surfaceSet->trans3[j][i] = surfaceSet->trans2[j][i];
@@ -267,26 +255,73 @@ int ar2Tracking( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, ARUint8 *dat
     return 0;
 }
 
+// Bounds of the observed image, in ideal (undistorted) screen coordinates, with a margin for the approximation.
+static void getIdealScreenBounds( const ARParamLT *cparamLT, float bounds[4] )
+{
+    float       ix, iy;
+    float       mx, my;
+    int         i;
+
+    bounds[0] = bounds[1] =  1e10f;
+    bounds[2] = bounds[3] = -1e10f;
+    for( i = 0; i < 9; i++ ) {
+        if( i == 4 ) continue; // Centre.
+        if( arParamObserv2IdealLTf( &cparamLT->paramLTf, (float)((i % 3) * (cparamLT->param.xsize - 1)) / 2, (float)((i / 3) * (cparamLT->param.ysize - 1)) / 2, &ix, &iy ) < 0 ) {
+            // Can't bound; disable culling.
+            bounds[0] = bounds[1] = -1e10f;
+            bounds[2] = bounds[3] =  1e10f;
+            return;
+        }
+        if( ix < bounds[0] ) bounds[0] = ix;
+        if( iy < bounds[1] ) bounds[1] = iy;
+        if( ix > bounds[2] ) bounds[2] = ix;
+        if( iy > bounds[3] ) bounds[3] = iy;
+    }
+    mx = cparamLT->param.xsize * 0.05f;
+    my = cparamLT->param.ysize * 0.05f;
+    bounds[0] -= mx;
+    bounds[1] -= my;
+    bounds[2] += mx;
+    bounds[3] += my;
+}
+
 static int extractVisibleFeatures(const ARParamLT *cparamLT, const float  trans1[][3][4], AR2SurfaceSetT *surfaceSet,
                                   AR2TemplateCandidateT candidate[],  // candidates inside DPI range of [mindpi, maxdpi].
                                   AR2TemplateCandidateT candidate2[]) // candidates inside DPI range of [mindpi/2, maxdpi*2].
 {
     float       trans2[3][4];
+    float       wtrans[3][4];
+    float       bounds[4];
     float       sx, sy;
     float       wpos[2], w[2];
     float       vdir[3], vlen;
+    int        *visible;
     int         xsize, ysize;
-    int         i, j, k, l, l2;
+    int         i, j, k, l, l2, n, v;
 
     xsize = cparamLT->param.xsize;
     ysize = cparamLT->param.ysize;
+    getIdealScreenBounds( cparamLT, bounds );
 
     l = l2 = 0;
     for( i = 0; i < surfaceSet->num; i++ ) {
         for(j=0;j<3;j++) for(k=0;k<4;k++) trans2[j][k] = trans1[i][j][k];
 
+        // Cull the surface's feature index against the view, so only features in potentially visible cells are projected.
+        if( surfaceSet->surface[i].featureIndex == NULL ) {
+            surfaceSet->surface[i].featureIndex = ar2GenFeatureIndex( surfaceSet->surface[i].featureSet );
+        }
+#ifdef ARDOUBLE_IS_FLOAT
+        arUtilMatMul( cparamLT->param.mat, (const float (*)[4])trans2, wtrans );
+#else
+        arUtilMatMuldff( cparamLT->param.mat, (const float (*)[4])trans2, wtrans );
+#endif
+        ar2SetFeatureIndexVisibility( surfaceSet->surface[i].featureIndex, (const float (*)[4])wtrans, bounds[0], bounds[1], bounds[2], bounds[3] );
+
         for( j = 0; j < surfaceSet->surface[i].featureSet->num; j++ ) {
-            for( k = 0; k < surfaceSet->surface[i].featureSet->list[j].num; k++ ) {
+            n = ar2GetFeatureIndexVisible( surfaceSet->surface[i].featureIndex, j, &visible );
+            for( v = 0; v < n; v++ ) {
+                k = visible[v];
 
                 if( ar2MarkerCoord2ScreenCoord2( cparamLT, (const float (*)[4])trans2,
                                                  surfaceSet->surface[i].featureSet->list[j].coord[k].mx,
@@ -362,14 +397,22 @@ static int extractVisibleFeaturesHomography(int xsize, int ysize, float  trans1[
     float       sx, sy;
     float       wpos[2], w[2];
     //float       vdir[3], vlen;
-    int         i, j, k, l, l2;
+    int        *visible;
+    int         i, j, k, l, l2, n, v;
 
     l = l2 = 0;
     for( i = 0; i < surfaceSet->num; i++ ) {
         for(j=0;j<3;j++) for(k=0;k<4;k++) trans2[j][k] = trans1[i][j][k];
 
+        if( surfaceSet->surface[i].featureIndex == NULL ) {
+            surfaceSet->surface[i].featureIndex = ar2GenFeatureIndex( surfaceSet->surface[i].featureSet );
+        }
+        ar2SetFeatureIndexVisibility( surfaceSet->surface[i].featureIndex, (const float (*)[4])trans2, -1.0f, -1.0f, (float)xsize, (float)ysize );
+
         for( j = 0; j < surfaceSet->surface[i].featureSet->num; j++ ) {
-            for( k = 0; k < surfaceSet->surface[i].featureSet->list[j].num; k++ ) {
+            n = ar2GetFeatureIndexVisible( surfaceSet->surface[i].featureIndex, j, &visible );
+            for( v = 0; v < n; v++ ) {
+                k = visible[v];
 
                 if( ar2MarkerCoord2ScreenCoord2( NULL, (const float (*)[4])trans2,
                                                  surfaceSet->surface[i].featureSet->list[j].coord[k].mx,
@@ -439,6 +482,110 @@ static int extractVisibleFeaturesHomography(int xsize, int ysize, float  trans1[
     return 0;
 }
 
+#define     K2_FACTOR     4.0F
+
+static int compE( const void *a, const void *b )
+{
+    float   c;
+    c = *(float  *)a - *(float  *)b;
+    if( c < 0.0F ) return -1;
+    if( c > 0.0F ) return  1;
+    return 0;
+}
+
+// Pose from the matched features in ar2Handle->pos2d/pos3d. A plain least-squares fit is tried first; if its error
+// exceeds trackingThresh, robust fits are run with the inlier probabilities in ar2Handle->robustSchedule, each starting
+// from the last successful fit, until one meets trackingThresh. Levels admitting more points than the residuals of
+// the plain fit suggest are inliers are skipped.
+static float ar2GetTransMatAdaptive( AR2HandleT *ar2Handle, float  initConv[3][4], int num, float  conv[3][4] )
+{
+    float    conv2[3][4];
+    float    err, err2;
+    int      level;
+    int      i, j;
+
+    if( ar2Handle->trackingMode == AR2_TRACKING_6DOF ) {
+        err = ar2GetTransMat( ar2Handle->icpHandle, initConv, ar2Handle->pos2d, ar2Handle->pos3d, num, conv, 0 );
+    }
+    else {
+        err = ar2GetTransMatHomography( initConv, ar2Handle->pos2d, ar2Handle->pos3d, num, conv, 0, 1.0F );
+    }
+//ARLOG("outlier  0%%: err = %f, num = %d\n", err, num);
+    if( err <= ar2Handle->trackingThresh ) return err;
+    if( err >= 100000000.0F ) {
+        // No fit to warm-start from, nor residuals to go by.
+        for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) conv[j][i] = initConv[j][i];
+        level = 0;
+    }
+    else {
+        level = ar2GetRobustStartLevel( ar2Handle, conv, num );
+    }
+
+    for( ; level < ar2Handle->robustScheduleNum; level++ ) {
+        if( ar2Handle->trackingMode == AR2_TRACKING_6DOF ) {
+            icpSetInlierProbability( ar2Handle->icpHandle, ar2Handle->robustSchedule[level] );
+            err2 = ar2GetTransMat( ar2Handle->icpHandle, conv, ar2Handle->pos2d, ar2Handle->pos3d, num, conv2, 1 );
+        }
+        else {
+            err2 = ar2GetTransMatHomography( conv, ar2Handle->pos2d, ar2Handle->pos3d, num, conv2, 1, ar2Handle->robustSchedule[level] );
+        }
+//ARLOG("inlier prob %f: err = %f, num = %d\n", ar2Handle->robustSchedule[level], err2, num);
+        if( err2 >= 100000000.0F ) continue; // Fit failed; next level starts from the last good fit.
+        for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) conv[j][i] = conv2[j][i];
+        err = err2;
+        if( err <= ar2Handle->trackingThresh ) break;
+    }
+
+    return err;
+}
+
+// First level of the robust schedule whose inlier probability does not exceed the fraction of points
+// consistent with conv, judged (as the robust fits do) against 4x the median squared residual.
+static int ar2GetRobustStartLevel( AR2HandleT *ar2Handle, float  conv[3][4], int num )
+{
+    float    wtrans[3][4];
+    float    E[AR2_SEARCH_FEATURE_MAX], E2[AR2_SEARCH_FEATURE_MAX];
+    float    hx, hy, h, dx, dy, K2, inlierProb;
+    int      inliers;
+    int      level;
+    int      i;
+
+    if( ar2Handle->trackingMode == AR2_TRACKING_6DOF ) {
+#ifdef ARDOUBLE_IS_FLOAT
+        arUtilMatMul( ar2Handle->cparamLT->param.mat, (const float (*)[4])conv, wtrans );
+#else
+        arUtilMatMuldff( ar2Handle->cparamLT->param.mat, (const float (*)[4])conv, wtrans );
+#endif
+    }
+    else {
+        for( i = 0; i < 3; i++ ) {
+            // As in the homography fits, z is ignored.
+            wtrans[i][0] = conv[i][0]; wtrans[i][1] = conv[i][1]; wtrans[i][2] = 0.0F; wtrans[i][3] = conv[i][3];
+        }
+    }
+
+    for( i = 0; i < num; i++ ) {
+        hx = wtrans[0][0]*ar2Handle->pos3d[i][0] + wtrans[0][1]*ar2Handle->pos3d[i][1] + wtrans[0][2]*ar2Handle->pos3d[i][2] + wtrans[0][3];
+        hy = wtrans[1][0]*ar2Handle->pos3d[i][0] + wtrans[1][1]*ar2Handle->pos3d[i][1] + wtrans[1][2]*ar2Handle->pos3d[i][2] + wtrans[1][3];
+        h  = wtrans[2][0]*ar2Handle->pos3d[i][0] + wtrans[2][1]*ar2Handle->pos3d[i][1] + wtrans[2][2]*ar2Handle->pos3d[i][2] + wtrans[2][3];
+        if( h == 0.0F ) return 0;
+        dx = ar2Handle->pos2d[i][0] - hx/h;
+        dy = ar2Handle->pos2d[i][1] - hy/h;
+        E[i] = E2[i] = dx*dx + dy*dy;
+    }
+    qsort( E2, num, sizeof(float), compE );
+    K2 = E2[num/2] * K2_FACTOR;
+    if( K2 < 16.0F ) K2 = 16.0F;
+    inliers = 0;
+    for( i = 0; i < num; i++ ) if( E[i] <= K2 ) inliers++;
+    inlierProb = (float)inliers / num;
+
+    for( level = 0; level < ar2Handle->robustScheduleNum - 1; level++ ) {
+        if( ar2Handle->robustSchedule[level] <= inlierProb ) break;
+    }
+    return level;
+}
+
 static float  ar2GetTransMat( ICPHandleT *icpHandle, float  initConv[3][4], float  pos2d[][2], float  pos3d[][3], int num,
                               float  conv[3][4], int robustMode )
 {   
@@ -606,17 +753,6 @@ static float  ar2GetTransMatHomography2( float  initConv[3][4], float  pos2d[][2
     return err1;
 }
 
-#define     K2_FACTOR     4.0F
-
-static int compE( const void *a, const void *b )
-{
-    float   c;
-    c = *(float  *)a - *(float  *)b;
-    if( c < 0.0F ) return -1;
-    if( c > 0.0F ) return  1;
-    return 0;
-}
-
 static float  ar2GetTransMatHomographyRobust  ( float  initConv[3][4], float  pos2d[][2], float  pos3d[][3], int num, float  conv[3][4], float inlierProb )
 {
     float         err = 100000000.0F;
@@ -47,11 +47,11 @@
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR2TemplateCandidateT *candidate,
-                              ARUint8 *dataPtr, ARUint8 *mfImage, AR2TemplateT **templ,
+                              ARUint8 *dataPtr, ARUint8 *coarsePtr, AR2MatchingWorkT *work, AR2TemplateT **templ,
                               AR2Template2T **templ2, AR2Tracking2DResultT *result );
 #else
 static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR2TemplateCandidateT *candidate,
-                              ARUint8 *dataPtr, ARUint8 *mfImage, AR2TemplateT **templ,
+                              ARUint8 *dataPtr, ARUint8 *coarsePtr, AR2MatchingWorkT *work, AR2TemplateT **templ,
                               AR2Tracking2DResultT *result );
 #endif
 
@@ -69,10 +69,10 @@ void *ar2Tracking2d( THREAD_HANDLE_T *threadHandle )
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
         arg->ret = ar2Tracking2dSub( arg->ar2Handle, arg->surfaceSet, arg->candidate,
-                                     arg->dataPtr, arg->mfImage, &(arg->templ), &(arg->templ2), &(arg->result) );
+                                     arg->dataPtr, arg->coarsePtr, arg->work, &(arg->templ), &(arg->templ2), &(arg->result) );
 #else
         arg->ret = ar2Tracking2dSub( arg->ar2Handle, arg->surfaceSet, arg->candidate,
-                                     arg->dataPtr, arg->mfImage, &(arg->templ), &(arg->result) );
+                                     arg->dataPtr, arg->coarsePtr, arg->work, &(arg->templ), &(arg->result) );
 #endif
         threadEndSignal(threadHandle);
     }
@@ -84,19 +84,17 @@ void *ar2Tracking2d( THREAD_HANDLE_T *threadHandle )
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR2TemplateCandidateT *candidate,
-                              ARUint8 *dataPtr, ARUint8 *mfImage, AR2TemplateT **templ,
+                              ARUint8 *dataPtr, ARUint8 *coarsePtr, AR2MatchingWorkT *work, AR2TemplateT **templ,
                               AR2Template2T **templ2, AR2Tracking2DResultT *result )
 #else
 static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR2TemplateCandidateT *candidate,
-                              ARUint8 *dataPtr, ARUint8 *mfImage, AR2TemplateT **templ,
+                              ARUint8 *dataPtr, ARUint8 *coarsePtr, AR2MatchingWorkT *work, AR2TemplateT **templ,
                               AR2Tracking2DResultT *result )
 #endif
 {
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    AR2Template2T        *templ2;
-#endif
     int                   snum, level, fnum;
     int                   search[3][2];
+    int                   searchSize;
     int                   bx, by;
 
     snum  = candidate->snum;
@@ -110,13 +108,15 @@ static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     if( handle->blurMethod == AR2_CONSTANT_BLUR ) {
-        if( ar2SetTemplateSub( handle->cparamLT,
-                               (const float (*)[4])handle->wtrans1[snum],
-                               surfaceSet->surface[snum].imageSet,
-                             &(surfaceSet->surface[snum].featureSet->list[level]),
-                               fnum,
-                               handle->blurLevel,
-                              *templ ) < 0 ) return -1;
+        if( ar2SetTemplateSubCached( handle->cparamLT,
+                                     (const float (*)[4])handle->wtrans1[snum],
+                                     surfaceSet->surface[snum].imageSet,
+                                   &(surfaceSet->surface[snum].featureSet->list[level]),
+                                     fnum,
+                                     handle->blurLevel,
+                                     surfaceSet->surface[snum].templCache, level,
+                                     handle->templateCachePosTol, handle->templateCacheShapeTol,
+                                    *templ ) < 0 ) return -1;
 
         if( (*templ)->vlen * (*templ)->vlen
               < ((*templ)->xts1+(*templ)->xts2+1) * ((*templ)->yts1+(*templ)->yts2+1)
@@ -140,12 +140,14 @@ static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR
         }
     }
 #else
-    if( ar2SetTemplateSub( handle->cparamLT,
-                           (const float (*)[4])handle->wtrans1[snum],
-                           surfaceSet->surface[snum].imageSet,
-                         &(surfaceSet->surface[snum].featureSet->list[level]),
-                           fnum,
-                          *templ ) < 0 ) return -1;
+    if( ar2SetTemplateSubCached( handle->cparamLT,
+                                 (const float (*)[4])handle->wtrans1[snum],
+                                 surfaceSet->surface[snum].imageSet,
+                               &(surfaceSet->surface[snum].featureSet->list[level]),
+                                 fnum,
+                                 surfaceSet->surface[snum].templCache, level,
+                                 handle->templateCachePosTol, handle->templateCacheShapeTol,
+                                *templ ) < 0 ) return -1;
 
     if( (*templ)->vlen * (*templ)->vlen
           < ((*templ)->xts1 + (*templ)->xts2 + 1) * ((*templ)->yts1 + (*templ)->yts2 + 1)
@@ -177,32 +179,40 @@ static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR
                            search );
     }
 
+    if( handle->searchSizeMode == AR2_SEARCH_SIZE_ADAPTIVE ) {
+        searchSize = ar2GetSearchRadius( search, surfaceSet->predictErr, handle->searchSizeMin, handle->searchSize );
+    }
+    else {
+        searchSize = handle->searchSize;
+    }
+
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     if( handle->blurMethod == AR2_CONSTANT_BLUR ) {
-        if( ar2GetBestMatching( dataPtr,
-                                mfImage,
-                                handle->xsize,
-                                handle->ysize,
-                                handle->pixFormat,
-                               *templ,
-                                handle->searchSize,
-                                handle->searchSize,
-                                search,
-                                &bx, &by,
-                              &(result->sim)) < 0 ) {
+        if( ar2GetBestMatchingCoarse( dataPtr,
+                                      coarsePtr,
+                                      work,
+                                      handle->xsize,
+                                      handle->ysize,
+                                      handle->pixFormat,
+                                     *templ,
+                                      searchSize,
+                                      searchSize,
+                                      search,
+                                      &bx, &by,
+                                    &(result->sim)) < 0 ) {
             return -1;
         }
         result->blurLevel = handle->blurLevel;
     }
     else {
         if( ar2GetBestMatching2( dataPtr,
-                                 mfImage,
+                                 work,
                                  handle->xsize,
                                  handle->ysize,
                                  handle->pixFormat,
                                 *templ2,
-                                 handle->searchSize,
-                                 handle->searchSize,
+                                 searchSize,
+                                 searchSize,
                                  search,
                                  &bx, &by,
                                &(result->sim),
@@ -211,23 +221,25 @@ static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR
         }
     }
 #else
-    if( ar2GetBestMatching( dataPtr,
-                            mfImage,
-                            handle->xsize,
-                            handle->ysize,
-                            handle->pixFormat,
-                           *templ,
-                            handle->searchSize,
-                            handle->searchSize,
-                            search,
-                            &bx, &by,
-                          &(result->sim)) < 0 ) {
+    if( ar2GetBestMatchingCoarse( dataPtr,
+                                  coarsePtr,
+                                  work,
+                                  handle->xsize,
+                                  handle->ysize,
+                                  handle->pixFormat,
+                                 *templ,
+                                  searchSize,
+                                  searchSize,
+                                  search,
+                                  &bx, &by,
+                                &(result->sim)) < 0 ) {
         return -1;
     }
 #endif
 
     result->pos2d[0] = (float)bx;
     result->pos2d[1] = (float)by;
+    result->predictErr = ar2GetSearchPointError( search, bx, by );
     result->pos3d[0] = surfaceSet->surface[snum].trans[0][0] * surfaceSet->surface[snum].featureSet->list[level].coord[fnum].mx
                      + surfaceSet->surface[snum].trans[0][1] * surfaceSet->surface[snum].featureSet->list[level].coord[fnum].my
                      + surfaceSet->surface[snum].trans[0][3];
@@ -103,6 +103,12 @@ ARController::ARController() :
     trackingThreadHandle(NULL),
     m_ar2Handle(NULL),
     m_kpmHandle(NULL),
+    m_nftPages(),
+    m_nftPageMemoryBudget(0),
+    m_nftPageLastTracked(),
+    m_nftFrame(0),
+    m_nftPageLoaderThread(NULL),
+    m_nftPageLoading(-1),
 #endif
     m_error(ARW_ERROR_NONE)
 {
@@ -111,7 +117,8 @@ ARController::ARController() :
     //syslog(LOG_ERR, "Hello world!\n");
 #endif
 #if HAVE_NFT
-    for (int i = 0; i < PAGES_MAX; i++) surfaceSet[i] = NULL;
+    m_nftPageLoad.datasetPathname = NULL;
+    m_nftPageLoad.surfaceSet = NULL;
 #endif
     pthread_mutex_init(&m_videoSourceLock, NULL);
 }
@@ -600,10 +607,13 @@ bool ARController::update()
                     if (ret != 0) {
                         m_kpmBusy = false;
                         if (ret == 1) {
-                            if (pageNo >= 0 && pageNo < PAGES_MAX) {
-								if (surfaceSet[pageNo]->contNum < 1) {
+                            if (pageNo >= 0 && pageNo < (int)m_nftPages.size()) {
+                                m_nftPageLastTracked[pageNo] = m_nftFrame;
+                                if (!m_nftPages[pageNo]->surfaceSet) {
+                                    requestNFTPage(pageNo, trackingTrans);
+                                } else if (m_nftPages[pageNo]->surfaceSet->contNum < 1) {
 									//logv("Detected page %d.\n", pageNo);
-									ar2SetInitTrans(surfaceSet[pageNo], trackingTrans); // Sets surfaceSet[page]->contNum = 1.
+									ar2SetInitTrans(m_nftPages[pageNo]->surfaceSet, trackingTrans); // Sets surfaceSet[page]->contNum = 1.
 								}
                             } else {
                                 logv(AR_LOG_LEVEL_ERROR, "ARController::update(): Detected bad page %d", pageNo);
@@ -615,31 +625,33 @@ bool ARController::update()
                 }
             }
             
+            // Install AR2 data for a page whose loading has completed.
+            if (m_nftPageMemoryBudget) updateNFTPageLoading();
+            
             // Do AR2 tracking and update NFT markers.
-            int page = 0;
             int pagesTracked = 0;
             bool success = true;
             ARdouble *transL2R = (m_videoSourceIsStereo ? (ARdouble *)m_transL2R : NULL);
 
-            for (std::vector<ARMarker *>::iterator it = markers.begin(); it != markers.end(); ++it) {
-                if ((*it)->type == ARMarker::NFT) {
-                    
-                    if (surfaceSet[page]->contNum > 0) {
-                        if (ar2Tracking(m_ar2Handle, surfaceSet[page], image0->buff, trackingTrans, &err) < 0) {
-                            //logv("Tracking lost on page %d.", page);
-                            success &= ((ARMarkerNFT *)(*it))->updateWithNFTResults(-1, NULL, NULL);
-                        } else {
-                            //logv("Tracked page %d (pos = {% 4f, % 4f, % 4f}).\n", page, trackingTrans[0][3], trackingTrans[1][3], trackingTrans[2][3]);
-                            success &= ((ARMarkerNFT *)(*it))->updateWithNFTResults(page, trackingTrans, (ARdouble (*)[4])transL2R);
-                            pagesTracked++;
-                        }
+            for (int page = 0; page < (int)m_nftPages.size(); page++) {
+                ARMarkerNFT *markerNFT = m_nftPages[page];
+                if (markerNFT->surfaceSet && markerNFT->surfaceSet->contNum > 0) {
+                    if (ar2Tracking(m_ar2Handle, markerNFT->surfaceSet, image0->buffLuma, trackingTrans, &err) < 0) {
+                        //logv("Tracking lost on page %d.", page);
+                        success &= markerNFT->updateWithNFTResults(-1, NULL, NULL);
+                    } else {
+                        //logv("Tracked page %d (pos = {% 4f, % 4f, % 4f}).\n", page, trackingTrans[0][3], trackingTrans[1][3], trackingTrans[2][3]);
+                        success &= markerNFT->updateWithNFTResults(page, trackingTrans, (ARdouble (*)[4])transL2R);
+                        m_nftPageLastTracked[page] = m_nftFrame;
+                        pagesTracked++;
                     }
-                    
-                    page++;
                 }
             }
             
-            m_kpmRequired = (pagesTracked < (m_nftMultiMode ? page : 1));
+            m_kpmRequired = (pagesTracked < (m_nftMultiMode ? (int)m_nftPages.size() : 1));
+            
+            if (m_nftPageMemoryBudget) evictNFTPages();
+            m_nftFrame++;
             
         } // trackingThreadHandle
     } // doNFTMarkerDetection
@@ -748,7 +760,7 @@ bool ARController::initNFT(void)
     //kpmSetProcMode( m_kpmHandle, KpmProcHalfSize );
     
     // AR2 init.
-    if( (m_ar2Handle = ar2CreateHandle(m_videoSource0->getCameraParameters(), m_videoSource0->getPixelFormat(), AR2_TRACKING_DEFAULT_THREAD_NUM)) == NULL ) {
+    if( (m_ar2Handle = ar2CreateHandle(m_videoSource0->getCameraParameters(), AR_PIXEL_FORMAT_MONO, AR2_TRACKING_DEFAULT_THREAD_NUM)) == NULL ) {
         logv(AR_LOG_LEVEL_ERROR, "ARController::initNFT(): Error: ar2CreateHandle, exiting, returning false");
         kpmDeleteHandle(&m_kpmHandle);
         return (false);
@@ -778,19 +790,92 @@ bool ARController::initNFT(void)
 
 bool ARController::unloadNFTData(void)
 {
-    int i;
-    
     if (trackingThreadHandle) {
         logv(AR_LOG_LEVEL_INFO, "Stopping NFT tracking thread.");
         trackingInitQuit(&trackingThreadHandle);
         m_kpmBusy = false;
     }
-    for (i = 0; i < PAGES_MAX; i++) surfaceSet[i] = NULL; // Discard weak-references.
+    if (m_nftPageLoaderThread) {
+        logv(AR_LOG_LEVEL_INFO, "Stopping NFT page loading thread.");
+        if (m_nftPageLoading >= 0) {
+            threadEndWait(m_nftPageLoaderThread); // Let any load in progress finish, then discard it.
+            if (m_nftPageLoad.surfaceSet) ar2FreeSurfaceSet(&m_nftPageLoad.surfaceSet);
+            free(m_nftPageLoad.datasetPathname);
+            m_nftPageLoad.datasetPathname = NULL;
+            m_nftPageLoading = -1;
+        }
+        threadWaitQuit(m_nftPageLoaderThread);
+        threadFree(&m_nftPageLoaderThread);
+    }
+    m_nftPages.clear(); // Discard weak-references.
+    m_nftPageLastTracked.clear();
     m_kpmRequired = true;
     
     return true;
 }
 
+void *ARController::nftPageLoader(THREAD_HANDLE_T *threadHandle)
+{
+    NFTPageLoad *load = (NFTPageLoad *)threadGetArg(threadHandle);
+    
+    while (threadStartWait(threadHandle) == 0) {
+        load->surfaceSet = ar2ReadSurfaceSet(load->datasetPathname, "fset", NULL);
+        threadEndSignal(threadHandle);
+    }
+    return (NULL);
+}
+
+void ARController::requestNFTPage(int pageNo, float trans[3][4])
+{
+    if (!m_nftPageLoaderThread || m_nftPageLoading >= 0) return; // One page at a time; KPM will recognise it again later.
+    
+    logv(AR_LOG_LEVEL_INFO, "Loading %s.fset for page %d.", m_nftPages[pageNo]->datasetPathname, pageNo);
+    m_nftPageLoad.datasetPathname = strdup(m_nftPages[pageNo]->datasetPathname);
+    m_nftPageLoad.surfaceSet = NULL;
+    for (int j = 0; j < 3; j++) for (int i = 0; i < 4; i++) m_nftPageLoadTrans[j][i] = trans[j][i];
+    m_nftPageLoading = pageNo;
+    threadStartSignal(m_nftPageLoaderThread);
+}
+
+void ARController::updateNFTPageLoading(void)
+{
+    if (m_nftPageLoading < 0 || threadGetStatus(m_nftPageLoaderThread) == 0) return;
+    threadEndWait(m_nftPageLoaderThread);
+    
+    ARMarkerNFT *markerNFT = m_nftPages[m_nftPageLoading];
+    if (!m_nftPageLoad.surfaceSet) {
+        logv(AR_LOG_LEVEL_ERROR, "Error reading data from %s.fset", m_nftPageLoad.datasetPathname);
+    } else {
+        markerNFT->attachSurfaceSet(m_nftPageLoad.surfaceSet);
+        m_nftPageLoad.surfaceSet = NULL;
+        // Start tracking from the pose at which the page was recognised. If it has moved since, tracking
+        // will fail and KPM will recognise it again.
+        ar2SetInitTrans(markerNFT->surfaceSet, m_nftPageLoadTrans);
+        m_nftPageLastTracked[m_nftPageLoading] = m_nftFrame;
+    }
+    free(m_nftPageLoad.datasetPathname);
+    m_nftPageLoad.datasetPathname = NULL;
+    m_nftPageLoading = -1;
+}
+
+void ARController::evictNFTPages(void)
+{
+    size_t resident = 0;
+    for (int page = 0; page < (int)m_nftPages.size(); page++) resident += m_nftPages[page]->getSurfaceSetMemorySize();
+    
+    while (resident > m_nftPageMemoryBudget) {
+        // Release the page least recently recognised or tracked, but never one currently being tracked.
+        int lru = -1;
+        for (int page = 0; page < (int)m_nftPages.size(); page++) {
+            if (!m_nftPages[page]->surfaceSet || m_nftPages[page]->surfaceSet->contNum > 0) continue;
+            if (lru < 0 || m_nftPageLastTracked[page] < m_nftPageLastTracked[lru]) lru = page;
+        }
+        if (lru < 0) break;
+        resident -= m_nftPages[lru]->getSurfaceSetMemorySize();
+        m_nftPages[lru]->releaseSurfaceSet();
+    }
+}
+
 bool ARController::loadNFTData(void)
 {
     // If data was already loaded, stop KPM tracking thread and unload previously loaded data.
@@ -814,6 +899,18 @@ bool ARController::loadNFTData(void)
                 ((ARMarkerNFT *)(*it))->pageNo = -1;
                 continue;
             }
+            // Markers added while a memory budget was set have deferred their AR2 data. Read it now if all pages are to be resident.
+            if (!((ARMarkerNFT *)(*it))->surfaceSet && !m_nftPageMemoryBudget) {
+                AR2SurfaceSetT *surfaceSet;
+                logv(AR_LOG_LEVEL_INFO, "Reading %s.fset", ((ARMarkerNFT *)(*it))->datasetPathname);
+                if ((surfaceSet = ar2ReadSurfaceSet(((ARMarkerNFT *)(*it))->datasetPathname, "fset", NULL)) == NULL) {
+                    logv(AR_LOG_LEVEL_ERROR, "Error reading data from %s.fset", ((ARMarkerNFT *)(*it))->datasetPathname);
+                    kpmDeleteRefDataSet(&refDataSet2);
+                    ((ARMarkerNFT *)(*it))->pageNo = -1;
+                    continue;
+                }
+                ((ARMarkerNFT *)(*it))->attachSurfaceSet(surfaceSet);
+            }
             ((ARMarkerNFT *)(*it))->pageNo = pageCount;
             logv(AR_LOG_LEVEL_INFO, "  Assigned page no. %d.", pageCount);
             if (kpmChangePageNoOfRefDataSet(refDataSet2, KpmChangePageNoAllPages, pageCount) < 0) {
@@ -826,11 +923,12 @@ bool ARController::loadNFTData(void)
             }
             logv(AR_LOG_LEVEL_INFO, "Done");
             
-            // For convenience, create a weak reference to the AR2 data.
-            surfaceSet[pageCount] = ((ARMarkerNFT *)(*it))->surfaceSet;
+            // For convenience, create a weak reference to the marker holding the AR2 data.
+            m_nftPages.push_back((ARMarkerNFT *)(*it));
+            m_nftPageLastTracked.push_back(-1);
             
             pageCount++;
-            if (pageCount == PAGES_MAX) {
+            if (pageCount == PAGES_MAX && !m_nftPageMemoryBudget) {
                 logv(AR_LOG_LEVEL_ERROR, "Maximum number of NFT pages (%d) loaded", PAGES_MAX);
                 break;
             }
@@ -850,6 +948,16 @@ bool ARController::loadNFTData(void)
         exit(-1);
     }
     
+    // Start the thread which reads AR2 data for pages as they are recognised.
+    if (m_nftPageMemoryBudget) {
+        logv(AR_LOG_LEVEL_INFO, "Starting NFT page loading thread.");
+        m_nftPageLoaderThread = threadInit(0, &m_nftPageLoad, nftPageLoader);
+        if (!m_nftPageLoaderThread) {
+            logv(AR_LOG_LEVEL_ERROR, "ARController::loadNFTData(): threadInit(), exit(-1)");
+            exit(-1);
+        }
+    }
+    
     logv(AR_LOG_LEVEL_DEBUG, "Loading of NFT data complete, exiting, return true");
     return true;
 }
@@ -1212,6 +1320,26 @@ bool ARController::getNFTMultiMode() const
 #endif
 }
 
+void ARController::setNFTPageMemoryBudget(int megabytes)
+{
+#if HAVE_NFT
+    if (megabytes < 0) megabytes = 0;
+    if ((megabytes > 0) != (m_nftPageMemoryBudget > 0) && trackingThreadHandle) {
+        unloadNFTData(); // loadNFTData() will be called on next update().
+    }
+    m_nftPageMemoryBudget = (size_t)megabytes * 1024 * 1024;
+#endif
+}
+
+int ARController::getNFTPageMemoryBudget() const
+{
+#if HAVE_NFT
+    return (int)(m_nftPageMemoryBudget / (1024 * 1024));
+#else
+    return 0;
+#endif
+}
+
 // ----------------------------------------------------------------------------------------------------
 #pragma mark Debug texture
 // ----------------------------------------------------------------------------------------------------
@@ -1337,7 +1465,11 @@ int ARController::addMarker(const char* cfg)
 		return -1;
 	}
     
+#if HAVE_NFT
+    ARMarker *marker = ARMarker::newWithConfig(cfg, m_arPattHandle, m_nftPageMemoryBudget > 0);
+#else
     ARMarker *marker = ARMarker::newWithConfig(cfg, m_arPattHandle);
+#endif
     if (!marker) {
         logv(AR_LOG_LEVEL_ERROR, "Error: Failed to load marker.\n");
         return -1;
@@ -242,7 +242,7 @@ std::vector<ARMarker *> ARMarker::newFromConfigDataFile(const char *markersConfi
 // multi;data/multi/marker.dat
 // nft;data/nft/pinball
 
-ARMarker* ARMarker::newWithConfig(const char* cfg, ARPattHandle *arPattHandle)
+ARMarker* ARMarker::newWithConfig(const char* cfg, ARPattHandle *arPattHandle, bool nftLoadOnDemand)
 {
     ARMarker *markerRet = NULL;
     
@@ -353,7 +353,7 @@ ARMarker* ARMarker::newWithConfig(const char* cfg, ARPattHandle *arPattHandle)
 			// NFT AR Marker, second token is the NFT data path base.
 			if (char *config = strtok(NULL, ";")) {
                 markerRet = new ARMarkerNFT();
-                if (!((ARMarkerNFT *)markerRet)->load(config)) {
+                if (!((ARMarkerNFT *)markerRet)->load(config, nftLoadOnDemand)) {
                     // Marker failed to load, or was not added
                     delete markerRet;
                     markerRet = NULL;
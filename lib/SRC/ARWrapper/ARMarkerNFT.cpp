@@ -43,8 +43,10 @@
 ARMarkerNFT::ARMarkerNFT() : ARMarker(NFT),
     m_loaded(false),
     m_nftScale(1.0f),
+    m_surfaceSetMemorySize(0),
     pageNo(-1),
-    datasetPathname(NULL)
+    datasetPathname(NULL),
+    surfaceSet(NULL)
 {
 }
 
@@ -53,37 +55,95 @@ ARMarkerNFT::~ARMarkerNFT()
 	if (m_loaded) unload();
 }
 
-bool ARMarkerNFT::load(const char* dataSetPathname_in)
+bool ARMarkerNFT::load(const char* dataSetPathname_in, bool loadOnDemand)
 {
     if (m_loaded) unload();
     
 	visible = visiblePrev = false;
 	
-    // Load AR2 data.
-    ARController::logv("Loading %s.fset.", dataSetPathname_in);
-    if ((surfaceSet = ar2ReadSurfaceSet(dataSetPathname_in, "fset", NULL)) == NULL) {
-        ARController::logv("Error reading data from %s.fset", dataSetPathname_in);
-        return (false);
+    allocatePatterns(1);
+    if (loadOnDemand) {
+        // Just check the AR2 data is present; it will be read when the page is first recognised.
+        char *fsetPathname = (char *)malloc(strlen(dataSetPathname_in) + 6);
+        sprintf(fsetPathname, "%s.fset", dataSetPathname_in);
+        FILE *fp = fopen(fsetPathname, "rb");
+        free(fsetPathname);
+        if (!fp) {
+            ARController::logv("Error: unable to open %s.fset", dataSetPathname_in);
+            freePatterns();
+            return (false);
+        }
+        fclose(fp);
+        ARController::logv("Deferring loading of %s.fset until page is recognised.", dataSetPathname_in);
+    } else {
+        // Load AR2 data.
+        ARController::logv("Loading %s.fset.", dataSetPathname_in);
+        AR2SurfaceSetT *surfaceSet_in;
+        if ((surfaceSet_in = ar2ReadSurfaceSet(dataSetPathname_in, "fset", NULL)) == NULL) {
+            ARController::logv("Error reading data from %s.fset", dataSetPathname_in);
+            freePatterns();
+            return (false);
+        }
+        attachSurfaceSet(surfaceSet_in);
     }
  	datasetPathname = strdup(dataSetPathname_in);
     
-    allocatePatterns(1);
-    patterns[0]->loadISet(surfaceSet->surface[0].imageSet, m_nftScale);
-   
     m_loaded = true;
     
 	return true;
 }
 
+bool ARMarkerNFT::attachSurfaceSet(AR2SurfaceSetT *surfaceSet_in)
+{
+    if (!surfaceSet_in || !patterns) return false;
+    
+    if (surfaceSet) ar2FreeSurfaceSet(&surfaceSet);
+    surfaceSet = surfaceSet_in;
+    patterns[0]->loadISet(surfaceSet->surface[0].imageSet, m_nftScale);
+    
+    m_surfaceSetMemorySize = 0;
+    for (int i = 0; i < surfaceSet->num; i++) {
+        AR2ImageSetT *imageSet = surfaceSet->surface[i].imageSet;
+        AR2FeatureSetT *featureSet = surfaceSet->surface[i].featureSet;
+        if (imageSet) {
+            if (imageSet->cache) m_surfaceSetMemorySize += imageSet->cacheSize;
+            else {
+                for (int j = 0; j < imageSet->num; j++) {
+                    // Tiled images are paged in under their own limit; count only the untiled ones.
+                    if (!imageSet->scale[j]->tiles) m_surfaceSetMemorySize += (size_t)imageSet->scale[j]->xsize * imageSet->scale[j]->ysize;
+                }
+            }
+        }
+        if (featureSet) {
+            for (int j = 0; j < featureSet->num; j++) {
+                m_surfaceSetMemorySize += featureSet->list[j].num * sizeof(AR2FeatureCoordT);
+            }
+        }
+    }
+    
+    return true;
+}
+
+void ARMarkerNFT::releaseSurfaceSet()
+{
+    if (surfaceSet) {
+        ARController::logv("Unloading %s.fset.", datasetPathname);
+        ar2FreeSurfaceSet(&surfaceSet); // Sets surfaceSet to NULL.
+    }
+    m_surfaceSetMemorySize = 0;
+}
+
+size_t ARMarkerNFT::getSurfaceSetMemorySize() const
+{
+    return (m_surfaceSetMemorySize);
+}
+
 bool ARMarkerNFT::unload()
 {
     if (m_loaded) {
         freePatterns();
         pageNo = -1;
-        if (surfaceSet) {
-            ARController::logv("Unloading %s.fset.", datasetPathname);
-            ar2FreeSurfaceSet(&surfaceSet); // Sets surfaceSet to NULL.
-        }
+        releaseSurfaceSet();
         if (datasetPathname) {
             free(datasetPathname);
             datasetPathname = NULL;
@@ -117,7 +177,7 @@ bool ARMarkerNFT::updateWithNFTResults(int detectedPage, float trackingTrans[3][
 void ARMarkerNFT::setNFTScale(const float scale)
 {
     m_nftScale = scale;
-    patterns[0]->loadISet(surfaceSet->surface[0].imageSet, m_nftScale);
+    if (surfaceSet) patterns[0]->loadISet(surfaceSet->surface[0].imageSet, m_nftScale);
 }
 
 float ARMarkerNFT::getNFTScale()
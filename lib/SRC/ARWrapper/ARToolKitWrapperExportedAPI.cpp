@@ -536,6 +536,18 @@ EXPORT_API bool arwGetNFTMultiMode()
     return gARTK->getNFTMultiMode();
 }
 
+EXPORT_API void arwSetNFTPageMemoryBudget(int megabytes)
+{
+    if (!gARTK) return;
+    gARTK->setNFTPageMemoryBudget(megabytes);
+}
+
+EXPORT_API int arwGetNFTPageMemoryBudget()
+{
+    if (!gARTK) return 0;
+    return gARTK->getNFTPageMemoryBudget();
+}
+
 
 // ----------------------------------------------------------------------------------------------------
 #pragma mark  Marker management
@@ -938,6 +950,8 @@ extern "C" {
     JNIEXPORT jint JNICALL JNIFUNCTION(arwGetImageProcMode(JNIEnv *env, jobject obj));
     JNIEXPORT void JNICALL JNIFUNCTION(arwSetNFTMultiMode(JNIEnv *env, jobject obj, jboolean on));
     JNIEXPORT jboolean JNICALL JNIFUNCTION(arwGetNFTMultiMode(JNIEnv *env, jobject obj));
+    JNIEXPORT void JNICALL JNIFUNCTION(arwSetNFTPageMemoryBudget(JNIEnv *env, jobject obj, jint megabytes));
+    JNIEXPORT jint JNICALL JNIFUNCTION(arwGetNFTPageMemoryBudget(JNIEnv *env, jobject obj));
 
     JNIEXPORT void JNICALL JNIFUNCTION(arwSetMarkerOptionBool(JNIEnv *env, jobject obj, jint markerUID, jint option, jboolean value));
     JNIEXPORT void JNICALL JNIFUNCTION(arwSetMarkerOptionInt(JNIEnv *env, jobject obj, jint markerUID, jint option, jint value));
@@ -1283,6 +1297,16 @@ JNIEXPORT jboolean JNICALL JNIFUNCTION(arwGetNFTMultiMode(JNIEnv *env, jobject o
     return arwGetNFTMultiMode();
 }
 
+JNIEXPORT void JNICALL JNIFUNCTION(arwSetNFTPageMemoryBudget(JNIEnv *env, jobject obj, jint megabytes))
+{
+    arwSetNFTPageMemoryBudget(megabytes);
+}
+
+JNIEXPORT jint JNICALL JNIFUNCTION(arwGetNFTPageMemoryBudget(JNIEnv *env, jobject obj))
+{
+    return arwGetNFTPageMemoryBudget();
+}
+
 JNIEXPORT void JNICALL JNIFUNCTION(arwSetMarkerOptionInt(JNIEnv *env, jobject obj, jint markerUID, jint option, jint value))
 {
     return arwSetMarkerOptionInt(markerUID, option, value);
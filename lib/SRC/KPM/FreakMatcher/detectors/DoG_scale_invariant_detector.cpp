@@ -41,9 +41,170 @@
 #include <algorithm>
 #include <functional>
 #include "interpolate.h"
+#include <AR/ar.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define DOG_NEON 1
+#elif defined(HAVE_INTEL_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#  include <emmintrin.h>
+#  define DOG_SSE2 1
+#endif
 
 using namespace vision;
 
+// Tasks over smaller images, or fewer feature points, are not split over threads
+static const size_t kMinParallelPixels = 1 << 15;
+static const size_t kMinParallelFeaturePoints = 64;
+
+namespace vision {
+    
+    /**
+     * Find the candidate extrema in columns [col_begin,col_end) of a DoG row. A candidate
+     * passes the Laplacian threshold, and is strictly greater (a maximum) or strictly less
+     * (a minimum) than its left and right neighbours and than columns col-1, col and col+1
+     * of each of ROWS. Candidates are stored in column order as col<<1 for a maximum, or
+     * (col<<1)|1 for a minimum.
+     *
+     * @return Number of candidates
+     */
+    static int FindExtremaCandidates(int* candidates,
+                                     const float* center,
+                                     const float* const* rows,
+                                     int num_rows,
+                                     int col_begin,
+                                     int col_end,
+                                     float laplacianSqrThreshold) {
+        int num_candidates = 0;
+        int col = col_begin;
+
+#if DOG_SSE2
+        const __m128 threshold = _mm_set1_ps(laplacianSqrThreshold);
+        for(; col+4 <= col_end; col+=4) {
+            __m128 value = _mm_loadu_ps(&center[col]);
+            
+            // Check laplacian score
+            __m128 keep = _mm_cmpnlt_ps(_mm_mul_ps(value, value), threshold);
+            if(_mm_movemask_ps(keep) == 0) {
+                continue;
+            }
+            
+            __m128 left = _mm_loadu_ps(&center[col-1]);
+            __m128 right = _mm_loadu_ps(&center[col+1]);
+            __m128 maxima = _mm_and_ps(keep, _mm_and_ps(_mm_cmpgt_ps(value, left), _mm_cmpgt_ps(value, right)));
+            __m128 minima = _mm_and_ps(keep, _mm_and_ps(_mm_cmplt_ps(value, left), _mm_cmplt_ps(value, right)));
+            for(int k = 0; k < num_rows; k++) {
+                if(_mm_movemask_ps(_mm_or_ps(maxima, minima)) == 0) {
+                    break;
+                }
+                for(int d = -1; d <= 1; d++) {
+                    __m128 neighbour = _mm_loadu_ps(&rows[k][col+d]);
+                    maxima = _mm_and_ps(maxima, _mm_cmpgt_ps(value, neighbour));
+                    minima = _mm_and_ps(minima, _mm_cmplt_ps(value, neighbour));
+                }
+            }
+            
+            int max_mask = _mm_movemask_ps(maxima);
+            int min_mask = _mm_movemask_ps(minima);
+            for(int j = 0; j < 4; j++) {
+                if(max_mask & (1 << j)) {
+                    candidates[num_candidates++] = (col+j)<<1;
+                } else if(min_mask & (1 << j)) {
+                    candidates[num_candidates++] = ((col+j)<<1)|1;
+                }
+            }
+        }
+#elif DOG_NEON
+        const float32x4_t threshold = vdupq_n_f32(laplacianSqrThreshold);
+        for(; col+4 <= col_end; col+=4) {
+            float32x4_t value = vld1q_f32(&center[col]);
+            uint32_t mask[4];
+            uint32x2_t any;
+            
+            // Check laplacian score
+            uint32x4_t keep = vmvnq_u32(vcltq_f32(vmulq_f32(value, value), threshold));
+            any = vorr_u32(vget_low_u32(keep), vget_high_u32(keep));
+            if((vget_lane_u32(any, 0) | vget_lane_u32(any, 1)) == 0) {
+                continue;
+            }
+            
+            float32x4_t left = vld1q_f32(&center[col-1]);
+            float32x4_t right = vld1q_f32(&center[col+1]);
+            uint32x4_t maxima = vandq_u32(keep, vandq_u32(vcgtq_f32(value, left), vcgtq_f32(value, right)));
+            uint32x4_t minima = vandq_u32(keep, vandq_u32(vcltq_f32(value, left), vcltq_f32(value, right)));
+            for(int k = 0; k < num_rows; k++) {
+                uint32x4_t either = vorrq_u32(maxima, minima);
+                any = vorr_u32(vget_low_u32(either), vget_high_u32(either));
+                if((vget_lane_u32(any, 0) | vget_lane_u32(any, 1)) == 0) {
+                    break;
+                }
+                for(int d = -1; d <= 1; d++) {
+                    float32x4_t neighbour = vld1q_f32(&rows[k][col+d]);
+                    maxima = vandq_u32(maxima, vcgtq_f32(value, neighbour));
+                    minima = vandq_u32(minima, vcltq_f32(value, neighbour));
+                }
+            }
+            
+            // Maxima are marked with bit 0, and minima with bit 1
+            vst1q_u32(mask, vorrq_u32(vandq_u32(maxima, vdupq_n_u32(1)), vandq_u32(minima, vdupq_n_u32(2))));
+            for(int j = 0; j < 4; j++) {
+                if(mask[j] & 1) {
+                    candidates[num_candidates++] = (col+j)<<1;
+                } else if(mask[j] & 2) {
+                    candidates[num_candidates++] = ((col+j)<<1)|1;
+                }
+            }
+        }
+#endif
+        
+        for(; col < col_end; col++) {
+            float value = center[col];
+            
+            // Check laplacian score
+            if(sqr(value) < laplacianSqrThreshold) {
+                continue;
+            }
+            
+            bool maxima = value > center[col-1] && value > center[col+1];
+            bool minima = value < center[col-1] && value < center[col+1];
+            for(int k = 0; k < num_rows && (maxima || minima); k++) {
+                const float* r = rows[k];
+                maxima = maxima && value > r[col-1] && value > r[col] && value > r[col+1];
+                minima = minima && value < r[col-1] && value < r[col] && value < r[col+1];
+            }
+            
+            if(maxima) {
+                candidates[num_candidates++] = col<<1;
+            } else if(minima) {
+                candidates[num_candidates++] = (col<<1)|1;
+            }
+        }
+        
+        return num_candidates;
+    }
+    
+    /**
+     * Check a candidate extremum against 9 points interpolated from a DoG image of another
+     * octave, at (x+dx[i],y+dy[i]).
+     */
+    static inline bool CheckInterpolatedExtremum(float value,
+                                                 bool maxima,
+                                                 const Image& im,
+                                                 float x,
+                                                 float y,
+                                                 const float dx[9],
+                                                 const float dy[9]) {
+        for(int i = 0; i < 9; i++) {
+            float neighbour = bilinear_interpolation<float>(im, x+dx[i], y+dy[i]);
+            if(maxima ? !(value > neighbour) : !(value < neighbour)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+} // vision
+
 DoGPyramid::DoGPyramid()
 : mNumOctaves(0)
 , mNumScalesPerOctave(0)
@@ -51,7 +212,7 @@ DoGPyramid::DoGPyramid()
 
 void DoGPyramid::alloc(const GaussianScaleSpacePyramid* pyramid) {
     ASSERT(pyramid->size() > 0, "Pyramid is not allocated");
-   
+    
     ImageType type = pyramid->get(0, 0).type();
     size_t width = pyramid->get(0, 0).width();
     size_t height = pyramid->get(0, 0).height();
@@ -69,20 +230,31 @@ void DoGPyramid::alloc(const GaussianScaleSpacePyramid* pyramid) {
 }
 
 void DoGPyramid::compute(const GaussianScaleSpacePyramid* pyramid) {
+    compute(pyramid, 0, 1);
+}
+
+void DoGPyramid::compute(const GaussianScaleSpacePyramid* pyramid, int band, int bandNum) {
     ASSERT(mImages.size() > 0, "Laplacian pyramid has not been allocated");
     ASSERT(pyramid->numOctaves() > 0, "Pyramid does not contain any levels");
     ASSERT(dynamic_cast<const BinomialPyramid32f*>(pyramid), "Only binomial pyramid is supported");
     
     for(size_t i = 0; i < mNumOctaves; i++) {
         for(size_t j = 0; j < mNumScalesPerOctave; j++) {
+            size_t height = get(i, j).height();
             difference_image_binomial(get(i, j),
                                       pyramid->get(i, j),
-                                      pyramid->get(i, j+1));
+                                      pyramid->get(i, j+1),
+                                      height*band/bandNum,
+                                      height*(band+1)/bandNum);
         }
     }
 }
 
 void DoGPyramid::difference_image_binomial(Image& d, const Image& im1, const Image& im2) {
+    difference_image_binomial(d, im1, im2, 0, im1.height());
+}
+
+void DoGPyramid::difference_image_binomial(Image& d, const Image& im1, const Image& im2, size_t row_begin, size_t row_end) {
     ASSERT(d.type() == IMAGE_F32, "Only F32 images supported");
     ASSERT(im1.type() == IMAGE_F32, "Only F32 images supported");
     ASSERT(im2.type() == IMAGE_F32, "Only F32 images supported");
@@ -95,11 +267,21 @@ void DoGPyramid::difference_image_binomial(Image& d, const Image& im1, const Ima
     ASSERT(im1.height() == im2.height(), "Images must have the same height");
     
     // Compute diff
-    for(size_t i = 0; i < im1.height(); i++) {
+    for(size_t i = row_begin; i < row_end; i++) {
         float* p0 = d.get<float>(i);
         const float* p1 = im1.get<float>(i);
         const float* p2 = im2.get<float>(i);
-        for(size_t j = 0; j < im1.width(); j++) {
+        size_t j = 0;
+#if DOG_SSE2
+        for(; j+4 <= im1.width(); j+=4) {
+            _mm_storeu_ps(&p0[j], _mm_sub_ps(_mm_loadu_ps(&p1[j]), _mm_loadu_ps(&p2[j])));
+        }
+#elif DOG_NEON
+        for(; j+4 <= im1.width(); j+=4) {
+            vst1q_f32(&p0[j], vsubq_f32(vld1q_f32(&p1[j]), vld1q_f32(&p2[j])));
+        }
+#endif
+        for(; j < im1.width(); j++) {
             p0[j] = p1[j]-p2[j];
         }
     }
@@ -113,12 +295,16 @@ DoGScaleInvariantDetector::DoGScaleInvariantDetector()
 , mFindOrientation(true)
 , mLaplacianThreshold(0)
 , mEdgeThreshold(10)
-, mMaxSubpixelDistanceSqr(3*3) {
+, mMaxSubpixelDistanceSqr(3*3)
+, mThreadNum(1)
+, mTask(TASK_DOG)
+, mTaskPyramid(NULL) {
     setMaxNumFeaturePoints(kMaxNumFeaturePoints);
-    mOrientations.resize(kMaxNumOrientations);
 }
 
-DoGScaleInvariantDetector::~DoGScaleInvariantDetector() {}
+DoGScaleInvariantDetector::~DoGScaleInvariantDetector() {
+    stopThreads();
+}
 
 void DoGScaleInvariantDetector::alloc(const GaussianScaleSpacePyramid* pyramid) {
     mLaplacianPyramid.alloc(pyramid);
@@ -146,9 +332,11 @@ void DoGScaleInvariantDetector::alloc(const GaussianScaleSpacePyramid* pyramid)
 void DoGScaleInvariantDetector::detect(const GaussianScaleSpacePyramid* pyramid) {
     ASSERT(pyramid->numOctaves() > 0, "Pyramid does not contain any levels");
     
+    startThreads();
+    
     // Compute Laplacian images (DoG)
     TIMED("DoG Pyramid") {
-        mLaplacianPyramid.compute(pyramid);
+        run(TASK_DOG, pyramid, mWidth*mHeight, kMinParallelPixels);
     }
     
     // Detect minima and maximum in Laplacian images
@@ -172,277 +360,248 @@ void DoGScaleInvariantDetector::detect(const GaussianScaleSpacePyramid* pyramid)
     }
 }
 
+int DoGScaleInvariantDetector::run(TaskType task, const GaussianScaleSpacePyramid* pyramid, size_t size, size_t min_parallel_size) {
+    mTask = task;
+    mTaskPyramid = pyramid;
+    
+    if(mThreads.empty() || size < min_parallel_size) {
+        runBand(0, 1);
+        return 1;
+    }
+    
+    for(size_t i = 0; i < mThreads.size(); i++) {
+        threadStartSignal(mThreads[i]);
+    }
+    runBand(0, (int)mThreads.size() + 1);
+    for(size_t i = 0; i < mThreads.size(); i++) {
+        threadEndWait(mThreads[i]);
+    }
+    return (int)mThreads.size() + 1;
+}
+
+void DoGScaleInvariantDetector::runBand(int index, int bandNum) {
+    const size_t num_points = mFeaturePoints.size();
+    
+    switch(mTask) {
+        case TASK_DOG:
+            mLaplacianPyramid.compute(mTaskPyramid, index, bandNum);
+            break;
+        case TASK_EXTREMA:
+            extractFeatures(mTaskPyramid, &mLaplacianPyramid, mBands[index], index, bandNum);
+            break;
+        case TASK_SUBPIXEL:
+            findSubpixelLocations(mTaskPyramid, num_points*index/bandNum, num_points*(index+1)/bandNum);
+            break;
+        case TASK_GRADIENTS:
+            mOrientationAssignment.computeGradients(mTaskPyramid, index, bandNum);
+            break;
+        case TASK_ORIENTATION:
+            findFeatureOrientations(mTaskPyramid, mBands[index], num_points*index/bandNum, num_points*(index+1)/bandNum);
+            break;
+    }
+}
+
+void* DoGScaleInvariantDetector::worker(THREAD_HANDLE_T* threadHandle) {
+    WorkerArg* arg = (WorkerArg*)threadGetArg(threadHandle);
+    
+    while(threadStartWait(threadHandle) == 0) {
+        arg->detector->runBand(arg->index, (int)arg->detector->mThreads.size() + 1);
+        threadEndSignal(threadHandle);
+    }
+    return NULL;
+}
+
+void DoGScaleInvariantDetector::startThreads() {
+    int threadNum = mThreadNum;
+    if(threadNum < 1) {
+        threadNum = threadGetCPU();
+    }
+    if(threadNum < 1) {
+        threadNum = 1;
+    }
+    
+    if((int)mThreads.size() != threadNum - 1) {
+        stopThreads();
+        
+        // Everything the workers reference must be in place before the first one starts.
+        mWorkerArgs.resize(threadNum - 1);
+        for(int i = 0; i < threadNum - 1; i++) {
+            mWorkerArgs[i].detector = this;
+            mWorkerArgs[i].index = i + 1;
+        }
+        for(int i = 0; i < threadNum - 1; i++) {
+            THREAD_HANDLE_T* thread = threadInit(i + 1, &mWorkerArgs[i], worker);
+            if(!thread) {
+                // Detect with the threads we have
+                break;
+            }
+            mThreads.push_back(thread);
+        }
+    }
+    
+    // Working space for each band
+    mBands.resize(threadNum);
+    for(size_t i = 0; i < mBands.size(); i++) {
+        mBands[i].levelEnd.resize(mLaplacianPyramid.size());
+        mBands[i].candidates.resize(mWidth);
+        mBands[i].histogram.resize(mOrientationAssignment.numBins());
+        mBands[i].orientations.resize(kMaxNumOrientations);
+    }
+}
+
+void DoGScaleInvariantDetector::stopThreads() {
+    for(size_t i = 0; i < mThreads.size(); i++) {
+        threadWaitQuit(mThreads[i]);
+        threadFree(&mThreads[i]);
+    }
+    mThreads.clear();
+}
+
 void DoGScaleInvariantDetector::extractFeatures(const GaussianScaleSpacePyramid* pyramid,
                                                 const DoGPyramid* laplacian) {
     
     // Clear old features
     mFeaturePoints.clear();
     
+    int bandNum = run(TASK_EXTREMA, pyramid, mWidth*mHeight, kMinParallelPixels);
+    
+    // Gather the features of each image, band by band, in the order of a single pass
+    // over the pyramid.
+    for(size_t i = 1; i < laplacian->size()-1; i++) {
+        for(int j = 0; j < bandNum; j++) {
+            const Band& band = mBands[j];
+            mFeaturePoints.insert(mFeaturePoints.end(),
+                                  band.points.begin() + band.levelEnd[i-1],
+                                  band.points.begin() + band.levelEnd[i]);
+        }
+    }
+}
+
+void DoGScaleInvariantDetector::extractFeatures(const GaussianScaleSpacePyramid* pyramid,
+                                                const DoGPyramid* laplacian,
+                                                Band& band,
+                                                int index,
+                                                int bandNum) {
+    // Offsets of the 3x3 neighbourhood in the image of the other octave
+    static const float kHalfPixelX[9] = {-0.5f, 0.f, 0.5f, -0.5f, 0.f, 0.5f, -0.5f, 0.f, 0.5f};
+    static const float kHalfPixelY[9] = {-0.5f, -0.5f, -0.5f, 0.f, 0.f, 0.f, 0.5f, 0.5f, 0.5f};
+    static const float kTwoPixelsX[9] = {-2.f, 0.f, 2.f, -2.f, 0.f, 2.f, -2.f, 0.f, 2.f};
+    static const float kTwoPixelsY[9] = {-2.f, -2.f, -2.f, 0.f, 0.f, 0.f, 2.f, 2.f, 2.f};
+    
     float laplacianSqrThreshold = sqr(mLaplacianThreshold);
     
-    for(size_t i = 1; i < mLaplacianPyramid.size()-1; i++) {
+    band.points.clear();
+    band.levelEnd[0] = 0;
+    
+    for(size_t i = 1; i < laplacian->size()-1; i++) {
         const Image& im0 = laplacian->get(i-1);
         const Image& im1 = laplacian->get(i);
         const Image& im2 = laplacian->get(i+1);
         
         int octave = laplacian->octaveFromIndex((int)i);
         int scale = laplacian->scaleFromIndex((int)i);
+        float sigma = pyramid->effectiveSigma(octave, scale);
         
+        // Rows searched and the rows compared against, depending on the image sizes
+        size_t row_first, row_last, col_first, col_last;
+        int mode;
         if(im0.width() == im1.width() && im0.width() == im2.width()) { // All images are the same size
             ASSERT(im0.height() == im1.height(), "Height is inconsistent");
             ASSERT(im0.height() == im2.height(), "Height is inconsistent");
-            
-            size_t width_minus_1 = im1.width() - 1;
-            size_t heigh_minus_1 = im1.height() - 1;
-            
-            for(size_t row = 1; row < heigh_minus_1; row++) {
-                const float* im0_ym1 = im0.get<float>(row-1);
-                const float* im0_y   = im0.get<float>(row);
-                const float* im0_yp1 = im0.get<float>(row+1);
-                
-                const float* im1_ym1 = im1.get<float>(row-1);
-                const float* im1_y   = im1.get<float>(row);
-                const float* im1_yp1 = im1.get<float>(row+1);
-                
-                const float* im2_ym1 = im2.get<float>(row-1);
-                const float* im2_y   = im2.get<float>(row);
-                const float* im2_yp1 = im2.get<float>(row+1);
-                
-                for(size_t col = 1; col < width_minus_1; col++) {
-                    const float& value = im1_y[col];
-                    FeaturePoint fp;
-                    
-                    // Check laplacian score
-                    if(sqr(value) < laplacianSqrThreshold) {
-                        continue;
-                    }
-                    
-#define NONMAX_CHECK(OPERATOR, VALUE)                  \
-                    /* im0 - 9 evaluations */          \
-                    VALUE OPERATOR im0_ym1[col-1]   && \
-                    VALUE OPERATOR im0_ym1[col]     && \
-                    VALUE OPERATOR im0_ym1[col+1]   && \
-                    VALUE OPERATOR im0_y[col-1]     && \
-                    VALUE OPERATOR im0_y[col]       && \
-                    VALUE OPERATOR im0_y[col+1]     && \
-                    VALUE OPERATOR im0_yp1[col-1]   && \
-                    VALUE OPERATOR im0_yp1[col]     && \
-                    VALUE OPERATOR im0_yp1[col+1]   && \
-                    /* im1 - 8 evaluations */          \
-                    VALUE OPERATOR im1_ym1[col-1]   && \
-                    VALUE OPERATOR im1_ym1[col]     && \
-                    VALUE OPERATOR im1_ym1[col+1]   && \
-                    VALUE OPERATOR im1_y[col-1]     && \
-                    VALUE OPERATOR im1_y[col+1]     && \
-                    VALUE OPERATOR im1_yp1[col-1]   && \
-                    VALUE OPERATOR im1_yp1[col]     && \
-                    VALUE OPERATOR im1_yp1[col+1]   && \
-                    /* im2 - 9 evaluations */          \
-                    VALUE OPERATOR im2_ym1[col-1]   && \
-                    VALUE OPERATOR im2_ym1[col]     && \
-                    VALUE OPERATOR im2_ym1[col+1]   && \
-                    VALUE OPERATOR im2_y[col-1]     && \
-                    VALUE OPERATOR im2_y[col]       && \
-                    VALUE OPERATOR im2_y[col+1]     && \
-                    VALUE OPERATOR im2_yp1[col-1]   && \
-                    VALUE OPERATOR im2_yp1[col]     && \
-                    VALUE OPERATOR im2_yp1[col+1]
-                    
-                    bool extrema = false;
-                    if(NONMAX_CHECK(>, value)) { // strictly greater than
-                        extrema = true;
-                    } else if(NONMAX_CHECK(<, value)) { // strictly less than
-                        extrema = true;
-                    }
-                    
-                    if(extrema) {
-                        fp.octave = octave;
-                        fp.scale  = scale;
-                        fp.score  = value;
-                        fp.sigma  = pyramid->effectiveSigma(octave, scale);
-                        
-                        bilinear_upsample_point(fp.x,
-                                                fp.y,
-                                                col,
-                                                row,
-                                                octave);
-                        
-                        mFeaturePoints.push_back(fp);
-                    }
-                    
-#undef NONMAX_CHECK
-                }
-            }
+            mode = 0;
+            row_first = 1;
+            row_last = im1.height() - 1;
+            col_first = 1;
+            col_last = im1.width() - 1;
         } else if(im0.width() == im1.width() && (im1.width()>>1) == im2.width()) { // 0,1 are the same size, 2 is half size
             ASSERT(im0.height() == im1.height(), "Height is inconsistent");
             ASSERT((im1.height()>>1) == im2.height(), "Height is inconsistent");
-    
-            size_t end_x = std::floor(((im2.width()-1)-0.5f)*2.f+0.5f);
-            size_t end_y = std::floor(((im2.height()-1)-0.5f)*2.f+0.5f);
-
-            for(size_t row = 2; row < end_y; row++) {
-                const float* im0_ym1 = im0.get<float>(row-1);
-                const float* im0_y   = im0.get<float>(row);
-                const float* im0_yp1 = im0.get<float>(row+1);
-                
-                const float* im1_ym1 = im1.get<float>(row-1);
-                const float* im1_y   = im1.get<float>(row);
-                const float* im1_yp1 = im1.get<float>(row+1);
-
-                for(size_t col = 2; col < end_x; col++) {
-                    const float& value = im1_y[col];
-                    FeaturePoint fp;
-                    
-                    // Check laplacian score
-                    if(sqr(value) < laplacianSqrThreshold) {
-                        continue;
-                    }
-                    
-                    // Compute downsampled point location
-                    float ds_x = col*0.5f-0.25f;
-                    float ds_y = row*0.5f-0.25f;
-                                        
-#define NONMAX_CHECK(OPERATOR, VALUE)                  \
-                    /* im0 - 9 evaluations */          \
-                    VALUE OPERATOR im0_ym1[col-1]   && \
-                    VALUE OPERATOR im0_ym1[col]     && \
-                    VALUE OPERATOR im0_ym1[col+1]   && \
-                    VALUE OPERATOR im0_y[col-1]     && \
-                    VALUE OPERATOR im0_y[col]       && \
-                    VALUE OPERATOR im0_y[col+1]     && \
-                    VALUE OPERATOR im0_yp1[col-1]   && \
-                    VALUE OPERATOR im0_yp1[col]     && \
-                    VALUE OPERATOR im0_yp1[col+1]   && \
-                    /* im1 - 8 evaluations */          \
-                    VALUE OPERATOR im1_ym1[col-1]   && \
-                    VALUE OPERATOR im1_ym1[col]     && \
-                    VALUE OPERATOR im1_ym1[col+1]   && \
-                    VALUE OPERATOR im1_y[col-1]     && \
-                    VALUE OPERATOR im1_y[col+1]     && \
-                    VALUE OPERATOR im1_yp1[col-1]   && \
-                    VALUE OPERATOR im1_yp1[col]     && \
-                    VALUE OPERATOR im1_yp1[col+1]   && \
-                    /* im2 - 9 evaluations */          \
-                    VALUE OPERATOR bilinear_interpolation<float>(im2, ds_x-0.5f, ds_y-0.5f)   && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im2, ds_x,      ds_y-0.5f)   && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im2, ds_x+0.5f, ds_y-0.5f)   && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im2, ds_x-0.5f, ds_y)        && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im2, ds_x,      ds_y)        && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im2, ds_x+0.5f, ds_y)        && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im2, ds_x-0.5f, ds_y+0.5f)   && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im2, ds_x,      ds_y+0.5f)   && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im2, ds_x+0.5f, ds_y+0.5f)
-
-                    bool extrema = false;
-                    if(NONMAX_CHECK(>, value)) { // strictly greater than
-                        extrema = true;
-                    } else if(NONMAX_CHECK(<, value)) { // strictly less than
-                        extrema = true;
-                    }
-                    
-                    if(extrema) {
-                        fp.octave = octave;
-                        fp.scale  = scale;
-                        fp.score  = value;
-                        fp.sigma  = pyramid->effectiveSigma(octave, scale);
-                        
-                        bilinear_upsample_point(fp.x,
-                                                fp.y,
-                                                col,
-                                                row,
-                                                octave);
-                        
-                        mFeaturePoints.push_back(fp);
-                    }
-                    
-#undef NONMAX_CHECK
-                }
-            }
+            mode = 1;
+            row_first = 2;
+            row_last = std::floor(((im2.height()-1)-0.5f)*2.f+0.5f);
+            col_first = 2;
+            col_last = std::floor(((im2.width()-1)-0.5f)*2.f+0.5f);
         } else if((im0.width()>>1) == im1.width() && (im0.width()>>1) == im2.width()) { // 0 is twice the size of 1 and 2
             ASSERT((im0.height()>>1) == im1.height(), "Height is inconsistent");
             ASSERT((im0.height()>>1) == im2.height(), "Height is inconsistent");
+            mode = 2;
+            row_first = 1;
+            row_last = im1.height() - 1;
+            col_first = 1;
+            col_last = im1.width() - 1;
+        } else {
+            band.levelEnd[i] = band.points.size();
+            continue;
+        }
+        
+        size_t row_begin = row_first + (row_last-row_first)*index/bandNum;
+        size_t row_end = row_first + (row_last-row_first)*(index+1)/bandNum;
+        
+        for(size_t row = row_begin; row < row_end; row++) {
+            const float* rows[8];
+            int num_rows = 0;
             
-            size_t width_minus_1 = im1.width() - 1;
-            size_t height_minus_1 = im1.height() - 1;
+            // Neighbouring rows of the same size. The neighbours in the image of the
+            // other octave are interpolated for each candidate.
+            if(mode != 2) {
+                rows[num_rows++] = im0.get<float>(row-1);
+                rows[num_rows++] = im0.get<float>(row);
+                rows[num_rows++] = im0.get<float>(row+1);
+            }
+            rows[num_rows++] = im1.get<float>(row-1);
+            rows[num_rows++] = im1.get<float>(row+1);
+            if(mode != 1) {
+                rows[num_rows++] = im2.get<float>(row-1);
+                rows[num_rows++] = im2.get<float>(row);
+                rows[num_rows++] = im2.get<float>(row+1);
+            }
             
-            for(size_t row = 1; row < height_minus_1; row++) {
-                const float* im1_ym1 = im1.get<float>(row-1);
-                const float* im1_y   = im1.get<float>(row);
-                const float* im1_yp1 = im1.get<float>(row+1);
-                
-                const float* im2_ym1 = im2.get<float>(row-1);
-                const float* im2_y   = im2.get<float>(row);
-                const float* im2_yp1 = im2.get<float>(row+1);
+            const float* im1_y = im1.get<float>(row);
+            int num_candidates = FindExtremaCandidates(&band.candidates[0],
+                                                       im1_y,
+                                                       rows,
+                                                       num_rows,
+                                                       (int)col_first,
+                                                       (int)col_last,
+                                                       laplacianSqrThreshold);
+            
+            for(int k = 0; k < num_candidates; k++) {
+                int col = band.candidates[k]>>1;
+                bool maxima = (band.candidates[k]&1) == 0;
+                const float& value = im1_y[col];
                 
-                for(size_t col = 1; col < width_minus_1; col++) {
-                    const float& value = im1_y[col];
-                    FeaturePoint fp;
-                    
-                    // Check laplacian score
-                    if(sqr(value) < laplacianSqrThreshold) {
+                if(mode == 1) {
+                    // Compute downsampled point location
+                    float ds_x = col*0.5f-0.25f;
+                    float ds_y = row*0.5f-0.25f;
+                    if(!CheckInterpolatedExtremum(value, maxima, im2, ds_x, ds_y, kHalfPixelX, kHalfPixelY)) {
                         continue;
                     }
-                    
+                } else if(mode == 2) {
                     float us_x = (col<<1)+0.5f;
                     float us_y = (row<<1)+0.5f;
-                    
-#define NONMAX_CHECK(OPERATOR, VALUE)                  \
-                    /* im1 - 8 evaluations */          \
-                    VALUE OPERATOR im1_ym1[col-1]   && \
-                    VALUE OPERATOR im1_ym1[col]     && \
-                    VALUE OPERATOR im1_ym1[col+1]   && \
-                    VALUE OPERATOR im1_y[col-1]     && \
-                    VALUE OPERATOR im1_y[col+1]     && \
-                    VALUE OPERATOR im1_yp1[col-1]   && \
-                    VALUE OPERATOR im1_yp1[col]     && \
-                    VALUE OPERATOR im1_yp1[col+1]   && \
-                    /* im2 - 9 evaluations */          \
-                    VALUE OPERATOR im2_ym1[col-1]   && \
-                    VALUE OPERATOR im2_ym1[col]     && \
-                    VALUE OPERATOR im2_ym1[col+1]   && \
-                    VALUE OPERATOR im2_y[col-1]     && \
-                    VALUE OPERATOR im2_y[col]       && \
-                    VALUE OPERATOR im2_y[col+1]     && \
-                    VALUE OPERATOR im2_yp1[col-1]   && \
-                    VALUE OPERATOR im2_yp1[col]     && \
-                    VALUE OPERATOR im2_yp1[col+1]   && \
-                    /* im2 - 9 evaluations */          \
-                    VALUE OPERATOR bilinear_interpolation<float>(im0, us_x-2.f, us_y-2.f)   && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im0, us_x,     us_y-2.f)   && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im0, us_x+2.f, us_y-2.f)   && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im0, us_x-2.f, us_y)       && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im0, us_x,     us_y)       && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im0, us_x+2.f, us_y)       && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im0, us_x-2.f, us_y+2.f)   && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im0, us_x,     us_y+2.f)   && \
-                    VALUE OPERATOR bilinear_interpolation<float>(im0, us_x+2.f, us_y+2.f)
-                    
-                    bool extrema = false;
-                    if(NONMAX_CHECK(>, value)) { // strictly greater than
-                        extrema = true;
-                    } else if(NONMAX_CHECK(<, value)) { // strictly less than
-                        extrema = true;
-                    }
-                    
-                    if(extrema) {
-                        fp.octave = octave;
-                        fp.scale  = scale;
-                        fp.score  = value;
-                        fp.sigma  = pyramid->effectiveSigma(octave, scale);
-                        
-                        bilinear_upsample_point(fp.x,
-                                                fp.y,
-                                                col,
-                                                row,
-                                                octave);
-                        
-                        mFeaturePoints.push_back(fp);
+                    if(!CheckInterpolatedExtremum(value, maxima, im0, us_x, us_y, kTwoPixelsX, kTwoPixelsY)) {
+                        continue;
                     }
-                    
-#undef NONMAX_CHECK
                 }
+                
+                FeaturePoint fp;
+                fp.octave = octave;
+                fp.scale  = scale;
+                fp.score  = value;
+                fp.sigma  = sigma;
+                
+                bilinear_upsample_point(fp.x,
+                                        fp.y,
+                                        col,
+                                        row,
+                                        octave);
+                
+                band.points.push_back(fp);
             }
         }
+        
+        band.levelEnd[i] = band.points.size();
     }
 }
 
@@ -470,22 +629,39 @@ void DoGScaleInvariantDetector::pruneFeatures() {
 }
 
 void DoGScaleInvariantDetector::findSubpixelLocations(const GaussianScaleSpacePyramid* pyramid) {
+    size_t num_points;
+    
+    mKeep.resize(mFeaturePoints.size());
+    run(TASK_SUBPIXEL, pyramid, mFeaturePoints.size(), kMinParallelFeaturePoints);
+    
+    // Keep the refined feature points, in their original order
+    num_points = 0;
+    for(size_t i = 0; i < mFeaturePoints.size(); i++) {
+        if(mKeep[i]) {
+            mFeaturePoints[num_points++] = mFeaturePoints[i];
+        }
+    }
+    
+    mFeaturePoints.resize(num_points);
+}
+
+void DoGScaleInvariantDetector::findSubpixelLocations(const GaussianScaleSpacePyramid* pyramid, size_t begin, size_t end) {
     float A[9];
     float b[3];
     float u[3];
     int x, y;
     float xp, yp;
-    int num_points;
     float laplacianSqrThreshold;
     float hessianThreshold;
     
-    num_points = 0;
     laplacianSqrThreshold = sqr(mLaplacianThreshold);
     hessianThreshold = (sqr(mEdgeThreshold+1)/mEdgeThreshold);
     
-    for(size_t i = 0; i < mFeaturePoints.size(); i++) {
+    for(size_t i = begin; i < end; i++) {
         FeaturePoint& kp = mFeaturePoints[i];
         
+        mKeep[i] = 0;
+        
         ASSERT(kp.scale < mLaplacianPyramid.numScalePerOctave(), "Feature point scale is out of bounds");
         int lap_index = kp.octave*mLaplacianPyramid.numScalePerOctave()+kp.scale;
         
@@ -542,13 +718,12 @@ void DoGScaleInvariantDetector::findSubpixelLocations(const GaussianScaleSpacePy
            kp.y                     < mLaplacianPyramid.images()[0].height()) {
             // Update the sigma
             kp.sigma = pyramid->effectiveSigma(kp.octave, kp.sp_scale);
-            mFeaturePoints[num_points++] = kp;
+            mKeep[i] = 1;
         }
     }
-    
-    mFeaturePoints.resize(num_points);
 }
 
+
 void DoGScaleInvariantDetector::findFeatureOrientations(const GaussianScaleSpacePyramid* pyramid) {
     if(!mFindOrientation) {
         for(size_t i = 0; i < mFeaturePoints.size(); i++) {
@@ -556,22 +731,37 @@ void DoGScaleInvariantDetector::findFeatureOrientations(const GaussianScaleSpace
         }
         return;
     }
-
-    int num_angles;
+    
+    // Compute the gradient pyramid
+    run(TASK_GRADIENTS, pyramid, mWidth*mHeight, kMinParallelPixels);
+    
+    // Compute the orientations of each batch of feature points
+    int bandNum = run(TASK_ORIENTATION, pyramid, mFeaturePoints.size(), kMinParallelFeaturePoints);
+    
     mTmpOrientatedFeaturePoints.clear();
     mTmpOrientatedFeaturePoints.reserve(mFeaturePoints.size()*kMaxNumOrientations);
+    for(int i = 0; i < bandNum; i++) {
+        mTmpOrientatedFeaturePoints.insert(mTmpOrientatedFeaturePoints.end(),
+                                           mBands[i].points.begin(),
+                                           mBands[i].points.end());
+    }
     
-    // Compute the gradient pyramid
-    mOrientationAssignment.computeGradients(pyramid);
+    mFeaturePoints.swap(mTmpOrientatedFeaturePoints);
+}
+
+void DoGScaleInvariantDetector::findFeatureOrientations(const GaussianScaleSpacePyramid* pyramid, Band& band, size_t begin, size_t end) {
+    int num_angles;
+    
+    band.points.clear();
     
     // Compute an orientation for each feature point
-    for(size_t i = 0; i < mFeaturePoints.size(); i++) {
+    for(size_t i = begin; i < end; i++) {
         float x, y, s;
         
         // Down sample the point to the detected octave
         bilinear_downsample_point(x,
                                   y,
-                                  s, 
+                                  s,
                                   mFeaturePoints[i].x,
                                   mFeaturePoints[i].y,
                                   mFeaturePoints[i].sigma,
@@ -583,8 +773,9 @@ void DoGScaleInvariantDetector::findFeatureOrientations(const GaussianScaleSpace
         y = ClipScalar<float>(y, 0, pyramid->get(mFeaturePoints[i].octave, 0).height()-1);
         
         // Compute dominant orientations
-        mOrientationAssignment.compute(&mOrientations[0],
+        mOrientationAssignment.compute(&band.orientations[0],
                                        num_angles,
+                                       &band.histogram[0],
                                        mFeaturePoints[i].octave,
                                        mFeaturePoints[i].scale,
                                        x,
@@ -596,13 +787,11 @@ void DoGScaleInvariantDetector::findFeatureOrientations(const GaussianScaleSpace
             // Copy the feature point
             FeaturePoint fp = mFeaturePoints[i];
             // Update the orientation
-            fp.angle = mOrientations[j];
+            fp.angle = band.orientations[j];
             // Store oriented feature point
-            mTmpOrientatedFeaturePoints.push_back(fp);
+            band.points.push_back(fp);
         }
     }
-    
-    mFeaturePoints.swap(mTmpOrientatedFeaturePoints);
 }
 
 namespace vision {
@@ -41,6 +41,7 @@
 #include "utils/point.h"
 #include <framework/error.h>
 #include <math/math_utils.h>
+#include <thread_sub.h>
 
 namespace vision {
     
@@ -63,6 +64,12 @@ namespace vision {
          */
         void compute(const GaussianScaleSpacePyramid* pyramid);
         
+        /**
+         * Compute one band of rows of each Difference-of-Gaussian image. Different bands
+         * can be computed concurrently.
+         */
+        void compute(const GaussianScaleSpacePyramid* pyramid, int band, int bandNum);
+        
         /**
          * Get a Laplacian image at a level in the pyramid.
          */
@@ -115,6 +122,11 @@ namespace vision {
          * d = im1 - im2
          */
         void difference_image_binomial(Image& d, const Image& im1, const Image& im2);
+        
+        /**
+         * Compute rows [row_begin,row_end) of the difference image.
+         */
+        void difference_image_binomial(Image& d, const Image& im1, const Image& im2, size_t row_begin, size_t row_end);
     };
     
     class DoGScaleInvariantDetector {
@@ -194,6 +206,16 @@ namespace vision {
             return mFindOrientation;
         }
         
+        /**
+         * Set/Get the number of threads used to detect feature points. The DoG images,
+         * extrema and gradients are computed in bands of rows, and the sub-pixel locations
+         * and orientations in batches of feature points, one per thread. The feature
+         * points found do not depend on the number of threads. -1 uses one thread per
+         * CPU, and 1 (the default) detects on the calling thread.
+         */
+        void setThreadNum(int threadNum) { mThreadNum = threadNum; }
+        int threadNum() const { return mThreadNum; }
+        
         /**
          * @return Feature points
          */
@@ -206,6 +228,36 @@ namespace vision {
         
     private:
         
+        // Not copyable: owns threads which refer back to it
+        DoGScaleInvariantDetector(const DoGScaleInvariantDetector&);
+        DoGScaleInvariantDetector& operator=(const DoGScaleInvariantDetector&);
+        
+        enum TaskType {
+            TASK_DOG,
+            TASK_EXTREMA,
+            TASK_SUBPIXEL,
+            TASK_GRADIENTS,
+            TASK_ORIENTATION
+        };
+        
+        // Working space of one band
+        struct Band {
+            // Feature points found in the band
+            std::vector<FeaturePoint> points;
+            // Number of points found up to and including each DoG image
+            std::vector<size_t> levelEnd;
+            // Candidate extrema in a row
+            std::vector<int> candidates;
+            // Orientation histogram and orientations of a feature point
+            std::vector<float> histogram;
+            std::vector<float> orientations;
+        };
+        
+        struct WorkerArg {
+            DoGScaleInvariantDetector* detector;
+            int index;
+        };
+        
         // Width/Height of configured image
         size_t mWidth;
         size_t mHeight;
@@ -244,9 +296,28 @@ namespace vision {
         // Orientation assignment
         OrientationAssignment mOrientationAssignment;
         
-        // Vector of orientations. Pre-allocated to the maximum
-        // number of orientations per feature point.
-        std::vector<float> mOrientations;
+        // Features kept by the sub-pixel refinement
+        std::vector<unsigned char> mKeep;
+        
+        // Threads, and the task they are running
+        int mThreadNum;
+        TaskType mTask;
+        const GaussianScaleSpacePyramid* mTaskPyramid;
+        std::vector<Band> mBands;
+        std::vector<WorkerArg> mWorkerArgs;
+        std::vector<THREAD_HANDLE_T*> mThreads;
+        
+        /**
+         * Run a task, splitting it over the threads if its SIZE is at least MIN_PARALLEL_SIZE.
+         *
+         * @return Number of bands the task was split into
+         */
+        int run(TaskType task, const GaussianScaleSpacePyramid* pyramid, size_t size, size_t min_parallel_size);
+        void runBand(int index, int bandNum);
+        
+        static void* worker(THREAD_HANDLE_T* threadHandle);
+        void startThreads();
+        void stopThreads();
         
         /**
          * Extract the minima/maxima.
@@ -254,11 +325,25 @@ namespace vision {
         void extractFeatures(const GaussianScaleSpacePyramid* pyramid,
                              const DoGPyramid* laplacian);
         
+        /**
+         * Extract the minima/maxima in one band of rows of each DoG image.
+         */
+        void extractFeatures(const GaussianScaleSpacePyramid* pyramid,
+                             const DoGPyramid* laplacian,
+                             Band& band,
+                             int index,
+                             int bandNum);
+        
         /**
          * Sub-pixel refinement.
          */
         void findSubpixelLocations(const GaussianScaleSpacePyramid* pyramid);
         
+        /**
+         * Sub-pixel refinement of feature points [begin,end), flagging those kept in mKeep.
+         */
+        void findSubpixelLocations(const GaussianScaleSpacePyramid* pyramid, size_t begin, size_t end);
+        
         /**
          * Prune the number of features.
          */
@@ -269,6 +354,12 @@ namespace vision {
          */
         void findFeatureOrientations(const GaussianScaleSpacePyramid* pyramid);
         
+        /**
+         * Find the orientations of feature points [begin,end), storing a feature point for
+         * each orientation in the band.
+         */
+        void findFeatureOrientations(const GaussianScaleSpacePyramid* pyramid, Band& band, size_t begin, size_t end);
+        
     }; // DoGScaleInvariantDetector
     
     inline void ComputeSubpixelDerivatives(float& Dx,
@@ -36,251 +36,637 @@
 #include "gaussian_scale_space_pyramid.h"
 #include <framework/error.h>
 //#include <framework/logger.h>
+#include <AR/ar.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define PYRAMID_NEON 1
+#elif defined(HAVE_INTEL_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#  include <emmintrin.h>
+#  define PYRAMID_SSE2 1
+#  if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#    include <immintrin.h>
+#    define PYRAMID_AVX2 1
+#    define PYRAMID_TARGET_AVX2 __attribute__((target("avx2")))
+#  elif defined(_MSC_VER) && _MSC_VER >= 1800
+#    include <immintrin.h>
+#    include <intrin.h>
+#    define PYRAMID_AVX2 1
+#    define PYRAMID_TARGET_AVX2
+#  endif
+#endif
 
 using namespace vision;
 
 namespace vision {
 
-    void binomial_4th_order(float* dst,
-                            unsigned short* tmp,
-                            const unsigned char* src,
-                            size_t width,
-                            size_t height) {
-        unsigned short* tmp_ptr;
-        float* dst_ptr;
-        
-        size_t width_minus_1, width_minus_2;
-        size_t height_minus_2;
-        
+    //
+    // Row kernels for the separable binomial filter [1 4 6 4 1]/16 (applied twice, so
+    // normalized by 1/256) and for the 2x2 downsample. Borders are handled by repeating the
+    // edge pixel. The vectorized kernels do the same arithmetic in the same order as the
+    // scalar code, so they give identical results.
+    //
+    // In fixed point, values are gray levels * 256 in 16 bits. The filter is built from four
+    // rounds of pairwise averages, [1 1]/2 convolved four times being [1 4 6 4 1]/16, which
+    // keep every intermediate in 16 bits. Rounds alternately round up and down so that the
+    // rounding does not drift the image brighter.
+    //
+
+    static inline unsigned short binomial_u16(unsigned int m2, unsigned int m1, unsigned int c, unsigned int p1, unsigned int p2) {
+        return (unsigned short)(((c<<1)+(c<<2)) + ((m1+p1)<<2) + (m2+p2));
+    }
+
+    static inline float binomial_f32(float m2, float m1, float c, float p1, float p2) {
+        return 6.f*c + 4.f*(m1+p1) + m2 + p2;
+    }
+
+    static inline unsigned int average_up(unsigned int a, unsigned int b) {
+        return (a+b+1)>>1;
+    }
+
+    static inline unsigned int average_down(unsigned int a, unsigned int b) {
+        return (a+b)>>1;
+    }
+
+    static inline unsigned short binomial_q8(unsigned int m2, unsigned int m1, unsigned int c, unsigned int p1, unsigned int p2) {
+        unsigned int a0 = average_up(m2, m1);
+        unsigned int a1 = average_up(m1, c);
+        unsigned int a2 = average_up(c, p1);
+        unsigned int a3 = average_up(p1, p2);
+        unsigned int b0 = average_down(a0, a1);
+        unsigned int b1 = average_down(a1, a2);
+        unsigned int b2 = average_down(a2, a3);
+        return (unsigned short)average_down(average_up(b0, b1), average_up(b1, b2));
+    }
+
+    /**
+     * Horizontal binomial filter of an 8-bit row into 16 bits (unnormalized).
+     */
+    static void binomial_row_u8(unsigned short* dst, const unsigned char* src, size_t width) {
+        size_t col = 2;
+
+        // Left border is computed by extending the border pixel beyond the image
+        dst[0] = binomial_u16(src[0], src[0], src[0], src[1], src[2]);
+        dst[1] = binomial_u16(src[0], src[0], src[1], src[2], src[3]);
+
+#if PYRAMID_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        for(; col+16 <= width-2; col+=16) {
+            __m128i m2 = _mm_loadu_si128((const __m128i*)&src[col-2]);
+            __m128i m1 = _mm_loadu_si128((const __m128i*)&src[col-1]);
+            __m128i c  = _mm_loadu_si128((const __m128i*)&src[col]);
+            __m128i p1 = _mm_loadu_si128((const __m128i*)&src[col+1]);
+            __m128i p2 = _mm_loadu_si128((const __m128i*)&src[col+2]);
+            for(int half = 0; half < 2; half++) {
+                __m128i wm2 = half ? _mm_unpackhi_epi8(m2, zero) : _mm_unpacklo_epi8(m2, zero);
+                __m128i wm1 = half ? _mm_unpackhi_epi8(m1, zero) : _mm_unpacklo_epi8(m1, zero);
+                __m128i wc  = half ? _mm_unpackhi_epi8(c, zero)  : _mm_unpacklo_epi8(c, zero);
+                __m128i wp1 = half ? _mm_unpackhi_epi8(p1, zero) : _mm_unpacklo_epi8(p1, zero);
+                __m128i wp2 = half ? _mm_unpackhi_epi8(p2, zero) : _mm_unpacklo_epi8(p2, zero);
+                __m128i r = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(wc, 1), _mm_slli_epi16(wc, 2)),
+                                          _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(wm1, wp1), 2), _mm_add_epi16(wm2, wp2)));
+                _mm_storeu_si128((__m128i*)&dst[col+8*half], r);
+            }
+        }
+#elif PYRAMID_NEON
+        for(; col+16 <= width-2; col+=16) {
+            uint8x16_t m2 = vld1q_u8(&src[col-2]);
+            uint8x16_t m1 = vld1q_u8(&src[col-1]);
+            uint8x16_t c  = vld1q_u8(&src[col]);
+            uint8x16_t p1 = vld1q_u8(&src[col+1]);
+            uint8x16_t p2 = vld1q_u8(&src[col+2]);
+            uint16x8_t lo = vaddq_u16(vaddq_u16(vshlq_n_u16(vmovl_u8(vget_low_u8(c)), 1), vshlq_n_u16(vmovl_u8(vget_low_u8(c)), 2)),
+                                      vaddq_u16(vshlq_n_u16(vaddl_u8(vget_low_u8(m1), vget_low_u8(p1)), 2), vaddl_u8(vget_low_u8(m2), vget_low_u8(p2))));
+            uint16x8_t hi = vaddq_u16(vaddq_u16(vshlq_n_u16(vmovl_u8(vget_high_u8(c)), 1), vshlq_n_u16(vmovl_u8(vget_high_u8(c)), 2)),
+                                      vaddq_u16(vshlq_n_u16(vaddl_u8(vget_high_u8(m1), vget_high_u8(p1)), 2), vaddl_u8(vget_high_u8(m2), vget_high_u8(p2))));
+            vst1q_u16(&dst[col], lo);
+            vst1q_u16(&dst[col+8], hi);
+        }
+#endif
+
+        // Compute non-border pixels
+        for(; col < width-2; col++) {
+            dst[col] = binomial_u16(src[col-2], src[col-1], src[col], src[col+1], src[col+2]);
+        }
+
+        // Right border. Computed similarily as the left border.
+        dst[width-2] = binomial_u16(src[width-4], src[width-3], src[width-2], src[width-1], src[width-1]);
+        dst[width-1] = binomial_u16(src[width-3], src[width-2], src[width-1], src[width-1], src[width-1]);
+    }
+
+    /**
+     * Vertical binomial filter of 5 horizontally filtered 16-bit rows, normalized to a float
+     * row. The exact 16-bit sum, which is the result in fixed point, is stored in dst_q8
+     * unless it is NULL.
+     */
+    static void binomial_column_u16(float* dst, unsigned short* dst_q8, const unsigned short* const rows[5], size_t width) {
+        const unsigned short* pm2 = rows[0];
+        const unsigned short* pm1 = rows[1];
+        const unsigned short* p   = rows[2];
+        const unsigned short* pp1 = rows[3];
+        const unsigned short* pp2 = rows[4];
+        size_t col = 0;
+
+#if PYRAMID_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 scale = _mm_set1_ps(1.f/256.f);
+        for(; col+8 <= width; col+=8) {
+            __m128i c = _mm_loadu_si128((const __m128i*)&p[col]);
+            __m128i r = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(c, 1), _mm_slli_epi16(c, 2)),
+                                      _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)&pm1[col]),
+                                                                                 _mm_loadu_si128((const __m128i*)&pp1[col])), 2),
+                                                    _mm_add_epi16(_mm_loadu_si128((const __m128i*)&pm2[col]),
+                                                                  _mm_loadu_si128((const __m128i*)&pp2[col]))));
+            if(dst_q8) {
+                _mm_storeu_si128((__m128i*)&dst_q8[col], r);
+            }
+            _mm_storeu_ps(&dst[col],   _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(r, zero)), scale));
+            _mm_storeu_ps(&dst[col+4], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(r, zero)), scale));
+        }
+#elif PYRAMID_NEON
+        for(; col+8 <= width; col+=8) {
+            uint16x8_t c = vld1q_u16(&p[col]);
+            uint16x8_t r = vaddq_u16(vaddq_u16(vshlq_n_u16(c, 1), vshlq_n_u16(c, 2)),
+                                     vaddq_u16(vshlq_n_u16(vaddq_u16(vld1q_u16(&pm1[col]), vld1q_u16(&pp1[col])), 2),
+                                               vaddq_u16(vld1q_u16(&pm2[col]), vld1q_u16(&pp2[col]))));
+            if(dst_q8) {
+                vst1q_u16(&dst_q8[col], r);
+            }
+            vst1q_f32(&dst[col],   vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(r))), 1.f/256.f));
+            vst1q_f32(&dst[col+4], vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(r))), 1.f/256.f));
+        }
+#endif
+
+        for(; col < width; col++) {
+            unsigned short r = binomial_u16(pm2[col], pm1[col], p[col], pp1[col], pp2[col]);
+            if(dst_q8) {
+                dst_q8[col] = r;
+            }
+            dst[col] = r*(1.f/256.f);
+        }
+    }
+
+    /**
+     * Horizontal binomial filter of a float row (unnormalized).
+     */
+    static void binomial_row_f32_C(float* dst, const float* src, size_t width, size_t col) {
+        for(; col < width-2; col++) {
+            dst[col] = binomial_f32(src[col-2], src[col-1], src[col], src[col+1], src[col+2]);
+        }
+    }
+
+    /**
+     * Vertical binomial filter of 5 horizontally filtered float rows, normalized.
+     */
+    static void binomial_column_f32_C(float* dst, const float* const rows[5], size_t width, size_t col) {
+        for(; col < width; col++) {
+            dst[col] = binomial_f32(rows[0][col], rows[1][col], rows[2][col], rows[3][col], rows[4][col])*(1.f/256.f);
+        }
+    }
+
+#if PYRAMID_SSE2
+    static size_t binomial_row_f32_SSE2(float* dst, const float* src, size_t width, size_t col) {
+        const __m128 six = _mm_set1_ps(6.f);
+        const __m128 four = _mm_set1_ps(4.f);
+        for(; col+4 <= width-2; col+=4) {
+            __m128 r = _mm_add_ps(_mm_mul_ps(six, _mm_loadu_ps(&src[col])),
+                                  _mm_mul_ps(four, _mm_add_ps(_mm_loadu_ps(&src[col-1]), _mm_loadu_ps(&src[col+1]))));
+            r = _mm_add_ps(_mm_add_ps(r, _mm_loadu_ps(&src[col-2])), _mm_loadu_ps(&src[col+2]));
+            _mm_storeu_ps(&dst[col], r);
+        }
+        return col;
+    }
+
+    static size_t binomial_column_f32_SSE2(float* dst, const float* const rows[5], size_t width, size_t col) {
+        const __m128 six = _mm_set1_ps(6.f);
+        const __m128 four = _mm_set1_ps(4.f);
+        const __m128 scale = _mm_set1_ps(1.f/256.f);
+        for(; col+4 <= width; col+=4) {
+            __m128 r = _mm_add_ps(_mm_mul_ps(six, _mm_loadu_ps(&rows[2][col])),
+                                  _mm_mul_ps(four, _mm_add_ps(_mm_loadu_ps(&rows[1][col]), _mm_loadu_ps(&rows[3][col]))));
+            r = _mm_add_ps(_mm_add_ps(r, _mm_loadu_ps(&rows[0][col])), _mm_loadu_ps(&rows[4][col]));
+            _mm_storeu_ps(&dst[col], _mm_mul_ps(r, scale));
+        }
+        return col;
+    }
+#endif
+
+#if PYRAMID_AVX2
+    PYRAMID_TARGET_AVX2 static size_t binomial_row_f32_AVX2(float* dst, const float* src, size_t width, size_t col) {
+        const __m256 six = _mm256_set1_ps(6.f);
+        const __m256 four = _mm256_set1_ps(4.f);
+        for(; col+8 <= width-2; col+=8) {
+            __m256 r = _mm256_add_ps(_mm256_mul_ps(six, _mm256_loadu_ps(&src[col])),
+                                     _mm256_mul_ps(four, _mm256_add_ps(_mm256_loadu_ps(&src[col-1]), _mm256_loadu_ps(&src[col+1]))));
+            r = _mm256_add_ps(_mm256_add_ps(r, _mm256_loadu_ps(&src[col-2])), _mm256_loadu_ps(&src[col+2]));
+            _mm256_storeu_ps(&dst[col], r);
+        }
+        return col;
+    }
+
+    PYRAMID_TARGET_AVX2 static size_t binomial_column_f32_AVX2(float* dst, const float* const rows[5], size_t width, size_t col) {
+        const __m256 six = _mm256_set1_ps(6.f);
+        const __m256 four = _mm256_set1_ps(4.f);
+        const __m256 scale = _mm256_set1_ps(1.f/256.f);
+        for(; col+8 <= width; col+=8) {
+            __m256 r = _mm256_add_ps(_mm256_mul_ps(six, _mm256_loadu_ps(&rows[2][col])),
+                                     _mm256_mul_ps(four, _mm256_add_ps(_mm256_loadu_ps(&rows[1][col]), _mm256_loadu_ps(&rows[3][col]))));
+            r = _mm256_add_ps(_mm256_add_ps(r, _mm256_loadu_ps(&rows[0][col])), _mm256_loadu_ps(&rows[4][col]));
+            _mm256_storeu_ps(&dst[col], _mm256_mul_ps(r, scale));
+        }
+        return col;
+    }
+
+    static bool CPUHasAVX2() {
+#  if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuidex(info, 7, 0);
+        if((info[1] & (1 << 5)) == 0) {
+            return false;
+        }
+        // The OS must also save the YMM registers
+        __cpuid(info, 1);
+        return (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+#  else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#  endif
+    }
+#endif
+
+#if PYRAMID_NEON
+    static size_t binomial_row_f32_NEON(float* dst, const float* src, size_t width, size_t col) {
+        for(; col+4 <= width-2; col+=4) {
+            float32x4_t r = vaddq_f32(vmulq_n_f32(vld1q_f32(&src[col]), 6.f),
+                                      vmulq_n_f32(vaddq_f32(vld1q_f32(&src[col-1]), vld1q_f32(&src[col+1])), 4.f));
+            r = vaddq_f32(vaddq_f32(r, vld1q_f32(&src[col-2])), vld1q_f32(&src[col+2]));
+            vst1q_f32(&dst[col], r);
+        }
+        return col;
+    }
+
+    static size_t binomial_column_f32_NEON(float* dst, const float* const rows[5], size_t width, size_t col) {
+        for(; col+4 <= width; col+=4) {
+            float32x4_t r = vaddq_f32(vmulq_n_f32(vld1q_f32(&rows[2][col]), 6.f),
+                                      vmulq_n_f32(vaddq_f32(vld1q_f32(&rows[1][col]), vld1q_f32(&rows[3][col])), 4.f));
+            r = vaddq_f32(vaddq_f32(r, vld1q_f32(&rows[0][col])), vld1q_f32(&rows[4][col]));
+            vst1q_f32(&dst[col], vmulq_n_f32(r, 1.f/256.f));
+        }
+        return col;
+    }
+#endif
+
+    typedef size_t (*BinomialRowF32Func)(float* dst, const float* src, size_t width, size_t col);
+    typedef size_t (*BinomialColumnF32Func)(float* dst, const float* const rows[5], size_t width, size_t col);
+
+    struct BinomialF32Kernel {
+        BinomialRowF32Func row;
+        BinomialColumnF32Func column;
+    };
+
+    /**
+     * The widest float kernels the CPU supports. These process as many columns as they can
+     * from col onwards, and return the first column left for the scalar code.
+     */
+    static const BinomialF32Kernel* SelectBinomialF32Kernel() {
+#if PYRAMID_AVX2
+        static const BinomialF32Kernel kernelAVX2 = {binomial_row_f32_AVX2, binomial_column_f32_AVX2};
+        static const BinomialF32Kernel kernelSSE2 = {binomial_row_f32_SSE2, binomial_column_f32_SSE2};
+        return CPUHasAVX2() ? &kernelAVX2 : &kernelSSE2;
+#elif PYRAMID_SSE2
+        static const BinomialF32Kernel kernel = {binomial_row_f32_SSE2, binomial_column_f32_SSE2};
+        return &kernel;
+#elif PYRAMID_NEON
+        static const BinomialF32Kernel kernel = {binomial_row_f32_NEON, binomial_column_f32_NEON};
+        return &kernel;
+#else
+        static const BinomialF32Kernel kernel = {NULL, NULL};
+        return &kernel;
+#endif
+    }
+
+    // Chosen once while the library is loaded, before any pyramid band threads exist, rather than in a
+    // function-local static, whose initialisation is not thread-safe before Visual Studio 2015.
+    static const BinomialF32Kernel* const gBinomialF32Kernel = SelectBinomialF32Kernel();
+
+    static void binomial_row_f32(float* dst, const float* src, size_t width) {
+        const BinomialF32Kernel& kernel = *gBinomialF32Kernel;
+        size_t col = 2;
+
+        // Left border is computed by extending the border pixel beyond the image
+        dst[0] = binomial_f32(src[0], src[0], src[0], src[1], src[2]);
+        dst[1] = binomial_f32(src[0], src[0], src[1], src[2], src[3]);
+
+        // Compute non-border pixels
+        if(kernel.row) {
+            col = kernel.row(dst, src, width, col);
+        }
+        binomial_row_f32_C(dst, src, width, col);
+
+        // Right border. Computed similarily as the left border.
+        dst[width-2] = binomial_f32(src[width-4], src[width-3], src[width-2], src[width-1], src[width-1]);
+        dst[width-1] = binomial_f32(src[width-3], src[width-2], src[width-1], src[width-1], src[width-1]);
+    }
+
+    static void binomial_column_f32(float* dst, const float* const rows[5], size_t width) {
+        const BinomialF32Kernel& kernel = *gBinomialF32Kernel;
+        size_t col = 0;
+
+        if(kernel.column) {
+            col = kernel.column(dst, rows, width, col);
+        }
+        binomial_column_f32_C(dst, rows, width, col);
+    }
+
+#if PYRAMID_SSE2
+    static inline __m128i average_up_SSE2(__m128i a, __m128i b) {
+        return _mm_avg_epu16(a, b);
+    }
+
+    static inline __m128i average_down_SSE2(__m128i a, __m128i b) {
+        return _mm_sub_epi16(_mm_avg_epu16(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi16(1)));
+    }
+
+    static inline __m128i binomial_q8_SSE2(__m128i m2, __m128i m1, __m128i c, __m128i p1, __m128i p2) {
+        __m128i a0 = average_up_SSE2(m2, m1);
+        __m128i a1 = average_up_SSE2(m1, c);
+        __m128i a2 = average_up_SSE2(c, p1);
+        __m128i a3 = average_up_SSE2(p1, p2);
+        __m128i b0 = average_down_SSE2(a0, a1);
+        __m128i b1 = average_down_SSE2(a1, a2);
+        __m128i b2 = average_down_SSE2(a2, a3);
+        return average_down_SSE2(average_up_SSE2(b0, b1), average_up_SSE2(b1, b2));
+    }
+#elif PYRAMID_NEON
+    static inline uint16x8_t binomial_q8_NEON(uint16x8_t m2, uint16x8_t m1, uint16x8_t c, uint16x8_t p1, uint16x8_t p2) {
+        uint16x8_t a0 = vrhaddq_u16(m2, m1);
+        uint16x8_t a1 = vrhaddq_u16(m1, c);
+        uint16x8_t a2 = vrhaddq_u16(c, p1);
+        uint16x8_t a3 = vrhaddq_u16(p1, p2);
+        uint16x8_t b0 = vhaddq_u16(a0, a1);
+        uint16x8_t b1 = vhaddq_u16(a1, a2);
+        uint16x8_t b2 = vhaddq_u16(a2, a3);
+        return vhaddq_u16(vrhaddq_u16(b0, b1), vrhaddq_u16(b1, b2));
+    }
+#endif
+
+    /**
+     * Horizontal binomial filter of a fixed point row.
+     */
+    static void binomial_row_q8(unsigned short* dst, const unsigned short* src, size_t width) {
+        size_t col = 2;
+
+        dst[0] = binomial_q8(src[0], src[0], src[0], src[1], src[2]);
+        dst[1] = binomial_q8(src[0], src[0], src[1], src[2], src[3]);
+
+#if PYRAMID_SSE2
+        for(; col+8 <= width-2; col+=8) {
+            __m128i r = binomial_q8_SSE2(_mm_loadu_si128((const __m128i*)&src[col-2]),
+                                         _mm_loadu_si128((const __m128i*)&src[col-1]),
+                                         _mm_loadu_si128((const __m128i*)&src[col]),
+                                         _mm_loadu_si128((const __m128i*)&src[col+1]),
+                                         _mm_loadu_si128((const __m128i*)&src[col+2]));
+            _mm_storeu_si128((__m128i*)&dst[col], r);
+        }
+#elif PYRAMID_NEON
+        for(; col+8 <= width-2; col+=8) {
+            vst1q_u16(&dst[col], binomial_q8_NEON(vld1q_u16(&src[col-2]),
+                                                  vld1q_u16(&src[col-1]),
+                                                  vld1q_u16(&src[col]),
+                                                  vld1q_u16(&src[col+1]),
+                                                  vld1q_u16(&src[col+2])));
+        }
+#endif
+
+        for(; col < width-2; col++) {
+            dst[col] = binomial_q8(src[col-2], src[col-1], src[col], src[col+1], src[col+2]);
+        }
+
+        dst[width-2] = binomial_q8(src[width-4], src[width-3], src[width-2], src[width-1], src[width-1]);
+        dst[width-1] = binomial_q8(src[width-3], src[width-2], src[width-1], src[width-1], src[width-1]);
+    }
+
+    /**
+     * Vertical binomial filter of 5 horizontally filtered fixed point rows. Each of the
+     * fixed point and float results is stored unless its destination is NULL.
+     */
+    static void binomial_column_q8(unsigned short* dst_q8, float* dst, const unsigned short* const rows[5], size_t width) {
+        size_t col = 0;
+
+#if PYRAMID_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 scale = _mm_set1_ps(1.f/256.f);
+        for(; col+8 <= width; col+=8) {
+            __m128i r = binomial_q8_SSE2(_mm_loadu_si128((const __m128i*)&rows[0][col]),
+                                         _mm_loadu_si128((const __m128i*)&rows[1][col]),
+                                         _mm_loadu_si128((const __m128i*)&rows[2][col]),
+                                         _mm_loadu_si128((const __m128i*)&rows[3][col]),
+                                         _mm_loadu_si128((const __m128i*)&rows[4][col]));
+            if(dst_q8) {
+                _mm_storeu_si128((__m128i*)&dst_q8[col], r);
+            }
+            if(dst) {
+                _mm_storeu_ps(&dst[col],   _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(r, zero)), scale));
+                _mm_storeu_ps(&dst[col+4], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(r, zero)), scale));
+            }
+        }
+#elif PYRAMID_NEON
+        for(; col+8 <= width; col+=8) {
+            uint16x8_t r = binomial_q8_NEON(vld1q_u16(&rows[0][col]),
+                                            vld1q_u16(&rows[1][col]),
+                                            vld1q_u16(&rows[2][col]),
+                                            vld1q_u16(&rows[3][col]),
+                                            vld1q_u16(&rows[4][col]));
+            if(dst_q8) {
+                vst1q_u16(&dst_q8[col], r);
+            }
+            if(dst) {
+                vst1q_f32(&dst[col],   vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(r))), 1.f/256.f));
+                vst1q_f32(&dst[col+4], vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(r))), 1.f/256.f));
+            }
+        }
+#endif
+
+        for(; col < width; col++) {
+            unsigned short r = binomial_q8(rows[0][col], rows[1][col], rows[2][col], rows[3][col], rows[4][col]);
+            if(dst_q8) {
+                dst_q8[col] = r;
+            }
+            if(dst) {
+                dst[col] = r*(1.f/256.f);
+            }
+        }
+    }
+
+    /**
+     * Downsample two float rows into one by averaging 2x2 pixel quads.
+     */
+    static void downsample_row_f32(float* dst, const float* src1, const float* src2, size_t dst_width) {
+        size_t col = 0;
+
+#if PYRAMID_SSE2
+        const __m128 quarter = _mm_set1_ps(0.25f);
+        for(; col+4 <= dst_width; col+=4) {
+            __m128 a0 = _mm_loadu_ps(&src1[col<<1]);
+            __m128 a1 = _mm_loadu_ps(&src1[(col<<1)+4]);
+            __m128 b0 = _mm_loadu_ps(&src2[col<<1]);
+            __m128 b1 = _mm_loadu_ps(&src2[(col<<1)+4]);
+            __m128 r = _mm_add_ps(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1)));
+            r = _mm_add_ps(_mm_add_ps(r, _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0))), _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+            _mm_storeu_ps(&dst[col], _mm_mul_ps(r, quarter));
+        }
+#elif PYRAMID_NEON
+        for(; col+4 <= dst_width; col+=4) {
+            float32x4x2_t a = vld2q_f32(&src1[col<<1]);
+            float32x4x2_t b = vld2q_f32(&src2[col<<1]);
+            float32x4_t r = vaddq_f32(vaddq_f32(vaddq_f32(a.val[0], a.val[1]), b.val[0]), b.val[1]);
+            vst1q_f32(&dst[col], vmulq_n_f32(r, 0.25f));
+        }
+#endif
+
+        for(; col < dst_width; col++) {
+            dst[col] = (src1[col<<1]+src1[(col<<1)+1]+src2[col<<1]+src2[(col<<1)+1])*0.25f;
+        }
+    }
+
+    /**
+     * Downsample two fixed point rows into one, rounding to nearest. Each of the fixed point
+     * and float results is stored unless its destination is NULL.
+     */
+    static void downsample_row_q8(unsigned short* dst_q8, float* dst, const unsigned short* src1, const unsigned short* src2, size_t dst_width) {
+        for(size_t col = 0; col < dst_width; col++) {
+            unsigned short r = (unsigned short)((src1[col<<1]+src1[(col<<1)+1]+src2[col<<1]+src2[(col<<1)+1]+2)>>2);
+            if(dst_q8) {
+                dst_q8[col] = r;
+            }
+            if(dst) {
+                dst[col] = r*(1.f/256.f);
+            }
+        }
+    }
+
+    //
+    // Filters for binomial_rows(). row() filters one source row horizontally, and column()
+    // filters 5 of these vertically into output row ROW.
+    //
+
+    struct BinomialFilterU8 {
+        typedef unsigned char src_t;
+        typedef unsigned short tmp_t;
+
+        float* dst;
+        unsigned short* dst_q8;
+
+        void row(tmp_t* tmp, const src_t* src, size_t width) const {
+            binomial_row_u8(tmp, src, width);
+        }
+        void column(size_t row, const tmp_t* const rows[5], size_t width) const {
+            binomial_column_u16(&dst[row*width], dst_q8 ? &dst_q8[row*width] : NULL, rows, width);
+        }
+    };
+
+    struct BinomialFilterF32 {
+        typedef float src_t;
+        typedef float tmp_t;
+
+        float* dst;
+
+        void row(tmp_t* tmp, const src_t* src, size_t width) const {
+            binomial_row_f32(tmp, src, width);
+        }
+        void column(size_t row, const tmp_t* const rows[5], size_t width) const {
+            binomial_column_f32(&dst[row*width], rows, width);
+        }
+    };
+
+    struct BinomialFilterQ8 {
+        typedef unsigned short src_t;
+        typedef unsigned short tmp_t;
+
+        unsigned short* dst_q8;
+        float* dst;
+
+        void row(tmp_t* tmp, const src_t* src, size_t width) const {
+            binomial_row_q8(tmp, src, width);
+        }
+        void column(size_t row, const tmp_t* const rows[5], size_t width) const {
+            binomial_column_q8(dst_q8 ? &dst_q8[row*width] : NULL, dst ? &dst[row*width] : NULL, rows, width);
+        }
+    };
+
+    /**
+     * Apply a 2D binomial filter to rows [row_begin,row_end) of a source image.
+     *
+     * The horizontally filtered source rows are kept in TMP, a ring of 5 rows of WIDTH, and
+     * each is computed once as the window of rows needed moves down the image.
+     */
+    template<typename FILTER>
+    static void binomial_rows(const FILTER& filter,
+                              typename FILTER::tmp_t* tmp,
+                              const typename FILTER::src_t* src,
+                              size_t width,
+                              size_t height,
+                              size_t row_begin,
+                              size_t row_end) {
+        const typename FILTER::tmp_t* rows[5];
+        size_t next;
+
         ASSERT(width >= 5, "Image is too small");
         ASSERT(height >= 5, "Image is too small");
-        
-        width_minus_1 = width-1;
-        width_minus_2 = width-2;
-        height_minus_2 = height-2;
-        
-        tmp_ptr = tmp;
-        
-        // Apply horizontal filter
-        for(size_t row = 0; row < height; row++) {
-            const unsigned char* src_ptr = &src[row*width];
-            
-            // Left border is computed by extending the border pixel beyond the image
-            *(tmp_ptr++) = ((src_ptr[0]<<1)+(src_ptr[0]<<2)) + ((src_ptr[0]+src_ptr[1])<<2) + (src_ptr[0]+src_ptr[2]);
-            *(tmp_ptr++) = ((src_ptr[1]<<1)+(src_ptr[1]<<2)) + ((src_ptr[0]+src_ptr[2])<<2) + (src_ptr[0]+src_ptr[3]);
-            
-            // Compute non-border pixels
-            for(size_t col = 2; col < width_minus_2; col++, tmp_ptr++) {
-                *tmp_ptr = ((src_ptr[col]<<1)+(src_ptr[col]<<2)) + ((src_ptr[col-1]+src_ptr[col+1])<<2) + (src_ptr[col-2]+src_ptr[col+2]);
+
+        next = row_begin < 2 ? 0 : row_begin-2;
+        for(size_t row = row_begin; row < row_end; row++) {
+            // Apply horizontal filter to the rows up to row+2
+            for(; next <= row+2 && next < height; next++) {
+                filter.row(&tmp[(next%5)*width], &src[next*width], width);
             }
-            
-            // Right border. Computed similarily as the left border.
-            *(tmp_ptr++) = ((src_ptr[width_minus_2]<<1)+(src_ptr[width_minus_2]<<2)) + ((src_ptr[width_minus_2-1]+src_ptr[width_minus_2+1])<<2) + (src_ptr[width_minus_2-2]+src_ptr[width_minus_2+1]);
-            *(tmp_ptr++) = ((src_ptr[width_minus_1]<<1)+(src_ptr[width_minus_1]<<2)) + ((src_ptr[width_minus_1-1]+src_ptr[width_minus_1])<<2)   + (src_ptr[width_minus_1-2]+src_ptr[width_minus_1]);
-        }
-        
-        const unsigned short* pm2;
-        const unsigned short* pm1;
-        const unsigned short* p;
-        const unsigned short* pp1;
-        const unsigned short* pp2;
-        
-        // Apply vertical filter along top border. This is applied twice as there are two
-        // border pixels.
-        pm2     = tmp;
-        pm1     = tmp;
-        p       = tmp;
-        pp1     = p+width;
-        pp2     = pp1+width;
-        dst_ptr = dst;
-        
-        for(size_t col = 0; col < width; col++, dst_ptr++, pm2++, pm1++, p++, pp1++, pp2++) {
-            *dst_ptr = (((*p<<1)+(*p<<2)) + ((*pm1+*pp1)<<2) + (*pm2+*pp2))*(1.f/256.f);
-        }
-        
-        pm2     = tmp;
-        pm1     = tmp;
-        p       = tmp+width;
-        pp1     = p+width;
-        pp2     = pp1+width;
-        dst_ptr = dst+width;
-        
-        for(size_t col = 0; col < width; col++, dst_ptr++, pm2++, pm1++, p++, pp1++, pp2++) {
-            *dst_ptr = (((*p<<1)+(*p<<2)) + ((*pm1+*pp1)<<2) + (*pm2+*pp2))*(1.f/256.f);
-        }
-        
-        // Apply vertical filter for non-border pixels.
-        pm2 = tmp;
-        pm1 = pm2+width;
-        p   = pm1+width;
-        pp1 = p+width;
-        pp2 = pp1+width;
-        
-        for(size_t row = 2; row < height_minus_2; row++) {
-            pm2 = &tmp[(row-2)*width];
-            pm1 = pm2+width;
-            p   = pm1+width;
-            pp1 = p+width;
-            pp2 = pp1+width;
-            
-            dst_ptr = &dst[row*width];
-            
-            for(size_t col = 0; col < width; col++, dst_ptr++, pm2++, pm1++, p++, pp1++, pp2++) {
-                *dst_ptr = (((*p<<1)+(*p<<2)) + ((*pm1+*pp1)<<2) + (*pm2+*pp2))*(1.f/256.f);
+
+            // Apply vertical filter. The top and bottom borders are computed by extending
+            // the border row beyond the image.
+            for(int i = 0; i < 5; i++) {
+                size_t r = (size_t)ClipScalar<int>((int)row+i-2, 0, (int)height-1);
+                rows[i] = &tmp[(r%5)*width];
             }
+            filter.column(row, rows, width);
         }
-        
-        // Apply vertical filter for bottom border. Similar to top border.
-        pm2     = tmp+(height-4)*width;
-        pm1     = pm2+width;
-        p       = pm1+width;
-        pp1     = p+width;
-        pp2     = pp1;
-        dst_ptr = dst+(height-2)*width;
-        
-        for(size_t col = 0; col < width; col++, dst_ptr++, pm2++, pm1++, p++, pp1++, pp2++) {
-            *dst_ptr = (((*p<<1)+(*p<<2)) + ((*pm1+*pp1)<<2) + (*pm2+*pp2))*(1.f/256.f);
-        }
-        
-        pm2     = tmp+(height-3)*width;
-        pm1     = pm2+width;
-        p       = pm1+width;
-        pp1     = p;
-        pp2     = p;
-        dst_ptr = dst+(height-1)*width;
-        
-        for(size_t col = 0; col < width; col++, dst_ptr++, pm2++, pm1++, p++, pp1++, pp2++) {
-            *dst_ptr = (((*p<<1)+(*p<<2)) + ((*pm1+*pp1)<<2) + (*pm2+*pp2))*(1.f/256.f);
-        }
-    }
-    
+    }
+
+    void binomial_4th_order(float* dst,
+                            unsigned short* tmp,
+                            const unsigned char* src,
+                            size_t width,
+                            size_t height) {
+        BinomialFilterU8 filter = {dst, NULL};
+        binomial_rows(filter, tmp, src, width, height, 0, height);
+    }
+
     void binomial_4th_order(float* dst,
                             float* tmp,
                             const float* src,
                             size_t width,
                             size_t height) {
-        float* tmp_ptr;
-        float* dst_ptr;
-        
-        size_t width_minus_1, width_minus_2;
-        size_t height_minus_2;
-        
-        ASSERT(width >= 5, "Image is too small");
-        ASSERT(height >= 5, "Image is too small");
-        
-        width_minus_1 = width-1;
-        width_minus_2 = width-2;
-        height_minus_2 = height-2;
-        
-        tmp_ptr = tmp;
-        
-        // Apply horizontal filter
-        for(size_t row = 0; row < height; row++) {
-            const float* src_ptr = &src[row*width];
-            
-            // Left border is computed by extending the border pixel beyond the image
-            *(tmp_ptr++) = 6.f*src_ptr[0] + 4.f*(src_ptr[0]+src_ptr[1]) + src_ptr[0] + src_ptr[2];
-            *(tmp_ptr++) = 6.f*src_ptr[1] + 4.f*(src_ptr[0]+src_ptr[2]) + src_ptr[0] + src_ptr[3];
-            
-            // Compute non-border pixels
-            for(size_t col = 2; col < width_minus_2; col++, tmp_ptr++) {
-                *tmp_ptr = (6.f*src_ptr[col] + 4.f*(src_ptr[col-1]+src_ptr[col+1]) + src_ptr[col-2] + src_ptr[col+2]);
-            }
-            
-            // Right border. Computed similarily as the left border.
-            *(tmp_ptr++) = 6.f*src_ptr[width_minus_2] + 4.f*(src_ptr[width_minus_2-1]+src_ptr[width_minus_2+1]) + src_ptr[width_minus_2-2] + src_ptr[width_minus_2+1];
-            *(tmp_ptr++) = 6.f*src_ptr[width_minus_1] + 4.f*(src_ptr[width_minus_1-1]+src_ptr[width_minus_1])   + src_ptr[width_minus_1-2] + src_ptr[width_minus_1];
-        }
-        
-        const float* pm2;
-        const float* pm1;
-        const float* p;
-        const float* pp1;
-        const float* pp2;
-        
-        // Apply vertical filter along top border. This is applied twice as there are two
-        // border pixels.
-        pm2     = tmp;
-        pm1     = tmp;
-        p       = tmp;
-        pp1     = p+width;
-        pp2     = pp1+width;
-        dst_ptr = dst;
-        
-        for(size_t col = 0; col < width; col++, dst_ptr++, pm2++, pm1++, p++, pp1++, pp2++) {
-            *dst_ptr = (6.f*(*p) + 4.f*(*pm1+*pp1) + (*pm2) + (*pp2))*(1.f/256.f);;
-        }
-        
-        pm2     = tmp;
-        pm1     = tmp;
-        p       = tmp+width;
-        pp1     = p+width;
-        pp2     = pp1+width;
-        dst_ptr = dst+width;
-        
-        for(size_t col = 0; col < width; col++, dst_ptr++, pm2++, pm1++, p++, pp1++, pp2++) {
-            *dst_ptr = (6.f*(*p) + 4.f*(*pm1+*pp1) + (*pm2) + (*pp2))*(1.f/256.f);;
-        }
-        
-        // Apply vertical filter for non-border pixels.
-        for(size_t row = 2; row < height_minus_2; row++) {
-            pm2 = &tmp[(row-2)*width];
-            pm1 = pm2+width;
-            p   = pm1+width;
-            pp1 = p+width;
-            pp2 = pp1+width;
-            
-            dst_ptr = &dst[row*width];
-            
-            for(size_t col = 0; col < width; col++, dst_ptr++, pm2++, pm1++, p++, pp1++, pp2++) {
-                *dst_ptr = (6.f*(*p) + 4.f*(*pm1+*pp1) + (*pm2) + (*pp2))*(1.f/256.f);;
-            }
-        }
-        
-        // Apply vertical filter for bottom border. Similar to top border.
-        pm2     = tmp+(height-4)*width;
-        pm1     = pm2+width;
-        p       = pm1+width;
-        pp1     = p+width;
-        pp2     = pp1;
-        dst_ptr = dst+(height-2)*width;
-        
-        for(size_t col = 0; col < width; col++, dst_ptr++, pm2++, pm1++, p++, pp1++, pp2++) {
-            *dst_ptr = (6.f*(*p) + 4.f*(*pm1+*pp1) + (*pm2) + (*pp2))*(1.f/256.f);;
-        }
-        
-        pm2     = tmp+(height-3)*width;
-        pm1     = pm2+width;
-        p       = pm1+width;
-        pp1     = p;
-        pp2     = p;
-        dst_ptr = dst+(height-1)*width;
-        
-        for(size_t col = 0; col < width; col++, dst_ptr++, pm2++, pm1++, p++, pp1++, pp2++) {
-            *dst_ptr = (6.f*(*p) + 4.f*(*pm1+*pp1) + (*pm2) + (*pp2))*(1.f/256.f);;
-        }
-    }
-    
+        BinomialFilterF32 filter = {dst};
+        binomial_rows(filter, tmp, src, width, height, 0, height);
+    }
+
     void downsample_bilinear(float* dst, const float* src, size_t src_width, size_t src_height) {
         size_t dst_width;
         size_t dst_height;
-        const float* src_ptr1;
-        const float* src_ptr2;
-        
+
         dst_width = src_width>>1;
         dst_height = src_height>>1;
-        
+
         for(size_t row = 0; row < dst_height; row++) {
-            src_ptr1 = &src[(row<<1)*src_width];
-            src_ptr2 = src_ptr1 + src_width;
-            for(size_t col = 0; col < dst_width; col++, src_ptr1+=2, src_ptr2+=2) {
-                *(dst++) = (src_ptr1[0]+src_ptr1[1]+src_ptr2[0]+src_ptr2[1])*0.25f;
-            }
+            const float* src_ptr1 = &src[(row<<1)*src_width];
+            downsample_row_f32(&dst[row*dst_width], src_ptr1, src_ptr1 + src_width, dst_width);
         }
     }
-    
+
 }
 
+// Passes over images smaller than this are not split over threads
+static const size_t kMinParallelPixels = 1 << 15;
+
 GaussianScaleSpacePyramid::GaussianScaleSpacePyramid()
 : mNumOctaves(0)
 , mNumScalesPerOctave(0)
@@ -295,19 +681,22 @@ void GaussianScaleSpacePyramid::configure(int num_octaves, int num_scales_per_oc
     mOneOverLogK = 1.f/std::log(mK);
 }
 
-BinomialPyramid32f::BinomialPyramid32f() {
+BinomialPyramid32f::BinomialPyramid32f()
+: mFixedPoint(false)
+, mThreadNum(1) {
 }
 
-BinomialPyramid32f::~BinomialPyramid32f()
-{}
+BinomialPyramid32f::~BinomialPyramid32f() {
+    stopThreads();
+}
 
 void BinomialPyramid32f::alloc(size_t width,
                                size_t height,
                                int num_octaves) {
     //LOG_DEBUG("Binomial pyramid allocating memory for: w = %u, h = %u, levels = %u",              width, height, num_octaves);
-    
+
     GaussianScaleSpacePyramid::configure(num_octaves, 3);
-    
+
     // Allocate the pyramid memory
     mPyramid.resize(num_octaves*mNumScalesPerOctave);
     for(int i = 0; i < num_octaves; i++) {
@@ -315,67 +704,112 @@ void BinomialPyramid32f::alloc(size_t width,
             mPyramid[i*mNumScalesPerOctave+j].alloc(IMAGE_F32, width>>i, height>>i, AUTO_STEP, 1);
         }
     }
-    
-    mTemp_us16.resize(width*height);
-    mTemp_f32_1.resize(width*height);
+
     mTemp_f32_2.resize(width*height);
-    
+
+    // Fixed point buffers are allocated by the first fixed point build
+    mPyramidQ8.clear();
+    mTemp_q8.clear();
 }
 
 void BinomialPyramid32f::release() {
     mPyramid.clear();
+    mPyramidQ8.clear();
 }
 
 void BinomialPyramid32f::build(const Image& image) {
     ASSERT(image.type() == IMAGE_UINT8, "Image must be grayscale");
     ASSERT(image.channels() == 1, "Image must have 1 channel");
-    
+
     ASSERT(mPyramid.size() == mNumOctaves*mNumScalesPerOctave, "Pyramid has not been allocated yet");
     ASSERT(image.width() == mPyramid[0].width(), "Image of wrong size for pyramid");
     ASSERT(image.height() == mPyramid[0].height(), "Image of wrong size for pyramid");
-    
+
+    startThreads();
+
+    if(mFixedPoint) {
+        build_fixed_point(image);
+        return;
+    }
+
     // First octave
     apply_filter(mPyramid[0], image);
     apply_filter(mPyramid[1], mPyramid[0]);
     apply_filter_twice(mPyramid[2], mPyramid[1]);
-    
+
     // Remaining octaves
     for(size_t i = 1; i < mNumOctaves; i++) {
         // Downsample
-        downsample_bilinear((float*)mPyramid[i*mNumScalesPerOctave].get(),
-                            (const float*)mPyramid[i*mNumScalesPerOctave-1].get(),
-                            mPyramid[i*mNumScalesPerOctave-1].width(),
-                            mPyramid[i*mNumScalesPerOctave-1].height());
-        
+        Pass pass = {PASS_DOWNSAMPLE_F32,
+                     mPyramid[i*mNumScalesPerOctave-1].get(),
+                     mPyramid[i*mNumScalesPerOctave-1].width(),
+                     mPyramid[i*mNumScalesPerOctave-1].height(),
+                     (float*)mPyramid[i*mNumScalesPerOctave].get(),
+                     NULL};
+        run(pass);
+
         // Apply binomial filters
         apply_filter(mPyramid[i*mNumScalesPerOctave+1], mPyramid[i*mNumScalesPerOctave]);
         apply_filter_twice(mPyramid[i*mNumScalesPerOctave+2], mPyramid[i*mNumScalesPerOctave+1]);
     }
 }
 
+void BinomialPyramid32f::build_fixed_point(const Image& image) {
+    if(mPyramidQ8.size() != mPyramid.size()) {
+        mPyramidQ8.resize(mPyramid.size());
+        for(size_t i = 0; i < mPyramid.size(); i++) {
+            mPyramidQ8[i].resize(mPyramid[i].width()*mPyramid[i].height());
+        }
+        mTemp_q8.resize(mPyramid[0].width()*mPyramid[0].height());
+    }
+
+    for(int i = 0; i < mNumOctaves; i++) {
+        const size_t level = i*mNumScalesPerOctave;
+        const size_t width = mPyramid[level].width();
+        const size_t height = mPyramid[level].height();
+
+        if(i == 0) {
+            // The first image is exact, so it is the same as the floating point pyramid's
+            Pass pass = {PASS_FILTER_U8, image.get(), width, height, (float*)mPyramid[0].get(), &mPyramidQ8[0][0]};
+            run(pass);
+        } else {
+            Pass pass = {PASS_DOWNSAMPLE_Q8,
+                         &mPyramidQ8[level-1][0],
+                         mPyramid[level-1].width(),
+                         mPyramid[level-1].height(),
+                         (float*)mPyramid[level].get(),
+                         &mPyramidQ8[level][0]};
+            run(pass);
+        }
+
+        Pass filter1 = {PASS_FILTER_Q8, &mPyramidQ8[level][0], width, height, (float*)mPyramid[level+1].get(), &mPyramidQ8[level+1][0]};
+        run(filter1);
+
+        // The last image of the octave is filtered twice. Only the second result is needed as floats.
+        Pass filter2 = {PASS_FILTER_Q8, &mPyramidQ8[level+1][0], width, height, NULL, &mTemp_q8[0]};
+        run(filter2);
+        Pass filter3 = {PASS_FILTER_Q8, &mTemp_q8[0], width, height, (float*)mPyramid[level+2].get(), &mPyramidQ8[level+2][0]};
+        run(filter3);
+    }
+}
+
 void BinomialPyramid32f::apply_filter(Image& dst, const Image& src) {
     ASSERT(dst.type() == IMAGE_F32, "Destination image should be a float");
-    
+
+    Pass pass = {PASS_FILTER_F32, src.get(), src.width(), src.height(), (float*)dst.get(), NULL};
     switch(src.type()) {
         case IMAGE_UINT8:
-            binomial_4th_order((float*)dst.get(),
-                               &mTemp_us16[0],
-                               (const unsigned char*)src.get(),
-                               src.width(),
-                               src.height());
+            pass.type = PASS_FILTER_U8;
             break;
         case IMAGE_F32:
-            binomial_4th_order((float*)dst.get(),
-                               &mTemp_f32_1[0],
-                               (const float*)src.get(),
-                               src.width(),
-                               src.height());
+            pass.type = PASS_FILTER_F32;
             break;
         case IMAGE_UNKNOWN:
             throw EXCEPTION("Unknown image type");
         default:
             throw EXCEPTION("Unsupported image type");
     }
+    run(pass);
 }
 
 void BinomialPyramid32f::apply_filter_twice(Image& dst, const Image& src) {
@@ -383,3 +817,123 @@ void BinomialPyramid32f::apply_filter_twice(Image& dst, const Image& src) {
     apply_filter(tmp, src);
     apply_filter(dst, tmp);
 }
+
+void BinomialPyramid32f::run(const Pass& pass) {
+    mPass = pass;
+
+    if(mThreads.empty() || pass.width*pass.height < kMinParallelPixels) {
+        runBand(0, 1);
+        return;
+    }
+
+    for(size_t i = 0; i < mThreads.size(); i++) {
+        threadStartSignal(mThreads[i]);
+    }
+    runBand(0, (int)mThreads.size() + 1);
+    for(size_t i = 0; i < mThreads.size(); i++) {
+        threadEndWait(mThreads[i]);
+    }
+}
+
+void BinomialPyramid32f::runBand(int index, int bandNum) {
+    const Pass& pass = mPass;
+    const bool downsample = (pass.type == PASS_DOWNSAMPLE_F32 || pass.type == PASS_DOWNSAMPLE_Q8);
+    const size_t rows = downsample ? pass.height>>1 : pass.height;
+    const size_t row_begin = rows*index/bandNum;
+    const size_t row_end = rows*(index+1)/bandNum;
+
+    switch(pass.type) {
+        case PASS_FILTER_U8: {
+            BinomialFilterU8 filter = {pass.dst, pass.dst_q8};
+            binomial_rows(filter, &mRows_us16[index][0], (const unsigned char*)pass.src, pass.width, pass.height, row_begin, row_end);
+            break;
+        }
+        case PASS_FILTER_F32: {
+            BinomialFilterF32 filter = {pass.dst};
+            binomial_rows(filter, &mRows_f32[index][0], (const float*)pass.src, pass.width, pass.height, row_begin, row_end);
+            break;
+        }
+        case PASS_FILTER_Q8: {
+            BinomialFilterQ8 filter = {pass.dst_q8, pass.dst};
+            binomial_rows(filter, &mRows_us16[index][0], (const unsigned short*)pass.src, pass.width, pass.height, row_begin, row_end);
+            break;
+        }
+        case PASS_DOWNSAMPLE_F32: {
+            const float* src = (const float*)pass.src;
+            const size_t dst_width = pass.width>>1;
+            for(size_t row = row_begin; row < row_end; row++) {
+                const float* src_ptr1 = &src[(row<<1)*pass.width];
+                downsample_row_f32(&pass.dst[row*dst_width], src_ptr1, src_ptr1 + pass.width, dst_width);
+            }
+            break;
+        }
+        case PASS_DOWNSAMPLE_Q8: {
+            const unsigned short* src = (const unsigned short*)pass.src;
+            const size_t dst_width = pass.width>>1;
+            for(size_t row = row_begin; row < row_end; row++) {
+                const unsigned short* src_ptr1 = &src[(row<<1)*pass.width];
+                downsample_row_q8(&pass.dst_q8[row*dst_width],
+                                  pass.dst ? &pass.dst[row*dst_width] : NULL,
+                                  src_ptr1,
+                                  src_ptr1 + pass.width,
+                                  dst_width);
+            }
+            break;
+        }
+    }
+}
+
+void* BinomialPyramid32f::worker(THREAD_HANDLE_T* threadHandle) {
+    WorkerArg* arg = (WorkerArg*)threadGetArg(threadHandle);
+
+    while(threadStartWait(threadHandle) == 0) {
+        arg->pyramid->runBand(arg->index, (int)arg->pyramid->mThreads.size() + 1);
+        threadEndSignal(threadHandle);
+    }
+    return NULL;
+}
+
+void BinomialPyramid32f::startThreads() {
+    int threadNum = mThreadNum;
+    if(threadNum < 1) {
+        threadNum = threadGetCPU();
+    }
+    if(threadNum < 1) {
+        threadNum = 1;
+    }
+
+    if((int)mThreads.size() != threadNum - 1) {
+        stopThreads();
+
+        // Everything the workers reference must be in place before the first one starts.
+        mWorkerArgs.resize(threadNum - 1);
+        for(int i = 0; i < threadNum - 1; i++) {
+            mWorkerArgs[i].pyramid = this;
+            mWorkerArgs[i].index = i + 1;
+        }
+        for(int i = 0; i < threadNum - 1; i++) {
+            THREAD_HANDLE_T* thread = threadInit(i + 1, &mWorkerArgs[i], worker);
+            if(!thread) {
+                // Build with the threads we have
+                break;
+            }
+            mThreads.push_back(thread);
+        }
+    }
+
+    // Ring buffers for each band
+    mRows_us16.resize(threadNum);
+    mRows_f32.resize(threadNum);
+    for(size_t i = 0; i < mRows_us16.size(); i++) {
+        mRows_us16[i].resize(5*mPyramid[0].width());
+        mRows_f32[i].resize(5*mPyramid[0].width());
+    }
+}
+
+void BinomialPyramid32f::stopThreads() {
+    for(size_t i = 0; i < mThreads.size(); i++) {
+        threadWaitQuit(mThreads[i]);
+        threadFree(&mThreads[i]);
+    }
+    mThreads.clear();
+}
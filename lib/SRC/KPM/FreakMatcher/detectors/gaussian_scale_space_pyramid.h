@@ -38,6 +38,7 @@
 #include <vector>
 #include <framework/image.h>
 #include <math/math_utils.h>
+#include <thread_sub.h>
 #include <cmath>
 
 namespace vision {
@@ -303,6 +304,10 @@ namespace vision {
     
     /**
      * Build a Binomial Gaussian Scale Space Pyramid represented represented as 32-bit floats.
+     *
+     * Each filter and downsample pass is split into bands of rows, which can be processed
+     * in parallel. Optionally, the pyramid can be built in 16-bit fixed point and only
+     * converted to floats for output.
      */
     class BinomialPyramid32f : public GaussianScaleSpacePyramid {
     public:
@@ -310,6 +315,22 @@ namespace vision {
         BinomialPyramid32f();
         ~BinomialPyramid32f();
         
+        /**
+         * Set/Get the number of threads used to build the pyramid. 1 (the default) builds on
+         * the calling thread, and -1 uses one thread per CPU. The threads are started by the
+         * next call to build(). The pyramid does not depend on the number of threads.
+         */
+        void setThreadNum(int threadNum) { mThreadNum = threadNum; }
+        int threadNum() const { return mThreadNum; }
+        
+        /**
+         * Set/Get whether the pyramid is built in 16-bit fixed point (8 fractional bits)
+         * instead of 32-bit floats. Fixed point is faster but rounds every filter pass to
+         * 1/256 of a gray level. Off by default.
+         */
+        void setFixedPoint(bool fixedPoint) { mFixedPoint = fixedPoint; }
+        bool fixedPoint() const { return mFixedPoint; }
+        
         /**
          * Allocate memory for the pyramid.
          */
@@ -329,13 +350,66 @@ namespace vision {
         
     private:
         
-        // Temporary space for binomial filter
-        std::vector<unsigned short> mTemp_us16;
-        std::vector<float> mTemp_f32_1;
+        // Not copyable: owns threads which refer back to it
+        BinomialPyramid32f(const BinomialPyramid32f&);
+        BinomialPyramid32f& operator=(const BinomialPyramid32f&);
+        
+        enum PassType {
+            PASS_FILTER_U8,
+            PASS_FILTER_F32,
+            PASS_FILTER_Q8,
+            PASS_DOWNSAMPLE_F32,
+            PASS_DOWNSAMPLE_Q8
+        };
+        
+        // One filter or downsample pass over an image. src is of the type given by the pass,
+        // and the destination is written to dst and/or dst_q8 (either may be NULL for Q8 passes).
+        struct Pass {
+            PassType type;
+            const void* src;
+            size_t width;
+            size_t height;
+            float* dst;
+            unsigned short* dst_q8;
+        };
+        
+        struct WorkerArg {
+            BinomialPyramid32f* pyramid;
+            int index;
+        };
+        
+        // Temporary space for the second of two binomial filters
         std::vector<float> mTemp_f32_2;
+        std::vector<unsigned short> mTemp_q8;
+        
+        // Fixed point copy of each pyramid image, when building in fixed point
+        std::vector< std::vector<unsigned short> > mPyramidQ8;
+        
+        // Horizontally filtered rows, 5 per band
+        std::vector< std::vector<unsigned short> > mRows_us16;
+        std::vector< std::vector<float> > mRows_f32;
+        
+        bool mFixedPoint;
+        
+        int mThreadNum;
+        Pass mPass;
+        std::vector<WorkerArg> mWorkerArgs;
+        std::vector<THREAD_HANDLE_T*> mThreads;
         
         void apply_filter(Image& dst, const Image& src);
         void apply_filter_twice(Image& dst, const Image& src);
+        
+        void build_fixed_point(const Image& image);
+        
+        /**
+         * Run a pass, splitting its rows over the threads.
+         */
+        void run(const Pass& pass);
+        void runBand(int index, int bandNum);
+        
+        static void* worker(THREAD_HANDLE_T* threadHandle);
+        void startThreads();
+        void stopThreads();
     };
     
     /**
@@ -88,6 +88,10 @@ void OrientationAssignment::alloc(size_t fine_width,
 }
 
 void OrientationAssignment::computeGradients(const GaussianScaleSpacePyramid* pyramid) {
+    computeGradients(pyramid, 0, 1);
+}
+
+void OrientationAssignment::computeGradients(const GaussianScaleSpacePyramid* pyramid, int band, int bandNum) {
     // Loop over each pyramid image and compute the gradients
     for(size_t i = 0; i < pyramid->images().size(); i++) {
         const Image& im = pyramid->images()[i];
@@ -97,7 +101,9 @@ void OrientationAssignment::computeGradients(const GaussianScaleSpacePyramid* py
         ComputePolarGradients(mGradients[i].get<float>(),
                               im.get<float>(),
                               im.width(),
-                              im.height());
+                              im.height(),
+                              im.height()*band/bandNum,
+                              im.height()*(band+1)/bandNum);
     }
 }
 
@@ -107,7 +113,18 @@ void OrientationAssignment::compute(float* angles,
                                     int scale,
                                     float x,
                                     float y,
-                                    float sigma) {  
+                                    float sigma) {
+    compute(angles, num_angles, &mHistogram[0], octave, scale, x, y, sigma);
+}
+
+void OrientationAssignment::compute(float* angles,
+                                    int& num_angles,
+                                    float* histogram,
+                                    int octave,
+                                    int scale,
+                                    float x,
+                                    float y,
+                                    float sigma) const {
     int xi, yi;
     float radius;
     float radius2;
@@ -160,7 +177,7 @@ void OrientationAssignment::compute(float* angles,
     y1 = min2<int>(y1, (int)g.height()-1);
     
     // Zero out the orientation histogram
-    ZeroVector(&mHistogram[0], mHistogram.size());
+    ZeroVector(histogram, mNumBins);
     
     // Build up the orientation histogram
     for(int yp = y0; yp <= y1; yp++) {
@@ -189,7 +206,7 @@ void OrientationAssignment::compute(float* angles,
             float fbin  = mNumBins*angle*ONE_OVER_2PI;
             
             // Vote to the orientation histogram with a bilinear update
-            bilinear_histogram_update(&mHistogram[0], fbin, w*mag, mNumBins);
+            bilinear_histogram_update(histogram, fbin, w*mag, mNumBins);
         }
     }
     
@@ -200,13 +217,13 @@ void OrientationAssignment::compute(float* angles,
             0.274068619061197f,
             0.451862761877606f,
             0.274068619061197f};
-        SmoothOrientationHistogram(&mHistogram[0], &mHistogram[0], mNumBins, kernel);
+        SmoothOrientationHistogram(histogram, histogram, mNumBins, kernel);
     }
     
     // Find the peak of the histogram.
     for(int i = 0; i < mNumBins; i++) {
-        if(mHistogram[i] > max_height) {
-            max_height = mHistogram[i];
+        if(histogram[i] > max_height) {
+            max_height = histogram[i];
         }
     }
     
@@ -219,12 +236,12 @@ void OrientationAssignment::compute(float* angles,
     
     // Find all the peaks.
     for(int i = 0; i < mNumBins; i++) {
-        const float p0[]  = {(float)i, mHistogram[i]};
-        const float pm1[] = {(float)(i-1), mHistogram[(i-1+mNumBins)%mNumBins]};
-        const float pp1[] = {(float)(i+1), mHistogram[(i+1+mNumBins)%mNumBins]};
+        const float p0[]  = {(float)i, histogram[i]};
+        const float pm1[] = {(float)(i-1), histogram[(i-1+mNumBins)%mNumBins]};
+        const float pp1[] = {(float)(i+1), histogram[(i+1+mNumBins)%mNumBins]};
         
         // Ensure that "p0" is a relative peak w.r.t. the two neighbors
-        if((mHistogram[i] > mPeakThreshold*max_height) && (p0[1] > pm1[1]) && (p0[1] > pp1[1])) {
+        if((histogram[i] > mPeakThreshold*max_height) && (p0[1] > pm1[1]) && (p0[1] > pp1[1])) {
             float A, B, C, fbin;
             
             // The default sub-pixel bin location is the discrete location if the quadratic
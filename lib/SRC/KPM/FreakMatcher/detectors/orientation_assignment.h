@@ -70,6 +70,12 @@ namespace vision {
          */
         void computeGradients(const GaussianScaleSpacePyramid* pyramid);
         
+        /**
+         * Compute the gradients of one band of rows of each image in a pyramid. Different
+         * bands can be computed concurrently.
+         */
+        void computeGradients(const GaussianScaleSpacePyramid* pyramid, int band, int bandNum);
+        
         /**
          * Compute orientations for a keypont.
          */
@@ -81,6 +87,25 @@ namespace vision {
                      float y,
                      float sigma);
         
+        /**
+         * Compute orientations for a keypont, building the orientation histogram in
+         * HISTOGRAM, which has numBins() elements. Feature points can be computed
+         * concurrently, each with its own histogram.
+         */
+        void compute(float* angles,
+                     int& num_angles,
+                     float* histogram,
+                     int octave,
+                     int scale,
+                     float x,
+                     float y,
+                     float sigma) const;
+        
+        /**
+         * @return Number of bins in the orientation histogram
+         */
+        inline int numBins() const { return mNumBins; }
+        
         /**
          * @return Vector of images.
          */
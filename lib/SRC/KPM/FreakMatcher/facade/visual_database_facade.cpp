@@ -99,6 +99,9 @@ namespace vision {
                                                                   std::vector<unsigned char>& descriptors){
         Image img = Image(grayImage,IMAGE_UINT8,width,height,(int)width,1);
         std::unique_ptr<vdb_t> tmpDb(new vdb_t());
+        // Callers such as genTexData already run one of these per scale on its own thread, so don't
+        // spread the pyramid, detector and extractor over further threads here.
+        tmpDb->setQueryThreadNum(1);
         tmpDb->addImage(img, 1);
         featurePoints = tmpDb->keyframe(1)->store().points();
         descriptors = tmpDb->keyframe(1)->store().features();
@@ -111,6 +114,22 @@ namespace vision {
         return mVisualDbImpl->mVdb->query(img);
     }
     
+    void VisualDatabaseFacade::setQueryThreadNum(int n){
+        mVisualDbImpl->mVdb->setQueryThreadNum(n);
+    }
+    
+    int VisualDatabaseFacade::getQueryThreadNum() const{
+        return mVisualDbImpl->mVdb->queryThreadNum();
+    }
+    
+    void VisualDatabaseFacade::setShortlistSize(int k){
+        mVisualDbImpl->mVdb->setShortlistSize(k);
+    }
+    
+    int VisualDatabaseFacade::getShortlistSize() const{
+        return mVisualDbImpl->mVdb->shortlistSize();
+    }
+    
     bool VisualDatabaseFacade::erase(int image_id){
         return mVisualDbImpl->mVdb->erase(image_id);
     }
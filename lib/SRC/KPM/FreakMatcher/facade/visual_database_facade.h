@@ -67,6 +67,14 @@ namespace vision {
         
         bool query(unsigned char* grayImage, size_t width, size_t height) ;
         
+        void setQueryThreadNum(int n);
+        
+        int getQueryThreadNum() const;
+        
+        void setShortlistSize(int k);
+        
+        int getShortlistSize() const;
+        
         
         bool erase(int image_id);
         
@@ -41,12 +41,23 @@
 #include <math/cholesky_linear_solvers.h>
 #include <math/robustifiers.h>
 #include <utils/partial_sort.h>
+#include <thread_sub.h>
 
 #include <Eigen/Core>
 #include <Eigen/LU>
 #include <Eigen/Eigen>
 #include <unsupported/Eigen/MatrixFunctions>
 
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define ROBUST_HOMOGRAPHY_SSE2 1
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define ROBUST_HOMOGRAPHY_NEON 1
+#endif
+
 namespace vision {
     
 #define HOMOGRAPHY_DEFAULT_CAUCHY_SCALE         0.01
@@ -90,6 +101,290 @@ namespace vision {
         return total_cost;
     }
     
+    /**
+     * Compute the Cauchy reprojection cost for H*p_i-q_i, with the correspondences stored as
+     * structure-of-arrays: p_i = (px[i],py[i]) and q_i = (qx[i],qy[i]).
+     */
+    template<typename T>
+    inline T CauchyProjectiveReprojectionCostSoA(const T H[9],
+                                                 const T* px,
+                                                 const T* py,
+                                                 const T* qx,
+                                                 const T* qy,
+                                                 int num_points,
+                                                 T one_over_scale2) {
+        T total_cost;
+        T pp[2];
+        
+        total_cost = 0;
+        for(int i = 0; i < num_points; i++) {
+            MultiplyPointHomographyInhomogenous(pp[0], pp[1], H, px[i], py[i]);
+            total_cost += CauchyCost(pp[0]-qx[i], pp[1]-qy[i], one_over_scale2);
+        }
+        
+        return total_cost;
+    }
+    
+#if ROBUST_HOMOGRAPHY_SSE2 || ROBUST_HOMOGRAPHY_NEON
+    
+    //
+    // 4-wide Cauchy reprojection cost. The logarithm is Cephes' logf polynomial, valid here
+    // because the Cauchy cost only takes logarithms of values >= 1. Overflowed (infinite or NaN)
+    // costs are returned as infinity so that such hypotheses are never preferred.
+    //
+    
+#define ROBUST_HOMOGRAPHY_LOG_P0    7.0376836292E-2f
+#define ROBUST_HOMOGRAPHY_LOG_P1   -1.1514610310E-1f
+#define ROBUST_HOMOGRAPHY_LOG_P2    1.1676998740E-1f
+#define ROBUST_HOMOGRAPHY_LOG_P3   -1.2420140846E-1f
+#define ROBUST_HOMOGRAPHY_LOG_P4    1.4249322787E-1f
+#define ROBUST_HOMOGRAPHY_LOG_P5   -1.6668057665E-1f
+#define ROBUST_HOMOGRAPHY_LOG_P6    2.0000714765E-1f
+#define ROBUST_HOMOGRAPHY_LOG_P7   -2.4999993993E-1f
+#define ROBUST_HOMOGRAPHY_LOG_P8    3.3333331174E-1f
+#define ROBUST_HOMOGRAPHY_LOG_Q1   -2.12194440E-4f
+#define ROBUST_HOMOGRAPHY_LOG_Q2    0.693359375f
+#define ROBUST_HOMOGRAPHY_SQRTHF    0.707106781186547524f
+    
+#endif
+    
+#if ROBUST_HOMOGRAPHY_SSE2
+    
+    /**
+     * Natural logarithm of 4 floats, each >= 1.
+     */
+    inline __m128 CauchyLog4(__m128 x) {
+        const __m128 one = _mm_set1_ps(1.f);
+        __m128i bits = _mm_castps_si128(x);
+        
+        // x = m*2^e, with m in [0.5,1)
+        __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+        __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)),
+                                                 _mm_set1_epi32(0x3F000000)));
+        
+        // Shift m to [sqrt(0.5)-1,sqrt(2)-1)
+        __m128 small = _mm_cmplt_ps(m, _mm_set1_ps(ROBUST_HOMOGRAPHY_SQRTHF));
+        e = _mm_sub_ps(e, _mm_and_ps(one, small));
+        m = _mm_sub_ps(_mm_add_ps(m, _mm_and_ps(m, small)), one);
+        
+        __m128 z = _mm_mul_ps(m, m);
+        __m128 y = _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_P0);
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_P1));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_P2));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_P3));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_P4));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_P5));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_P6));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_P7));
+        y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_P8));
+        y = _mm_mul_ps(_mm_mul_ps(y, m), z);
+        y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_Q1)));
+        y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+        __m128 r = _mm_add_ps(_mm_add_ps(m, y), _mm_mul_ps(e, _mm_set1_ps(ROBUST_HOMOGRAPHY_LOG_Q2)));
+        
+        __m128 finite = _mm_cmple_ps(x, _mm_set1_ps(std::numeric_limits<float>::max()));
+        return _mm_or_ps(_mm_and_ps(finite, r),
+                         _mm_andnot_ps(finite, _mm_set1_ps(std::numeric_limits<float>::infinity())));
+    }
+    
+    inline float CauchyProjectiveReprojectionCostSoA(const float H[9],
+                                                     const float* px,
+                                                     const float* py,
+                                                     const float* qx,
+                                                     const float* qy,
+                                                     int num_points,
+                                                     float one_over_scale2) {
+        const __m128 h0 = _mm_set1_ps(H[0]), h1 = _mm_set1_ps(H[1]), h2 = _mm_set1_ps(H[2]);
+        const __m128 h3 = _mm_set1_ps(H[3]), h4 = _mm_set1_ps(H[4]), h5 = _mm_set1_ps(H[5]);
+        const __m128 h6 = _mm_set1_ps(H[6]), h7 = _mm_set1_ps(H[7]), h8 = _mm_set1_ps(H[8]);
+        const __m128 s = _mm_set1_ps(one_over_scale2);
+        const __m128 one = _mm_set1_ps(1.f);
+        __m128 sum = _mm_setzero_ps();
+        float tail[4][4];
+        float lanes[4];
+        
+        for(int i = 0; i < num_points; i+=4) {
+            __m128 x, y, u, v;
+            __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            if(i+4 <= num_points) {
+                x = _mm_loadu_ps(px+i);
+                y = _mm_loadu_ps(py+i);
+                u = _mm_loadu_ps(qx+i);
+                v = _mm_loadu_ps(qy+i);
+            } else {
+                // Pad the last 1-3 points, and mask out the padding's cost
+                int n = num_points-i;
+                for(int k = 0; k < 4; k++) {
+                    tail[0][k] = k < n ? px[i+k] : 0;
+                    tail[1][k] = k < n ? py[i+k] : 0;
+                    tail[2][k] = k < n ? qx[i+k] : 0;
+                    tail[3][k] = k < n ? qy[i+k] : 0;
+                }
+                x = _mm_loadu_ps(tail[0]);
+                y = _mm_loadu_ps(tail[1]);
+                u = _mm_loadu_ps(tail[2]);
+                v = _mm_loadu_ps(tail[3]);
+                mask = _mm_castsi128_ps(_mm_cmplt_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(n)));
+            }
+            __m128 w = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_mul_ps(h6, x), _mm_mul_ps(h7, y)), h8));
+            __m128 fx = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(h0, x), _mm_mul_ps(h1, y)), h2), w), u);
+            __m128 fy = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(h3, x), _mm_mul_ps(h4, y)), h5), w), v);
+            __m128 r2 = _mm_add_ps(_mm_mul_ps(fx, fx), _mm_mul_ps(fy, fy));
+            sum = _mm_add_ps(sum, _mm_and_ps(mask, CauchyLog4(_mm_add_ps(one, _mm_mul_ps(r2, s)))));
+        }
+        
+        _mm_storeu_ps(lanes, sum);
+        return (lanes[0]+lanes[1])+(lanes[2]+lanes[3]);
+    }
+    
+#elif ROBUST_HOMOGRAPHY_NEON
+    
+    /**
+     * Natural logarithm of 4 floats, each >= 1.
+     */
+    inline float32x4_t CauchyLog4(float32x4_t x) {
+        const float32x4_t one = vdupq_n_f32(1.f);
+        uint32x4_t bits = vreinterpretq_u32_f32(x);
+        
+        // x = m*2^e, with m in [0.5,1)
+        float32x4_t e = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(126)));
+        float32x4_t m = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007FFFFF)),
+                                                        vdupq_n_u32(0x3F000000)));
+        
+        // Shift m to [sqrt(0.5)-1,sqrt(2)-1)
+        uint32x4_t small = vcltq_f32(m, vdupq_n_f32(ROBUST_HOMOGRAPHY_SQRTHF));
+        e = vsubq_f32(e, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(one), small)));
+        m = vsubq_f32(vaddq_f32(m, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(m), small))), one);
+        
+        float32x4_t z = vmulq_f32(m, m);
+        float32x4_t y = vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_P0);
+        y = vaddq_f32(vmulq_f32(y, m), vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_P1));
+        y = vaddq_f32(vmulq_f32(y, m), vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_P2));
+        y = vaddq_f32(vmulq_f32(y, m), vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_P3));
+        y = vaddq_f32(vmulq_f32(y, m), vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_P4));
+        y = vaddq_f32(vmulq_f32(y, m), vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_P5));
+        y = vaddq_f32(vmulq_f32(y, m), vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_P6));
+        y = vaddq_f32(vmulq_f32(y, m), vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_P7));
+        y = vaddq_f32(vmulq_f32(y, m), vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_P8));
+        y = vmulq_f32(vmulq_f32(y, m), z);
+        y = vaddq_f32(y, vmulq_f32(e, vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_Q1)));
+        y = vsubq_f32(y, vmulq_f32(z, vdupq_n_f32(0.5f)));
+        float32x4_t r = vaddq_f32(vaddq_f32(m, y), vmulq_f32(e, vdupq_n_f32(ROBUST_HOMOGRAPHY_LOG_Q2)));
+        
+        uint32x4_t finite = vcleq_f32(x, vdupq_n_f32(std::numeric_limits<float>::max()));
+        return vbslq_f32(finite, r, vdupq_n_f32(std::numeric_limits<float>::infinity()));
+    }
+    
+    /**
+     * Reciprocal of 4 floats. ARMv7 NEON has no divide, so refine the reciprocal estimate instead.
+     */
+    inline float32x4_t CauchyReciprocal4(float32x4_t x) {
+#if defined(__aarch64__) || defined(_M_ARM64)
+        return vdivq_f32(vdupq_n_f32(1.f), x);
+#else
+        float32x4_t r = vrecpeq_f32(x);
+        r = vmulq_f32(vrecpsq_f32(x, r), r);
+        return vmulq_f32(vrecpsq_f32(x, r), r);
+#endif
+    }
+    
+    inline float CauchyProjectiveReprojectionCostSoA(const float H[9],
+                                                     const float* px,
+                                                     const float* py,
+                                                     const float* qx,
+                                                     const float* qy,
+                                                     int num_points,
+                                                     float one_over_scale2) {
+        const float32x4_t s = vdupq_n_f32(one_over_scale2);
+        const float32x4_t one = vdupq_n_f32(1.f);
+        const int32_t lane_index[4] = {0, 1, 2, 3};
+        float32x4_t sum = vdupq_n_f32(0.f);
+        float tail[4][4];
+        
+        for(int i = 0; i < num_points; i+=4) {
+            float32x4_t x, y, u, v;
+            uint32x4_t mask = vdupq_n_u32(0xFFFFFFFF);
+            if(i+4 <= num_points) {
+                x = vld1q_f32(px+i);
+                y = vld1q_f32(py+i);
+                u = vld1q_f32(qx+i);
+                v = vld1q_f32(qy+i);
+            } else {
+                // Pad the last 1-3 points, and mask out the padding's cost
+                int n = num_points-i;
+                for(int k = 0; k < 4; k++) {
+                    tail[0][k] = k < n ? px[i+k] : 0;
+                    tail[1][k] = k < n ? py[i+k] : 0;
+                    tail[2][k] = k < n ? qx[i+k] : 0;
+                    tail[3][k] = k < n ? qy[i+k] : 0;
+                }
+                x = vld1q_f32(tail[0]);
+                y = vld1q_f32(tail[1]);
+                u = vld1q_f32(tail[2]);
+                v = vld1q_f32(tail[3]);
+                mask = vcltq_s32(vld1q_s32(lane_index), vdupq_n_s32(n));
+            }
+            float32x4_t w = CauchyReciprocal4(vaddq_f32(vaddq_f32(vmulq_n_f32(x, H[6]), vmulq_n_f32(y, H[7])), vdupq_n_f32(H[8])));
+            float32x4_t fx = vsubq_f32(vmulq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x, H[0]), vmulq_n_f32(y, H[1])), vdupq_n_f32(H[2])), w), u);
+            float32x4_t fy = vsubq_f32(vmulq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x, H[3]), vmulq_n_f32(y, H[4])), vdupq_n_f32(H[5])), w), v);
+            float32x4_t r2 = vaddq_f32(vmulq_f32(fx, fx), vmulq_f32(fy, fy));
+            float32x4_t cost = CauchyLog4(vaddq_f32(one, vmulq_f32(r2, s)));
+            sum = vaddq_f32(sum, vreinterpretq_f32_u32(vandq_u32(mask, vreinterpretq_u32_f32(cost))));
+        }
+        
+        return (vgetq_lane_f32(sum, 0)+vgetq_lane_f32(sum, 1))+(vgetq_lane_f32(sum, 2)+vgetq_lane_f32(sum, 3));
+    }
+    
+#endif // ROBUST_HOMOGRAPHY_SSE2 / ROBUST_HOMOGRAPHY_NEON
+    
+    /**
+     * Add the cost of correspondences [first,last) to each of hypotheses hyp_costs[0..num_hypotheses).
+     *
+     * @param[in] points structure-of-arrays correspondences, [px | py | qx | qy], each num_points long
+     */
+    template<typename T>
+    inline void ScoreHomographyHypotheses(std::pair<T, int>* hyp_costs,
+                                          int num_hypotheses,
+                                          const T* hyp,
+                                          const T* points,
+                                          int num_points,
+                                          int first,
+                                          int last,
+                                          T one_over_scale2) {
+        const T* px = points + first;
+        const T* py = px + num_points;
+        const T* qx = py + num_points;
+        const T* qy = qx + num_points;
+        
+        for(int j = 0; j < num_hypotheses; j++) {
+            hyp_costs[j].first += CauchyProjectiveReprojectionCostSoA(&hyp[hyp_costs[j].second*9],
+                                                                      px,
+                                                                      py,
+                                                                      qx,
+                                                                      qy,
+                                                                      last-first,
+                                                                      one_over_scale2);
+        }
+    }
+    
+    /**
+     * Scores hypotheses on behalf of PreemptiveRobustHomography(), e.g. spread over threads.
+     * score() has the same arguments and result as ScoreHomographyHypotheses().
+     */
+    template<typename T>
+    class HomographyHypothesisScorer {
+    public:
+        virtual ~HomographyHypothesisScorer() {}
+        virtual void score(std::pair<T, int>* hyp_costs,
+                           int num_hypotheses,
+                           const T* hyp,
+                           const T* points,
+                           int num_points,
+                           int first,
+                           int last,
+                           T one_over_scale2) = 0;
+    };
+    
     /**
      * Robustly solve for the homography given a set of correspondences. 
      */
@@ -102,12 +397,15 @@ namespace vision {
                                     int num_test_points,
                                     std::vector<T> &hyp /* 9*max_num_hypotheses */,
                                     std::vector<int> &tmp_i /* num_points */,
+                                    std::vector<T> &tmp_points /* 4*num_points */,
                                     std::vector< std::pair<T, int> > &hyp_costs /* max_num_hypotheses */,
                                     T scale = HOMOGRAPHY_DEFAULT_CAUCHY_SCALE,
                                     int max_num_hypotheses = HOMOGRAPHY_DEFAULT_NUM_HYPOTHESES,
                                     int max_trials = HOMOGRAPHY_DEFAULT_MAX_TRIALS,
-                                    int chunk_size = HOMOGRAPHY_DEFAULT_CHUNK_SIZE) {
+                                    int chunk_size = HOMOGRAPHY_DEFAULT_CHUNK_SIZE,
+                                    HomographyHypothesisScorer<T>* scorer = NULL) {
         int* hyp_perm;
+        T* points;
         T one_over_scale2;
         T min_cost;
         int num_hypotheses, num_hypotheses_remaining, min_index;
@@ -118,6 +416,7 @@ namespace vision {
         
         ASSERT(hyp.size() >= 9*max_num_hypotheses, "hyp vector should be of size 9*max_num_hypotheses");
         ASSERT(tmp_i.size() >= num_points, "tmp_i vector should be of size num_points");
+        ASSERT(tmp_points.size() >= (size_t)(4*num_points), "tmp_points vector should be of size 4*num_points");
         ASSERT(hyp_costs.size() >= max_num_hypotheses, "hyp_costs vector should be of size max_num_hypotheses");
         
         // We need at least SAMPLE_SIZE points to sample from
@@ -186,6 +485,16 @@ namespace vision {
             return false;
         }
         
+        // Lay the correspondences out in scoring order as structure-of-arrays, so that
+        // each chunk is contiguous.
+        points = &tmp_points[0];
+        for(int i = 0; i < num_points; i++) {
+            points[i]              = p[hyp_perm[i]<<1];
+            points[num_points+i]   = p[(hyp_perm[i]<<1)+1];
+            points[2*num_points+i] = q[hyp_perm[i]<<1];
+            points[3*num_points+i] = q[(hyp_perm[i]<<1)+1];
+        }
+        
         // Initialize the hypotheses costs
         for(int i = 0; i < num_hypotheses; i++) {
             hyp_costs[i].first = 0;
@@ -206,14 +515,10 @@ namespace vision {
             this_chunk_end = i+cur_chunk_size;
             
             // Score each of the remaining hypotheses
-            for(int j = 0; j < num_hypotheses_remaining; j++) {
-                const T* H_cur = &hyp[hyp_costs[j].second*9];
-                for(int k = i; k < this_chunk_end; k++) {
-                    hyp_costs[j].first += CauchyProjectiveReprojectionCost(H_cur,
-                                                                           &p[hyp_perm[k]<<1],
-                                                                           &q[hyp_perm[k]<<1],
-                                                                           one_over_scale2);
-                }
+            if(scorer) {
+                scorer->score(&hyp_costs[0], num_hypotheses_remaining, &hyp[0], points, num_points, i, this_chunk_end, one_over_scale2);
+            } else {
+                ScoreHomographyHypotheses(&hyp_costs[0], num_hypotheses_remaining, &hyp[0], points, num_points, i, this_chunk_end, one_over_scale2);
             }
             
             // Cut out half of the hypotheses
@@ -570,14 +875,14 @@ namespace vision {
      * Robust homography estimation.
      */
     template<typename T>
-    class RobustHomography {
+    class RobustHomography : private HomographyHypothesisScorer<T> {
     public:
         
         RobustHomography(T cauchyScale          = HOMOGRAPHY_DEFAULT_CAUCHY_SCALE,
                          int maxNumHypotheses   = HOMOGRAPHY_DEFAULT_NUM_HYPOTHESES,
                          int maxTrials          = HOMOGRAPHY_DEFAULT_MAX_TRIALS,
                          int chunkSize          = HOMOGRAPHY_DEFAULT_CHUNK_SIZE);
-        ~RobustHomography() {}
+        ~RobustHomography() { stopScoringThreads(); }
         
         /**
          * Initalize the RANSAC parameters.
@@ -593,11 +898,69 @@ namespace vision {
         bool find(float H[9], const T* p, const T* q, int num_points);
         bool find(float H[9], const T* p, const T* q, int num_points, const T* test_points, int num_test_points);
         
+        /**
+         * Set/Get the number of threads used to score hypotheses. Each thread scores a block
+         * of the hypotheses, so the result does not depend on the number of threads. 1 (the
+         * default) scores on the calling thread, and -1 uses one thread per CPU. The threads
+         * are started by the next call to find().
+         *
+         * This is intentionally internal-only, and not reachable through the KPM API:
+         * VisualDatabase already verifies keyframes in parallel (kpmSetMatchingThreadNum()),
+         * and each of those threads runs its own RobustHomography on one thread, so threading
+         * here as well would only oversubscribe the CPUs. It is for code that estimates a
+         * single large homography directly.
+         */
+        void setThreadNum(int threadNum) { mThreadNum = threadNum; }
+        int threadNum() const { return mThreadNum; }
+        
     private:
         
+        // Not copyable: owns threads which refer back to it
+        RobustHomography(const RobustHomography&);
+        RobustHomography& operator=(const RobustHomography&);
+        
+        // Fewer point evaluations than this per chunk are scored on the calling thread
+        static const int kMinParallelScoringSize = 16384;
+        
+        // Arguments of the current score() call, shared with the scoring threads
+        struct ScoringJob {
+            std::pair<T, int>* hyp_costs;
+            int num_hypotheses;
+            const T* hyp;
+            const T* points;
+            int num_points;
+            int first;
+            int last;
+            T one_over_scale2;
+        };
+        
+        struct ScoringWorkerArg {
+            RobustHomography* rh;
+            int index;
+        };
+        
+        void score(std::pair<T, int>* hyp_costs,
+                   int num_hypotheses,
+                   const T* hyp,
+                   const T* points,
+                   int num_points,
+                   int first,
+                   int last,
+                   T one_over_scale2);
+        
+        /**
+         * Score the index'th of threadNum blocks of the current job's hypotheses.
+         */
+        void scoreBlock(int index, int threadNum);
+        
+        static void* scoringWorker(THREAD_HANDLE_T* threadHandle);
+        void startScoringThreads();
+        void stopScoringThreads();
+        
         // Temporary memory for RANSAC
         std::vector<T> mHyp;
         std::vector<int> mTmpi;
+        std::vector<T> mTmpPoints;
         std::vector< std::pair<T, int> > mHypCosts;
         
         // RANSAC params
@@ -606,13 +969,20 @@ namespace vision {
         int mMaxTrials;
         int mChunkSize;
         
+        // Scoring threads
+        int mThreadNum;
+        ScoringJob mJob;
+        std::vector<ScoringWorkerArg> mScoringWorkerArgs;
+        std::vector<THREAD_HANDLE_T*> mScoringThreads;
+        
     }; // RobustHomography
     
     template<typename T>
     RobustHomography<T>::RobustHomography(T cauchyScale,
                                           int maxNumHypotheses,
                                           int maxTrials,
-                                          int chunkSize) {
+                                          int chunkSize)
+    : mThreadNum(1) {
         init(cauchyScale, maxNumHypotheses, maxTrials, chunkSize);
     }
     
@@ -633,6 +1003,8 @@ namespace vision {
     template<typename T>
     bool RobustHomography<T>::find(float H[9], const T* p, const T* q, int num_points) {
         mTmpi.resize(num_points);
+        mTmpPoints.resize(4*num_points);
+        startScoringThreads();
         if(!PreemptiveRobustHomography<T>(H,
                                           p,
                                           q,
@@ -641,11 +1013,13 @@ namespace vision {
                                           0,
                                           mHyp,
                                           mTmpi,
+                                          mTmpPoints,
                                           mHypCosts,
                                           mCauchyScale,
                                           mMaxNumHypotheses,
                                           mMaxTrials,
-                                          mChunkSize)) {
+                                          mChunkSize,
+                                          this)) {
             return false;
         }
         
@@ -655,6 +1029,8 @@ namespace vision {
     template<typename T>
     bool RobustHomography<T>::find(float H[9], const T* p, const T* q, int num_points, const T* test_points, int num_test_points) {
         mTmpi.resize(num_points);
+        mTmpPoints.resize(4*num_points);
+        startScoringThreads();
         return PreemptiveRobustHomography<T>(H,
                                              p,
                                              q,
@@ -663,11 +1039,106 @@ namespace vision {
                                              num_test_points,
                                              mHyp,
                                              mTmpi,
+                                             mTmpPoints,
                                              mHypCosts,
                                              mCauchyScale,
                                              mMaxNumHypotheses,
                                              mMaxTrials,
-                                             mChunkSize);
+                                             mChunkSize,
+                                             this);
+    }
+    
+    template<typename T>
+    void RobustHomography<T>::score(std::pair<T, int>* hyp_costs,
+                                    int num_hypotheses,
+                                    const T* hyp,
+                                    const T* points,
+                                    int num_points,
+                                    int first,
+                                    int last,
+                                    T one_over_scale2) {
+        if(mScoringThreads.empty() || num_hypotheses*(last-first) < kMinParallelScoringSize) {
+            ScoreHomographyHypotheses(hyp_costs, num_hypotheses, hyp, points, num_points, first, last, one_over_scale2);
+            return;
+        }
+        
+        mJob.hyp_costs = hyp_costs;
+        mJob.num_hypotheses = num_hypotheses;
+        mJob.hyp = hyp;
+        mJob.points = points;
+        mJob.num_points = num_points;
+        mJob.first = first;
+        mJob.last = last;
+        mJob.one_over_scale2 = one_over_scale2;
+        
+        for(size_t i = 0; i < mScoringThreads.size(); i++) {
+            threadStartSignal(mScoringThreads[i]);
+        }
+        scoreBlock(0, (int)mScoringThreads.size() + 1);
+        for(size_t i = 0; i < mScoringThreads.size(); i++) {
+            threadEndWait(mScoringThreads[i]);
+        }
+    }
+    
+    template<typename T>
+    void RobustHomography<T>::scoreBlock(int index, int threadNum) {
+        int begin = (int)((long long)mJob.num_hypotheses*index/threadNum);
+        int end = (int)((long long)mJob.num_hypotheses*(index+1)/threadNum);
+        ScoreHomographyHypotheses(mJob.hyp_costs + begin,
+                                  end - begin,
+                                  mJob.hyp,
+                                  mJob.points,
+                                  mJob.num_points,
+                                  mJob.first,
+                                  mJob.last,
+                                  mJob.one_over_scale2);
+    }
+    
+    template<typename T>
+    void* RobustHomography<T>::scoringWorker(THREAD_HANDLE_T* threadHandle) {
+        ScoringWorkerArg* arg = (ScoringWorkerArg*)threadGetArg(threadHandle);
+        
+        while(threadStartWait(threadHandle) == 0) {
+            arg->rh->scoreBlock(arg->index, (int)arg->rh->mScoringThreads.size() + 1);
+            threadEndSignal(threadHandle);
+        }
+        return NULL;
+    }
+    
+    template<typename T>
+    void RobustHomography<T>::startScoringThreads() {
+        int threadNum = mThreadNum;
+        if(threadNum < 1) {
+            threadNum = threadGetCPU();
+        }
+        threadNum = max2<int>(1, threadNum);
+        if((int)mScoringThreads.size() == threadNum - 1) {
+            return;
+        }
+        
+        stopScoringThreads();
+        mScoringWorkerArgs.resize(threadNum - 1);
+        for(int i = 0; i < threadNum - 1; i++) {
+            mScoringWorkerArgs[i].rh = this;
+            mScoringWorkerArgs[i].index = i + 1;
+        }
+        for(int i = 0; i < threadNum - 1; i++) {
+            THREAD_HANDLE_T* thread = threadInit(i + 1, &mScoringWorkerArgs[i], scoringWorker);
+            if(!thread) {
+                // Score with the threads we have
+                break;
+            }
+            mScoringThreads.push_back(thread);
+        }
+    }
+    
+    template<typename T>
+    void RobustHomography<T>::stopScoringThreads() {
+        for(size_t i = 0; i < mScoringThreads.size(); i++) {
+            threadWaitQuit(mScoringThreads[i]);
+            threadFree(&mScoringThreads[i]);
+        }
+        mScoringThreads.clear();
     }
     
 } // vision
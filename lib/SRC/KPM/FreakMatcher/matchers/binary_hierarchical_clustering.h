@@ -144,8 +144,14 @@ namespace vision {
             
             // Compute the distance to each cluster center
             std::vector<queue_item_t> v(mChildren.size());
+            std::vector<const unsigned char*> centers(mChildren.size());
+            std::vector<unsigned int> dist(mChildren.size());
             for(size_t i = 0; i < v.size(); i++) {
-                unsigned int d = HammingDistance<NUM_BYTES_PER_FEATURE>(mChildren[i]->mCenter, feature);
+                centers[i] = mChildren[i]->mCenter;
+            }
+            HammingDistanceBatch<NUM_BYTES_PER_FEATURE>(&dist[0], feature, &centers[0], (int)centers.size());
+            for(size_t i = 0; i < v.size(); i++) {
+                unsigned int d = dist[i];
                 v[i] = queue_item_t(mChildren[i], d);
                 if(d < mind) {
                     mind = d;
@@ -227,6 +233,12 @@ namespace vision {
          */
         void build(const unsigned char* features, int num_features);
         
+        /**
+         * Build the tree over the subset of FEATURES given by INDICES. The reverse
+         * index holds indices into FEATURES.
+         */
+        void build(const unsigned char* features, int num_features, const int* indices, int num_indices);
+        
         /**
          * Query the tree for a reverse index.
          */
@@ -297,11 +309,6 @@ namespace vision {
             return mNextNodeId++;
         }
         
-        /**
-         * Private build function with a set of indices.
-         */
-        void build(const unsigned char* features, int num_features, const int* indices, int num_indices);
-        
         /**
          * Recursive function to build the tree.
          */
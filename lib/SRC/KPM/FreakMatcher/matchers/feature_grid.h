@@ -0,0 +1,185 @@
+//
+//  feature_grid.h
+//  ARToolKit5
+//
+//  This file is part of ARToolKit.
+//
+//  ARToolKit is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  ARToolKit is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with ARToolKit.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  As a special exception, the copyright holders of this library give you
+//  permission to link this library with independent modules to produce an
+//  executable, regardless of the license terms of these independent modules, and to
+//  copy and distribute the resulting executable under terms of your choice,
+//  provided that you also meet, for each linked independent module, the terms and
+//  conditions of the license of that module. An independent module is a module
+//  which is neither derived from nor based on this library. If you modify this
+//  library, you may extend this exception to your version of the library, but you
+//  are not obligated to do so. If you do not wish to do so, delete this exception
+//  statement from your version.
+//
+//  Copyright 2016 Daqri, LLC.
+//
+//  Author(s): Philip Lamb
+//
+
+#pragma once
+
+#include "feature_point.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+namespace vision {
+    
+    /**
+     * A uniform grid over the positions of a set of feature points, used to find the
+     * points near a location without visiting every point. The indices of the points in
+     * each cell are stored contiguously, in increasing order.
+     */
+    class FeatureGrid {
+    public:
+        
+        FeatureGrid()
+        : mCellSize(0)
+        , mMinX(0)
+        , mMinY(0)
+        , mMaxX(0)
+        , mMaxY(0)
+        , mCols(0)
+        , mRows(0) {}
+        ~FeatureGrid() {}
+        
+        /**
+         * Build the grid over POINTS with square cells of CELLSIZE pixels.
+         */
+        void build(const std::vector<FeaturePoint>& points, float cellSize) {
+            std::vector<int> indices(points.size());
+            for(size_t i = 0; i < indices.size(); i++) {
+                indices[i] = (int)i;
+            }
+            build(points, indices, cellSize);
+        }
+        
+        /**
+         * Build the grid over the subset of POINTS given by INDICES (in increasing order).
+         * Queries return indices into POINTS.
+         */
+        void build(const std::vector<FeaturePoint>& points, const std::vector<int>& indices, float cellSize) {
+            mCellSize = cellSize;
+            mCols = mRows = 0;
+            mCellStart.clear();
+            mIndices.clear();
+            if(indices.empty() || !(cellSize > 0)) {
+                return;
+            }
+            
+            mMinX = mMaxX = points[indices[0]].x;
+            mMinY = mMaxY = points[indices[0]].y;
+            for(size_t i = 1; i < indices.size(); i++) {
+                const FeaturePoint& p = points[indices[i]];
+                mMinX = std::min(mMinX, p.x);
+                mMinY = std::min(mMinY, p.y);
+                mMaxX = std::max(mMaxX, p.x);
+                mMaxY = std::max(mMaxY, p.y);
+            }
+            mCols = cellX(mMaxX) + 1;
+            mRows = cellY(mMaxY) + 1;
+            
+            // Counting sort of the points by cell, which keeps each cell's indices in order
+            std::vector<int> cells(indices.size());
+            mCellStart.assign(mCols*mRows + 1, 0);
+            for(size_t i = 0; i < indices.size(); i++) {
+                const FeaturePoint& p = points[indices[i]];
+                cells[i] = cellY(p.y)*mCols + cellX(p.x);
+                mCellStart[cells[i] + 1]++;
+            }
+            for(int c = 0; c < mCols*mRows; c++) {
+                mCellStart[c + 1] += mCellStart[c];
+            }
+            std::vector<int> next(mCellStart.begin(), mCellStart.end() - 1);
+            mIndices.resize(indices.size());
+            for(size_t i = 0; i < indices.size(); i++) {
+                mIndices[next[cells[i]]++] = indices[i];
+            }
+        }
+        
+        /**
+         * @return True if the grid has been built over at least one point.
+         */
+        inline bool empty() const { return mIndices.empty(); }
+        
+        /**
+         * @return Size of a cell in pixels.
+         */
+        inline float cellSize() const { return mCellSize; }
+        
+        /**
+         * Append to INDICES, in increasing order, the indices of all points in the cells
+         * within RADIUS of (X,Y). This includes every point within RADIUS, and possibly
+         * some further away.
+         */
+        void query(std::vector<int>& indices, float x, float y, float radius) const {
+            if(empty()) {
+                return;
+            }
+            // Pad by one pixel so that rounding in the caller's distance test can't need a cell
+            // outside the range. The bounds test is written so that a NaN location finds nothing.
+            float r = radius + 1.f;
+            if(!(x + r >= mMinX && x - r <= mMaxX && y + r >= mMinY && y - r <= mMaxY)) {
+                return;
+            }
+            int x0 = cellX(x - r), x1 = std::min(cellX(std::min(x + r, mMaxX)), mCols - 1);
+            int y0 = cellY(y - r), y1 = std::min(cellY(std::min(y + r, mMaxY)), mRows - 1);
+            
+            size_t first = indices.size();
+            for(int cy = y0; cy <= y1; cy++) {
+                // The cells of a row are contiguous
+                int begin = mCellStart[cy*mCols + x0];
+                int end = mCellStart[cy*mCols + x1 + 1];
+                indices.insert(indices.end(), mIndices.begin() + begin, mIndices.begin() + end);
+            }
+            if(x1 > x0 || y1 > y0) {
+                std::sort(indices.begin() + first, indices.end());
+            }
+        }
+        
+    private:
+        
+        // Size of a cell, and the bounds of the points. Cell (0,0) has its corner at (mMinX,mMinY).
+        float mCellSize;
+        float mMinX;
+        float mMinY;
+        float mMaxX;
+        float mMaxY;
+        
+        // Number of cells across and down
+        int mCols;
+        int mRows;
+        
+        // Index in mIndices of the first point of each cell, in row-major order, and one past the last cell
+        std::vector<int> mCellStart;
+        
+        // Point indices, grouped by cell
+        std::vector<int> mIndices;
+        
+        inline int cellX(float x) const {
+            return std::max(0, (int)std::floor((x - mMinX)/mCellSize));
+        }
+        inline int cellY(float y) const {
+            return std::max(0, (int)std::floor((y - mMinY)/mCellSize));
+        }
+        
+    }; // FeatureGrid
+    
+} // vision
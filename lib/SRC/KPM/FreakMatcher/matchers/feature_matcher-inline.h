@@ -56,6 +56,49 @@ namespace vision {
     template<int FEATURE_SIZE>
     BinaryFeatureMatcher<FEATURE_SIZE>::~BinaryFeatureMatcher() {}
 
+    template<int FEATURE_SIZE>
+    void BinaryFeatureMatcher<FEATURE_SIZE>::matchCandidates(int i,
+                                                             const unsigned char* f1,
+                                                             const int* indices,
+                                                             const unsigned char* const* features,
+                                                             int count) {
+        unsigned int first_best = std::numeric_limits<unsigned int>::max();
+        unsigned int second_best = std::numeric_limits<unsigned int>::max();
+        int best_index = std::numeric_limits<int>::max();
+        
+        // Compute all the distances in one pass, then search for 1st and 2nd best match
+        ASSERT(FEATURE_SIZE == 96, "Only 96 bytes supported now");
+        mCandidateDistances.resize(count);
+        HammingDistanceBatch<FEATURE_SIZE>(&mCandidateDistances[0], f1, features, count);
+        for(int j = 0; j < count; j++) {
+            unsigned int d = mCandidateDistances[j];
+            if(d < first_best) {
+                second_best = first_best;
+                first_best = d;
+                best_index = indices[j];
+            } else if(d < second_best) {
+                second_best = d;
+            }
+        }
+        
+        // Check if FIRST_BEST has been set
+        if(first_best != std::numeric_limits<unsigned int>::max()) {
+            ASSERT(best_index != std::numeric_limits<int>::max(), "Something strange");
+            
+            // If there isn't a SECOND_BEST, then always choose the FIRST_BEST.
+            // Otherwise, do a ratio test.
+            if(second_best == std::numeric_limits<unsigned int>::max()) {
+                mMatches.push_back(match_t(i, best_index));
+            } else {
+                // Ratio test
+                float r = (float)first_best / (float)second_best;
+                if(r < mThreshold) {
+                    mMatches.push_back(match_t(i, best_index));
+                }
+            }
+        }
+    }
+    
     template<int FEATURE_SIZE>
     size_t BinaryFeatureMatcher<FEATURE_SIZE>::match(const BinaryFeatureStore* features1,
                                                      const BinaryFeatureStore* features2) {
@@ -67,46 +110,63 @@ namespace vision {
             return 0;
         }
         
+        // Both points should be a MINIMA or MAXIMA, so split the candidates once
+        std::vector<int> indices[2];
+        std::vector<const unsigned char*> features[2];
+        for(size_t j = 0; j < features2->size(); j++) {
+            int k = features2->point(j).maxima ? 1 : 0;
+            indices[k].push_back((int)j);
+            features[k].push_back(features2->feature(j));
+        }
+        
+        mMatches.reserve(features1->size());
+        for(size_t i = 0; i < features1->size(); i++) {
+            int k = features1->point(i).maxima ? 1 : 0;
+            if(indices[k].empty()) {
+                continue;
+            }
+            matchCandidates((int)i, features1->feature(i), &indices[k][0], &features[k][0], (int)indices[k].size());
+        }
+        ASSERT(mMatches.size() <= features1->size(), "Number of matches should be lower");
+        return mMatches.size();
+    }
+    
+    template<int FEATURE_SIZE>
+    size_t BinaryFeatureMatcher<FEATURE_SIZE>::match(const BinaryFeatureStore* features1,
+                                                     const BinaryFeatureStore* features2,
+                                                     const index_t& maximaIndex2,
+                                                     const index_t& minimaIndex2) {
+        mMatches.clear();
+        
+        if(features1->size() == 0 ||
+           features2->size() == 0) {
+            return 0;
+        }
+        
         mMatches.reserve(features1->size());
         for(size_t i = 0; i < features1->size(); i++) {
-            unsigned int first_best = std::numeric_limits<unsigned int>::max();
-            unsigned int second_best = std::numeric_limits<unsigned int>::max();
-            int best_index = std::numeric_limits<int>::max();
-            
-            // Search for 1st and 2nd best match
             const unsigned char* f1 = features1->feature(i);
             const FeaturePoint& p1 = features1->point(i);
-            for(size_t j = 0; j < features2->size(); j++) {
-                // Both points should be a MINIMA or MAXIMA
-                if(p1.maxima != features2->point(j).maxima) {
+            
+            // Perform an indexed nearest neighbor lookup among features of the same sign
+            const index_t& index2 = p1.maxima ? maximaIndex2 : minimaIndex2;
+            index2.query(f1);
+            
+            // Gather the candidates from the reverse index
+            const std::vector<int>& v = index2.reverseIndex();
+            mCandidateIndices.clear();
+            mCandidates.clear();
+            for(size_t j = 0; j < v.size(); j++) {
+                // Both points should be a MINIMA or MAXIMA. This only fails when one index covers both.
+                if(p1.maxima != features2->point(v[j]).maxima) {
                     continue;
                 }
-                
-                ASSERT(FEATURE_SIZE == 96, "Only 96 bytes supported now");
-                unsigned int d = HammingDistance<FEATURE_SIZE>(f1,
-                                                               (unsigned char*)features2->feature(j));
-                if(d < first_best) {
-                    second_best = first_best;
-                    first_best = d;
-                    best_index = (int)j;
-                } else if(d < second_best) {
-                    second_best = d;
-                }
+                mCandidateIndices.push_back(v[j]);
+                mCandidates.push_back(features2->feature(v[j]));
             }
             
-            // Check if FIRST_BEST has been set
-            if(first_best != std::numeric_limits<unsigned int>::max()) {
-                // If there isn't a SECOND_BEST, then always choose the FIRST_BEST.
-                // Otherwise, do a ratio test.
-                if(second_best == std::numeric_limits<unsigned int>::max()) {
-                    mMatches.push_back(match_t((int)i, best_index));
-                } else {
-                    // Ratio test
-                    float r = (float)first_best / (float)second_best;
-                    if(r < mThreshold) {
-                        mMatches.push_back(match_t((int)i, best_index));
-                    }
-                }
+            if(!mCandidates.empty()) {
+                matchCandidates((int)i, f1, &mCandidateIndices[0], &mCandidates[0], (int)mCandidates.size());
             }
         }
         ASSERT(mMatches.size() <= features1->size(), "Number of matches should be lower");
@@ -116,7 +176,9 @@ namespace vision {
     template<int FEATURE_SIZE>
     size_t BinaryFeatureMatcher<FEATURE_SIZE>::match(const BinaryFeatureStore* features1,
                                                      const BinaryFeatureStore* features2,
-                                                     const index_t& index2) {
+                                                     const float H[9],
+                                                     float tr) {
+
         mMatches.clear();
         
         if(features1->size() == 0 ||
@@ -124,52 +186,45 @@ namespace vision {
             return 0;
         }
         
+        float tr_sqr = sqr(tr);
+        
+        float Hinv[9];
+        if(!MatrixInverse3x3(Hinv, H, 0.f)) {
+            ASSERT(0, "Failed to compute matrix inverse");
+            return 0;
+        }
+        
         mMatches.reserve(features1->size());
         for(size_t i = 0; i < features1->size(); i++) {
-            unsigned int first_best = std::numeric_limits<unsigned int>::max();
-            unsigned int second_best = std::numeric_limits<unsigned int>::max();
-            int best_index = std::numeric_limits<int>::max();
-            
-            // Perform an indexed nearest neighbor lookup
             const unsigned char* f1 = features1->feature(i);
-            index2.query(f1);
-            
             const FeaturePoint& p1 = features1->point(i);
             
-            // Search for 1st and 2nd best match
-            const std::vector<int>& v = index2.reverseIndex();
-            for(size_t j = 0; j < v.size(); j++) {
+            // Map p1 to p2 space through H
+            float xp1, yp1;
+            MultiplyPointHomographyInhomogenous(xp1, yp1, Hinv, p1.x, p1.y);
+            
+            // Gather the candidates within the spatial threshold
+            mCandidateIndices.clear();
+            mCandidates.clear();
+            for(size_t j = 0; j < features2->size(); j++) {
+                const FeaturePoint& p2 = features2->point(j);
+                
                 // Both points should be a MINIMA or MAXIMA
-                if(p1.maxima != features2->point(v[j]).maxima) {
+                if(p1.maxima != p2.maxima) {
                     continue;
                 }
                 
-                ASSERT(FEATURE_SIZE == 96, "Only 96 bytes supported now");
-                unsigned int d = HammingDistance<FEATURE_SIZE>(f1, (unsigned char*)features2->feature(v[j]));
-                if(d < first_best) {
-                    second_best = first_best;
-                    first_best = d;
-                    best_index = v[j];
-                } else if(d < second_best) {
-                    second_best = d;
+                // Check spatial constraint
+                if(sqr(xp1-p2.x) + sqr(yp1-p2.y) > tr_sqr) {
+                    continue;
                 }
+                
+                mCandidateIndices.push_back((int)j);
+                mCandidates.push_back(features2->feature(j));
             }
             
-            // Check if FIRST_BEST has been set
-            if(first_best != std::numeric_limits<unsigned int>::max()) {
-                ASSERT(best_index != std::numeric_limits<size_t>::max(), "Something strange");
-                
-                // If there isn't a SECOND_BEST, then always choose the FIRST_BEST.
-                // Otherwise, do a ratio test.
-                if(second_best == std::numeric_limits<unsigned int>::max()) {
-                    mMatches.push_back(match_t((int)i, best_index));
-                } else {
-                    // Ratio test
-                    float r = (float)first_best / (float)second_best;
-                    if(r < mThreshold) {
-                        mMatches.push_back(match_t((int)i, best_index));
-                    }
-                }
+            if(!mCandidates.empty()) {
+                matchCandidates((int)i, f1, &mCandidateIndices[0], &mCandidates[0], (int)mCandidates.size());
             }
         }
         ASSERT(mMatches.size() <= features1->size(), "Number of matches should be lower");
@@ -179,9 +234,15 @@ namespace vision {
     template<int FEATURE_SIZE>
     size_t BinaryFeatureMatcher<FEATURE_SIZE>::match(const BinaryFeatureStore* features1,
                                                      const BinaryFeatureStore* features2,
+                                                     const FeatureGrid& maximaGrid2,
+                                                     const FeatureGrid& minimaGrid2,
                                                      const float H[9],
                                                      float tr) {
-
+        
+        if(maximaGrid2.empty() && minimaGrid2.empty()) {
+            return match(features1, features2, H, tr);
+        }
+        
         mMatches.clear();
         
         if(features1->size() == 0 ||
@@ -199,10 +260,6 @@ namespace vision {
         
         mMatches.reserve(features1->size());
         for(size_t i = 0; i < features1->size(); i++) {
-            unsigned int first_best = std::numeric_limits<unsigned int>::max();
-            unsigned int second_best = std::numeric_limits<unsigned int>::max();
-            int best_index = std::numeric_limits<int>::max();
-            
             const unsigned char* f1 = features1->feature(i);
             const FeaturePoint& p1 = features1->point(i);
             
@@ -210,11 +267,17 @@ namespace vision {
             float xp1, yp1;
             MultiplyPointHomographyInhomogenous(xp1, yp1, Hinv, p1.x, p1.y);
             
-            // Search for 1st and 2nd best match
-            for(size_t j = 0; j < features2->size(); j++) {
+            // Gather the candidates within the spatial threshold from the nearby grid cells.
+            // They come in increasing order, as in the exhaustive search.
+            mGridIndices.clear();
+            (p1.maxima ? maximaGrid2 : minimaGrid2).query(mGridIndices, xp1, yp1, tr);
+            mCandidateIndices.clear();
+            mCandidates.clear();
+            for(size_t k = 0; k < mGridIndices.size(); k++) {
+                int j = mGridIndices[k];
                 const FeaturePoint& p2 = features2->point(j);
                 
-                // Both points should be a MINIMA or MAXIMA
+                // Both points should be a MINIMA or MAXIMA. This only fails when one grid covers both.
                 if(p1.maxima != p2.maxima) {
                     continue;
                 }
@@ -224,33 +287,12 @@ namespace vision {
                     continue;
                 }
                 
-                ASSERT(FEATURE_SIZE == 96, "Only 96 bytes supported now");
-                unsigned int d = HammingDistance768((unsigned int*)f1,
-                                                    (unsigned int*)features2->feature(j));
-                if(d < first_best) {
-                    second_best = first_best;
-                    first_best = d;
-                    best_index = (int)j;
-                } else if(d < second_best) {
-                    second_best = d;
-                }
+                mCandidateIndices.push_back(j);
+                mCandidates.push_back(features2->feature(j));
             }
             
-            // Check if FIRST_BEST has been set
-            if(first_best != std::numeric_limits<unsigned int>::max()) {
-                ASSERT(best_index != std::numeric_limits<size_t>::max(), "Something strange");
-                
-                // If there isn't a SECOND_BEST, then always choose the FIRST_BEST.
-                // Otherwise, do a ratio test.
-                if(second_best == std::numeric_limits<unsigned int>::max()) {
-                    mMatches.push_back(match_t((int)i, best_index));
-                } else {
-                    // Ratio test
-                    float r = (float)first_best / (float)second_best;
-                    if(r < mThreshold) {
-                        mMatches.push_back(match_t((int)i, best_index));
-                    }
-                }
+            if(!mCandidates.empty()) {
+                matchCandidates((int)i, f1, &mCandidateIndices[0], &mCandidates[0], (int)mCandidates.size());
             }
         }
         ASSERT(mMatches.size() <= features1->size(), "Number of matches should be lower");
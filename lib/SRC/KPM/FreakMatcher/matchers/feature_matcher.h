@@ -37,6 +37,7 @@
 
 #include <vector>
 #include <matchers/binary_hierarchical_clustering.h>
+#include <matchers/feature_grid.h>
 #include <matchers/matcher_types.h>
 
 namespace vision {
@@ -82,7 +83,19 @@ namespace vision {
          */
         size_t match(const BinaryFeatureStore* features1,
                      const BinaryFeatureStore* features2,
-                     const index_t& index2);
+                     const index_t& index2) {
+            return match(features1, features2, index2, index2);
+        }
+        
+        /**
+         * Match two feature stores with separate indices on the maxima and minima of
+         * features2. Each feature in store 1 only queries the index for its own sign.
+         * @return Number of matches
+         */
+        size_t match(const BinaryFeatureStore* features1,
+                     const BinaryFeatureStore* features2,
+                     const index_t& maximaIndex2,
+                     const index_t& minimaIndex2);
         
         /**
          * Match two feature stores given a homography from the features in store 1 to
@@ -95,6 +108,31 @@ namespace vision {
                      const float H[9],
                      float tr);
         
+        /**
+         * As above, but only visits the features in store 2 that GRID2 (built over
+         * their positions) finds near each projected feature.
+         * @return Number of matches
+         */
+        size_t match(const BinaryFeatureStore* features1,
+                     const BinaryFeatureStore* features2,
+                     const FeatureGrid& grid2,
+                     const float H[9],
+                     float tr) {
+            return match(features1, features2, grid2, grid2, H, tr);
+        }
+        
+        /**
+         * As above, with separate grids over the maxima and minima of store 2. Each
+         * feature in store 1 only queries the grid for its own sign.
+         * @return Number of matches
+         */
+        size_t match(const BinaryFeatureStore* features1,
+                     const BinaryFeatureStore* features2,
+                     const FeatureGrid& maximaGrid2,
+                     const FeatureGrid& minimaGrid2,
+                     const float H[9],
+                     float tr);
+        
         /**
          * @return Vector of matches after a call to MATCH.
          */
@@ -108,6 +146,24 @@ namespace vision {
         // Threshold on the 1st and 2nd best matches
         float mThreshold;
         
+        // Features found near the feature being matched by a grid query
+        std::vector<int> mGridIndices;
+        
+        // Candidate features for the feature being matched, and their distances
+        std::vector<int> mCandidateIndices;
+        std::vector<const unsigned char*> mCandidates;
+        std::vector<unsigned int> mCandidateDistances;
+        
+        /**
+         * Find the 1st and 2nd best of COUNT candidate FEATURES for feature I, with value F1.
+         * The match to INDICES[best] is added if it passes the ratio test.
+         */
+        void matchCandidates(int i,
+                             const unsigned char* f1,
+                             const int* indices,
+                             const unsigned char* const* features,
+                             int count);
+        
     }; // BinaryFeatureMatcher
     
     /**
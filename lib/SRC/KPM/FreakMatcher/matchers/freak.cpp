@@ -36,10 +36,228 @@
 #include "freak.h"
 #include <framework/error.h>
 #include "freak84-inline.h"
+#include <AR/ar.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define FREAK_NEON 1
+#elif defined(HAVE_INTEL_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#  include <emmintrin.h>
+#  define FREAK_SSE2 1
+// The vectorized sampling gives the same results as the scalar code only when the scalar
+// code also rounds every operation to float, i.e. uses SSE rather than x87 arithmetic,
+// and the compiler cannot fuse its multiplies and adds.
+#  if (defined(__SSE2_MATH__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)) && !defined(__FMA__) && !defined(__AVX2__)
+#    define FREAK_SSE2_SAMPLE 1
+#  endif
+#endif
 
 using namespace vision;
 
-FREAKExtractor::FREAKExtractor() {
+// Number of samples per descriptor, padded to a multiple of 4
+static const int kNumSamples = 40;
+
+// Fewer feature points than this are not split over threads
+static const size_t kMinParallelFeaturePoints = 32;
+
+namespace vision {
+
+    /**
+     * Packs the bits of a descriptor into bytes, least significant bit first, as
+     * bitstring_set_bit() does.
+     */
+    class DescriptorBitPacker {
+    public:
+        
+        DescriptorBitPacker(unsigned char* desc)
+        : mDesc(desc)
+        , mWord(0)
+        , mPos(0) {}
+        
+        /**
+         * Append the N lowest bits of BITS.
+         */
+        inline void push(unsigned int bits, int n) {
+            int offset = mPos & 63;
+            mWord |= (unsigned long long)bits << offset;
+            if(offset+n >= 64) {
+                store(8);
+                mWord = (offset+n > 64) ? (unsigned long long)bits >> (64-offset) : 0;
+            }
+            mPos += n;
+        }
+        
+        /**
+         * Store the remaining bits, zero padded to NUM_BYTES in total.
+         */
+        inline void finish(int num_bytes) {
+            int stored = (mPos & ~63) >> 3;
+            store(num_bytes-stored);
+        }
+        
+    private:
+        
+        unsigned char* mDesc;
+        unsigned long long mWord;
+        int mPos;
+        
+        inline void store(int num_bytes) {
+            unsigned char* p = &mDesc[(mPos & ~63) >> 3];
+            for(int i = 0; i < num_bytes; i++) {
+                p[i] = (unsigned char)(mWord >> (i*8));
+            }
+        }
+    };
+    
+#if FREAK_SSE2_SAMPLE
+    /**
+     * Sample the receptors of a point 4 at a time. Each receptor goes through the same
+     * operations, in the same order, as SampleReceptor() in SamplePyramidFREAK84(). The
+     * pixels are gathered with scalar loads.
+     */
+    static void SamplePyramidFREAK84_SSE2(float samples[kNumSamples],
+                                          const GaussianScaleSpacePyramid* pyramid,
+                                          const FeaturePoint& point,
+                                          const float receptor_x[kNumSamples],
+                                          const float receptor_y[kNumSamples],
+                                          const float receptor_sigma[7],
+                                          float expansion_factor) {
+        float S[9];
+        float a[kNumSamples];
+        float b[kNumSamples];
+        float max_x[kNumSamples];
+        float max_y[kNumSamples];
+        const unsigned char* data[kNumSamples];
+        size_t step[kNumSamples];
+        
+        // Ensure the scale of the similarity transform is at least "1".
+        float transform_scale = point.scale*expansion_factor;
+        if(transform_scale < 1) {
+            transform_scale = 1;
+        }
+        
+        // Transformation from canonical test locations to image
+        Similarity(S, point.x, point.y, point.angle, transform_scale);
+        
+        // Locate the image and the downsampling of each ring. The last ring is the center
+        // receptor and the padding.
+        for(int i = 0; i < 7; i++) {
+            int octave, scale;
+            pyramid->locate(octave, scale, receptor_sigma[i]*transform_scale);
+            
+            const Image& image = pyramid->get(octave, scale);
+            float ai = 1.f/(1<<octave);
+            float bi = 0.5f*ai-0.5f;
+            for(int j = i*6; j < (i < 6 ? (i+1)*6 : kNumSamples); j++) {
+                a[j] = ai;
+                b[j] = bi;
+                max_x[j] = image.width()-2;
+                max_y[j] = image.height()-2;
+                data[j] = (const unsigned char*)image.get();
+                step[j] = image.step();
+            }
+        }
+        
+        const __m128 S0 = _mm_set1_ps(S[0]);
+        const __m128 S1 = _mm_set1_ps(S[1]);
+        const __m128 S2 = _mm_set1_ps(S[2]);
+        const __m128 S3 = _mm_set1_ps(S[3]);
+        const __m128 S4 = _mm_set1_ps(S[4]);
+        const __m128 S5 = _mm_set1_ps(S[5]);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128i one = _mm_set1_epi32(1);
+        
+        for(int k = 0; k < kNumSamples; k += 4) {
+            __m128 rx = _mm_loadu_ps(&receptor_x[k]);
+            __m128 ry = _mm_loadu_ps(&receptor_y[k]);
+            
+            // Map the receptor to the image, and downsample it to the octave
+            __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(S0, rx), _mm_mul_ps(S1, ry)), S2);
+            __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(S3, rx), _mm_mul_ps(S4, ry)), S5);
+            x = _mm_add_ps(_mm_mul_ps(x, _mm_loadu_ps(&a[k])), _mm_loadu_ps(&b[k]));
+            y = _mm_add_ps(_mm_mul_ps(y, _mm_loadu_ps(&a[k])), _mm_loadu_ps(&b[k]));
+            
+            // Clip to the image, leaving room for the interpolation
+            x = _mm_max_ps(_mm_min_ps(x, _mm_loadu_ps(&max_x[k])), zero);
+            y = _mm_max_ps(_mm_min_ps(y, _mm_loadu_ps(&max_y[k])), zero);
+            
+            // Bilinear weights
+            __m128i xi = _mm_cvttps_epi32(x);
+            __m128i yi = _mm_cvttps_epi32(y);
+            __m128 xp = _mm_cvtepi32_ps(xi);
+            __m128 yp = _mm_cvtepi32_ps(yi);
+            __m128 xp_plus_1 = _mm_cvtepi32_ps(_mm_add_epi32(xi, one));
+            __m128 yp_plus_1 = _mm_cvtepi32_ps(_mm_add_epi32(yi, one));
+            __m128 w0 = _mm_mul_ps(_mm_sub_ps(xp_plus_1, x), _mm_sub_ps(yp_plus_1, y));
+            __m128 w1 = _mm_mul_ps(_mm_sub_ps(x, xp), _mm_sub_ps(yp_plus_1, y));
+            __m128 w2 = _mm_mul_ps(_mm_sub_ps(xp_plus_1, x), _mm_sub_ps(y, yp));
+            __m128 w3 = _mm_mul_ps(_mm_sub_ps(x, xp), _mm_sub_ps(y, yp));
+            
+            // Gather the 4 neighbouring pixels of each receptor
+            int col[4], row[4];
+            float p00[4], p01[4], p10[4], p11[4];
+            _mm_storeu_si128((__m128i*)col, xi);
+            _mm_storeu_si128((__m128i*)row, yi);
+            for(int l = 0; l < 4; l++) {
+                const float* p0 = (const float*)(data[k+l] + step[k+l]*row[l]);
+                const float* p1 = (const float*)((const unsigned char*)p0 + step[k+l]);
+                p00[l] = p0[col[l]];
+                p01[l] = p0[col[l]+1];
+                p10[l] = p1[col[l]];
+                p11[l] = p1[col[l]+1];
+            }
+            
+            __m128 res = _mm_add_ps(_mm_mul_ps(w0, _mm_loadu_ps(p00)), _mm_mul_ps(w1, _mm_loadu_ps(p01)));
+            res = _mm_add_ps(res, _mm_mul_ps(w2, _mm_loadu_ps(p10)));
+            res = _mm_add_ps(res, _mm_mul_ps(w3, _mm_loadu_ps(p11)));
+            _mm_storeu_ps(&samples[k], res);
+        }
+    }
+#endif
+    
+    /**
+     * Compute the descriptor given the 37 samples from each receptor, comparing each
+     * sample with up to 4 others at a time. Same result as CompareFREAK84(). SAMPLES must
+     * be padded to kNumSamples.
+     */
+    static void CompareFREAK84Vector(unsigned char desc[84], const float samples[kNumSamples]) {
+        DescriptorBitPacker packer(desc);
+        for(int i = 0; i < 37; i++) {
+#if FREAK_SSE2
+            const __m128 si = _mm_set1_ps(samples[i]);
+#elif FREAK_NEON
+            static const uint32_t kLaneBits[4] = {1, 2, 4, 8};
+            const float32x4_t si = vdupq_n_f32(samples[i]);
+            const uint32x4_t lane_bits = vld1q_u32(kLaneBits);
+#endif
+            for(int j = i+1; j < 37; j += 4) {
+                int n = min2<int>(4, 37-j);
+                unsigned int bits;
+#if FREAK_SSE2
+                bits = _mm_movemask_ps(_mm_cmplt_ps(si, _mm_loadu_ps(&samples[j])));
+#elif FREAK_NEON
+                uint32x4_t m = vandq_u32(vcltq_f32(si, vld1q_f32(&samples[j])), lane_bits);
+                uint32x2_t t = vpadd_u32(vget_low_u32(m), vget_high_u32(m));
+                bits = vget_lane_u32(vpadd_u32(t, t), 0);
+#else
+                bits = 0;
+                for(int l = 0; l < n; l++) {
+                    bits |= (unsigned int)(samples[i] < samples[j+l]) << l;
+                }
+#endif
+                packer.push(bits & ((1u << n)-1), n);
+            }
+        }
+        packer.finish(84);
+    }
+    
+} // vision
+
+FREAKExtractor::FREAKExtractor()
+: mThreadNum(1)
+, mStore(NULL)
+, mPyramid(NULL)
+, mPoints(NULL) {
     CopyVector(mPointRing0, freak84_points_ring0, 12);
     CopyVector(mPointRing1, freak84_points_ring1, 12);
     CopyVector(mPointRing2, freak84_points_ring2, 12);
@@ -63,6 +281,30 @@ FREAKExtractor::FREAKExtractor() {
     ASSERT(sizeof(freak84_points_ring3) == 48, "Size should be 48 bytes");
     ASSERT(sizeof(freak84_points_ring4) == 48, "Size should be 48 bytes");
     ASSERT(sizeof(freak84_points_ring5) == 48, "Size should be 48 bytes");
+    
+    // Receptors in the order they are sampled
+    const float* rings[6] = {mPointRing5, mPointRing4, mPointRing3, mPointRing2, mPointRing1, mPointRing0};
+    for(int i = 0; i < 6; i++) {
+        for(int j = 0; j < 6; j++) {
+            mReceptorX[i*6+j] = rings[i][j*2];
+            mReceptorY[i*6+j] = rings[i][j*2+1];
+        }
+    }
+    for(int i = 36; i < kNumSamples; i++) {
+        mReceptorX[i] = 0;
+        mReceptorY[i] = 0;
+    }
+    mReceptorSigma[0] = mSigmaRing5;
+    mReceptorSigma[1] = mSigmaRing4;
+    mReceptorSigma[2] = mSigmaRing3;
+    mReceptorSigma[3] = mSigmaRing2;
+    mReceptorSigma[4] = mSigmaRing1;
+    mReceptorSigma[5] = mSigmaRing0;
+    mReceptorSigma[6] = mSigmaCenter;
+}
+
+FREAKExtractor::~FREAKExtractor() {
+    stopThreads();
 }
 
 void FREAKExtractor::layout84(std::vector<receptor>& receptors,
@@ -153,6 +395,45 @@ void FREAKExtractor::extract(BinaryFeatureStore& store,
     
     store.setNumBytesPerFeature(96);
     store.resize(points.size());
+#ifndef FREAK_DEBUG
+    ASSERT(pyramid, "Pyramid is NULL");
+    
+    startThreads();
+    
+    mStore = &store;
+    mPyramid = pyramid;
+    mPoints = &points;
+    mExtracted.resize(points.size());
+    
+    if(mThreads.empty() || points.size() < kMinParallelFeaturePoints) {
+        extractBatch(0, 1);
+    } else {
+        for(size_t i = 0; i < mThreads.size(); i++) {
+            threadStartSignal(mThreads[i]);
+        }
+        extractBatch(0, (int)mThreads.size() + 1);
+        for(size_t i = 0; i < mThreads.size(); i++) {
+            threadEndWait(mThreads[i]);
+        }
+    }
+    
+    // Keep the points with a descriptor
+    size_t num_points = 0;
+    for(size_t i = 0; i < points.size(); i++) {
+        if(!mExtracted[i]) {
+            continue;
+        }
+        if(num_points != i) {
+            CopyVector(store.feature(num_points), store.feature(i), store.numBytesPerFeature());
+        }
+        store.point(num_points) = points[i];
+        num_points++;
+    }
+    ASSERT(num_points == points.size(), "Should be same size");
+    
+    // Shrink store down to the number of valid points
+    store.resize(num_points);
+#else
     ExtractFREAK84(store,
                    pyramid,
                    points,
@@ -188,4 +469,108 @@ void FREAKExtractor::extract(BinaryFeatureStore& store,
                    mMappedSC
 #endif
                    );
+#endif
+}
+
+bool FREAKExtractor::extract(unsigned char desc[84],
+                             const GaussianScaleSpacePyramid* pyramid,
+                             const FeaturePoint& point) const {
+    float samples[kNumSamples];
+    
+#if FREAK_SSE2_SAMPLE
+    SamplePyramidFREAK84_SSE2(samples,
+                              pyramid,
+                              point,
+                              mReceptorX,
+                              mReceptorY,
+                              mReceptorSigma,
+                              mExpansionFactor);
+#else
+    if(!SamplePyramidFREAK84(samples,
+                             pyramid,
+                             point,
+                             mPointRing0,
+                             mPointRing1,
+                             mPointRing2,
+                             mPointRing3,
+                             mPointRing4,
+                             mPointRing5,
+                             mSigmaCenter,
+                             mSigmaRing0,
+                             mSigmaRing1,
+                             mSigmaRing2,
+                             mSigmaRing3,
+                             mSigmaRing4,
+                             mSigmaRing5,
+                             mExpansionFactor)) {
+        return false;
+    }
+    for(int i = 37; i < kNumSamples; i++) {
+        samples[i] = samples[36];
+    }
+#endif
+    
+    // Once samples are created compute descriptor
+    CompareFREAK84Vector(desc, samples);
+    
+    return true;
+}
+
+void FREAKExtractor::extractBatch(int index, int batchNum) {
+    const size_t num_points = mPoints->size();
+    const size_t begin = num_points*index/batchNum;
+    const size_t end = num_points*(index+1)/batchNum;
+    
+    for(size_t i = begin; i < end; i++) {
+        mExtracted[i] = extract(mStore->feature(i), mPyramid, (*mPoints)[i]) ? 1 : 0;
+    }
+}
+
+void* FREAKExtractor::worker(THREAD_HANDLE_T* threadHandle) {
+    WorkerArg* arg = (WorkerArg*)threadGetArg(threadHandle);
+    
+    while(threadStartWait(threadHandle) == 0) {
+        arg->extractor->extractBatch(arg->index, (int)arg->extractor->mThreads.size() + 1);
+        threadEndSignal(threadHandle);
+    }
+    return NULL;
+}
+
+void FREAKExtractor::startThreads() {
+    int threadNum = mThreadNum;
+    if(threadNum < 1) {
+        threadNum = threadGetCPU();
+    }
+    if(threadNum < 1) {
+        threadNum = 1;
+    }
+    
+    if((int)mThreads.size() == threadNum - 1) {
+        return;
+    }
+    
+    stopThreads();
+    
+    // Everything the workers reference must be in place before the first one starts.
+    mWorkerArgs.resize(threadNum - 1);
+    for(int i = 0; i < threadNum - 1; i++) {
+        mWorkerArgs[i].extractor = this;
+        mWorkerArgs[i].index = i + 1;
+    }
+    for(int i = 0; i < threadNum - 1; i++) {
+        THREAD_HANDLE_T* thread = threadInit(i + 1, &mWorkerArgs[i], worker);
+        if(!thread) {
+            // Extract with the threads we have
+            break;
+        }
+        mThreads.push_back(thread);
+    }
+}
+
+void FREAKExtractor::stopThreads() {
+    for(size_t i = 0; i < mThreads.size(); i++) {
+        threadWaitQuit(mThreads[i]);
+        threadFree(&mThreads[i]);
+    }
+    mThreads.clear();
 }
\ No newline at end of file
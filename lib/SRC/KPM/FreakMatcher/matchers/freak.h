@@ -42,6 +42,7 @@
 #include <utils/point.h>
 #include <detectors/interpolate.h>
 #include "feature_store.h"
+#include <thread_sub.h>
 
 namespace vision {
     
@@ -63,7 +64,7 @@ namespace vision {
         };
         
         FREAKExtractor();
-        ~FREAKExtractor() {}
+        ~FREAKExtractor();
         
         /**
          * Get a set of tests for an 84 byte descriptor.
@@ -78,6 +79,24 @@ namespace vision {
                      const GaussianScaleSpacePyramid* pyramid,
                      const std::vector<FeaturePoint>& points);
         
+        /**
+         * Extract the 84 byte descriptor of a single point. The receptors are sampled and compared with SSE2/NEON where the
+         * results are the same as ExtractFREAK84(). Descriptors can be extracted
+         * concurrently.
+         */
+        bool extract(unsigned char desc[84],
+                     const GaussianScaleSpacePyramid* pyramid,
+                     const FeaturePoint& point) const;
+        
+        /**
+         * Set/Get the number of threads used to extract descriptors. The feature points
+         * are split into batches, one per thread, and the descriptors do not depend on
+         * the number of threads. -1 uses one thread per CPU, and 1 (the default) extracts
+         * on the calling thread.
+         */
+        void setThreadNum(int threadNum) { mThreadNum = threadNum; }
+        int threadNum() const { return mThreadNum; }
+        
 #ifdef FREAK_DEBUG
         std::vector<Point2d<float> > mMappedPoints0;
         std::vector<Point2d<float> > mMappedPoints1;
@@ -118,6 +137,39 @@ namespace vision {
         // Scale expansion factor
         float mExpansionFactor;
         
+        // Receptor locations and sigma values in sample order (rings 5 to 0, then the
+        // center), padded to a multiple of 4 receptors
+        float mReceptorX[40];
+        float mReceptorY[40];
+        float mReceptorSigma[7];
+        
+        // Not copyable: owns threads which refer back to it
+        FREAKExtractor(const FREAKExtractor&);
+        FREAKExtractor& operator=(const FREAKExtractor&);
+        
+        struct WorkerArg {
+            FREAKExtractor* extractor;
+            int index;
+        };
+        
+        // Threads, and the extraction they are running
+        int mThreadNum;
+        BinaryFeatureStore* mStore;
+        const GaussianScaleSpacePyramid* mPyramid;
+        const std::vector<FeaturePoint>* mPoints;
+        std::vector<unsigned char> mExtracted;
+        std::vector<WorkerArg> mWorkerArgs;
+        std::vector<THREAD_HANDLE_T*> mThreads;
+        
+        /**
+         * Extract descriptors for one batch of the feature points.
+         */
+        void extractBatch(int index, int batchNum);
+        
+        static void* worker(THREAD_HANDLE_T* threadHandle);
+        void startThreads();
+        void stopThreads();
+        
     }; // FREAKExtractor
 
     /**
@@ -38,6 +38,9 @@
 
 using namespace vision;
 
+// Largest bin space voted for in a flat array (4 bytes per bin).
+static const long long kMaxDenseBins = 1 << 19;
+
 HoughSimilarityVoting::HoughSimilarityVoting()
 : mRefImageWidth(0)
 , mRefImageHeight(0)
@@ -61,7 +64,8 @@ HoughSimilarityVoting::HoughSimilarityVoting()
 , mfBinAngle(0)
 , mfBinScale(0)
 , mA(0)
-, mB(0) {
+, mB(0)
+, mDenseVotes(false) {
 }
 
 HoughSimilarityVoting::~HoughSimilarityVoting() {}
@@ -98,14 +102,32 @@ void HoughSimilarityVoting::init(float minX,
     else
         mAutoAdjustXYNumBins = false;
     
+    resetVotes();
+}
+
+void HoughSimilarityVoting::clearVotes() {
     mVotes.clear();
+    for(size_t i = 0; i < mTouchedBins.size(); i++) {
+        mDenseVoteBins[mTouchedBins[i]] = 0;
+    }
+    mTouchedBins.clear();
+}
+
+void HoughSimilarityVoting::resetVotes() {
+    clearVotes();
+    
+    long long numBins = (long long)mNumXBins*mNumYBins*mNumAngleBins*mNumScaleBins;
+    mDenseVotes = (numBins <= kMaxDenseBins);
+    if(mDenseVotes && (long long)mDenseVoteBins.size() < numBins) {
+        mDenseVoteBins.resize((size_t)numBins, 0);
+    }
 }
 
 void HoughSimilarityVoting::vote(const float* ins, const float* ref, int size) {
     float x, y, angle, scale;
     int num_features_that_cast_vote;
     
-    mVotes.clear();
+    clearVotes();
     if(size == 0) {
         return;
     }
@@ -115,6 +137,7 @@ void HoughSimilarityVoting::vote(const float* ins, const float* ref, int size) {
     if(mAutoAdjustXYNumBins) {
         autoAdjustXYNumBins(ins, ref, size);
     }
+    resetVotes();
     
     num_features_that_cast_vote = 0;
     for(int i = 0; i < size; i++) {
@@ -154,8 +177,18 @@ void HoughSimilarityVoting::vote(const float* ins, const float* ref, int size) {
 
 void HoughSimilarityVoting::getVotes(vote_vector_t& votes, int threshold) const {
     votes.clear();
-    votes.reserve(mVotes.size());
     
+    if(mDenseVotes) {
+        for(size_t i = 0; i < mTouchedBins.size(); i++) {
+            unsigned int n = mDenseVoteBins[mTouchedBins[i]];
+            if(n >= (unsigned int)threshold) {
+                votes.push_back(std::make_pair(n, mTouchedBins[i]));
+            }
+        }
+        return;
+    }
+    
+    votes.reserve(mVotes.size());
     for(hash_t::const_iterator it = mVotes.begin(); it != mVotes.end(); it++) {
         if(it->second >= threshold) {
             votes.push_back(std::make_pair(it->second, it->first));
@@ -167,6 +200,18 @@ void HoughSimilarityVoting::getMaximumNumberOfVotes(float& maxVotes, int& maxInd
     maxVotes = 0;
     maxIndex = -1;
     
+    if(mDenseVotes) {
+        // Of equal maxima, the bin voted for first wins
+        for(size_t i = 0; i < mTouchedBins.size(); i++) {
+            unsigned int n = mDenseVoteBins[mTouchedBins[i]];
+            if(n > maxVotes) {
+                maxIndex = mTouchedBins[i];
+                maxVotes = n;
+            }
+        }
+        return;
+    }
+    
     for(hash_t::const_iterator it = mVotes.begin(); it != mVotes.end(); it++) {
         if(it->second > maxVotes) {
             maxIndex = it->first;
@@ -95,7 +95,7 @@ namespace vision {
             mMaxX = maxX;
             mMinY = minY;
             mMaxY = maxY;
-            mVotes.clear();
+            clearVotes();
         }
         
         /**
@@ -280,6 +280,13 @@ namespace vision {
         
         mutable hash_t mVotes;
         
+        // When the bin space has at most kMaxDenseBins bins, votes are accumulated in a flat
+        // array indexed by bin instead of mVotes. The bins voted for are listed in the order
+        // they were first touched, so that reading and clearing the votes only visits those.
+        bool mDenseVotes;
+        std::vector<unsigned int> mDenseVoteBins;
+        std::vector<int> mTouchedBins;
+        
         std::vector<float> mSubBinLocations;
         std::vector<int> mSubBinLocationIndices;
         
@@ -288,6 +295,15 @@ namespace vision {
          */
         inline void voteAtIndex(int index, unsigned int weight) {
             ASSERT(index >= 0, "index out of range");
+            if(mDenseVotes) {
+                ASSERT(index < (int)mDenseVoteBins.size(), "index out of range");
+                unsigned int& votes = mDenseVoteBins[index];
+                if(votes == 0) {
+                    mTouchedBins.push_back(index);
+                }
+                votes += weight;
+                return;
+            }
             const hash_t::iterator it = mVotes.find(index);
             if(it == mVotes.end()) {
                 mVotes.insert(std::pair<unsigned int, unsigned int>(index, weight));
@@ -296,6 +312,16 @@ namespace vision {
             }
         }
         
+        /**
+         * Remove all votes.
+         */
+        void clearVotes();
+        
+        /**
+         * Remove all votes, and choose dense or hashed voting for the current number of bins.
+         */
+        void resetVotes();
+        
         /**
          * Set the number of bins for translation based on the correspondences.
          */
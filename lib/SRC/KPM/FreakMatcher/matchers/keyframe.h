@@ -36,10 +36,15 @@
 #pragma once
 
 #include "feature_store.h"
+#include "feature_grid.h"
 #include "binary_hierarchical_clustering.h"
 
 namespace vision {
     
+    // Cell size in pixels of the grid over a keyframe's feature positions. This is
+    // about the search radius of homography-guided matching.
+    static const float kFeatureGridCellSize = 10;
+    
     template<int NUM_BYTES_PER_FEATURE>
     class Keyframe {
     public:
@@ -69,12 +74,25 @@ namespace vision {
         inline const BinaryFeatureStore& store() const { return mStore; }
         
         /**
-         * @return Index over the features.
+         * The features are partitioned by the sign of their extremum, since a maximum
+         * only ever matches a maximum and a minimum a minimum.
+         * @return Indices (in increasing order) of the features that are maxima, or minima.
+         */
+        inline const std::vector<int>& partition(bool maxima) const { return mPartition[maxima ? 1 : 0]; }
+        
+        /**
+         * @return Index over the features that are maxima, or minima.
+         */
+        inline const index_t& index(bool maxima) const { return mIndex[maxima ? 1 : 0]; }
+        
+        /**
+         * @return Grid over the positions of the features that are maxima, or minima.
          */
-        inline const index_t& index() const { return mIndex; }
+        inline const FeatureGrid& grid(bool maxima) const { return mGrid[maxima ? 1 : 0]; }
         
         /**
-         * Build an index for the features.
+         * Partition the features by sign, and build an index over each partition and
+         * a grid over their positions.
          */
         void buildIndex();
         
@@ -107,18 +125,36 @@ namespace vision {
         // Feature store
         BinaryFeatureStore mStore;
         
-        // Feature index
-        index_t mIndex;
+        // Feature indices of the minima [0] and maxima [1]
+        std::vector<int> mPartition[2];
+        
+        // Feature index per partition
+        index_t mIndex[2];
+        
+        // Grid over the feature positions per partition
+        FeatureGrid mGrid[2];
         
     }; // Keyframe
     
     template<int NUM_BYTES_PER_FEATURE>
     void Keyframe<NUM_BYTES_PER_FEATURE>::buildIndex() {
-        mIndex.setNumHypotheses(128);
-        mIndex.setNumCenters(8);
-        mIndex.setMaxNodesToPop(8);
-        mIndex.setMinFeaturesPerNode(16);
-        mIndex.build(&mStore.features()[0], (int)mStore.size());
+        for(int k = 0; k < 2; k++) {
+            mPartition[k].clear();
+        }
+        for(size_t i = 0; i < mStore.size(); i++) {
+            mPartition[mStore.point(i).maxima ? 1 : 0].push_back((int)i);
+        }
+        for(int k = 0; k < 2; k++) {
+            mIndex[k].setNumHypotheses(128);
+            mIndex[k].setNumCenters(8);
+            mIndex[k].setMaxNodesToPop(8);
+            mIndex[k].setMinFeaturesPerNode(16);
+            mIndex[k].build(mStore.features().empty() ? NULL : &mStore.features()[0],
+                            (int)mStore.size(),
+                            mPartition[k].empty() ? NULL : &mPartition[k][0],
+                            (int)mPartition[k].size());
+            mGrid[k].build(mStore.points(), mPartition[k], kFeatureGridCellSize);
+        }
     }
     
 } // vision
\ No newline at end of file
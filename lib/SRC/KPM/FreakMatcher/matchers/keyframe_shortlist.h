@@ -0,0 +1,314 @@
+//
+//  keyframe_shortlist.h
+//  ARToolKit5
+//
+//  This file is part of ARToolKit.
+//
+//  ARToolKit is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  ARToolKit is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with ARToolKit.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  As a special exception, the copyright holders of this library give you
+//  permission to link this library with independent modules to produce an
+//  executable, regardless of the license terms of these independent modules, and to
+//  copy and distribute the resulting executable under terms of your choice,
+//  provided that you also meet, for each linked independent module, the terms and
+//  conditions of the license of that module. An independent module is a module
+//  which is neither derived from nor based on this library. If you modify this
+//  library, you may extend this exception to your version of the library, but you
+//  are not obligated to do so. If you do not wish to do so, delete this exception
+//  statement from your version.
+//
+//  Copyright 2016 Daqri, LLC.
+//
+//  Author(s): Philip Lamb
+//
+
+#pragma once
+
+#include "feature_store.h"
+#include "kmedoids.h"
+#include <math/hamming.h>
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+namespace vision {
+    
+    /**
+     * A vocabulary tree over the features of many keyframes, used to choose which
+     * keyframes are worth verifying against a query. The tree is trained by hierarchical
+     * k-medoids on a sample of the features, and each leaf (a "word") keeps an inverted
+     * list of the keyframes with features quantized to it, and how many. A query feature
+     * is quantized by descending the tree, and votes for the keyframes in its word's list,
+     * weighted by how rare the word is. The n-th query feature in a word only votes for
+     * keyframes with at least n features in it, so a keyframe's score is the weighted
+     * intersection of its and the query's word counts. The cost of a query depends on the depth of the tree and
+     * the length of the lists, not on the number of keyframes searched.
+     */
+    template<int NUM_BYTES_PER_FEATURE>
+    class KeyframeShortlist {
+    public:
+        
+        KeyframeShortlist();
+        ~KeyframeShortlist() {}
+        
+        /**
+         * Build the tree and inverted lists over the features of a set of keyframes.
+         * Keyframes are identified in the shortlist by their position in STORES.
+         */
+        void build(const std::vector<const BinaryFeatureStore*>& stores);
+        
+        /**
+         * Vote for keyframes with the features of QUERY, and return (in increasing order)
+         * the positions of the K keyframes with the highest scores. Ties go to the earlier
+         * keyframe.
+         */
+        void shortlist(std::vector<int>& keyframes, const BinaryFeatureStore* query, int k) const;
+        
+        /**
+         * @return Number of keyframes indexed.
+         */
+        inline int numKeyframes() const { return mNumKeyframes; }
+        
+        /**
+         * @return Number of leaves (words) in the tree.
+         */
+        inline int numWords() const { return (int)mInvertedLists.size(); }
+        
+        /**
+         * @return Score per keyframe from the last shortlist().
+         */
+        inline const std::vector<float>& scores() const { return mScores; }
+        
+        /**
+         * Set/Get the maximum number of features used to train the tree.
+         */
+        inline void setMaxTrainingFeatures(int n) { mMaxTrainingFeatures = n; }
+        inline int maxTrainingFeatures() const { return mMaxTrainingFeatures; }
+        
+    private:
+        
+        struct Node {
+            unsigned char center[NUM_BYTES_PER_FEATURE];
+            std::vector<int> children;
+            int word;   // Leaf index, or -1 for an interior node
+        };
+        
+        // Keyframe and number of its features in a word
+        typedef std::pair<int, int> posting_t;
+        
+        // Branching factor of the tree
+        enum { NUM_CENTERS = 8 };
+        
+        // Random number seed
+        int mRandSeed;
+        
+        int mNumKeyframes;
+        int mMaxTrainingFeatures;
+        int mMinFeaturesPerNode;
+        
+        // Tree nodes. mNodes[0] is the root.
+        std::vector<Node> mNodes;
+        
+        // Clustering algorithm
+        BinarykMedoids<NUM_BYTES_PER_FEATURE> mBinarykMedoids;
+        
+        // Per word, the keyframes holding it and the word's weight
+        std::vector<std::vector<posting_t> > mInvertedLists;
+        std::vector<float> mWordWeights;
+        
+        mutable std::vector<float> mScores;
+        mutable std::vector<int> mOrder;
+        mutable std::vector<int> mQueryWordCounts;
+        
+        /**
+         * Recursive function to build the tree. Returns the index of the new node.
+         */
+        int buildNode(const unsigned char* features, int num_features, const int* indices, int num_indices);
+        
+        /**
+         * @return Word (leaf) that a feature falls in.
+         */
+        int quantize(const unsigned char* feature) const;
+        
+        // Orders keyframes by decreasing score
+        struct ScoreGreater {
+            ScoreGreater(const std::vector<float>& scores) : mScores(scores) {}
+            bool operator()(int a, int b) const { return mScores[a] > mScores[b]; }
+            const std::vector<float>& mScores;
+        };
+        
+    }; // KeyframeShortlist
+    
+    template<int NUM_BYTES_PER_FEATURE>
+    KeyframeShortlist<NUM_BYTES_PER_FEATURE>::KeyframeShortlist()
+    : mRandSeed(1234)
+    , mNumKeyframes(0)
+    , mMaxTrainingFeatures(32768)
+    , mMinFeaturesPerNode(16)
+    , mBinarykMedoids(mRandSeed) {
+        mBinarykMedoids.setk(NUM_CENTERS);
+        mBinarykMedoids.setNumHypotheses(4);
+    }
+    
+    template<int NUM_BYTES_PER_FEATURE>
+    void KeyframeShortlist<NUM_BYTES_PER_FEATURE>::build(const std::vector<const BinaryFeatureStore*>& stores) {
+        size_t num_features = 0;
+        for(size_t i = 0; i < stores.size(); i++) {
+            ASSERT(stores[i]->size() == 0 || stores[i]->numBytesPerFeature() == NUM_BYTES_PER_FEATURE, "Feature size mismatch");
+            num_features += stores[i]->size();
+        }
+        
+        mNumKeyframes = (int)stores.size();
+        mNodes.clear();
+        mInvertedLists.clear();
+        mWordWeights.clear();
+        mRandSeed = 1234;
+        if(num_features == 0) {
+            return;
+        }
+        
+        //
+        // Train the tree on an evenly-spaced sample of the features
+        //
+        
+        size_t num_samples = min2<size_t>(num_features, mMaxTrainingFeatures);
+        std::vector<unsigned char> samples(num_samples*NUM_BYTES_PER_FEATURE);
+        std::vector<int> indices(num_samples);
+        size_t store = 0, offset = 0;
+        for(size_t i = 0; i < num_samples; i++) {
+            size_t n = i*num_features/num_samples;
+            while(n - offset >= stores[store]->size()) {
+                offset += stores[store]->size();
+                store++;
+            }
+            CopyVector(&samples[i*NUM_BYTES_PER_FEATURE], stores[store]->feature(n - offset), NUM_BYTES_PER_FEATURE);
+            indices[i] = (int)i;
+        }
+        buildNode(&samples[0], (int)num_samples, &indices[0], (int)num_samples);
+        
+        //
+        // Quantize every feature, and list the keyframes in each word
+        //
+        
+        for(size_t i = 0; i < stores.size(); i++) {
+            for(size_t j = 0; j < stores[i]->size(); j++) {
+                std::vector<posting_t>& postings = mInvertedLists[quantize(stores[i]->feature(j))];
+                if(postings.empty() || postings.back().first != (int)i) {
+                    postings.push_back(posting_t((int)i, 1));
+                } else {
+                    postings.back().second++;
+                }
+            }
+        }
+        
+        // Words found in fewer keyframes carry more weight (inverse document frequency)
+        mWordWeights.resize(mInvertedLists.size());
+        for(size_t i = 0; i < mInvertedLists.size(); i++) {
+            mWordWeights[i] = mInvertedLists[i].empty() ? 0 : std::log((float)mNumKeyframes/(float)mInvertedLists[i].size());
+        }
+    }
+    
+    template<int NUM_BYTES_PER_FEATURE>
+    int KeyframeShortlist<NUM_BYTES_PER_FEATURE>::buildNode(const unsigned char* features, int num_features, const int* indices, int num_indices) {
+        int node = (int)mNodes.size();
+        mNodes.push_back(Node());
+        mNodes[node].word = -1;
+        
+        std::map<int, std::vector<int> > cluster_map;
+        if(num_indices > max2(mBinarykMedoids.k(), mMinFeaturesPerNode)) {
+            mBinarykMedoids.assign(features, num_features, indices, num_indices);
+            const std::vector<int>& assignment = mBinarykMedoids.assignment();
+            for(int i = 0; i < num_indices; i++) {
+                cluster_map[indices[assignment[i]]].push_back(indices[i]);
+            }
+        }
+        
+        // Too few features, or features that can't be separated, make a leaf.
+        if(cluster_map.size() <= 1) {
+            mNodes[node].word = (int)mInvertedLists.size();
+            mInvertedLists.push_back(std::vector<posting_t>());
+            return node;
+        }
+        
+        for(typename std::map<int, std::vector<int> >::const_iterator it = cluster_map.begin();
+            it != cluster_map.end();
+            it++) {
+            const std::vector<int>& v = it->second;
+            int child = buildNode(features, num_features, &v[0], (int)v.size());
+            CopyVector(mNodes[child].center, &features[it->first*NUM_BYTES_PER_FEATURE], NUM_BYTES_PER_FEATURE);
+            mNodes[node].children.push_back(child);
+        }
+        return node;
+    }
+    
+    template<int NUM_BYTES_PER_FEATURE>
+    int KeyframeShortlist<NUM_BYTES_PER_FEATURE>::quantize(const unsigned char* feature) const {
+        const unsigned char* centers[NUM_CENTERS];
+        unsigned int dist[NUM_CENTERS];
+        int node = 0;
+        while(mNodes[node].word < 0) {
+            const std::vector<int>& children = mNodes[node].children;
+            unsigned int mind = std::numeric_limits<unsigned int>::max();
+            for(size_t i = 0; i < children.size(); i++) {
+                centers[i] = mNodes[children[i]].center;
+            }
+            HammingDistanceBatch<NUM_BYTES_PER_FEATURE>(dist, feature, centers, (int)children.size());
+            for(size_t i = 0; i < children.size(); i++) {
+                unsigned int d = dist[i];
+                if(d < mind) {
+                    mind = d;
+                    node = children[i];
+                }
+            }
+        }
+        return mNodes[node].word;
+    }
+    
+    template<int NUM_BYTES_PER_FEATURE>
+    void KeyframeShortlist<NUM_BYTES_PER_FEATURE>::shortlist(std::vector<int>& keyframes, const BinaryFeatureStore* query, int k) const {
+        keyframes.clear();
+        mScores.assign(mNumKeyframes, 0);
+        if(mNodes.empty()) {
+            return;
+        }
+        
+        mQueryWordCounts.assign(mInvertedLists.size(), 0);
+        for(size_t i = 0; i < query->size(); i++) {
+            int word = quantize(query->feature(i));
+            int count = ++mQueryWordCounts[word];
+            const std::vector<posting_t>& postings = mInvertedLists[word];
+            for(size_t j = 0; j < postings.size(); j++) {
+                if(postings[j].second >= count) {
+                    mScores[postings[j].first] += mWordWeights[word];
+                }
+            }
+        }
+        
+        // Keep the K keyframes with the highest scores, in keyframe order.
+        mOrder.resize(mNumKeyframes);
+        for(int i = 0; i < mNumKeyframes; i++) {
+            mOrder[i] = i;
+        }
+        k = min2(k, mNumKeyframes);
+        std::stable_sort(mOrder.begin(), mOrder.end(), ScoreGreater(mScores));
+        for(int i = 0; i < k && mScores[mOrder[i]] > 0; i++) {
+            keyframes.push_back(mOrder[i]);
+        }
+        std::sort(keyframes.begin(), keyframes.end());
+    }
+    
+} // vision
@@ -202,13 +202,22 @@ namespace vision {
         
         unsigned int sum_dist = 0;
         
+        std::vector<const unsigned char*> center_features(num_centers);
+        std::vector<unsigned int> center_dist(num_centers);
+        for(int j = 0; j < num_centers; j++) {
+            center_features[j] = &features[NUM_BYTES_PER_FEATURE*indices[centers[j]]];
+        }
+        
         for(int i = 0; i < num_indices; i++) {
             unsigned int best_dist = std::numeric_limits<unsigned int>::max();
+            // Compute the distance from each center
+            HammingDistanceBatch<NUM_BYTES_PER_FEATURE>(&center_dist[0],
+                                                        &features[NUM_BYTES_PER_FEATURE*indices[i]],
+                                                        &center_features[0],
+                                                        num_centers);
             // Find the closest center
             for(int j = 0; j < num_centers; j++) {
-                // Compute the distance from the center
-                unsigned int dist = HammingDistance<NUM_BYTES_PER_FEATURE>(&features[NUM_BYTES_PER_FEATURE*indices[i]],
-                                                                           &features[NUM_BYTES_PER_FEATURE*indices[centers[j]]]);
+                unsigned int dist = center_dist[j];
                 if(dist < best_dist) {
                     assignment[i] = centers[j];
                     best_dist = dist;
@@ -70,10 +70,21 @@ namespace vision {
         mMinNumInliers = kMinNumInliers;
         
         mUseFeatureIndex = kUseFeatureIndex;
+        
+        mQueryThreadNum = 1;
+        mQueryWorkKeyframe = NULL;
+        mPyramid.setThreadNum(mQueryThreadNum);
+        mDetector.setThreadNum(mQueryThreadNum);
+        mFeatureExtractor.setThreadNum(mQueryThreadNum);
+        
+        mShortlistSize = 0;
+        mShortlistDirty = true;
     }
     
     template<typename FEATURE_EXTRACTOR, typename STORE, typename MATCHER>
-    VisualDatabase<FEATURE_EXTRACTOR, STORE, MATCHER>::~VisualDatabase() {}
+    VisualDatabase<FEATURE_EXTRACTOR, STORE, MATCHER>::~VisualDatabase() {
+        stopQueryThreads();
+    }
     
     template<typename FEATURE_EXTRACTOR, typename STORE, typename MATCHER>
     void VisualDatabase<FEATURE_EXTRACTOR, STORE, MATCHER>::addImage(const vision::Image& image, id_t id) throw(Exception) {
@@ -126,6 +137,7 @@ namespace vision {
         
         // Store the keyframe
         mKeyframeMap[id] = keyframe;
+        mShortlistDirty = true;
     }
     
     template<typename FEATURE_EXTRACTOR, typename STORE, typename MATCHER>
@@ -136,6 +148,7 @@ namespace vision {
         }
         
         mKeyframeMap[id] = keyframe;
+        mShortlistDirty = true;
     }
     
     template<typename FEATURE_EXTRACTOR, typename STORE, typename MATCHER>
@@ -181,159 +194,289 @@ namespace vision {
         mMatchedInliers.clear();
         mMatchedId = -1;
         
-        const std::vector<FeaturePoint>& query_points = query_keyframe->store().points();
-        
-        // Loop over all the images in the database
+        // Snapshot the keyframes in map order. The best match is chosen in this order
+        // below, exactly as a serial loop over the map would.
+        std::vector<id_t> ids;
+        ids.reserve(mKeyframeMap.size());
+        mQueryWorkKeyframes.clear();
         typename keyframe_map_t::const_iterator it = mKeyframeMap.begin();
         for(; it != mKeyframeMap.end(); it++) {
-            TIMED("Find Matches (1)") {
-                if(mUseFeatureIndex) {
-                    if(mMatcher.match(&query_keyframe->store(), &it->second->store(), it->second->index()) < mMinNumInliers) {
-                        continue;
-                    }
-                } else {
-                    if(mMatcher.match(&query_keyframe->store(), &it->second->store()) < mMinNumInliers) {
-                        continue;
+            ids.push_back(it->first);
+            mQueryWorkKeyframes.push_back(it->second.get());
+        }
+        
+        // With a large database, only verify the keyframes that share most features with the query.
+        if(mShortlistSize > 0 && mQueryWorkKeyframes.size() > (size_t)mShortlistSize) {
+            if(mShortlistDirty) {
+                TIMED("Build Shortlist Index") {
+                    std::vector<const BinaryFeatureStore*> stores(mQueryWorkKeyframes.size());
+                    for(size_t i = 0; i < stores.size(); i++) {
+                        stores[i] = &mQueryWorkKeyframes[i]->store();
                     }
+                    mShortlist.build(stores);
                 }
+                mShortlistDirty = false;
             }
-            
-            const std::vector<FeaturePoint>& ref_points = it->second->store().points();
-            //std::cout<<"ref_points-"<<ref_points.size()<<std::endl;
-            //std::cout<<"query_points-"<<query_points.size()<<std::endl;
-            
-            //
-            // Vote for a transformation based on the correspondences
-            //
-            
-            int max_hough_index = -1;
-            TIMED("Hough Voting (1)") {
-                max_hough_index = FindHoughSimilarity(mHoughSimilarityVoting,
-                                                      query_points,
-                                                      ref_points,
-                                                      mMatcher.matches(),
-                                                      query_keyframe->width(),
-                                                      query_keyframe->height(),
-                                                      it->second->width(),
-                                                      it->second->height());
-                if(max_hough_index < 0) {
-                    continue;
-                }
+            TIMED("Shortlist Keyframes") {
+                mShortlist.shortlist(mShortlistKeyframes, &query_keyframe->store(), mShortlistSize);
             }
-            
-            matches_t hough_matches;
-            TIMED("Find Hough Matches (1)") {
-                FindHoughMatches(hough_matches,
-                                 mHoughSimilarityVoting,
-                                 mMatcher.matches(),
-                                 max_hough_index,
-                                 kHoughBinDelta);
-            }
-            
-            //
-            // Estimate the transformation between the two images
-            //
-            
-            float H[9];
-            TIMED("Estimate Homography (1)") {
-                if(!EstimateHomography(H,
-                                       query_points,
-                                       ref_points,
-                                       hough_matches,
-                                       mRobustHomography,
-                                       it->second->width(),
-                                       it->second->height())) {
-                    continue;
-                }
+            for(size_t i = 0; i < mShortlistKeyframes.size(); i++) {
+                ids[i] = ids[mShortlistKeyframes[i]];
+                mQueryWorkKeyframes[i] = mQueryWorkKeyframes[mShortlistKeyframes[i]];
             }
-            
-            //
-            // Find the inliers
-            //
-            
-            matches_t inliers;
-            TIMED("Find Inliers (1)") {
-                FindInliers(inliers, H, query_points, ref_points, hough_matches, mHomographyInlierThreshold);
-                if(inliers.size() < mMinNumInliers) {
-                    continue;
-                }
-            }
-            
-            //
-            // Use the estimated homography to find more inliers
-            //
-            
-            TIMED("Find Matches (2)") {
-                if(mMatcher.match(&query_keyframe->store(),
-                                  &it->second->store(),
-                                  H,
-                                  10) < mMinNumInliers) {
-                    continue;
+            ids.resize(mShortlistKeyframes.size());
+            mQueryWorkKeyframes.resize(mShortlistKeyframes.size());
+            LOG_INFO("Shortlisted %d of %d keyframes", (int)ids.size(), (int)mKeyframeMap.size());
+        }
+        mQueryWorkKeyframe = query_keyframe;
+        mQueryWorkResults.resize(mQueryWorkKeyframes.size());
+        
+        int threadNum = mQueryThreadNum;
+        if(threadNum < 1) {
+            threadNum = threadGetCPU();
+        }
+        threadNum = max2<int>(1, min2<int>(threadNum, (int)mQueryWorkKeyframes.size()));
+        
+        TIMED("Verify Keyframes") {
+            if(threadNum == 1) {
+                verifyKeyframes(mMatcher, mHoughSimilarityVoting, mRobustHomography, 0, 1);
+            } else {
+                if((int)mQueryThreads.size() != threadNum - 1) {
+                    startQueryThreads(threadNum);
                 }
-            }
-            
-            //
-            // Vote for a similarity with new matches
-            //
-            
-            TIMED("Hough Voting (2)") {
-                max_hough_index = FindHoughSimilarity(mHoughSimilarityVoting,
-                                                      query_points,
-                                                      ref_points,
-                                                      mMatcher.matches(),
-                                                      query_keyframe->width(),
-                                                      query_keyframe->height(),
-                                                      it->second->width(),
-                                                      it->second->height());
-                if(max_hough_index < 0) {
-                    continue;
+                for(size_t i = 0; i < mQueryThreads.size(); i++) {
+                    threadStartSignal(mQueryThreads[i]);
                 }
-            }
-            
-            TIMED("Find Hough Matches (2)") {
-                FindHoughMatches(hough_matches,
-                                 mHoughSimilarityVoting,
-                                 mMatcher.matches(),
-                                 max_hough_index,
-                                 kHoughBinDelta);
-            }
-            
-            //
-            // Re-estimate the homography
-            //
-            
-            TIMED("Estimate Homography (2)") {
-                if(!EstimateHomography(H,
-                                       query_points,
-                                       ref_points,
-                                       hough_matches,
-                                       mRobustHomography,
-                                       it->second->width(),
-                                       it->second->height())) {
-                    continue;
+                verifyKeyframes(mMatcher, mHoughSimilarityVoting, mRobustHomography, 0, threadNum);
+                for(size_t i = 0; i < mQueryThreads.size(); i++) {
+                    threadEndWait(mQueryThreads[i]);
                 }
             }
-            
-            //
-            // Check if this is the best match based on number of inliers
-            //
-            
-            inliers.clear();
-            TIMED("Find Inliers (2)") {
-                FindInliers(inliers, H, query_points, ref_points, hough_matches, mHomographyInlierThreshold);
-            }
-            
-            //std::cout<<"inliers-"<<inliers.size()<<std::endl;
+        }
+        
+        //
+        // Pick the best match based on number of inliers
+        //
+        
+        for(size_t i = 0; i < mQueryWorkResults.size(); i++) {
+            matches_t& inliers = mQueryWorkResults[i].inliers;
             if(inliers.size() >= mMinNumInliers && inliers.size() > mMatchedInliers.size()) {
-                CopyVector9(mMatchedGeometry, H);
+                CopyVector9(mMatchedGeometry, mQueryWorkResults[i].H);
                 mMatchedInliers.swap(inliers);
-                mMatchedId = it->first;
+                mMatchedId = ids[i];
             }
         }
+        mQueryWorkKeyframe = NULL;
+        mQueryWorkKeyframes.clear();
         
         return mMatchedId >= 0;
     }
     
+    template<typename FEATURE_EXTRACTOR, typename STORE, typename MATCHER>
+    void VisualDatabase<FEATURE_EXTRACTOR, STORE, MATCHER>::verifyKeyframes(MATCHER& matcher,
+                                                                            HoughSimilarityVoting& hough,
+                                                                            RobustHomography<float>& robustHomography,
+                                                                            int index,
+                                                                            int threadNum) {
+        for(size_t i = index; i < mQueryWorkKeyframes.size(); i += threadNum) {
+            QueryResult& result = mQueryWorkResults[i];
+            result.inliers.clear();
+            if(!verifyKeyframe(matcher,
+                               hough,
+                               robustHomography,
+                               mQueryWorkKeyframe,
+                               mQueryWorkKeyframes[i],
+                               result.H,
+                               result.inliers)) {
+                result.inliers.clear();
+            }
+        }
+    }
+    
+    template<typename FEATURE_EXTRACTOR, typename STORE, typename MATCHER>
+    bool VisualDatabase<FEATURE_EXTRACTOR, STORE, MATCHER>::verifyKeyframe(MATCHER& matcher,
+                                                                           HoughSimilarityVoting& hough,
+                                                                           RobustHomography<float>& robustHomography,
+                                                                           const keyframe_t* query_keyframe,
+                                                                           const keyframe_t* keyframe,
+                                                                           float H[9],
+                                                                           matches_t& inliers) {
+        // This runs on the query worker threads, so it must not use TIMED or LOG_*; the logger
+        // is not thread-safe.
+        const std::vector<FeaturePoint>& query_points = query_keyframe->store().points();
+        
+        if(mUseFeatureIndex) {
+            if(matcher.match(&query_keyframe->store(), &keyframe->store(), keyframe->index(true), keyframe->index(false)) < mMinNumInliers) {
+                return false;
+            }
+        } else {
+            if(matcher.match(&query_keyframe->store(), &keyframe->store()) < mMinNumInliers) {
+                return false;
+            }
+        }
+        
+        const std::vector<FeaturePoint>& ref_points = keyframe->store().points();
+        //std::cout<<"ref_points-"<<ref_points.size()<<std::endl;
+        //std::cout<<"query_points-"<<query_points.size()<<std::endl;
+        
+        //
+        // Vote for a transformation based on the correspondences
+        //
+        
+        int max_hough_index = -1;
+        max_hough_index = FindHoughSimilarity(hough,
+                                              query_points,
+                                              ref_points,
+                                              matcher.matches(),
+                                              query_keyframe->width(),
+                                              query_keyframe->height(),
+                                              keyframe->width(),
+                                              keyframe->height());
+        if(max_hough_index < 0) {
+            return false;
+        }
+        
+        matches_t hough_matches;
+        FindHoughMatches(hough_matches,
+                         hough,
+                         matcher.matches(),
+                         max_hough_index,
+                         kHoughBinDelta);
+        
+        //
+        // Estimate the transformation between the two images
+        //
+        
+        if(!EstimateHomography(H,
+                               query_points,
+                               ref_points,
+                               hough_matches,
+                               robustHomography,
+                               keyframe->width(),
+                               keyframe->height())) {
+            return false;
+        }
+        
+        //
+        // Find the inliers
+        //
+        
+        FindInliers(inliers, H, query_points, ref_points, hough_matches, mHomographyInlierThreshold);
+        if(inliers.size() < mMinNumInliers) {
+            return false;
+        }
+        
+        //
+        // Use the estimated homography to find more inliers
+        //
+        
+        if(matcher.match(&query_keyframe->store(),
+                         &keyframe->store(),
+                         keyframe->grid(true),
+                         keyframe->grid(false),
+                         H,
+                         10) < mMinNumInliers) {
+            return false;
+        }
+        
+        //
+        // Vote for a similarity with new matches
+        //
+        
+        max_hough_index = FindHoughSimilarity(hough,
+                                              query_points,
+                                              ref_points,
+                                              matcher.matches(),
+                                              query_keyframe->width(),
+                                              query_keyframe->height(),
+                                              keyframe->width(),
+                                              keyframe->height());
+        if(max_hough_index < 0) {
+            return false;
+        }
+        
+        FindHoughMatches(hough_matches,
+                         hough,
+                         matcher.matches(),
+                         max_hough_index,
+                         kHoughBinDelta);
+        
+        //
+        // Re-estimate the homography
+        //
+        
+        if(!EstimateHomography(H,
+                               query_points,
+                               ref_points,
+                               hough_matches,
+                               robustHomography,
+                               keyframe->width(),
+                               keyframe->height())) {
+            return false;
+        }
+        
+        //
+        // Check if this is the best match based on number of inliers
+        //
+        
+        inliers.clear();
+        FindInliers(inliers, H, query_points, ref_points, hough_matches, mHomographyInlierThreshold);
+        
+        return inliers.size() >= mMinNumInliers;
+    }
+    
+    template<typename FEATURE_EXTRACTOR, typename STORE, typename MATCHER>
+    void* VisualDatabase<FEATURE_EXTRACTOR, STORE, MATCHER>::queryWorker(THREAD_HANDLE_T* threadHandle) {
+        QueryWorkerArg* arg = (QueryWorkerArg*)threadGetArg(threadHandle);
+        VisualDatabase* vdb = arg->vdb;
+        QueryContext* context = vdb->mQueryContexts[arg->index - 1].get();
+        
+        while(threadStartWait(threadHandle) == 0) {
+            vdb->verifyKeyframes(context->matcher,
+                                 context->houghSimilarityVoting,
+                                 context->robustHomography,
+                                 arg->index,
+                                 (int)vdb->mQueryThreads.size() + 1);
+            threadEndSignal(threadHandle);
+        }
+        return NULL;
+    }
+    
+    template<typename FEATURE_EXTRACTOR, typename STORE, typename MATCHER>
+    void VisualDatabase<FEATURE_EXTRACTOR, STORE, MATCHER>::startQueryThreads(int threadNum) {
+        stopQueryThreads();
+        
+        // Everything the workers reference must be in place before the first one starts.
+        mQueryWorkerArgs.resize(threadNum - 1);
+        mQueryContexts.resize(threadNum - 1);
+        for(int i = 0; i < threadNum - 1; i++) {
+            mQueryWorkerArgs[i].vdb = this;
+            mQueryWorkerArgs[i].index = i + 1;
+            mQueryContexts[i].reset(new QueryContext());
+            mQueryContexts[i]->matcher = mMatcher;
+        }
+        mQueryThreads.resize(threadNum - 1);
+        for(int i = 0; i < threadNum - 1; i++) {
+            mQueryThreads[i] = threadInit(i + 1, &mQueryWorkerArgs[i], queryWorker);
+            if(!mQueryThreads[i]) {
+                throw EXCEPTION("Unable to create query thread");
+            }
+        }
+    }
+    
+    template<typename FEATURE_EXTRACTOR, typename STORE, typename MATCHER>
+    void VisualDatabase<FEATURE_EXTRACTOR, STORE, MATCHER>::stopQueryThreads() {
+        for(size_t i = 0; i < mQueryThreads.size(); i++) {
+            if(mQueryThreads[i]) {
+                threadWaitQuit(mQueryThreads[i]);
+                threadFree(&mQueryThreads[i]);
+            }
+        }
+        mQueryThreads.clear();
+        mQueryContexts.clear();
+        mQueryWorkerArgs.clear();
+    }
+    
     template<typename FEATURE_EXTRACTOR, typename STORE, typename MATCHER>
     bool VisualDatabase<FEATURE_EXTRACTOR, STORE, MATCHER>::erase(id_t id) {
         typename keyframe_map_t::iterator it = mKeyframeMap.find(id);
@@ -341,6 +484,7 @@ namespace vision {
             return false;
         }
         mKeyframeMap.erase(it);
+        mShortlistDirty = true;
         return true;
     }
     
@@ -39,12 +39,14 @@
 #include <framework/exception.h>
 #include <detectors/DoG_scale_invariant_detector.h>
 #include <matchers/keyframe.h>
+#include <matchers/keyframe_shortlist.h>
 #include <matchers/feature_matcher-inline.h>
 #include <matchers/hough_similarity_voting.h>
 #include <homography_estimation/robust_homography.h>
 #include <utils/point.h>
 #include <math/homography.h>
 #include <math/indexing.h>
+#include <thread_sub.h>
 
 #include <vector>
 #include <memory>
@@ -164,8 +166,77 @@ namespace vision {
         inline void setMinNumInliers(size_t n) { mMinNumInliers = n; }
         inline size_t minNumInliers() const { return mMinNumInliers; }
         
+        /**
+         * Set/Get the number of threads used to verify keyframes during a query. Each
+         * thread matches, votes and estimates a homography for its share of the keyframes,
+         * and the best match is then chosen in keyframe order, so the result does not
+         * depend on the number of threads. 1 (the default) verifies all keyframes on the
+         * calling thread, and -1 uses one thread per CPU. The same number of threads
+         * builds the image pyramid, detects its feature points and extracts their
+         * descriptors.
+         */
+        inline void setQueryThreadNum(int n) {
+            mQueryThreadNum = n;
+            mPyramid.setThreadNum(n);
+            mDetector.setThreadNum(n);
+            mFeatureExtractor.setThreadNum(n);
+        }
+        inline int queryThreadNum() const { return mQueryThreadNum; }
+        
+        /**
+         * Set/Get the maximum number of keyframes to verify per query. When the database
+         * holds more keyframes than this, a database-wide index is used to shortlist the
+         * keyframes sharing most features with the query, and only those are verified.
+         * 0 (the default) verifies every keyframe.
+         */
+        inline void setShortlistSize(int k) { mShortlistSize = k; }
+        inline int shortlistSize() const { return mShortlistSize; }
+        
     private:
         
+        // State used by a query worker thread. The calling thread uses mMatcher,
+        // mHoughSimilarityVoting and mRobustHomography.
+        struct QueryContext {
+            MATCHER matcher;
+            HoughSimilarityVoting houghSimilarityVoting;
+            RobustHomography<float> robustHomography;
+        };
+        
+        // Outcome of verifying one keyframe. inliers is empty if verification failed.
+        struct QueryResult {
+            matches_t inliers;
+            float H[9];
+        };
+        
+        struct QueryWorkerArg {
+            VisualDatabase* vdb;
+            int index;
+        };
+        
+        /**
+         * Match, vote and estimate a homography between the query and one keyframe.
+         */
+        bool verifyKeyframe(MATCHER& matcher,
+                            HoughSimilarityVoting& hough,
+                            RobustHomography<float>& robustHomography,
+                            const keyframe_t* query_keyframe,
+                            const keyframe_t* keyframe,
+                            float H[9],
+                            matches_t& inliers);
+        
+        /**
+         * Verify every threadNum'th keyframe of the current query, starting at index.
+         */
+        void verifyKeyframes(MATCHER& matcher,
+                             HoughSimilarityVoting& hough,
+                             RobustHomography<float>& robustHomography,
+                             int index,
+                             int threadNum);
+        
+        static void* queryWorker(THREAD_HANDLE_T* threadHandle);
+        void startQueryThreads(int threadNum);
+        void stopQueryThreads();
+        
         size_t mMinNumInliers;
         float mHomographyInlierThreshold;
         
@@ -199,6 +270,24 @@ namespace vision {
         // Robust homography estimation
         RobustHomography<float> mRobustHomography;
         
+        // Database-wide index for shortlisting keyframes. Rebuilt on the next query
+        // after keyframes are added or erased.
+        int mShortlistSize;
+        bool mShortlistDirty;
+        KeyframeShortlist<96> mShortlist;
+        std::vector<int> mShortlistKeyframes;
+        
+        // Keyframe verification threads, and their state. The calling thread is thread 0.
+        int mQueryThreadNum;
+        std::vector<THREAD_HANDLE_T*> mQueryThreads;
+        std::vector<QueryWorkerArg> mQueryWorkerArgs;
+        std::vector<std::unique_ptr<QueryContext> > mQueryContexts;
+        
+        // The query being verified, the keyframes in map order, and one result per keyframe.
+        const keyframe_t* mQueryWorkKeyframe;
+        std::vector<const keyframe_t*> mQueryWorkKeyframes;
+        std::vector<QueryResult> mQueryWorkResults;
+        
     }; // VisualDatabase
     
     /**
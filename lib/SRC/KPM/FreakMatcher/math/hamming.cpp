@@ -0,0 +1,254 @@
+//
+//  hamming.cpp
+//  ARToolKit5
+//
+//  This file is part of ARToolKit.
+//
+//  ARToolKit is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  ARToolKit is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with ARToolKit.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  As a special exception, the copyright holders of this library give you
+//  permission to link this library with independent modules to produce an
+//  executable, regardless of the license terms of these independent modules, and to
+//  copy and distribute the resulting executable under terms of your choice,
+//  provided that you also meet, for each linked independent module, the terms and
+//  conditions of the license of that module. An independent module is a module
+//  which is neither derived from nor based on this library. If you modify this
+//  library, you may extend this exception to your version of the library, but you
+//  are not obligated to do so. If you do not wish to do so, delete this exception
+//  statement from your version.
+//  Copyright 2016 Daqri, LLC.
+//
+//  Author(s): Philip Lamb
+//
+
+#include "hamming.h"
+#include <AR/ar.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+#  include <arm_neon.h>
+#  define HAMMING_NEON 1
+#  if defined(ANDROID) && defined(HAVE_ARM_NEON)
+#    include "cpu-features.h"
+#  endif
+#elif defined(HAVE_INTEL_SIMD)
+#  if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#    include <immintrin.h>
+#    define HAMMING_POPCNT 1
+#    define HAMMING_AVX2 1
+#    define HAMMING_TARGET_POPCNT __attribute__((target("popcnt")))
+#    define HAMMING_TARGET_AVX2 __attribute__((target("avx2")))
+#  elif defined(_MSC_VER) && _MSC_VER >= 1800
+#    include <immintrin.h>
+#    include <intrin.h>
+#    define HAMMING_POPCNT 1
+#    define HAMMING_AVX2 1
+#    define HAMMING_TARGET_POPCNT
+#    define HAMMING_TARGET_AVX2
+#  endif
+#endif
+
+namespace vision {
+
+    //
+    // One-to-many Hamming distance kernels for 768 bit (96 byte) descriptors.
+    //
+    // The query is loaded once and each feature is XORed against it and counted with the
+    // widest population count the CPU offers: 64-bit POPCNT, a nibble lookup table in AVX2
+    // registers, or NEON's per-byte VCNT. The best available kernel is chosen once at run time.
+    //
+    
+    typedef void (*HammingDistance768BatchFunc)(unsigned int* distances,
+                                                const unsigned char* query,
+                                                const unsigned char* const* features,
+                                                int count);
+    
+    struct HammingKernel {
+        HammingDistance768BatchFunc distance768Batch;
+        const char* name;
+    };
+    
+    static void HammingDistance768BatchC(unsigned int* distances,
+                                         const unsigned char* query,
+                                         const unsigned char* const* features,
+                                         int count) {
+        for(int i = 0; i < count; i++) {
+            distances[i] = HammingDistance768((const unsigned int*)query, (const unsigned int*)features[i]);
+        }
+    }
+    
+    static const HammingKernel gHammingKernelC = {HammingDistance768BatchC, "C"};
+    
+#if HAMMING_POPCNT
+    HAMMING_TARGET_POPCNT static inline unsigned int Popcount64(uint64_t x) {
+#  if defined(_MSC_VER) && defined(_M_X64)
+        return (unsigned int)__popcnt64(x);
+#  elif defined(_MSC_VER)
+        return __popcnt((unsigned int)x) + __popcnt((unsigned int)(x >> 32));
+#  else
+        return (unsigned int)__builtin_popcountll(x);
+#  endif
+    }
+    
+    HAMMING_TARGET_POPCNT static void HammingDistance768BatchPOPCNT(unsigned int* distances,
+                                                                    const unsigned char* query,
+                                                                    const unsigned char* const* features,
+                                                                    int count) {
+        uint64_t q[12], f[12];
+        memcpy(q, query, sizeof(q));
+        for(int i = 0; i < count; i++) {
+            memcpy(f, features[i], sizeof(f));
+            distances[i] = Popcount64(q[0]  ^ f[0])  + Popcount64(q[1]  ^ f[1])  +
+                           Popcount64(q[2]  ^ f[2])  + Popcount64(q[3]  ^ f[3])  +
+                           Popcount64(q[4]  ^ f[4])  + Popcount64(q[5]  ^ f[5])  +
+                           Popcount64(q[6]  ^ f[6])  + Popcount64(q[7]  ^ f[7])  +
+                           Popcount64(q[8]  ^ f[8])  + Popcount64(q[9]  ^ f[9])  +
+                           Popcount64(q[10] ^ f[10]) + Popcount64(q[11] ^ f[11]);
+        }
+    }
+    
+    static const HammingKernel gHammingKernelPOPCNT = {HammingDistance768BatchPOPCNT, "POPCNT"};
+    
+    static bool CPUHasPOPCNT() {
+#  if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 23)) != 0;
+#  else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("popcnt") != 0;
+#  endif
+    }
+#endif // HAMMING_POPCNT
+    
+#if HAMMING_AVX2
+    // Per-byte population count of X, by looking up each nibble in a 16 entry table.
+    HAMMING_TARGET_AVX2 static inline __m256i PopcountBytesAVX2(__m256i x) {
+        const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                             0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i lowMask = _mm256_set1_epi8(0x0f);
+        __m256i lo = _mm256_and_si256(x, lowMask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), lowMask);
+        return _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+    }
+    
+    HAMMING_TARGET_AVX2 static void HammingDistance768BatchAVX2(unsigned int* distances,
+                                                                const unsigned char* query,
+                                                                const unsigned char* const* features,
+                                                                int count) {
+        const __m256i q0 = _mm256_loadu_si256((const __m256i*)query);
+        const __m256i q1 = _mm256_loadu_si256((const __m256i*)(query + 32));
+        const __m256i q2 = _mm256_loadu_si256((const __m256i*)(query + 64));
+        const __m256i zero = _mm256_setzero_si256();
+        for(int i = 0; i < count; i++) {
+            const unsigned char* f = features[i];
+            // Each byte of the sum is at most 3*8, so no overflow before the horizontal add.
+            __m256i c = PopcountBytesAVX2(_mm256_xor_si256(q0, _mm256_loadu_si256((const __m256i*)f)));
+            c = _mm256_add_epi8(c, PopcountBytesAVX2(_mm256_xor_si256(q1, _mm256_loadu_si256((const __m256i*)(f + 32)))));
+            c = _mm256_add_epi8(c, PopcountBytesAVX2(_mm256_xor_si256(q2, _mm256_loadu_si256((const __m256i*)(f + 64)))));
+            __m256i s = _mm256_sad_epu8(c, zero);
+            __m128i t = _mm_add_epi64(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+            t = _mm_add_epi64(t, _mm_unpackhi_epi64(t, t));
+            distances[i] = (unsigned int)_mm_cvtsi128_si32(t);
+        }
+    }
+    
+    static const HammingKernel gHammingKernelAVX2 = {HammingDistance768BatchAVX2, "AVX2"};
+    
+    static bool CPUHasAVX2() {
+#  if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        if(info[0] < 7) return false;
+        __cpuid(info, 1);
+        if((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false; // OSXSAVE and AVX.
+        if((_xgetbv(0) & 0x6) != 0x6) return false; // OS saves XMM and YMM state.
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#  else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#  endif
+    }
+#endif // HAMMING_AVX2
+    
+#if HAMMING_NEON
+    static void HammingDistance768BatchNEON(unsigned int* distances,
+                                            const unsigned char* query,
+                                            const unsigned char* const* features,
+                                            int count) {
+        const uint8x16_t q0 = vld1q_u8(query);
+        const uint8x16_t q1 = vld1q_u8(query + 16);
+        const uint8x16_t q2 = vld1q_u8(query + 32);
+        const uint8x16_t q3 = vld1q_u8(query + 48);
+        const uint8x16_t q4 = vld1q_u8(query + 64);
+        const uint8x16_t q5 = vld1q_u8(query + 80);
+        for(int i = 0; i < count; i++) {
+            const unsigned char* f = features[i];
+            // Each byte of the sum is at most 6*8, so no overflow before the pairwise widening adds.
+            uint8x16_t c = vcntq_u8(veorq_u8(q0, vld1q_u8(f)));
+            c = vaddq_u8(c, vcntq_u8(veorq_u8(q1, vld1q_u8(f + 16))));
+            c = vaddq_u8(c, vcntq_u8(veorq_u8(q2, vld1q_u8(f + 32))));
+            c = vaddq_u8(c, vcntq_u8(veorq_u8(q3, vld1q_u8(f + 48))));
+            c = vaddq_u8(c, vcntq_u8(veorq_u8(q4, vld1q_u8(f + 64))));
+            c = vaddq_u8(c, vcntq_u8(veorq_u8(q5, vld1q_u8(f + 80))));
+            uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(c)));
+            distances[i] = (unsigned int)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+        }
+    }
+    
+    static const HammingKernel gHammingKernelNEON = {HammingDistance768BatchNEON, "NEON"};
+#endif // HAMMING_NEON
+    
+    static const HammingKernel* SelectHammingKernel() {
+        const HammingKernel* kernel = &gHammingKernelC;
+#if HAMMING_NEON
+#  if defined(ANDROID) && defined(HAVE_ARM_NEON)
+        // Not all Android devices with ARMv7 CPUs are guaranteed to have NEON, so check.
+        if((android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON) != 0)
+#  endif
+        kernel = &gHammingKernelNEON;
+#else
+#  if HAMMING_POPCNT
+        if(CPUHasPOPCNT()) kernel = &gHammingKernelPOPCNT;
+#  endif
+#  if HAMMING_AVX2
+        if(CPUHasAVX2()) kernel = &gHammingKernelAVX2;
+#  endif
+#endif
+        ARLOGd("KPM Hamming distance will use %s kernel.\n", kernel->name);
+        return kernel;
+    }
+    
+    // Chosen once while the library is loaded, before any matching threads exist. (Not a function-local
+    // static, whose initialisation is not thread-safe on older compilers, e.g. Visual Studio before 2015.)
+    static const HammingKernel* const gHammingKernel = SelectHammingKernel();
+    
+    static const HammingKernel* GetHammingKernel() {
+        return gHammingKernel;
+    }
+    
+    void HammingDistance768Batch(unsigned int* distances,
+                                 const unsigned char* query,
+                                 const unsigned char* const* features,
+                                 int count) {
+        GetHammingKernel()->distance768Batch(distances, query, features, count);
+    }
+    
+    const char* HammingDistance768BatchKernelName() {
+        return GetHammingKernel()->name;
+    }
+    
+} // vision
@@ -35,12 +35,18 @@
 
 #pragma once
 
+#include <limits>
+
 namespace vision {
     
     /**
      * Hamming distance for 32 bits.
      */
     inline unsigned int HammingDistance32(unsigned int a, unsigned int b) {
+#if defined(__POPCNT__)
+        // The compiler may assume the POPCNT instruction is available.
+        return (unsigned int)__builtin_popcount(a^b);
+#else
         const unsigned int m1  = 0x55555555; // 0101...
         const unsigned int m2  = 0x33333333; // 00110011..
         const unsigned int m4  = 0x0f0f0f0f; // 4 zeros,  4 ones
@@ -54,6 +60,7 @@ namespace vision {
         x = (x + (x >> 4)) & m4;        // put count of each 8 bits into those 8 bits
         
         return (x * h01) >> 24;         // returns left 8 bits of x + (x<<8) + (x<<16) + (x<<24) + ...
+#endif
     }
     
     /**
@@ -95,5 +102,35 @@ namespace vision {
         };
         return std::numeric_limits<unsigned int>::max();
     }
+    
+    /**
+     * Hamming distances for 768 bits (96 bytes) from one QUERY to COUNT FEATURES.
+     * DISTANCES[i] is set to the distance between QUERY and FEATURES[i].
+     * The fastest kernel the CPU supports (AVX2, POPCNT or NEON) is chosen on the first call.
+     */
+    void HammingDistance768Batch(unsigned int* distances,
+                                 const unsigned char* query,
+                                 const unsigned char* const* features,
+                                 int count);
+    
+    /**
+     * @return Name of the kernel used by HammingDistance768Batch.
+     */
+    const char* HammingDistance768BatchKernelName();
+    
+    template<int NUM_BYTES>
+    inline void HammingDistanceBatch(unsigned int* distances,
+                                     const unsigned char* query,
+                                     const unsigned char* const* features,
+                                     int count) {
+        switch(NUM_BYTES) {
+            case 96:
+                HammingDistance768Batch(distances, query, features, count);
+                return;
+        };
+        for(int i = 0; i < count; i++) {
+            distances[i] = std::numeric_limits<unsigned int>::max();
+        }
+    }
 
 } // vision
@@ -223,6 +223,45 @@ int kpmSetSurfThreadNum( KpmHandle *kpmHandle, int surfThreadNum )
     return 0;
 }
 
+int kpmSetMatchingThreadNum( KpmHandle *kpmHandle, int matchingThreadNum )
+{
+    if( kpmHandle == NULL ) return -1;
+#if BINARY_FEATURE
+    kpmHandle->freakMatcher->setQueryThreadNum(matchingThreadNum);
+#endif
+    return 0;
+}
+
+int kpmGetMatchingThreadNum( KpmHandle *kpmHandle, int *matchingThreadNum )
+{
+    if( kpmHandle == NULL || matchingThreadNum == NULL ) return -1;
+#if BINARY_FEATURE
+    *matchingThreadNum = kpmHandle->freakMatcher->getQueryThreadNum();
+#else
+    *matchingThreadNum = 1;
+#endif
+    return 0;
+}
+
+int kpmSetMatchingShortlistSize( KpmHandle *kpmHandle, int shortlistSize )
+{
+    if( kpmHandle == NULL || shortlistSize < 0 ) return -1;
+#if BINARY_FEATURE
+    kpmHandle->freakMatcher->setShortlistSize(shortlistSize);
+#endif
+    return 0;
+}
+
+int kpmGetMatchingShortlistSize( KpmHandle *kpmHandle, int *shortlistSize )
+{
+    if( kpmHandle == NULL || shortlistSize == NULL ) return -1;
+#if BINARY_FEATURE
+    *shortlistSize = kpmHandle->freakMatcher->getShortlistSize();
+#else
+    *shortlistSize = 0;
+#endif
+    return 0;
+}
 
 
 int kpmDeleteHandle( KpmHandle **kpmHandle )
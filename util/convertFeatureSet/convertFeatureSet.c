@@ -0,0 +1,111 @@
+/*
+ *  convertFeatureSet.c
+ *  ARToolKit5
+ *
+ *  Convert NFT feature sets (.fset) between the legacy and packed layouts.
+ *
+ *  Run with "--help" parameter to see usage.
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  ARToolKit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ARToolKit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with ARToolKit.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2016 Daqri, LLC.
+ *
+ *  Author(s): Philip Lamb
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <AR/ar.h>
+#include <AR2/featureSet.h>
+#include <AR2/util.h>
+
+static void usage( char *com );
+
+int main( int argc, char *argv[] )
+{
+    AR2FeatureSetT *featureSet;
+    char            filename[1024] = "";
+    char           *ext;
+    int             version = AR2_FEATURE_SET_VERSION_PACKED;
+    int             i;
+
+    for( i = 1; i < argc; i++ ) {
+        if( strcmp(argv[i], "-legacy") == 0 ) {
+            version = AR2_FEATURE_SET_VERSION_LEGACY;
+        } else if( strcmp(argv[i], "-packed") == 0 ) {
+            version = AR2_FEATURE_SET_VERSION_PACKED;
+        } else if( strncmp(argv[i], "-loglevel=", 10) == 0 ) {
+            if (strcmp(&(argv[i][10]), "DEBUG") == 0) arLogLevel = AR_LOG_LEVEL_DEBUG;
+            else if (strcmp(&(argv[i][10]), "INFO") == 0) arLogLevel = AR_LOG_LEVEL_INFO;
+            else if (strcmp(&(argv[i][10]), "WARN") == 0) arLogLevel = AR_LOG_LEVEL_WARN;
+            else if (strcmp(&(argv[i][10]), "ERROR") == 0) arLogLevel = AR_LOG_LEVEL_ERROR;
+            else usage(argv[0]);
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-?") == 0) {
+            usage(argv[0]);
+        } else if( filename[0] == '\0' ) {
+            strncpy(filename, argv[i], sizeof(filename) - 1);
+            filename[sizeof(filename) - 1] = '\0';
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if( filename[0] == '\0' ) usage(argv[0]);
+
+    // Accept the name with or without the .fset extension.
+    ext = strrchr(filename, '.');
+    if( ext && strcmp(ext, ".fset") == 0 ) *ext = '\0';
+
+    if( (featureSet = ar2ReadFeatureSet(filename, "fset")) == NULL ) {
+        ARLOGe("Error: unable to read feature set '%s.fset'.\n", filename);
+        return (-1);
+    }
+    if( ar2SaveFeatureSet2(filename, "fset", featureSet, version) < 0 ) {
+        ARLOGe("Error: unable to write feature set '%s.fset'.\n", filename);
+        ar2FreeFeatureSet(&featureSet);
+        return (-1);
+    }
+    ARLOGi("Wrote '%s.fset' in %s layout.\n", filename, (version == AR2_FEATURE_SET_VERSION_LEGACY ? "legacy" : "packed"));
+    ar2FreeFeatureSet(&featureSet);
+
+    return 0;
+}
+
+static void usage( char *com )
+{
+    ARLOG("%s [options] <filename>[.fset]\n", com);
+    ARLOG("  Rewrites the feature set in place.\n");
+    ARLOG("    -packed\n");
+    ARLOG("         Write the packed layout, which loads in a single read (default).\n");
+    ARLOG("    -legacy\n");
+    ARLOG("         Write the legacy layout, readable by ARToolKit versions before 5.3.3.\n");
+    ARLOG("    -loglevel=x\n");
+    ARLOG("         x is one of: DEBUG, INFO, WARN, ERROR. Default is %s.\n", (AR_LOG_LEVEL_DEFAULT == AR_LOG_LEVEL_DEBUG ? "DEBUG" : (AR_LOG_LEVEL_DEFAULT == AR_LOG_LEVEL_INFO ? "INFO" : (AR_LOG_LEVEL_DEFAULT == AR_LOG_LEVEL_WARN ? "WARN" : (AR_LOG_LEVEL_DEFAULT == AR_LOG_LEVEL_ERROR ? "ERROR" : "UNKNOWN")))));
+    ARLOG("    --help -h -?  Display this help\n");
+    exit(0);
+}
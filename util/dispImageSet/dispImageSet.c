@@ -159,7 +159,11 @@ static void dispFunc( void )
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     argViewportSetPixFormat( vp[page/AR2_BLUR_IMAGE_MAX], AR_PIXEL_FORMAT_MONO );
     argDrawMode2D( vp[page/AR2_BLUR_IMAGE_MAX] );
-    argDrawImage( imageSet->scale[page/AR2_BLUR_IMAGE_MAX]->imgBWBlur[page%AR2_BLUR_IMAGE_MAX] );
+    {
+        ARUint8 *imgBW = ar2GenImageBlur( imageSet->scale[page/AR2_BLUR_IMAGE_MAX], page%AR2_BLUR_IMAGE_MAX );
+        argDrawImage( imgBW );
+        free( imgBW );
+    }
 #else
     argViewportSetPixFormat( vp[page], AR_PIXEL_FORMAT_MONO );
     argDrawMode2D( vp[page] );
@@ -80,6 +80,9 @@ enum {
 
 static AR2ImageSetT    *imageSet = NULL;
 static AR2JpegImageT   *jpegImage = NULL;
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+static ARUint8         *imageBlur = NULL;
+#endif
 static AR2VideoBufferT  buff = {0};
 static int              xsize = 0, ysize = 0; // Input image size.
 static int              windowWidth = XWIN_MAX;
@@ -222,7 +225,8 @@ static int init( int argc, char *argv[] )
         pixFormat = AR_PIXEL_FORMAT_MONO;
         
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-        buff.buff = imageSet->scale[targetScale]->imgBWBlur[1];
+        imageBlur = ar2GenImageBlur( imageSet->scale[targetScale], 1 );
+        buff.buff = imageBlur;
         buff.fillFlag = 1;
 #else
         buff.buff = imageSet->scale[targetScale]->imgBW;
@@ -360,6 +364,10 @@ static void cleanup(void)
     argCleanup();
     ar2FreeImageSet(&imageSet);
     ar2FreeJpegImage(&jpegImage);
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    free(imageBlur);
+    imageBlur = NULL;
+#endif
     free(inputFilePath);
 }
 
@@ -45,6 +45,9 @@
 #endif
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h> // mkdir()
 #include <AR/ar.h>
 #include <AR2/config.h>
 #include <AR2/imageFormat.h>
@@ -52,6 +55,7 @@
 #include <AR2/featureSet.h>
 #include <AR2/util.h>
 #include <KPM/kpm.h>
+#include <thread_sub.h>
 #ifdef _WIN32
 #  define MAXPATHLEN MAX_PATH
 #else
@@ -61,6 +65,13 @@
 #  define HAVE_DAEMON_FUNC 1
 #  include <unistd.h>
 #endif
+#ifdef _WIN32
+#  include <process.h> // _spawnvp(), _cwait()
+#  include <direct.h>  // _mkdir()
+#else
+#  include <unistd.h> // fork(), execvp(), getpid()
+#  include <sys/wait.h> // waitpid()
+#endif
 #include <time.h> // time(), localtime(), strftime()
 
 #define          KPM_SURF_FEATURE_DENSITY_L0    70
@@ -90,6 +101,9 @@ enum {
 
 static int                  genfset = 1;
 static int                  genfset3 = 1;
+static int                  genisetc = 0;
+static int                  genisett = 0;
+static int                  fsetVersion = AR2_FEATURE_SET_VERSION_DEFAULT;
 
 static char                 filename[MAXPATHLEN] = "";
 static AR2JpegImageT       *jpegImage;
@@ -112,16 +126,43 @@ static int                  tracking_extraction_level = -1; // Allows specificat
 static int                  initialization_extraction_level = -1;
 
 static int                  background = 0;
+static int                  interactive = 1;
 static char                 logfile[MAXPATHLEN] = "";
 static char                 exitcodefile[MAXPATHLEN] = "";
 static char                 exitcode = 255;
 #define EXIT(c) {exitcode=c;exit(c);}
 
+// Batch building. Each manifest entry is built by a separate genTexData process.
+#define BATCH_ARGS_MAX              256
+static char                 batchManifest[MAXPATHLEN] = "";
+static int                  batchJobs = 1;
+static int                  imageThreads = 0;
+
+// Content-hash cache of generated files. Bump GEN_CACHE_VERSION whenever generation changes in a way
+// that should invalidate existing cache entries.
+#define GEN_CACHE_VERSION           "1"
+static char                 cacheDir[MAXPATHLEN] = "";
+
+typedef struct {
+    AR2ImageSetT    *imageSet;
+    int              procMode;
+    int              scale0, scaleStep;     // This worker generates scales scale0, scale0+scaleStep, ...
+    KpmRefDataSet  **refDataSets;           // One per scale.
+    int              error;
+} GenRefDataSetArgT;
+
 
 static void  usage( char *com );
 static int   readImageFromFile(const char *filename, ARUint8 **image_p, int *xsize_p, int *ysize_p, int *nc_p, float *dpi_p);
 static int   setDPI( void );
 static void  write_exitcode(void);
+static void  genRefDataSetScales( GenRefDataSetArgT *arg );
+static void *genRefDataSetWorker( THREAD_HANDLE_T *threadHandle );
+static int   runBatch( const char *command, char *passArgv[], int passArgc );
+static uint64_t hashBytes( uint64_t hash, const void *data, size_t len );
+static int   hashFile( const char *path, uint64_t *hash );
+static int   cacheFetch( uint64_t key, const char *ext, const char *outBase );
+static int   cacheStore( uint64_t key, const char *ext, const char *outBase );
 
 int main( int argc, char *argv[] )
 {
@@ -135,13 +176,25 @@ int main( int argc, char *argv[] )
     int                  procMode;
     char                 buf[1024];
     int                  num;
-    int                  i, j;
+    int                  i, j, n;
     char                *sep = NULL;
 	time_t				 clock;
-    int                  maxFeatureNum;
     int                  err;
+    KpmRefDataSet      **refDataSets;
+    GenRefDataSetArgT   *refDataSetArgs;
+    THREAD_HANDLE_T    **threadHandle;
+    int                  threadNum;
+    char                *passArgv[BATCH_ARGS_MAX];
+    int                  passArgc = 0;
+    uint64_t             isetKey = 0, fsetKey = 0, fset3Key = 0, fmapKey = 0;
+    int                  haveIset = 0, haveFset = 0, haveFset3 = 0;
+    char                 fmapBase[MAXPATHLEN];
 
     for( i = 1; i < argc; i++ ) {
+        // In batch mode, options other than the batch options themselves are passed on to each job.
+        if( strncmp(argv[i], "-batch=", 7) != 0 && strncmp(argv[i], "-jobs=", 6) != 0 && passArgc < BATCH_ARGS_MAX ) {
+            passArgv[passArgc++] = argv[i];
+        }
         if( strncmp(argv[i], "-dpi=", 5) == 0 ) {
             if( sscanf(&argv[i][5], "%f", &dpi) != 1 ) usage(argv[0]);
         } else if( strncmp(argv[i], "-sd_thresh=", 11) == 0 ) {
@@ -162,10 +215,24 @@ int main( int argc, char *argv[] )
             if( sscanf(&argv[i][9], "%f", &dpiMin) != 1 ) usage(argv[0]);
         } else if( strcmp(argv[i], "-background") == 0 ) {
             background = 1;
+        } else if( strcmp(argv[i], "-noninteractive") == 0 ) {
+            interactive = 0;
+        } else if( strncmp(argv[i], "-batch=", 7) == 0 ) {
+            strncpy(batchManifest, &(argv[i][7]), sizeof(batchManifest) - 1);
+            batchManifest[sizeof(batchManifest) - 1] = '\0'; // Ensure NULL termination.
+        } else if( strncmp(argv[i], "-jobs=", 6) == 0 ) {
+            if( sscanf(&argv[i][6], "%d", &batchJobs) != 1 || batchJobs < 1 ) usage(argv[0]);
+        } else if( strncmp(argv[i], "-threads=", 9) == 0 ) {
+            if( sscanf(&argv[i][9], "%d", &imageThreads) != 1 || imageThreads < 1 ) usage(argv[0]);
+        } else if( strncmp(argv[i], "-cache=", 7) == 0 ) {
+            strncpy(cacheDir, &(argv[i][7]), sizeof(cacheDir) - 1);
+            cacheDir[sizeof(cacheDir) - 1] = '\0'; // Ensure NULL termination.
         } else if( strcmp(argv[i], "-nofset") == 0 ) {
             genfset = 0;
         } else if( strcmp(argv[i], "-fset") == 0 ) {
             genfset = 1;
+        } else if( strcmp(argv[i], "-packed_fset") == 0 ) {
+            fsetVersion = AR2_FEATURE_SET_VERSION_PACKED;
         } else if( strcmp(argv[i], "-nofset2") == 0 ) {
             ARLOGe("Error: -nofset2 option no longer supported as of ARToolKit v5.3.\n");
             exit(-1);
@@ -176,6 +243,14 @@ int main( int argc, char *argv[] )
             genfset3 = 0;
         } else if( strcmp(argv[i], "-fset3") == 0 ) {
             genfset3 = 1;
+        } else if( strcmp(argv[i], "-noisetc") == 0 ) {
+            genisetc = 0;
+        } else if( strcmp(argv[i], "-isetc") == 0 ) {
+            genisetc = 1;
+        } else if( strcmp(argv[i], "-noisett") == 0 ) {
+            genisett = 0;
+        } else if( strcmp(argv[i], "-isett") == 0 ) {
+            genisett = 1;
         } else if( strncmp(argv[i], "-log=", 5) == 0 ) {
             strncpy(logfile, &(argv[i][5]), sizeof(logfile) - 1);
             logfile[sizeof(logfile) - 1] = '\0'; // Ensure NULL termination.
@@ -202,6 +277,15 @@ int main( int argc, char *argv[] )
         }
     }
     
+    if (batchManifest[0]) {
+        if (filename[0] != '\0' || background) {
+            ARLOGe("Error: -batch cannot be combined with an input file or -background. Exiting.\n");
+            usage(argv[0]);
+        }
+        exitcode = runBatch(argv[0], passArgv, passArgc);
+        return (exitcode);
+    }
+    
     // Do some checks on the input.
     if (filename[0] == '\0') {
         ARLOGe("Error: no input file specified. Exiting.\n");
@@ -275,6 +359,7 @@ int main( int argc, char *argv[] )
     }
 
     if (genfset) {
+        if (tracking_extraction_level == -1 && !interactive) tracking_extraction_level = TRACKING_EXTRACTION_LEVEL_DEFAULT;
         if (tracking_extraction_level == -1 && (sd_thresh  == -1.0 || min_thresh == -1.0 || max_thresh == -1.0 || occ_size == -1)) {
             do {
                 printf("Select extraction level for tracking features, 0(few) <--> 4(many), [default=%d]: ", TRACKING_EXTRACTION_LEVEL_DEFAULT);
@@ -322,6 +407,7 @@ int main( int argc, char *argv[] )
         ARLOGi("SD_THRESH   = %f\n", sd_thresh);
     }
     if (genfset3) {
+        if (initialization_extraction_level == -1 && !interactive) initialization_extraction_level = INITIALIZATION_EXTRACTION_LEVEL_DEFAULT;
         if (initialization_extraction_level == -1 && featureDensity == -1) {
             do {
                 printf("Select extraction level for initializing features, 0(few) <--> 3(many), [default=%d]: ", INITIALIZATION_EXTRACTION_LEVEL_DEFAULT);
@@ -355,39 +441,127 @@ int main( int argc, char *argv[] )
 
     setDPI();
 
-    ARLOGi("Generating ImageSet...\n");
-    ARLOGi("   (Source image xsize=%d, ysize=%d, channels=%d, dpi=%.1f).\n", xsize, ysize, nc, dpi);
-    imageSet = ar2GenImageSet( image, xsize, ysize, nc, dpi, dpi_list, dpi_num );
-    ar2FreeJpegImage(&jpegImage);
-    if( imageSet == NULL ) {
-        ARLOGe("ImageSet generation error!!\n");
-        EXIT(E_DATA_PROCESSING_ERROR);
+    // Each cache key covers the image file contents and every setting that affects the generated file.
+    if (cacheDir[0]) {
+        int adaptive = AR2_CAPABLE_ADAPTIVE_TEMPLATE, ts1 = AR2_DEFAULT_TS1*AR2_TEMP_SCALE, ts2 = AR2_DEFAULT_TS2*AR2_TEMP_SCALE;
+        int searchSize1 = AR2_DEFAULT_GEN_FEATURE_MAP_SEARCH_SIZE1, searchSize2 = AR2_DEFAULT_GEN_FEATURE_MAP_SEARCH_SIZE2;
+        float maxSimThresh2 = AR2_DEFAULT_MAX_SIM_THRESH2, sdThresh2 = AR2_DEFAULT_SD_THRESH2;
+        int kpmProcMode = KpmProcFullSize;
+        
+        if (hashFile(filename, &isetKey) < 0) {
+            ARLOGe("Error: unable to read '%s'. Exiting.\n", filename);
+            EXIT(E_INPUT_DATA_ERROR);
+        }
+        isetKey = hashBytes(isetKey, GEN_CACHE_VERSION " " AR_HEADER_VERSION_STRING, strlen(GEN_CACHE_VERSION " " AR_HEADER_VERSION_STRING));
+        isetKey = hashBytes(isetKey, &dpi, sizeof(dpi));
+        isetKey = hashBytes(isetKey, dpi_list, dpi_num*sizeof(float));
+        // Feature maps (one per scale) don't depend on the tracking extraction level.
+        fmapKey = hashBytes(isetKey, &adaptive, sizeof(adaptive));
+        fmapKey = hashBytes(fmapKey, &ts1, sizeof(ts1));
+        fmapKey = hashBytes(fmapKey, &ts2, sizeof(ts2));
+        fmapKey = hashBytes(fmapKey, &searchSize1, sizeof(searchSize1));
+        fmapKey = hashBytes(fmapKey, &searchSize2, sizeof(searchSize2));
+        fmapKey = hashBytes(fmapKey, &maxSimThresh2, sizeof(maxSimThresh2));
+        fmapKey = hashBytes(fmapKey, &sdThresh2, sizeof(sdThresh2));
+        fsetKey = hashBytes(fmapKey, &sd_thresh, sizeof(sd_thresh));
+        fsetKey = hashBytes(fsetKey, &min_thresh, sizeof(min_thresh));
+        fsetKey = hashBytes(fsetKey, &max_thresh, sizeof(max_thresh));
+        fsetKey = hashBytes(fsetKey, &occ_size, sizeof(occ_size));
+        fsetKey = hashBytes(fsetKey, &fsetVersion, sizeof(fsetVersion));
+        fset3Key = hashBytes(isetKey, &adaptive, sizeof(adaptive));
+        fset3Key = hashBytes(fset3Key, &featureDensity, sizeof(featureDensity));
+        fset3Key = hashBytes(fset3Key, &kpmProcMode, sizeof(kpmProcMode));
     }
-    ARLOGi("  Done.\n");
     ar2UtilRemoveExt( filename );
-    ARLOGi("Saving to %s.iset...\n", filename);
-    if( ar2WriteImageSet( filename, imageSet ) < 0 ) {
-        ARLOGe("Save error: %s.iset\n", filename );
-        EXIT(E_DATA_PROCESSING_ERROR);
+    if (cacheDir[0]) {
+        haveIset  = cacheFetch(isetKey, "iset", filename);
+        haveFset  = genfset  && cacheFetch(fsetKey, "fset", filename);
+        haveFset3 = genfset3 && cacheFetch(fset3Key, "fset3", filename);
     }
-    ARLOGi("  Done.\n");
 
-    if (genfset) {
+    if (!haveIset || (genfset && !haveFset) || (genfset3 && !haveFset3)) {
+        ARLOGi("Generating ImageSet...\n");
+        ARLOGi("   (Source image xsize=%d, ysize=%d, channels=%d, dpi=%.1f).\n", xsize, ysize, nc, dpi);
+        imageSet = ar2GenImageSet( image, xsize, ysize, nc, dpi, dpi_list, dpi_num );
+        if( imageSet == NULL ) {
+            ARLOGe("ImageSet generation error!!\n");
+            EXIT(E_DATA_PROCESSING_ERROR);
+        }
+        ARLOGi("  Done.\n");
+    } else {
+        ARLOGi("All files are up to date in cache %s.\n", cacheDir);
+    }
+    ar2FreeJpegImage(&jpegImage);
+    if (!haveIset) {
+        ARLOGi("Saving to %s.iset...\n", filename);
+        if( ar2WriteImageSet( filename, imageSet ) < 0 ) {
+            ARLOGe("Save error: %s.iset\n", filename );
+            EXIT(E_DATA_PROCESSING_ERROR);
+        }
+        if (cacheDir[0]) cacheStore(isetKey, "iset", filename);
+        ARLOGi("  Done.\n");
+    }
+    if (genisetc) {
+        ARLOGi("Saving to %s.isetc...\n", filename);
+        if( ar2WriteImageSetCache( filename ) < 0 ) {
+            ARLOGe("Save error: %s.isetc\n", filename );
+            EXIT(E_DATA_PROCESSING_ERROR);
+        }
+        ARLOGi("  Done.\n");
+    }
+    if (genisett) {
+        ARLOGi("Saving to %s.isett...\n", filename);
+        if( ar2WriteImageSetTiled( filename ) < 0 ) {
+            ARLOGe("Save error: %s.isett\n", filename );
+            EXIT(E_DATA_PROCESSING_ERROR);
+        }
+        ARLOGi("  Done.\n");
+    }
+
+    if (genfset && !haveFset) {
         arMalloc( featureSet, AR2FeatureSetT, 1 );                      // A featureSet with a single image,
         arMalloc( featureSet->list, AR2FeaturePointsT, imageSet->num ); // and with 'num' scale levels of this image.
         featureSet->num = imageSet->num;
         
         ARLOGi("Generating FeatureList...\n");
+        if( imageThreads > 0 ) ar2SetFeatureMapThreadNum( imageThreads );
         for( i = 0; i < imageSet->num; i++ ) {
             ARLOGi("Start for %f dpi image.\n", imageSet->scale[i]->dpi);
             
-            featureMap = ar2GenFeatureMap( imageSet->scale[i],
-                                          AR2_DEFAULT_TS1*AR2_TEMP_SCALE, AR2_DEFAULT_TS2*AR2_TEMP_SCALE,
-                                          AR2_DEFAULT_GEN_FEATURE_MAP_SEARCH_SIZE1, AR2_DEFAULT_GEN_FEATURE_MAP_SEARCH_SIZE2,
-                                          AR2_DEFAULT_MAX_SIM_THRESH2, AR2_DEFAULT_SD_THRESH2 );
-            if( featureMap == NULL ) {
-                ARLOGe("Error!!\n");
-                EXIT(E_DATA_PROCESSING_ERROR);
+            featureMap = NULL;
+            if (cacheDir[0]) {
+                n = snprintf(fmapBase, sizeof(fmapBase), "%s/%016llx", cacheDir, (unsigned long long)hashBytes(fmapKey, &i, sizeof(i)));
+                if (n < 0 || n >= (int)sizeof(fmapBase)) {
+                    ARLOGe("Error: cache directory path '%s' is too long.\n", cacheDir);
+                    EXIT(E_BAD_PARAMETER);
+                }
+                if ((featureMap = ar2ReadFeatureMap( fmapBase, "fmap" )) != NULL) ARLOGi("  Feature map read from cache.\n");
+            }
+            if (!featureMap) {
+                featureMap = ar2GenFeatureMap( imageSet->scale[i],
+                                              AR2_DEFAULT_TS1*AR2_TEMP_SCALE, AR2_DEFAULT_TS2*AR2_TEMP_SCALE,
+                                              AR2_DEFAULT_GEN_FEATURE_MAP_SEARCH_SIZE1, AR2_DEFAULT_GEN_FEATURE_MAP_SEARCH_SIZE2,
+                                              AR2_DEFAULT_MAX_SIM_THRESH2, AR2_DEFAULT_SD_THRESH2 );
+                if( featureMap == NULL ) {
+                    ARLOGe("Error!!\n");
+                    EXIT(E_DATA_PROCESSING_ERROR);
+                }
+                if (cacheDir[0]) {
+                    // Write under a temporary name so concurrent jobs never read a partial map.
+                    snprintf(buf, sizeof(buf), "fmap.%d.tmp", (int)getpid());
+                    if (ar2SaveFeatureMap( fmapBase, buf, featureMap ) == 0) {
+                        char tmpPath[MAXPATHLEN+32], mapPath[MAXPATHLEN+32];
+                        int  n1, n2;
+                        n1 = snprintf(tmpPath, sizeof(tmpPath), "%s.%s", fmapBase, buf);
+                        n2 = snprintf(mapPath, sizeof(mapPath), "%s.fmap", fmapBase);
+                        if (n1 < 0 || n1 >= (int)sizeof(tmpPath) || n2 < 0 || n2 >= (int)sizeof(mapPath)) {
+                            ARLOGe("Error: cache directory path '%s' is too long.\n", cacheDir);
+                            EXIT(E_BAD_PARAMETER);
+                        }
+                        remove(mapPath);
+                        if (rename(tmpPath, mapPath) != 0) remove(tmpPath);
+                    }
+                }
             }
             ARLOGi("  Done.\n");
             
@@ -442,48 +616,77 @@ int main( int argc, char *argv[] )
         ARLOGi("  Done.\n");
         
         ARLOGi("Saving FeatureSet...\n");
-        if( ar2SaveFeatureSet( filename, "fset", featureSet ) < 0 ) {
+        if( ar2SaveFeatureSet2( filename, "fset", featureSet, fsetVersion ) < 0 ) {
             ARLOGe("Save error: %s.fset\n", filename );
             EXIT(E_DATA_PROCESSING_ERROR);
         }
+        if (cacheDir[0]) cacheStore(fsetKey, "fset", filename);
         ARLOGi("  Done.\n");
         ar2FreeFeatureSet( &featureSet );
     }
     
-    if (genfset3) {
+    if (genfset3 && !haveFset3) {
         ARLOGi("Generating FeatureSet3...\n");
         refDataSet  = NULL;
         procMode    = KpmProcFullSize;
+        
+        // Scales are independent, so generate them on one worker per CPU (or per -threads). Merging the
+        // results in scale order gives the same data set as adding the scales one after another.
+        arMallocClear( refDataSets, KpmRefDataSet *, imageSet->num );
+        threadNum = (imageThreads > 0 ? imageThreads : threadGetCPU());
+        if( threadNum > imageSet->num ) threadNum = imageSet->num;
+        if( threadNum < 1 ) threadNum = 1;
+        arMalloc( refDataSetArgs, GenRefDataSetArgT, threadNum );
+        for( i = 0; i < threadNum; i++ ) {
+            refDataSetArgs[i].imageSet    = imageSet;
+            refDataSetArgs[i].procMode    = procMode;
+            refDataSetArgs[i].scale0      = i;
+            refDataSetArgs[i].scaleStep   = threadNum;
+            refDataSetArgs[i].refDataSets = refDataSets;
+            refDataSetArgs[i].error       = 0;
+        }
+        if( threadNum == 1 ) {
+            genRefDataSetScales( &refDataSetArgs[0] );
+        } else {
+            arMalloc( threadHandle, THREAD_HANDLE_T *, threadNum );
+            for( i = 0; i < threadNum; i++ ) {
+                threadHandle[i] = threadInit( i, &refDataSetArgs[i], genRefDataSetWorker );
+                threadStartSignal( threadHandle[i] );
+            }
+            for( i = 0; i < threadNum; i++ ) {
+                threadEndWait( threadHandle[i] );
+                threadWaitQuit( threadHandle[i] );
+                threadFree( &threadHandle[i] );
+            }
+            free( threadHandle );
+        }
+        for( i = 0; i < threadNum; i++ ) {
+            if( refDataSetArgs[i].error ) {
+                ARLOGe("Error at kpmGenRefDataSet.\n");
+                EXIT(E_DATA_PROCESSING_ERROR);
+            }
+        }
+        free( refDataSetArgs );
         for( i = 0; i < imageSet->num; i++ ) {
-            //if( imageSet->scale[i]->dpi > 100.0f ) continue;
-            
-            maxFeatureNum = featureDensity * imageSet->scale[i]->xsize * imageSet->scale[i]->ysize / (480*360);
-            ARLOGi("(%d, %d) %f[dpi]\n", imageSet->scale[i]->xsize, imageSet->scale[i]->ysize, imageSet->scale[i]->dpi);
-            if( kpmAddRefDataSet (
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                                  imageSet->scale[i]->imgBWBlur[1],
-#else
-                                  imageSet->scale[i]->imgBW,
-#endif
-                                  imageSet->scale[i]->xsize,
-                                  imageSet->scale[i]->ysize,
-                                  imageSet->scale[i]->dpi,
-                                  procMode, KpmCompNull, maxFeatureNum, 1, i, &refDataSet) < 0 ) { // Page number set to 1 by default.
-                ARLOGe("Error at kpmAddRefDataSet.\n");
+            ARLOGi("========= %d ===========\n", refDataSets[i]->num);
+            if( kpmMergeRefDataSet( &refDataSet, &refDataSets[i] ) < 0 ) {
+                ARLOGe("Error at kpmMergeRefDataSet.\n");
                 EXIT(E_DATA_PROCESSING_ERROR);
             }
         }
+        free( refDataSets );
         ARLOGi("  Done.\n");
         ARLOGi("Saving FeatureSet3...\n");
         if( kpmSaveRefDataSet(filename, "fset3", refDataSet) != 0 ) {
             ARLOGe("Save error: %s.fset2\n", filename );
             EXIT(E_DATA_PROCESSING_ERROR);
         }
+        if (cacheDir[0]) cacheStore(fset3Key, "fset3", filename);
         ARLOGi("  Done.\n");
         kpmDeleteRefDataSet( &refDataSet );
     }
     
-    ar2FreeImageSet( &imageSet );
+    if (imageSet) ar2FreeImageSet( &imageSet );
 
     // Print the start date and time.
     clock = time(NULL);
@@ -511,7 +714,7 @@ static int setDPI( void )
     // Determine minimum allowable DPI, truncated to 3 decimal places.
     dpiMinAllowable = truncf(((float)KPM_MINIMUM_IMAGE_SIZE / (float)(MIN(xsize, ysize))) * dpi * 1000.0) / 1000.0f;
     
-    if (background) {
+    if (background || !interactive) {
         if (dpiMin == -1.0f) dpiMin = dpiMinAllowable;
         if (dpiMax == -1.0f) dpiMax = dpi;
     }
@@ -568,6 +771,53 @@ static int setDPI( void )
     return 0;
 }
 
+static void genRefDataSetScales( GenRefDataSetArgT *arg )
+{
+    AR2ImageSetT   *imageSet = arg->imageSet;
+    int             maxFeatureNum;
+    int             i;
+    
+    for( i = arg->scale0; i < imageSet->num; i += arg->scaleStep ) {
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+        ARUint8 *imageBlur;
+#endif
+        //if( imageSet->scale[i]->dpi > 100.0f ) continue;
+        
+        maxFeatureNum = featureDensity * imageSet->scale[i]->xsize * imageSet->scale[i]->ysize / (480*360);
+        ARLOGi("(%d, %d) %f[dpi]\n", imageSet->scale[i]->xsize, imageSet->scale[i]->ysize, imageSet->scale[i]->dpi);
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+        imageBlur = ar2GenImageBlur( imageSet->scale[i], 1 );
+#endif
+        if( kpmGenRefDataSet (
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+                              imageBlur,
+#else
+                              imageSet->scale[i]->imgBW,
+#endif
+                              imageSet->scale[i]->xsize,
+                              imageSet->scale[i]->ysize,
+                              imageSet->scale[i]->dpi,
+                              arg->procMode, KpmCompNull, maxFeatureNum, 1, i, &(arg->refDataSets[i])) < 0 ) { // Page number set to 1 by default.
+            arg->error = 1;
+        }
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+        free( imageBlur );
+#endif
+        if( arg->error ) break;
+    }
+}
+
+static void *genRefDataSetWorker( THREAD_HANDLE_T *threadHandle )
+{
+    GenRefDataSetArgT *arg = (GenRefDataSetArgT *)threadGetArg( threadHandle );
+    
+    while( threadStartWait( threadHandle ) == 0 ) {
+        genRefDataSetScales( arg );
+        threadEndSignal( threadHandle );
+    }
+    return NULL;
+}
+
 static void usage( char *com )
 {
     if (!background) {
@@ -583,6 +833,28 @@ static void usage( char *com )
         ARLOG("    -dpi=f: Override embedded JPEG DPI value.\n");
         ARLOG("    -max_dpi=<max_dpi>\n");
         ARLOG("    -min_dpi=<min_dpi>\n");
+        ARLOG("    -isetc\n");
+        ARLOG("         Also write a precomputed image set cache (.isetc), which loads without decoding. Default off.\n");
+        ARLOG("    -isett\n");
+        ARLOG("         Also write a tiled image set (.isett), which tracking pages in as needed. For very large images. Default off.\n");
+        ARLOG("    -packed_fset\n");
+        ARLOG("         Write the .fset in the packed layout, which loads in a single read but cannot be read by\n"
+              "         ARToolKit versions before 5.3.3. Default is the legacy layout.\n");
+        ARLOG("    -cache=<dir>\n");
+        ARLOG("         Reuse previously-generated files from (and add new files to) the cache in directory <dir>.\n"
+              "         Files are matched by a hash of the image contents and the generation settings.\n");
+        ARLOG("    -noninteractive\n");
+        ARLOG("         Never prompt; use defaults for any settings not given on the command line.\n");
+        ARLOG("    -batch=<manifest>\n");
+        ARLOG("         Build every image listed in <manifest>, one per line, optionally followed by per-image options.\n"
+              "         Other options given on the command line apply to every image. Implies -noninteractive, and\n"
+              "         -cache=<manifest>.cache unless -cache is given.\n");
+        ARLOG("    -jobs=n\n");
+        ARLOG("         Number of images to build at once in batch mode. Default is 1. The CPUs are shared between\n"
+              "         the jobs, i.e. each job gets -threads=<CPUs/n> unless -threads is given.\n");
+        ARLOG("    -threads=n\n");
+        ARLOG("         Number of threads used to generate the feature map and the .fset3 scales of an image.\n"
+              "         Default is the number of CPUs.\n");
         ARLOG("    -background\n");
         ARLOG("         Run in background, i.e. as daemon detached from controlling terminal. (Mac OS X and Linux only.)\n");
         ARLOG("    -log=<path>\n");
@@ -634,6 +906,10 @@ static int readImageFromFile(const char *filename, ARUint8 **image_p, int *xsize
         *ysize_p = jpegImage->ysize;
         if (*dpi_p == -1.0) {
             if( jpegImage->dpi == 0.0f ) {
+                if (!interactive) {
+                    ARLOGe("Error: JPEG image '%s' does not contain embedded resolution data, and no resolution specified with -dpi. Exiting.\n", filename);
+                    EXIT(E_INPUT_DATA_ERROR);
+                }
                 for (;;) {
                     printf("JPEG image '%s' does not contain embedded resolution data, and no resolution specified on command-line.\nEnter resolution to use (in decimal DPI): ", filename);
                     if( fgets( buf, 256, stdin ) == NULL ) {
@@ -668,3 +944,343 @@ static void write_exitcode(void)
     }
 }
 
+
+// 64-bit FNV-1a.
+static uint64_t hashBytes( uint64_t hash, const void *data, size_t len )
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t               i;
+    
+    if (!hash) hash = 0xcbf29ce484222325ULL;
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return (hash);
+}
+
+static int hashFile( const char *path, uint64_t *hash )
+{
+    FILE          *fp;
+    unsigned char  buf[65536];
+    size_t         n;
+    
+    if (!(fp = fopen(path, "rb"))) return (-1);
+    *hash = 0;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) *hash = hashBytes(*hash, buf, n);
+    if (ferror(fp)) {
+        fclose(fp);
+        return (-1);
+    }
+    fclose(fp);
+    return (0);
+}
+
+static int copyFile( const char *from, const char *to )
+{
+    FILE          *in, *out;
+    unsigned char  buf[65536];
+    size_t         n;
+    int            ret = 0;
+    
+    if (!(in = fopen(from, "rb"))) return (-1);
+    if (!(out = fopen(to, "wb"))) {
+        fclose(in);
+        return (-1);
+    }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            ret = -1;
+            break;
+        }
+    }
+    if (ferror(in)) ret = -1;
+    fclose(in);
+    if (fclose(out) != 0) ret = -1;
+    return (ret);
+}
+
+// Returns 1 and copies <cacheDir>/<key>.<ext> to <outBase>.<ext> if the entry exists, 0 otherwise.
+static int cacheFetch( uint64_t key, const char *ext, const char *outBase )
+{
+    char cachePath[MAXPATHLEN+32], outPath[MAXPATHLEN+32];
+    int  n1, n2;
+    
+    n1 = snprintf(cachePath, sizeof(cachePath), "%s/%016llx.%s", cacheDir, (unsigned long long)key, ext);
+    n2 = snprintf(outPath, sizeof(outPath), "%s.%s", outBase, ext);
+    if (n1 < 0 || n1 >= (int)sizeof(cachePath) || n2 < 0 || n2 >= (int)sizeof(outPath)) {
+        ARLOGe("Error: cache or output path for '%s' is too long.\n", outBase);
+        EXIT(E_BAD_PARAMETER);
+    }
+    if (copyFile(cachePath, outPath) < 0) return (0);
+    ARLOGi("%s is up to date (cache entry %016llx).\n", outPath, (unsigned long long)key);
+    return (1);
+}
+
+// Copies <outBase>.<ext> into the cache. Entries are written under a temporary name and then renamed,
+// so that concurrent batch jobs sharing the cache never see a partially-written entry.
+static int cacheStore( uint64_t key, const char *ext, const char *outBase )
+{
+    char cachePath[MAXPATHLEN+32], tmpPath[MAXPATHLEN+48], outPath[MAXPATHLEN+32];
+    int  n1, n2, n3;
+    
+#ifdef _WIN32
+    _mkdir(cacheDir);
+#else
+    mkdir(cacheDir, 0755);
+#endif
+    n1 = snprintf(cachePath, sizeof(cachePath), "%s/%016llx.%s", cacheDir, (unsigned long long)key, ext);
+    n2 = snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", cachePath, (int)getpid());
+    n3 = snprintf(outPath, sizeof(outPath), "%s.%s", outBase, ext);
+    if (n1 < 0 || n1 >= (int)sizeof(cachePath) || n2 < 0 || n2 >= (int)sizeof(tmpPath) || n3 < 0 || n3 >= (int)sizeof(outPath)) {
+        ARLOGe("Error: cache or output path for '%s' is too long.\n", outBase);
+        EXIT(E_BAD_PARAMETER);
+    }
+    if (copyFile(outPath, tmpPath) < 0) {
+        ARLOGw("Warning: unable to write cache entry %s.\n", cachePath);
+        remove(tmpPath);
+        return (-1);
+    }
+    remove(cachePath); // rename() won't replace an existing file on Windows.
+    if (rename(tmpPath, cachePath) != 0) {
+        remove(tmpPath);
+        return (-1);
+    }
+    return (0);
+}
+
+// Splits a manifest line into whitespace-separated tokens, honouring double quotes. Modifies line in place.
+static int splitManifestLine( char *line, char *tokens[], int maxTokens )
+{
+    int   n = 0;
+    char *p = line, *q;
+    
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+        if (!*p || *p == '#') break;
+        if (n == maxTokens) return (-1);
+        if (*p == '"') {
+            tokens[n++] = ++p;
+            if (!(q = strchr(p, '"'))) return (-1);
+        } else {
+            tokens[n++] = q = p;
+            while (*q && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n') q++;
+        }
+        if (!*q) break;
+        *q = '\0';
+        p = q + 1;
+    }
+    return (n);
+}
+
+typedef struct {
+    char   *line;
+    char   *argv[BATCH_ARGS_MAX*2 + 8];
+    char    image[MAXPATHLEN];
+    char    cacheArg[MAXPATHLEN+8];
+    char    logArg[MAXPATHLEN+8];
+#ifdef _WIN32
+    intptr_t pid;
+#else
+    pid_t    pid;
+#endif
+} BatchJobT;
+
+static int startBatchJob( BatchJobT *job )
+{
+#ifdef _WIN32
+    job->pid = _spawnvp(_P_NOWAIT, job->argv[0], (const char * const *)job->argv);
+    return (job->pid == -1 ? -1 : 0);
+#else
+    job->pid = fork();
+    if (job->pid == 0) {
+        execvp(job->argv[0], job->argv);
+        _exit(127);
+    }
+    return (job->pid < 0 ? -1 : 0);
+#endif
+}
+
+// Waits for any running job to finish. Returns its index in jobs[], and its exit status in *status_p.
+static int waitBatchJob( BatchJobT *jobs, int jobNum, int *status_p )
+{
+#ifdef _WIN32
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    int    index[MAXIMUM_WAIT_OBJECTS];
+    int    i, n = 0;
+    DWORD  r, code;
+    
+    for (i = 0; i < jobNum && n < MAXIMUM_WAIT_OBJECTS; i++) {
+        if (jobs[i].pid > 0) {
+            handles[n] = (HANDLE)jobs[i].pid;
+            index[n++] = i;
+        }
+    }
+    if (!n) return (-1);
+    r = WaitForMultipleObjects(n, handles, FALSE, INFINITE);
+    if (r < WAIT_OBJECT_0 || r >= WAIT_OBJECT_0 + n) return (-1);
+    i = index[r - WAIT_OBJECT_0];
+    *status_p = GetExitCodeProcess(handles[r - WAIT_OBJECT_0], &code) ? (int)code : -1;
+    CloseHandle(handles[r - WAIT_OBJECT_0]);
+    jobs[i].pid = 0;
+    return (i);
+#else
+    int   i, status;
+    pid_t pid;
+    
+    do {
+        pid = waitpid(-1, &status, 0);
+    } while (pid == -1 && errno == EINTR);
+    if (pid <= 0) return (-1);
+    for (i = 0; i < jobNum; i++) {
+        if (jobs[i].pid == pid) {
+            jobs[i].pid = 0;
+            *status_p = (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+            return (i);
+        }
+    }
+    return (-1);
+#endif
+}
+
+static int runBatch( const char *command, char *passArgv[], int passArgc )
+{
+    FILE       *fp;
+    char        buf[4096];
+    char        manifestDir[MAXPATHLEN];
+    char       *tokens[BATCH_ARGS_MAX];
+    BatchJobT  *jobs = NULL;
+    int         jobNum = 0, jobMax = 0;
+    int         haveCache = 0, haveLog = 0, haveThreads = 0;
+    char        threadsArg[32];
+    int         next, running, failed, status;
+    int         i, j, k, n, lineNo = 0, tooLong;
+    char       *base;
+    
+    for (i = 0; i < passArgc; i++) {
+        if (strncmp(passArgv[i], "-cache=", 7) == 0) haveCache = 1;
+        else if (strncmp(passArgv[i], "-log=", 5) == 0) haveLog = 1;
+        else if (strncmp(passArgv[i], "-threads=", 9) == 0) haveThreads = 1;
+    }
+    
+    // Split the CPUs between the concurrent jobs, so that jobs times per-image threads doesn't oversubscribe the machine.
+    if (batchJobs < 1) batchJobs = 1;
+#ifdef _WIN32
+    if (batchJobs > MAXIMUM_WAIT_OBJECTS) batchJobs = MAXIMUM_WAIT_OBJECTS;
+#endif
+    n = threadGetCPU() / batchJobs;
+    snprintf(threadsArg, sizeof(threadsArg), "-threads=%d", (n < 1 ? 1 : n));
+    if (!arUtilGetDirectoryNameFromPath(manifestDir, batchManifest, sizeof(manifestDir), 1)) manifestDir[0] = '\0';
+    
+    if (!(fp = fopen(batchManifest, "r"))) {
+        ARLOGe("Error: unable to open batch manifest '%s'.\n", batchManifest);
+        return (E_INPUT_DATA_ERROR);
+    }
+    while (fgets(buf, sizeof(buf), fp)) {
+        lineNo++;
+        if (jobNum == jobMax) {
+            jobMax += 16;
+            if (!(jobs = (BatchJobT *)realloc(jobs, jobMax*sizeof(BatchJobT)))) {
+                ARLOGe("Out of memory!!\n");
+                exit(1);
+            }
+        }
+        memset(&jobs[jobNum], 0, sizeof(BatchJobT));
+        if (!(jobs[jobNum].line = strdup(buf))) {
+            ARLOGe("Out of memory!!\n");
+            exit(1);
+        }
+        n = splitManifestLine(jobs[jobNum].line, tokens, BATCH_ARGS_MAX);
+        if (n == 0) {
+            free(jobs[jobNum].line);
+            continue;
+        } else if (n < 0) {
+            ARLOGe("Error: %s line %d is malformed or has too many options.\n", batchManifest, lineNo);
+            free(jobs[jobNum].line);
+            fclose(fp);
+            for (i = 0; i < jobNum; i++) free(jobs[i].line);
+            free(jobs);
+            return (E_BAD_PARAMETER);
+        }
+        
+        // Image paths in the manifest are relative to the manifest itself.
+        if (tokens[0][0] == '/' || tokens[0][0] == '\\' || (tokens[0][0] && tokens[0][1] == ':') || !manifestDir[0]) {
+            k = snprintf(jobs[jobNum].image, sizeof(jobs[jobNum].image), "%s", tokens[0]);
+        } else {
+            k = snprintf(jobs[jobNum].image, sizeof(jobs[jobNum].image), "%s%s", manifestDir, tokens[0]);
+        }
+        tooLong = (k < 0 || k >= (int)sizeof(jobs[jobNum].image));
+        if (!tooLong && !haveCache) {
+            k = snprintf(jobs[jobNum].cacheArg, sizeof(jobs[jobNum].cacheArg), "-cache=%s.cache", batchManifest);
+            tooLong = (k < 0 || k >= (int)sizeof(jobs[jobNum].cacheArg));
+        }
+        if (!tooLong && !haveLog) {
+            k = snprintf(jobs[jobNum].logArg, sizeof(jobs[jobNum].logArg), "-log=%s", jobs[jobNum].image);
+            if (k >= 0 && (base = strrchr(jobs[jobNum].logArg, '.')) && !strpbrk(base, "/\\")) {
+                *base = '\0';
+                k = (int)(base - jobs[jobNum].logArg);
+            }
+            tooLong = (k < 0 || k + 4 >= (int)sizeof(jobs[jobNum].logArg));
+            if (!tooLong) strcat(jobs[jobNum].logArg, ".log");
+        }
+        if (tooLong) {
+            ARLOGe("Error: %s line %d: image path is too long.\n", batchManifest, lineNo);
+            free(jobs[jobNum].line);
+            fclose(fp);
+            for (i = 0; i < jobNum; i++) free(jobs[i].line);
+            free(jobs);
+            return (E_BAD_PARAMETER);
+        }
+        
+        j = 0;
+        jobs[jobNum].argv[j++] = (char *)command;
+        jobs[jobNum].argv[j++] = "-noninteractive";
+        if (!haveThreads) jobs[jobNum].argv[j++] = threadsArg;
+        for (i = 0; i < passArgc; i++) jobs[jobNum].argv[j++] = passArgv[i];
+        if (!haveCache) jobs[jobNum].argv[j++] = jobs[jobNum].cacheArg;
+        if (!haveLog) jobs[jobNum].argv[j++] = jobs[jobNum].logArg;
+        for (i = 1; i < n; i++) jobs[jobNum].argv[j++] = tokens[i]; // Per-entry options override the global ones.
+        jobs[jobNum].argv[j++] = jobs[jobNum].image;
+        jobs[jobNum].argv[j] = NULL;
+        jobNum++;
+    }
+    fclose(fp);
+    
+    if (!jobNum) {
+        ARLOGe("Error: batch manifest '%s' contains no entries.\n", batchManifest);
+        free(jobs);
+        return (E_INPUT_DATA_ERROR);
+    }
+    ARLOGi("Building %d dataset(s) from '%s' using %d job(s).\n", jobNum, batchManifest, batchJobs);
+    
+    next = running = failed = 0;
+    while (next < jobNum || running > 0) {
+        while (next < jobNum && running < batchJobs) {
+            if (startBatchJob(&jobs[next]) < 0) {
+                ARLOGe("Error: unable to start job for '%s'.\n", jobs[next].image);
+                failed++;
+            } else {
+                running++;
+            }
+            next++;
+        }
+        if (!running) break;
+        if ((i = waitBatchJob(jobs, jobNum, &status)) < 0) {
+            ARLOGe("Error waiting for batch job.\n");
+            failed += running;
+            break;
+        }
+        running--;
+        if (status == E_NO_ERROR) {
+            ARLOG("%s: done.\n", jobs[i].image);
+        } else {
+            ARLOG("%s: failed (exit code %d).\n", jobs[i].image, status);
+            failed++;
+        }
+    }
+    ARLOG("Batch complete: %d of %d dataset(s) built successfully.\n", jobNum - failed, jobNum);
+    
+    for (i = 0; i < jobNum; i++) free(jobs[i].line);
+    free(jobs);
+    return (failed ? E_DATA_PROCESSING_ERROR : E_NO_ERROR);
+}